@@ -0,0 +1,105 @@
+/* mapbandwidth.c -- Measure the memory bandwidth of map operations
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+/* This program compares the speed of a parallel operation on a large
+ * map whose pages have been placed in three different ways:
+ *
+ * - "serial": one thread zeroes the whole map, so on a multi-socket
+ *   machine all the pages end up on the node of that thread;
+ *
+ * - "first touch": the map is created by hpix_create_map, which
+ *   zeroes each part of the map in the thread that will use it;
+ *
+ * - "interleaved": the pages are spread round-robin among the threads.
+ *
+ * On a single-socket machine the three numbers should be the same.
+ * Run it with OMP_PROC_BIND=true, so that threads do not move between
+ * sockets. */
+
+#include <hpixlib/hpix.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_OF_REPETITIONS 10
+
+double wall_time(void)
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Return the bandwidth, in GB/s, of a read-modify-write loop over the
+   pixels of the map */
+double measure_bandwidth(hpix_map_t * map)
+{
+  const size_t num_of_bytes = hpix_map_num_of_pixels(map) * sizeof(double);
+  double start;
+
+  /* Warm up */
+  hpix_add_constant_to_pixels_inplace(map, 1.0);
+
+  start = wall_time();
+  for(int idx = 0; idx < NUM_OF_REPETITIONS; ++idx)
+    hpix_scale_pixels_by_constant_inplace(map, 0.5);
+
+  return 2.0 * num_of_bytes * NUM_OF_REPETITIONS
+    / (wall_time() - start) * 1e-9;
+}
+
+int main(int argc, char ** argv)
+{
+  hpix_nside_t nside = 2048;
+  hpix_map_t * map;
+
+  if(argc > 1)
+    nside = atoi(argv[1]);
+
+  if(! hpix_valid_nside(nside)) {
+      fprintf(stderr, "Usage: mapbandwidth [NSIDE]\n");
+      return EXIT_FAILURE;
+  }
+
+  const size_t num_of_pixels = hpix_nside_to_npixel(nside);
+  printf("NSIDE %u, %.1f MB per map\n", nside,
+	 num_of_pixels * sizeof(double) / 1048576.0);
+
+  {
+      double * pixels = hpix_malloc(sizeof(double), num_of_pixels);
+      memset(pixels, 0, num_of_pixels * sizeof(double));
+
+      map = hpix_create_map_from_array(pixels, num_of_pixels,
+				       HPIX_ORDER_SCHEME_RING);
+      printf("Serial:      %6.2f GB/s\n", measure_bandwidth(map));
+      hpix_free_map(map);
+      hpix_free(pixels);
+  }
+
+  hpix_set_page_placement(HPIX_PAGES_FIRST_TOUCH);
+  map = hpix_create_map(nside, HPIX_ORDER_SCHEME_RING);
+  printf("First touch: %6.2f GB/s\n", measure_bandwidth(map));
+  hpix_free_map(map);
+
+  hpix_set_page_placement(HPIX_PAGES_INTERLEAVED);
+  map = hpix_create_map(nside, HPIX_ORDER_SCHEME_RING);
+  printf("Interleaved: %6.2f GB/s\n", measure_bandwidth(map));
+  hpix_free_map(map);
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,338 @@
+/* binning.c -- Turn lists of points into maps
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <stdlib.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/* Two strategies are used to bin the points in parallel:
+ *
+ * 1. If the map is small, each thread fills its own histogram, and
+ *    the histograms are summed at the end. This wastes memory and time
+ *    if the number of pixels is much larger than the number of points.
+ *
+ * 2. Otherwise, the points are scattered into buckets, each covering
+ *    a range of pixels, and each bucket is sorted by pixel. The values
+ *    of the points falling in the same pixel are then contiguous, and
+ *    each bucket is reduced into the map by one thread.
+ *
+ * In both cases, the points are always summed in the same order for a
+ * given number of threads, so that the result is reproducible. */
+
+/* Maximum number of cells in all the private histograms, unless the
+ * number of points is even larger */
+#define PRIVATE_HISTOGRAM_MAX_CELLS (1 << 23)
+
+/* Number of buckets used for each thread by the sorting strategy:
+ * more buckets improve the load balance when points are clustered */
+#define SORT_BUCKETS_PER_THREAD 16
+
+typedef struct {
+    hpix_pixel_num_t pixel;
+    size_t           index;
+} binned_point_t;
+
+/**********************************************************************/
+
+
+static int
+num_of_threads(void)
+{
+#ifdef HAVE_OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+/**********************************************************************/
+
+
+static int
+team_size(void)
+{
+#ifdef HAVE_OPENMP
+    return omp_get_num_threads();
+#else
+    return 1;
+#endif
+}
+
+/**********************************************************************/
+
+
+static int
+thread_num(void)
+{
+#ifdef HAVE_OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+/**********************************************************************/
+
+
+/* Compute the value of a pixel from the number of points in it and the
+ * sum of their weights */
+static double
+pixel_value(hpix_binning_mode_t mode, double count, double sum)
+{
+    switch(mode)
+    {
+    case HPIX_BIN_COUNTS: return count;
+    case HPIX_BIN_SUM: return sum;
+    case HPIX_BIN_MEAN: return (count > 0.0) ? sum / count : NAN;
+    default:
+	assert(0);
+	return NAN;
+    }
+}
+
+/**********************************************************************/
+
+
+static void
+bin_with_private_histograms(hpix_map_t * map,
+			    const hpix_pixel_num_t * pixels,
+			    const double * weights,
+			    size_t num_of_points,
+			    hpix_binning_mode_t mode)
+{
+    const size_t num_of_pixels = hpix_map_num_of_pixels(map);
+    const int max_threads = num_of_threads();
+    double * map_pixels = hpix_map_pixels(map);
+    double * counts = hpix_calloc(sizeof(double), num_of_pixels * max_threads);
+    double * sums = (mode != HPIX_BIN_COUNTS)
+	? hpix_calloc(sizeof(double), num_of_pixels * max_threads)
+	: NULL;
+
+#pragma omp parallel default(shared)
+    {
+	double * thread_counts = counts + thread_num() * num_of_pixels;
+	double * thread_sums =
+	    sums ? sums + thread_num() * num_of_pixels : NULL;
+
+#pragma omp for schedule(static)
+	for(size_t idx = 0; idx < num_of_points; ++idx)
+	{
+	    assert(pixels[idx] < num_of_pixels);
+
+	    thread_counts[pixels[idx]] += 1.0;
+	    if(thread_sums != NULL)
+		thread_sums[pixels[idx]] += weights ? weights[idx] : 1.0;
+	}
+
+#pragma omp for schedule(static)
+	for(size_t pixel = 0; pixel < num_of_pixels; ++pixel)
+	{
+	    double count = 0.0;
+	    double sum = 0.0;
+
+	    for(int thread = 0; thread < max_threads; ++thread)
+	    {
+		count += counts[thread * num_of_pixels + pixel];
+		if(sums != NULL)
+		    sum += sums[thread * num_of_pixels + pixel];
+	    }
+
+	    map_pixels[pixel] = pixel_value(mode, count, sum);
+	}
+    }
+
+    hpix_free(sums);
+    hpix_free(counts);
+}
+
+/**********************************************************************/
+
+
+static int
+compare_binned_points(const void * a, const void * b)
+{
+    const binned_point_t * point_a = a;
+    const binned_point_t * point_b = b;
+
+    if(point_a->pixel != point_b->pixel)
+	return (point_a->pixel > point_b->pixel) - (point_a->pixel < point_b->pixel);
+
+    return (point_a->index > point_b->index) - (point_a->index < point_b->index);
+}
+
+/**********************************************************************/
+
+
+static void
+bin_by_sorting(hpix_map_t * map,
+	       const hpix_pixel_num_t * pixels,
+	       const double * weights,
+	       size_t num_of_points,
+	       hpix_binning_mode_t mode)
+{
+    const size_t num_of_pixels = hpix_map_num_of_pixels(map);
+    const int max_threads = num_of_threads();
+    const size_t num_of_buckets = SORT_BUCKETS_PER_THREAD * max_threads;
+    const size_t pixels_per_bucket =
+	(num_of_pixels + num_of_buckets - 1) / num_of_buckets;
+    double * map_pixels = hpix_map_pixels(map);
+    const double empty_value = pixel_value(mode, 0.0, 0.0);
+    /* Element [t][b] is first the number of points of thread t in
+     * bucket b, then the position of the first of them in `sorted` */
+    size_t * offsets = hpix_calloc(sizeof(size_t), num_of_buckets * max_threads);
+    size_t * bucket_start = hpix_malloc(sizeof(size_t), num_of_buckets + 1);
+    binned_point_t * sorted = hpix_malloc(sizeof(binned_point_t), num_of_points);
+
+#pragma omp parallel default(shared)
+    {
+	/* The points are split among the threads by hand, as the
+	 * two loops below must use the same partition */
+	const int thread = thread_num();
+	const int num_of_team_threads = team_size();
+	const size_t first = num_of_points * thread / num_of_team_threads;
+	const size_t last = num_of_points * (thread + 1) / num_of_team_threads;
+	size_t * thread_offsets = offsets + thread * num_of_buckets;
+
+#pragma omp for schedule(static)
+	for(size_t pixel = 0; pixel < num_of_pixels; ++pixel)
+	    map_pixels[pixel] = empty_value;
+
+	for(size_t idx = first; idx < last; ++idx)
+	{
+	    assert(pixels[idx] < num_of_pixels);
+	    thread_offsets[pixels[idx] / pixels_per_bucket]++;
+	}
+
+#pragma omp barrier
+#pragma omp single
+	{
+	    size_t position = 0;
+
+	    for(size_t bucket = 0; bucket < num_of_buckets; ++bucket)
+	    {
+		bucket_start[bucket] = position;
+		for(int t = 0; t < num_of_team_threads; ++t)
+		{
+		    const size_t count = offsets[t * num_of_buckets + bucket];
+
+		    offsets[t * num_of_buckets + bucket] = position;
+		    position += count;
+		}
+	    }
+	    bucket_start[num_of_buckets] = position;
+	}
+
+	for(size_t idx = first; idx < last; ++idx)
+	{
+	    binned_point_t * dest =
+		sorted + thread_offsets[pixels[idx] / pixels_per_bucket]++;
+
+	    dest->pixel = pixels[idx];
+	    dest->index = idx;
+	}
+
+#pragma omp barrier
+
+	/* Each bucket covers a separate range of pixels, so no two
+	 * threads write the same pixel */
+#pragma omp for schedule(dynamic)
+	for(size_t bucket = 0; bucket < num_of_buckets; ++bucket)
+	{
+	    binned_point_t * points = sorted + bucket_start[bucket];
+	    const size_t count = bucket_start[bucket + 1] - bucket_start[bucket];
+
+	    qsort(points, count, sizeof(binned_point_t), compare_binned_points);
+
+	    for(size_t start = 0; start < count; )
+	    {
+		const hpix_pixel_num_t pixel = points[start].pixel;
+		size_t end = start;
+		double sum = 0.0;
+
+		for(; end < count && points[end].pixel == pixel; ++end)
+		    sum += weights ? weights[points[end].index] : 1.0;
+
+		map_pixels[pixel] = pixel_value(mode, end - start, sum);
+		start = end;
+	    }
+	}
+    }
+
+    hpix_free(sorted);
+    hpix_free(bucket_start);
+    hpix_free(offsets);
+}
+
+/**********************************************************************/
+
+
+void
+hpix_bin_pixels_to_map(hpix_map_t * map,
+		       const hpix_pixel_num_t * pixels,
+		       const double * weights,
+		       size_t num_of_points,
+		       hpix_binning_mode_t mode)
+{
+    assert(map);
+    assert(pixels || num_of_points == 0);
+
+    const size_t num_of_pixels = hpix_map_num_of_pixels(map);
+    const size_t cells = num_of_pixels * num_of_threads();
+
+    if(cells <= PRIVATE_HISTOGRAM_MAX_CELLS || cells <= num_of_points)
+	bin_with_private_histograms(map, pixels, weights, num_of_points, mode);
+    else
+	bin_by_sorting(map, pixels, weights, num_of_points, mode);
+}
+
+/**********************************************************************/
+
+
+void
+hpix_bin_points_to_map(hpix_map_t * map,
+		       const double * theta,
+		       const double * phi,
+		       const double * weights,
+		       size_t num_of_points,
+		       hpix_binning_mode_t mode)
+{
+    assert(map);
+    assert((theta && phi) || num_of_points == 0);
+
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    hpix_angles_to_pixel_fn_t * angles_to_pixel_fn =
+	(hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST)
+	? hpix_angles_to_nest_pixel
+	: hpix_angles_to_ring_pixel;
+    hpix_pixel_num_t * pixels =
+	hpix_malloc(sizeof(hpix_pixel_num_t), num_of_points);
+
+#pragma omp parallel for default(shared) schedule(static)
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+	pixels[idx] = angles_to_pixel_fn(resolution, theta[idx], phi[idx]);
+
+    hpix_bin_pixels_to_map(map, pixels, weights, num_of_points, mode);
+
+    hpix_free(pixels);
+}
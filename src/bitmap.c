@@ -20,27 +20,10 @@
 #include <hpixlib/hpix.h>
 #include <float.h>
 #include <math.h>
+#include <string.h>
 #include <assert.h>
 
-typedef int inside_test_t (const hpix_bmp_projection_t * proj,
-			   unsigned int x,
-			   unsigned int y);
-typedef int xy_to_angles_t (const hpix_bmp_projection_t * proj,
-			    unsigned int x,
-			    unsigned int y,
-			    double * theta,
-			    double * phi);
-
-struct ___hpix_bmp_projection_t {
-    unsigned int           width;
-    unsigned int           height;
-    hpix_coordinates_t     coordsys;
-
-    hpix_projection_type_t type;
-    xy_to_angles_t         * xy_to_angles_fn;
-    void                   * angle_to_xy_fn;
-    inside_test_t          * inside_test_fn;
-};
+#include "bmp_projection.h"
 
 /**********************************************************************/
 
@@ -53,6 +36,7 @@ hpix_create_bmp_projection(unsigned int width, unsigned int height)
     obj->width = width;
     obj->height = height;
     obj->xy_to_angles_fn = NULL;
+    obj->fxy_to_angles_fn = NULL;
     obj->angle_to_xy_fn = NULL;
     obj->inside_test_fn = NULL;
     obj->type = HPIX_PROJ_NULL;
@@ -109,7 +93,8 @@ hpix_set_equirectangular_projection(hpix_bmp_projection_t * proj)
     assert(proj);
 
     proj->xy_to_angles_fn = hpix_equirectangular_xy_to_angles;
-    proj->angle_to_xy_fn = NULL;
+    proj->fxy_to_angles_fn = hpix_equirectangular_fxy_to_angles;
+    proj->angle_to_xy_fn = hpix_equirectangular_angles_to_xy;
     proj->inside_test_fn = hpix_equirectangular_is_xy_inside;
     proj->type = HPIX_PROJ_EQUIRECTANGULAR;
 }
@@ -123,13 +108,105 @@ hpix_set_mollweide_projection(hpix_bmp_projection_t * proj)
     assert(proj);
 
     proj->xy_to_angles_fn = hpix_mollweide_xy_to_angles;
-    proj->angle_to_xy_fn = NULL;
+    proj->fxy_to_angles_fn = hpix_mollweide_fxy_to_angles;
+    proj->angle_to_xy_fn = hpix_mollweide_angles_to_xy;
     proj->inside_test_fn = hpix_mollweide_is_xy_inside;
     proj->type = HPIX_PROJ_MOLLWEIDE;
 }
 
 /**********************************************************************/
 
+
+/* Set up the tangent plane of a local projection, so that the bitmap
+ * covers [-plane_half_width, plane_half_width] along the X axis */
+static void
+set_local_projection(hpix_bmp_projection_t * proj,
+		     double center_theta,
+		     double center_phi,
+		     double plane_half_width)
+{
+    hpix_angles_to_vector(center_theta, center_phi, &proj->center);
+    proj->east = (hpix_vector_t) { -sin(center_phi), cos(center_phi), 0.0 };
+    proj->north = (hpix_vector_t) { -cos(center_theta) * cos(center_phi),
+				    -cos(center_theta) * sin(center_phi),
+				    sin(center_theta) };
+
+    proj->base_cell_size = 2.0 * plane_half_width / proj->width;
+    proj->base_plane_x0 = -0.5 * proj->width * proj->base_cell_size;
+    proj->base_plane_y0 = -0.5 * proj->height * proj->base_cell_size;
+    proj->cell_size = proj->base_cell_size;
+    proj->plane_x0 = proj->base_plane_x0;
+    proj->plane_y0 = proj->base_plane_y0;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_set_gnomonic_projection(hpix_bmp_projection_t * proj,
+			     double center_theta,
+			     double center_phi,
+			     double field_of_view)
+{
+    assert(proj);
+    assert(field_of_view > 0.0 && field_of_view < M_PI);
+
+    set_local_projection(proj, center_theta, center_phi,
+			 tan(0.5 * field_of_view));
+    proj->xy_to_angles_fn = hpix_gnomonic_xy_to_angles;
+    proj->fxy_to_angles_fn = hpix_gnomonic_fxy_to_angles;
+    proj->angle_to_xy_fn = hpix_gnomonic_angles_to_xy;
+    proj->inside_test_fn = hpix_gnomonic_is_xy_inside;
+    proj->type = HPIX_PROJ_GNOMONIC;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_set_orthographic_projection(hpix_bmp_projection_t * proj,
+				 double center_theta,
+				 double center_phi,
+				 double field_of_view)
+{
+    assert(proj);
+    assert(field_of_view > 0.0 && field_of_view <= M_PI);
+
+    set_local_projection(proj, center_theta, center_phi,
+			 sin(0.5 * field_of_view));
+    proj->xy_to_angles_fn = hpix_orthographic_xy_to_angles;
+    proj->fxy_to_angles_fn = hpix_orthographic_fxy_to_angles;
+    proj->angle_to_xy_fn = hpix_orthographic_angles_to_xy;
+    proj->inside_test_fn = hpix_orthographic_is_xy_inside;
+    proj->type = HPIX_PROJ_ORTHOGRAPHIC;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_set_bmp_projection_tile(hpix_bmp_projection_t * proj,
+			     unsigned int zoom,
+			     unsigned int tile_x,
+			     unsigned int tile_y)
+{
+    assert(proj);
+    assert(proj->type == HPIX_PROJ_GNOMONIC
+	   || proj->type == HPIX_PROJ_ORTHOGRAPHIC);
+    assert(zoom < 32);
+
+    const double num_of_tiles = ldexp(1.0, zoom);
+    assert(tile_x < num_of_tiles && tile_y < num_of_tiles);
+
+    proj->cell_size = proj->base_cell_size / num_of_tiles;
+    proj->plane_x0 = proj->base_plane_x0
+	+ tile_x * (proj->width * proj->cell_size);
+    proj->plane_y0 = proj->base_plane_y0
+	+ tile_y * (proj->height * proj->cell_size);
+}
+
+/**********************************************************************/
+
 int
 hpix_bmp_projection_is_xy_inside(const hpix_bmp_projection_t * proj,
 				 unsigned int x,
@@ -159,54 +236,98 @@ hpix_bmp_projection_xy_to_angles(const hpix_bmp_projection_t * proj,
 
 /**********************************************************************/
 
+
+int
+hpix_bmp_projection_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				  double x,
+				  double y,
+				  double * theta,
+				  double * phi)
+{
+    assert(proj);
+    assert(proj->fxy_to_angles_fn);
+
+    return proj->fxy_to_angles_fn(proj, x, y, theta, phi);
+}
+
+/**********************************************************************/
+
+
+int
+hpix_bmp_projection_angles_to_xy(const hpix_bmp_projection_t * proj,
+				 double theta,
+				 double phi,
+				 double * x,
+				 double * y)
+{
+    assert(proj);
+    assert(proj->angle_to_xy_fn);
+
+    return proj->angle_to_xy_fn(proj, theta, phi, x, y);
+}
+
+/**********************************************************************/
+
 
-double *
-hpix_bmp_projection_trace(const hpix_bmp_projection_t * proj,
-			  const hpix_map_t * map,
-			  double * min_value,
-			  double * max_value)
+void
+hpix_bmp_projection_trace_row(const hpix_bmp_projection_t * proj,
+			      const hpix_map_t * map,
+			      unsigned int y,
+			      double * row)
 {
     assert(proj);
     assert(map);
-
-    hpix_nside_t nside = hpix_map_nside(map);
+    assert(row);
+    assert(y < proj->height);
 
     hpix_angles_to_pixel_fn_t * angles_to_pixel_fn =
 	(hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST)
 	? hpix_angles_to_nest_pixel
 	: hpix_angles_to_ring_pixel;
+    const double * pixels = hpix_map_pixels(map);
+    double * line_ptr = row;
+
+    for (unsigned int x = 0; x < proj->width; ++x, ++line_ptr)
+    {
+	double theta, phi;
+
+	if(! hpix_bmp_projection_xy_to_angles(proj, x, y, &theta, &phi))
+	{
+	    *line_ptr = INFINITY; /* Skip the pixel */
+	    continue;
+	}
+
+	hpix_pixel_num_t pixel_idx =
+	    angles_to_pixel_fn(hpix_map_resolution(map), theta, phi);
+	if(pixels[pixel_idx] > -1.6e+30)
+	    *line_ptr = pixels[pixel_idx];
+	else
+	    *line_ptr = NAN;
+    }
+}
+
+/**********************************************************************/
+
+
+double *
+hpix_bmp_projection_trace(const hpix_bmp_projection_t * proj,
+			  const hpix_map_t * map,
+			  double * min_value,
+			  double * max_value)
+{
+    assert(proj);
+    assert(map);
 
     size_t num_of_pixels = proj->width * proj->height;
     double *restrict bitmap =
 	hpix_malloc(sizeof(bitmap[0]), num_of_pixels);
 
-    double * pixels = hpix_map_pixels(map);
-
     /* First step: render the bitmap */
 #pragma omp parallel for default(shared)
     for (unsigned int y = 0; y < hpix_bmp_projection_height(proj); ++y)
     {
-	double * line_ptr = bitmap + y * hpix_bmp_projection_width(proj);
-
-	for (unsigned int x = 0; 
-	     x < hpix_bmp_projection_width(proj); 
-	     ++x, ++line_ptr)
-	{
-	    double theta, phi;
-
-	    if(! hpix_bmp_projection_xy_to_angles(proj, x, y, &theta, &phi))
-	    {
-		*line_ptr = INFINITY; /* Skip the pixel */
-		continue;
-	    }
-
-	    hpix_pixel_num_t pixel_idx =
-		angles_to_pixel_fn(hpix_map_resolution(map), theta, phi);
-	    if(pixels[pixel_idx] > -1.6e+30)
-		*line_ptr = pixels[pixel_idx];
-	    else
-		*line_ptr = NAN;
-	}
+	hpix_bmp_projection_trace_row(proj, map, y,
+				      bitmap + (size_t) y * proj->width);
     }
 
     /* Second step: if the user asked for them, compute the maximum
@@ -234,3 +355,884 @@ hpix_bmp_projection_trace(const hpix_bmp_projection_t * proj,
 
     return bitmap;
 }
+
+/**********************************************************************/
+
+
+/* Minimum number of rows of the bitmap in a band. Each band is
+ * written by one thread only. */
+#define SPLAT_MIN_BAND_HEIGHT 16
+
+/* hpix_bmp_projection_render splats the map if the bitmap has more
+ * than SPLAT_CELLS_PER_PIXEL cells for each pixel in the map. The
+ * cells along the borders of the pixels are traced anyway, so
+ * splatting pays off only when each pixel covers many cells. */
+#define SPLAT_CELLS_PER_PIXEL 512
+
+/* Where the center of a pixel falls on the bitmap. The angular
+ * distance between the center and a point displaced by (dx, dy) is
+ * approximated by (p1 dx + p2 dy)^2 + (q1 dx + q2 dy)^2, using the
+ * local Jacobian of the projection. */
+typedef struct {
+    double x, y;
+    double radius_x, radius_y;
+    double p1, p2, q1, q2;
+} splat_center_t;
+
+/* The pixel centers of a map, sorted by the band of rows they fall
+ * in. Pixels in band i are sorted_pixels[band_start[i]] to
+ * sorted_pixels[band_start[i + 1] - 1]. */
+typedef struct {
+    const hpix_bmp_projection_t * proj;
+    const hpix_map_t * map;
+    splat_center_t * centers;
+    size_t * sorted_pixels;
+    size_t * band_start;
+    unsigned int band_height;
+    unsigned int num_of_bands;
+} splat_plan_t;
+
+static _Bool
+project_pixel_center(const hpix_bmp_projection_t * proj,
+		     double theta, double phi,
+		     double pixel_size,
+		     splat_center_t * center)
+{
+    double x_theta, y_theta, x_phi, y_phi;
+    const double sin_theta = fmax(sin(theta), 1e-6);
+    const double step = 1e-3 * pixel_size;
+    /* Move towards the Equator and the central meridian, so that the
+     * displaced points stay in the map */
+    const double step_theta = (theta > M_PI_2) ? -step : step;
+    const double step_phi = (remainder(phi, 2.0 * M_PI) > 0.0) ? -step : step;
+
+    if(! proj->angle_to_xy_fn(proj, theta, phi, &center->x, &center->y)
+       || ! proj->angle_to_xy_fn(proj, theta + step_theta, phi,
+				 &x_theta, &y_theta)
+       || ! proj->angle_to_xy_fn(proj, theta, phi + step_phi,
+				 &x_phi, &y_phi))
+	return FALSE;
+
+    /* Some projections wrap around in longitude */
+    double dx_dphi = x_phi - center->x;
+    if(dx_dphi > proj->width / 2.0)
+	dx_dphi -= proj->width;
+    else if(dx_dphi < -(proj->width / 2.0))
+	dx_dphi += proj->width;
+
+    const double a = (x_theta - center->x) / step_theta;
+    const double b = dx_dphi / step_phi;
+    const double c = (y_theta - center->y) / step_theta;
+    const double d = (y_phi - center->y) / step_phi;
+    const double det = a * d - b * c;
+
+    if(fabs(det) > 1e-12)
+    {
+	center->p1 = d / det;
+	center->p2 = -b / det;
+	center->q1 = -c / det * sin_theta;
+	center->q2 = a / det * sin_theta;
+    } else {
+	center->p1 = center->q2 = 1.0;
+	center->p2 = center->q1 = 0.0;
+    }
+
+    /* Search twice the size of the pixel, to be on the safe side */
+    center->radius_x = fmin(fmax(pixel_size * (fabs(a) + fabs(b) / sin_theta),
+				 1.0),
+			    proj->width / 2.0);
+    center->radius_y = fmin(fmax(pixel_size * (fabs(c) + fabs(d) / sin_theta),
+				 1.0),
+			    proj->height / 2.0);
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+/* Project the center of each pixel of the map on the bitmap and sort
+ * the pixels by band (counting sort). Bands are taller than the
+ * search region of any pixel, so that the cells in a band can only be
+ * reached by the pixels in the band itself and in the two
+ * neighbouring ones. */
+static void
+prepare_splat_plan(const hpix_bmp_projection_t * proj,
+		   const hpix_map_t * map,
+		   splat_plan_t * plan)
+{
+    const unsigned int height = proj->height;
+    const size_t num_of_map_pixels = hpix_map_num_of_pixels(map);
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    hpix_pixel_to_angles * pixel_to_angles_fn =
+	(hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST)
+	? hpix_nest_pixel_to_angles
+	: hpix_ring_pixel_to_angles;
+    const double pixel_size = sqrt(4.0 * M_PI / num_of_map_pixels);
+
+    splat_center_t *restrict centers =
+	hpix_malloc(sizeof(splat_center_t), num_of_map_pixels);
+    _Bool *restrict is_drawn = hpix_malloc(sizeof(_Bool), num_of_map_pixels);
+    size_t *restrict sorted_pixels =
+	hpix_malloc(sizeof(size_t), num_of_map_pixels);
+    double max_radius_y = 1.0;
+
+#pragma omp parallel for default(shared) reduction(max:max_radius_y)
+    for(size_t pixel = 0; pixel < num_of_map_pixels; ++pixel)
+    {
+	double theta, phi;
+
+	pixel_to_angles_fn(resolution, pixel, &theta, &phi);
+	is_drawn[pixel] = project_pixel_center(proj, theta, phi, pixel_size,
+					       &centers[pixel]);
+	if(is_drawn[pixel] && centers[pixel].radius_y > max_radius_y)
+	    max_radius_y = centers[pixel].radius_y;
+    }
+
+    unsigned int band_height = 2 * (unsigned int) ceil(max_radius_y) + 1;
+    if(band_height < SPLAT_MIN_BAND_HEIGHT)
+	band_height = SPLAT_MIN_BAND_HEIGHT;
+    const unsigned int num_of_bands = (height + band_height - 1) / band_height;
+    size_t *restrict band_start = hpix_calloc(sizeof(size_t), num_of_bands + 1);
+    size_t *restrict next = hpix_malloc(sizeof(size_t), num_of_bands);
+
+#define PIXEL_BAND(pixel)						\
+    ((unsigned int) fmin(fmax(floor(centers[pixel].y + 0.5), 0.0),	\
+			 height - 1.0) / band_height)
+
+    for(size_t pixel = 0; pixel < num_of_map_pixels; ++pixel)
+    {
+	if(is_drawn[pixel])
+	    ++band_start[PIXEL_BAND(pixel) + 1];
+    }
+    for(unsigned int band = 0; band < num_of_bands; ++band)
+    {
+	band_start[band + 1] += band_start[band];
+	next[band] = band_start[band];
+    }
+    for(size_t pixel = 0; pixel < num_of_map_pixels; ++pixel)
+    {
+	if(is_drawn[pixel])
+	    sorted_pixels[next[PIXEL_BAND(pixel)]++] = pixel;
+    }
+#undef PIXEL_BAND
+
+    hpix_free(next);
+    hpix_free(is_drawn);
+
+    plan->proj = proj;
+    plan->map = map;
+    plan->centers = centers;
+    plan->sorted_pixels = sorted_pixels;
+    plan->band_start = band_start;
+    plan->band_height = band_height;
+    plan->num_of_bands = num_of_bands;
+}
+
+/**********************************************************************/
+
+
+static void
+free_splat_plan(splat_plan_t * plan)
+{
+    hpix_free(plan->band_start);
+    hpix_free(plan->sorted_pixels);
+    hpix_free(plan->centers);
+}
+
+/**********************************************************************/
+
+
+/* Labels used by splat_rows for the cells which no pixel center
+ * reaches and for the cells outside the projection */
+#define LABEL_UNREACHED (-1.0)
+#define LABEL_OUTSIDE INFINITY
+
+/* States of a cell kept in the `distance` buffer of splat_rows, once
+ * the search for the nearest pixel center is over */
+#define CELL_QUEUED (-2.0)
+#define CELL_CHECKED (-1.0)
+
+/* Compute the pixel of the map containing the cell (x, y) in the same
+ * way as hpix_bmp_projection_trace_row */
+static double
+exact_cell_label(const hpix_bmp_projection_t * proj,
+		 const hpix_map_t * map,
+		 hpix_angles_to_pixel_fn_t * angles_to_pixel_fn,
+		 unsigned int x,
+		 unsigned int y)
+{
+    double theta, phi;
+
+    if(! proj->xy_to_angles_fn(proj, x, y, &theta, &phi))
+	return LABEL_OUTSIDE;
+
+    return angles_to_pixel_fn(hpix_map_resolution(map), theta, phi);
+}
+
+/**********************************************************************/
+
+
+/* Fill the rows from `first_row` to `last_row - 1` with the same
+ * values as hpix_bmp_projection_trace_row. Every cell is first
+ * assigned to the nearest pixel center; this is right everywhere but
+ * near the borders of the pixels, which are not equidistant from the
+ * centers. Hence the pixel of every cell on the border between two
+ * labels (or next to the outline of the projection, to a cell that no
+ * center reaches or to the first and last row and column) is computed
+ * using the inverse projection. Whenever this gives a different
+ * pixel, the neighbours of the cell are checked too, so that the
+ * whole misassigned region is corrected. Both `values` and `distance`
+ * start at the first cell of `first_row`. The range of the unmasked
+ * values is merged into `min_value` and `max_value`. */
+static void
+splat_rows(const splat_plan_t * plan,
+	   unsigned int first_row,
+	   unsigned int last_row,
+	   double *restrict values,
+	   double *restrict distance,
+	   double * min_value,
+	   double * max_value)
+{
+    const hpix_bmp_projection_t * proj = plan->proj;
+    const unsigned int width = proj->width;
+    const unsigned int num_of_rows = last_row - first_row;
+    const size_t num_of_cells = (size_t) num_of_rows * width;
+    const double * pixels = hpix_map_pixels(plan->map);
+    hpix_angles_to_pixel_fn_t * angles_to_pixel_fn =
+	(hpix_map_ordering_scheme(plan->map) == HPIX_ORDER_SCHEME_NEST)
+	? hpix_angles_to_nest_pixel
+	: hpix_angles_to_ring_pixel;
+
+    assert(first_row < last_row && last_row <= proj->height);
+
+    /* Only the pixels in the bands containing the rows and in the two
+     * neighbouring ones can reach the cells */
+    const unsigned int first_band = first_row / plan->band_height;
+    const unsigned int last_band = (last_row - 1) / plan->band_height;
+    const size_t first_pixel =
+	plan->band_start[first_band > 0 ? first_band - 1 : first_band];
+    const size_t last_pixel =
+	plan->band_start[last_band + 1 < plan->num_of_bands
+			 ? last_band + 2 : plan->num_of_bands];
+    double min = *min_value;
+    double max = *max_value;
+
+    for(size_t idx = 0; idx < num_of_cells; ++idx)
+    {
+	distance[idx] = INFINITY;
+	values[idx] = LABEL_UNREACHED;
+    }
+
+    for(size_t i = first_pixel; i < last_pixel; ++i)
+    {
+	const size_t pixel = plan->sorted_pixels[i];
+	const splat_center_t * center = &plan->centers[pixel];
+	const double ymin = fmax(ceil(center->y - center->radius_y),
+				 first_row);
+	const double ymax = fmin(floor(center->y + center->radius_y),
+				 last_row - 1.0);
+	const double xmin = fmax(ceil(center->x - center->radius_x), 0.0);
+	const double xmax = fmin(floor(center->x + center->radius_x),
+				 width - 1.0);
+
+	if(ymin > ymax || xmin > xmax)
+	    continue;
+
+	for(unsigned int y = ymin; y <= (unsigned int) ymax; ++y)
+	{
+	    const double dy = y - center->y;
+	    const size_t line = (size_t) (y - first_row) * width;
+
+	    for(unsigned int x = xmin; x <= (unsigned int) xmax; ++x)
+	    {
+		const double dx = x - center->x;
+		const double dtheta = center->p1 * dx + center->p2 * dy;
+		const double dphi = center->q1 * dx + center->q2 * dy;
+		const double dist = dtheta * dtheta + dphi * dphi;
+
+		if(dist < distance[line + x])
+		{
+		    distance[line + x] = dist;
+		    values[line + x] = pixel;
+		}
+	    }
+	}
+    }
+
+    /* From now on, `values` contains the label of each cell (the
+     * index of its pixel) and `distance` tells whether the cell has
+     * still to be checked */
+    for(unsigned int y = first_row; y < last_row; ++y)
+    {
+	const size_t line = (size_t) (y - first_row) * width;
+
+	for(unsigned int x = 0; x < width; ++x)
+	{
+	    if(! proj->inside_test_fn(proj, x, y))
+	    {
+		values[line + x] = LABEL_OUTSIDE;
+		distance[line + x] = CELL_CHECKED;
+	    }
+	}
+    }
+
+    size_t * queue = hpix_malloc(sizeof(size_t), num_of_cells);
+    size_t queue_size = 0;
+
+    for(size_t idx = 0; idx < num_of_cells; ++idx)
+    {
+	const unsigned int row = idx / width;
+	const unsigned int x = idx % width;
+	_Bool is_border;
+
+	if(distance[idx] == CELL_CHECKED)
+	    continue;
+
+	is_border = values[idx] == LABEL_UNREACHED
+	    || row == 0 || row == num_of_rows - 1
+	    || x == 0 || x == width - 1;
+	for(int dy = -1; dy <= 1 && ! is_border; ++dy)
+	{
+	    for(int dx = -1; dx <= 1; ++dx)
+	    {
+		if(values[idx + dy * (ptrdiff_t) width + dx] != values[idx])
+		{
+		    is_border = TRUE;
+		    break;
+		}
+	    }
+	}
+
+	if(is_border)
+	{
+	    distance[idx] = CELL_QUEUED;
+	    queue[queue_size++] = idx;
+	}
+    }
+
+    while(queue_size > 0)
+    {
+	const size_t idx = queue[--queue_size];
+	const unsigned int row = idx / width;
+	const unsigned int x = idx % width;
+	const double label = exact_cell_label(proj, plan->map,
+					      angles_to_pixel_fn,
+					      x, first_row + row);
+
+	distance[idx] = CELL_CHECKED;
+	if(label == values[idx])
+	    continue;
+
+	values[idx] = label;
+	for(int dy = -1; dy <= 1; ++dy)
+	{
+	    if((dy < 0 && row == 0) || (dy > 0 && row == num_of_rows - 1))
+		continue;
+
+	    for(int dx = -1; dx <= 1; ++dx)
+	    {
+		if((dx < 0 && x == 0) || (dx > 0 && x == width - 1))
+		    continue;
+
+		const size_t neighbour = idx + dy * (ptrdiff_t) width + dx;
+		if(distance[neighbour] >= 0.0)
+		{
+		    distance[neighbour] = CELL_QUEUED;
+		    queue[queue_size++] = neighbour;
+		}
+	    }
+	}
+    }
+
+    hpix_free(queue);
+
+    for(size_t idx = 0; idx < num_of_cells; ++idx)
+    {
+	if(isinf(values[idx]))
+	    continue; /* Skip the pixel */
+
+	values[idx] = pixels[(size_t) values[idx]];
+	if(HPIX_IS_MASKED(values[idx]))
+	{
+	    values[idx] = NAN;
+	    continue;
+	}
+
+	if(values[idx] < min)
+	    min = values[idx];
+	if(values[idx] > max)
+	    max = values[idx];
+    }
+
+    *min_value = min;
+    *max_value = max;
+}
+
+/**********************************************************************/
+
+
+double *
+hpix_bmp_projection_splat(const hpix_bmp_projection_t * proj,
+			  const hpix_map_t * map,
+			  double * min_value,
+			  double * max_value)
+{
+    assert(proj);
+    assert(proj->angle_to_xy_fn);
+    assert(map);
+
+    const unsigned int width = proj->width;
+    splat_plan_t plan;
+    double *restrict bitmap =
+	hpix_malloc(sizeof(bitmap[0]), (size_t) width * proj->height);
+    double min = DBL_MAX;
+    double max = -DBL_MAX;
+
+    prepare_splat_plan(proj, map, &plan);
+
+    /* Each thread takes a band of rows at a time */
+#pragma omp parallel default(shared) reduction(min:min) reduction(max:max)
+    {
+	double * distance =
+	    hpix_malloc(sizeof(double), (size_t) plan.band_height * width);
+
+#pragma omp for schedule(dynamic)
+	for(unsigned int band = 0; band < plan.num_of_bands; ++band)
+	{
+	    const unsigned int first_row = band * plan.band_height;
+	    const unsigned int last_row =
+		(first_row + plan.band_height < proj->height)
+		? first_row + plan.band_height : proj->height;
+
+	    splat_rows(&plan, first_row, last_row,
+		       bitmap + (size_t) first_row * width,
+		       distance, &min, &max);
+	}
+
+	hpix_free(distance);
+    }
+
+    free_splat_plan(&plan);
+
+    if(min_value)
+	*min_value = min;
+    if(max_value)
+	*max_value = max;
+
+    return bitmap;
+}
+
+/**********************************************************************/
+
+
+/* Walking the map is cheaper than walking the bitmap only if the map
+ * has far fewer pixels than the bitmap */
+static _Bool
+should_splat(const hpix_bmp_projection_t * proj,
+	     const hpix_map_t * map)
+{
+    return proj->angle_to_xy_fn != NULL
+	&& hpix_map_num_of_pixels(map) * SPLAT_CELLS_PER_PIXEL
+	   < (size_t) proj->width * proj->height;
+}
+
+/**********************************************************************/
+
+
+double *
+hpix_bmp_projection_render(const hpix_bmp_projection_t * proj,
+			   const hpix_map_t * map,
+			   double * min_value,
+			   double * max_value)
+{
+    assert(proj);
+    assert(map);
+
+    if(should_splat(proj, map))
+	return hpix_bmp_projection_splat(proj, map, min_value, max_value);
+    else
+	return hpix_bmp_projection_trace(proj, map, min_value, max_value);
+}
+
+/**********************************************************************/
+
+
+/* Number of rows traced and colored at a time by each thread in
+ * hpix_bmp_projection_render_argb32, and default height of the strips
+ * in hpix_bmp_projection_render_strips */
+#define RENDER_BAND_HEIGHT 16
+
+void
+hpix_bmp_projection_render_argb32(const hpix_bmp_projection_t * proj,
+				  const hpix_map_t * map,
+				  const hpix_palette_lut_t * lut,
+				  double min_value,
+				  double max_value,
+				  unsigned char * image,
+				  size_t stride,
+				  int flip_rows)
+{
+    assert(proj);
+    assert(map);
+    assert(lut);
+    assert(image);
+
+    const unsigned int width = proj->width;
+    const unsigned int height = proj->height;
+    const _Bool use_splat = should_splat(proj, map);
+    splat_plan_t plan;
+    unsigned int band_height = RENDER_BAND_HEIGHT;
+
+    if(use_splat)
+    {
+	prepare_splat_plan(proj, map, &plan);
+	band_height = plan.band_height;
+    }
+
+    const unsigned int num_of_bands = (height + band_height - 1) / band_height;
+
+    /* Every thread keeps only one band of values, which is colored as
+     * soon as it is complete: the image is never stored as a bitmap
+     * of doubles */
+#pragma omp parallel default(shared)
+    {
+	double * values =
+	    hpix_malloc(sizeof(double), (size_t) band_height * width);
+	double * distance = use_splat
+	    ? hpix_malloc(sizeof(double), (size_t) band_height * width)
+	    : NULL;
+	double min = DBL_MAX;
+	double max = -DBL_MAX;
+
+#pragma omp for schedule(dynamic)
+	for(unsigned int band = 0; band < num_of_bands; ++band)
+	{
+	    const unsigned int first_row = band * band_height;
+	    const unsigned int last_row =
+		(first_row + band_height < height)
+		? first_row + band_height : height;
+
+	    if(use_splat)
+		splat_rows(&plan, first_row, last_row, values, distance,
+			   &min, &max);
+	    else
+	    {
+		for(unsigned int y = first_row; y < last_row; ++y)
+		{
+		    hpix_bmp_projection_trace_row(proj, map, y,
+						  values + (size_t) (y - first_row) * width);
+		}
+	    }
+
+	    const unsigned int first_image_row =
+		flip_rows ? height - last_row : first_row;
+	    hpix_bitmap_to_argb32(lut, values, width, last_row - first_row,
+				  min_value, max_value,
+				  image + (size_t) first_image_row * stride,
+				  stride, flip_rows);
+	}
+
+	hpix_free(distance);
+	hpix_free(values);
+    }
+
+    if(use_splat)
+	free_splat_plan(&plan);
+}
+
+/**********************************************************************/
+
+
+int
+hpix_bmp_projection_render_strips(const hpix_bmp_projection_t * proj,
+				  const hpix_map_t * map,
+				  const hpix_palette_lut_t * lut,
+				  double min_value,
+				  double max_value,
+				  unsigned int strip_height,
+				  hpix_strip_fn_t * strip_fn,
+				  void * user_data)
+{
+    assert(proj);
+    assert(map);
+    assert(lut);
+    assert(strip_fn);
+
+    const unsigned int width = proj->width;
+    const unsigned int height = proj->height;
+    const _Bool use_splat = should_splat(proj, map);
+    splat_plan_t plan;
+    int is_aborted = 0;
+
+    if(use_splat)
+	prepare_splat_plan(proj, map, &plan);
+
+    if(strip_height == 0)
+	strip_height = use_splat ? plan.band_height : RENDER_BAND_HEIGHT;
+
+    const unsigned int num_of_strips = (height + strip_height - 1) / strip_height;
+
+    /* Strips are numbered from the top of the image, which is the
+     * last row of the bitmap. Each thread keeps one strip in memory:
+     * once it has been rendered, the thread waits for its turn to
+     * pass it to `strip_fn`. */
+#pragma omp parallel default(shared)
+    {
+	double * values =
+	    hpix_malloc(sizeof(double), (size_t) strip_height * width);
+	double * distance = use_splat
+	    ? hpix_malloc(sizeof(double), (size_t) strip_height * width)
+	    : NULL;
+	uint32_t * strip =
+	    hpix_malloc(sizeof(uint32_t), (size_t) strip_height * width);
+	double min = DBL_MAX;
+	double max = -DBL_MAX;
+
+#pragma omp for ordered schedule(static, 1)
+	for(unsigned int strip_idx = 0; strip_idx < num_of_strips; ++strip_idx)
+	{
+	    const unsigned int first_image_row = strip_idx * strip_height;
+	    const unsigned int num_of_rows =
+		(first_image_row + strip_height < height)
+		? strip_height : height - first_image_row;
+	    const unsigned int first_row = height - first_image_row - num_of_rows;
+	    const unsigned int last_row = height - first_image_row;
+	    int skip;
+
+	    /* Once `strip_fn` has failed, there is no need to render the
+	     * remaining strips */
+#pragma omp atomic read
+	    skip = is_aborted;
+	    if(skip)
+		continue;
+
+	    if(use_splat)
+		splat_rows(&plan, first_row, last_row, values, distance,
+			   &min, &max);
+	    else
+	    {
+		for(unsigned int y = first_row; y < last_row; ++y)
+		{
+		    hpix_bmp_projection_trace_row(proj, map, y,
+						  values + (size_t) (y - first_row) * width);
+		}
+	    }
+
+	    hpix_bitmap_to_argb32(lut, values, width, num_of_rows,
+				  min_value, max_value,
+				  (unsigned char *) strip,
+				  width * sizeof(uint32_t), TRUE);
+
+#pragma omp ordered
+	    {
+		if(! is_aborted
+		   && ! strip_fn(strip, first_image_row, num_of_rows, user_data))
+		{
+#pragma omp atomic write
+		    is_aborted = 1;
+		}
+	    }
+	}
+
+	hpix_free(strip);
+	hpix_free(distance);
+	hpix_free(values);
+    }
+
+    if(use_splat)
+	free_splat_plan(&plan);
+
+    return ! is_aborted;
+}
+
+/**********************************************************************/
+
+
+/* Number of cells sampled by hpix_bmp_projection_estimate_range */
+#define RANGE_ESTIMATE_SAMPLES 65536
+
+int
+hpix_bmp_projection_estimate_range(const hpix_bmp_projection_t * proj,
+				   const hpix_map_t * map,
+				   double * min_value,
+				   double * max_value)
+{
+    assert(proj);
+    assert(map);
+
+    hpix_angles_to_pixel_fn_t * angles_to_pixel_fn =
+	(hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST)
+	? hpix_angles_to_nest_pixel
+	: hpix_angles_to_ring_pixel;
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    const double * pixels = hpix_map_pixels(map);
+
+    /* Sample the center of every step x step block of cells */
+    unsigned int step =
+	(unsigned int) ceil(sqrt((double) proj->width * proj->height
+				 / RANGE_ESTIMATE_SAMPLES));
+    if(step < 1)
+	step = 1;
+
+    double min = DBL_MAX;
+    double max = -DBL_MAX;
+
+#pragma omp parallel for default(shared) reduction(min:min) reduction(max:max)
+    for(unsigned int y = step / 2; y < proj->height; y += step)
+    {
+	for(unsigned int x = step / 2; x < proj->width; x += step)
+	{
+	    double theta, phi;
+
+	    if(! hpix_bmp_projection_xy_to_angles(proj, x, y, &theta, &phi))
+		continue;
+
+	    const double value =
+		pixels[angles_to_pixel_fn(resolution, theta, phi)];
+	    if(HPIX_IS_MASKED(value))
+		continue;
+
+	    if(value < min)
+		min = value;
+	    if(value > max)
+		max = value;
+	}
+    }
+
+    if(min > max)
+	return FALSE;
+
+    if(min_value)
+	*min_value = min;
+    if(max_value)
+	*max_value = max;
+
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+double *
+hpix_bmp_projection_trace_tile(const hpix_bmp_projection_t * proj,
+			       const hpix_map_t * map,
+			       unsigned int zoom,
+			       unsigned int tile_x,
+			       unsigned int tile_y,
+			       double * min_value,
+			       double * max_value)
+{
+    assert(proj);
+    assert(map);
+
+    /* Each cell of the tile reads one pixel of the map, so the cost
+     * depends on the size of the tile and not on NSIDE */
+    hpix_bmp_projection_t tile = *proj;
+    hpix_set_bmp_projection_tile(&tile, zoom, tile_x, tile_y);
+    return hpix_bmp_projection_trace(&tile, map, min_value, max_value);
+}
+
+/**********************************************************************/
+
+
+static double
+angle_between(const hpix_vector_t * a, const hpix_vector_t * b)
+{
+    const hpix_vector_t cross = { a->y * b->z - a->z * b->y,
+				  a->z * b->x - a->x * b->z,
+				  a->x * b->y - a->y * b->x };
+
+    return atan2(hpix_vector_length(&cross), hpix_dot_product(a, b));
+}
+
+/**********************************************************************/
+
+
+/* Number of points sampled along each side of a tile to find the disc
+ * that encloses it */
+#define TILE_BOUNDARY_SAMPLES 16
+
+void
+hpix_bmp_projection_tile_pixels(const hpix_bmp_projection_t * proj,
+				unsigned int zoom,
+				unsigned int tile_x,
+				unsigned int tile_y,
+				const hpix_resolution_t * resolution,
+				hpix_ordering_scheme_t scheme,
+				hpix_pixel_num_t ** pixels,
+				size_t * num_of_pixels)
+{
+    assert(proj);
+    assert(resolution);
+    assert(pixels);
+    assert(num_of_pixels);
+
+    hpix_bmp_projection_t tile = *proj;
+    hpix_set_bmp_projection_tile(&tile, zoom, tile_x, tile_y);
+
+    /* Sample a grid of points over the tile and find the one farthest
+     * from the center of the tile. The distance between neighbouring
+     * samples bounds the error of this estimate. */
+    const double step_x = tile.width / (double) TILE_BOUNDARY_SAMPLES;
+    const double step_y = tile.height / (double) TILE_BOUNDARY_SAMPLES;
+    hpix_vector_t samples[TILE_BOUNDARY_SAMPLES + 1][TILE_BOUNDARY_SAMPLES + 1];
+    _Bool is_visible[TILE_BOUNDARY_SAMPLES + 1][TILE_BOUNDARY_SAMPLES + 1];
+    hpix_vector_t center = { 0.0, 0.0, 0.0 };
+    size_t num_of_visible = 0;
+
+    for(int j = 0; j <= TILE_BOUNDARY_SAMPLES; ++j)
+    {
+	for(int i = 0; i <= TILE_BOUNDARY_SAMPLES; ++i)
+	{
+	    double theta, phi;
+	    /* Stay within the (half-open) boundaries of the tile */
+	    const double x = fmin(i * step_x, tile.width - 1e-6) - 0.5;
+	    const double y = fmin(j * step_y, tile.height - 1e-6) - 0.5;
+
+	    is_visible[j][i] =
+		tile.fxy_to_angles_fn(&tile, x, y, &theta, &phi);
+	    if(! is_visible[j][i])
+		continue;
+
+	    hpix_angles_to_vector(theta, phi, &samples[j][i]);
+	    center.x += samples[j][i].x;
+	    center.y += samples[j][i].y;
+	    center.z += samples[j][i].z;
+	    ++num_of_visible;
+	}
+    }
+
+    if(num_of_visible == 0)
+    {
+	*pixels = NULL;
+	*num_of_pixels = 0;
+	return;
+    }
+
+    hpix_normalize_vector(&center);
+
+    double radius = 0.0;
+    double max_step = 0.0;
+    for(int j = 0; j <= TILE_BOUNDARY_SAMPLES; ++j)
+    {
+	for(int i = 0; i <= TILE_BOUNDARY_SAMPLES; ++i)
+	{
+	    if(! is_visible[j][i])
+		continue;
+
+	    radius = fmax(radius, angle_between(&center, &samples[j][i]));
+	    if(i > 0 && is_visible[j][i - 1])
+		max_step = fmax(max_step, angle_between(&samples[j][i - 1],
+							&samples[j][i]));
+	    if(j > 0 && is_visible[j - 1][i])
+		max_step = fmax(max_step, angle_between(&samples[j - 1][i],
+							&samples[j][i]));
+	}
+    }
+
+    double theta, phi;
+    hpix_vector_to_angles(&center, &theta, &phi);
+    hpix_query_disc_inclusive(resolution, scheme, theta, phi,
+			      fmin(radius + max_step, M_PI),
+			      pixels, num_of_pixels);
+}
@@ -0,0 +1,108 @@
+/* bmp_projection.h -- Internal layout of bitmap projections
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef BMP_PROJECTION_H
+#define BMP_PROJECTION_H
+
+#include <hpixlib/hpix.h>
+
+typedef int inside_test_t (const hpix_bmp_projection_t * proj,
+			   unsigned int x,
+			   unsigned int y);
+typedef int xy_to_angles_t (const hpix_bmp_projection_t * proj,
+			    unsigned int x,
+			    unsigned int y,
+			    double * theta,
+			    double * phi);
+typedef int fxy_to_angles_t (const hpix_bmp_projection_t * proj,
+			     double x,
+			     double y,
+			     double * theta,
+			     double * phi);
+typedef int angles_to_xy_t (const hpix_bmp_projection_t * proj,
+			    double theta,
+			    double phi,
+			    double * x,
+			    double * y);
+
+struct ___hpix_bmp_projection_t {
+    unsigned int           width;
+    unsigned int           height;
+    hpix_coordinates_t     coordsys;
+
+    hpix_projection_type_t type;
+    xy_to_angles_t         * xy_to_angles_fn;
+    fxy_to_angles_t        * fxy_to_angles_fn;
+    angles_to_xy_t         * angle_to_xy_fn;
+    inside_test_t          * inside_test_fn;
+
+    /* Local projections (gnomonic, orthographic) map the sky onto a
+     * plane tangent to the sphere in "center". The X axis of the
+     * plane points to West (like in the full-sky projections), the Y
+     * axis to North. */
+    hpix_vector_t          center;
+    hpix_vector_t          east;
+    hpix_vector_t          north;
+
+    /* Region of the plane covered by the bitmap: the cell (x, y) is
+     * centered on (plane_x0 + (x + 1/2) * cell_size, plane_y0 + (y +
+     * 1/2) * cell_size). The "base_" fields describe the whole field
+     * of view, the others the tile being drawn. */
+    double                 base_plane_x0;
+    double                 base_plane_y0;
+    double                 base_cell_size;
+    double                 plane_x0;
+    double                 plane_y0;
+    double                 cell_size;
+};
+
+/**********************************************************************/
+
+
+/* Coordinates on the tangent plane of the point (x, y) in the bitmap */
+static inline void
+bmp_projection_xy_to_plane(const hpix_bmp_projection_t * proj,
+			   double x,
+			   double y,
+			   double * plane_x,
+			   double * plane_y)
+{
+    *plane_x = proj->plane_x0 + (x + 0.5) * proj->cell_size;
+    *plane_y = proj->plane_y0 + (y + 0.5) * proj->cell_size;
+}
+
+/**********************************************************************/
+
+
+/* Inverse of bmp_projection_xy_to_plane. Return FALSE if the point
+ * falls outside the bitmap. */
+static inline int
+bmp_projection_plane_to_xy(const hpix_bmp_projection_t * proj,
+			   double plane_x,
+			   double plane_y,
+			   double * x,
+			   double * y)
+{
+    *x = (plane_x - proj->plane_x0) / proj->cell_size - 0.5;
+    *y = (plane_y - proj->plane_y0) / proj->cell_size - 0.5;
+
+    return *x >= -0.5 && *x < proj->width - 0.5
+	&& *y >= -0.5 && *y < proj->height - 0.5;
+}
+
+#endif
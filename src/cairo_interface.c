@@ -22,6 +22,9 @@
 #include <assert.h>
 #include <string.h>
 #include <math.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 /******************************************************************************/
 
@@ -29,22 +32,16 @@
 /* This function creates a Cairo image surface that contains a
  * projection of the map. The values `map_min` and `map_max` are used
  * to rescale every value in the map (i.e. to convert every pixel
- * value in the map into a number in [0.0, 1.0]). The value of
- * `bitmap` is the return value of `hpix_bmp_trace_bitmap`. Finally,
- * `width` and `height` give the resolution (in pixel) of the image
- * surface. */
+ * value in the map into a number in [0.0, 1.0]); if either of them is
+ * NaN, it is estimated by sampling the projection. The colors are
+ * written directly into the surface, one band of rows at a time. */
 cairo_surface_t *
 hpix_bmp_projection_to_cairo_surface(const hpix_bmp_projection_t * proj,
 				     const hpix_color_palette_t * palette,
 				     const hpix_map_t * map,
 				     double map_min, double map_max)
 {
-    const double dynamic_range = map_max - map_min;
-    double * map_bitmap;
-    double * cur_pixel;
-    unsigned char * image_data;
-    unsigned int cur_y;
-    unsigned int stride;
+    hpix_palette_lut_t * lut;
     cairo_surface_t * surface;
     unsigned int width;
     unsigned int height;
@@ -55,10 +52,18 @@ hpix_bmp_projection_to_cairo_surface(const hpix_bmp_projection_t * proj,
 
     assert(map);
 
-    map_bitmap = hpix_bmp_projection_trace(proj, map, NULL, NULL);
-    assert(map_bitmap);
-
-    cur_pixel = map_bitmap;
+    if(isnan(map_min) || isnan(map_max))
+    {
+	double estimated_min = 0.0;
+	double estimated_max = 1.0;
+
+	hpix_bmp_projection_estimate_range(proj, map,
+					   &estimated_min, &estimated_max);
+	if(isnan(map_min))
+	    map_min = estimated_min;
+	if(isnan(map_max))
+	    map_max = estimated_max;
+    }
 
     /* Because of the way Cairo implements surface copies, it is not
      * possible to use CAIRO_FORMAT_ARGB32 here. It would have been
@@ -67,51 +72,17 @@ hpix_bmp_projection_to_cairo_surface(const hpix_bmp_projection_t * proj,
      * operation. */
     surface = cairo_image_surface_create(CAIRO_FORMAT_RGB24,
 					 width, height);
-    image_data = cairo_image_surface_get_data(surface);
-    stride = cairo_image_surface_get_stride(surface);
-
-    hpix_color_t color_for_unseen_pixels =
-	hpix_color_for_unseen_pixels_in_palette(palette);
-    hpix_color_t white_color = hpix_create_color(1.0, 1.0, 1.0);
+    cairo_surface_flush(surface);
 
-    for(cur_y = 0; cur_y < height; ++cur_y)
-    {
-	unsigned int cur_x;
-	unsigned char * row = image_data + (height - cur_y - 1) * stride;
-	for(cur_x = 0; cur_x < width; ++cur_x)
-	{
-	    double value = *cur_pixel++;
-	    hpix_color_t color;
-
-	    /* Not sure if this works on big-endian machines... */
-#define SET_PIXEL(opacity,color) {  \
-		int base = cur_x * 4; \
-		row[base]     = (int) (255 * color.blue);	\
-		row[base + 1] = (int) (255 * color.green);	\
-		row[base + 2] = (int) (255 * color.red);	\
-		row[base + 3] = (int) (255 * opacity);		\
-	    }
-
-	    if(isinf(value))
-	    {
-		/* Transparent pixel */
-		SET_PIXEL(0.0, white_color);
-	    }
-	    else if (isnan(value) || value < -1.6e+30)
-	    {
-		SET_PIXEL(1.0, color_for_unseen_pixels);
-	    }
-	    else
-	    {
-		double normalized_value = (value - map_min) / dynamic_range;
-		hpix_palette_color(palette, normalized_value, &color);
-		SET_PIXEL(1.0, color);
-	    }
-#undef SET_PIXEL
-	}
-    }
+    /* Rows are flipped, as the y axis of Cairo points downwards */
+    lut = hpix_create_palette_lut(palette);
+    hpix_bmp_projection_render_argb32(proj, map, lut, map_min, map_max,
+				      cairo_image_surface_get_data(surface),
+				      cairo_image_surface_get_stride(surface),
+				      TRUE);
+    cairo_surface_mark_dirty(surface);
 
-    hpix_free(map_bitmap);
+    hpix_free_palette_lut(lut);
     return surface;
 }
 
@@ -134,3 +105,103 @@ hpix_bmp_configure_linear_gradient(cairo_pattern_t * pattern,
 					 color.red, color.green, color.blue);
     }
 }
+
+/******************************************************************************/
+
+
+/* Create every directory in `path` up to (but excluding) the last
+ * component. Return 0 in case of error. */
+static int
+create_parent_directories(char * path, size_t root_length)
+{
+    for(char * slash = strchr(path + root_length, '/');
+	slash != NULL;
+	slash = strchr(slash + 1, '/'))
+    {
+	*slash = 0;
+	const int result = mkdir(path, 0777);
+	*slash = '/';
+
+	if(result != 0 && errno != EEXIST)
+	    return 0;
+    }
+
+    return 1;
+}
+
+/******************************************************************************/
+
+
+typedef struct {
+    const char * root_path;
+    size_t root_length;
+} hips_png_writer_t;
+
+static int
+save_hips_tile_to_png(unsigned int order,
+		      hpix_pixel_num_t tile,
+		      const uint32_t * image,
+		      unsigned int tile_width,
+		      void * user_data)
+{
+    const hips_png_writer_t * writer = user_data;
+    char path[FILENAME_MAX];
+    int result;
+
+    strcpy(path, writer->root_path);
+    path[writer->root_length] = '/';
+    if(! hpix_hips_tile_path(order, tile, "png",
+			     path + writer->root_length + 1,
+			     sizeof(path) - writer->root_length - 1))
+	return 0;
+
+    if(! create_parent_directories(path, writer->root_length))
+	return 0;
+
+    /* Cairo only reads the pixels when saving the surface */
+    cairo_surface_t * surface =
+	cairo_image_surface_create_for_data((unsigned char *) image,
+					    CAIRO_FORMAT_ARGB32,
+					    tile_width, tile_width,
+					    tile_width * sizeof(uint32_t));
+    result = cairo_surface_write_to_png(surface, path) == CAIRO_STATUS_SUCCESS;
+    cairo_surface_destroy(surface);
+
+    return result;
+}
+
+/******************************************************************************/
+
+
+/* Save the tiles of a HiPS pyramid as PNG files in the directory
+ * `root_path`, using the usual "NorderK/DirD/NpixN.png" layout. If
+ * `only_changed` is nonzero, only the tiles affected by the last calls
+ * to hpix_update_hips_pyramid are saved. Return 0 in case of error. */
+int
+hpix_save_hips_tiles_to_png(hpix_hips_pyramid_t * pyramid,
+			    const hpix_color_palette_t * palette,
+			    double map_min, double map_max,
+			    int only_changed,
+			    const char * root_path)
+{
+    hips_png_writer_t writer;
+    hpix_palette_lut_t * lut;
+    int result;
+
+    assert(pyramid);
+    assert(palette);
+    assert(root_path);
+
+    writer.root_path = root_path;
+    writer.root_length = strlen(root_path);
+    if(writer.root_length + 2 >= FILENAME_MAX)
+	return 0;
+
+    lut = hpix_create_palette_lut(palette);
+    result = hpix_hips_render_tiles(pyramid, lut, map_min, map_max,
+				    only_changed, save_hips_tile_to_png,
+				    &writer);
+    hpix_free_palette_lut(lut);
+
+    return result;
+}
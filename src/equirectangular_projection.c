@@ -57,3 +57,60 @@ hpix_equirectangular_xy_to_angles(const hpix_bmp_projection_t * proj,
     *phi = ((double) x) / hpix_bmp_projection_width(proj) * 2.0 * M_PI;
     return TRUE;
 }
+
+/**********************************************************************/
+
+
+int
+hpix_equirectangular_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				   double x,
+				   double y,
+				   double * theta,
+				   double * phi)
+{
+    assert(proj);
+    assert(theta);
+    assert(phi);
+
+    const double width = hpix_bmp_projection_width(proj);
+    const double height = hpix_bmp_projection_height(proj);
+
+    /* The cell (x, y) covers [x - 1/2, x + 1/2[ x [y - 1/2, y + 1/2[,
+     * so that integer coordinates give the same angles as
+     * hpix_equirectangular_xy_to_angles */
+    if (x < -0.5 || x >= width - 0.5 || y < -0.5 || y >= height - 0.5)
+	return FALSE;
+
+    *theta = fmin(fmax(y / height * M_PI, 0.0), M_PI);
+    *phi = x / width * 2.0 * M_PI;
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_equirectangular_angles_to_xy(const hpix_bmp_projection_t * proj,
+				  double theta,
+				  double phi,
+				  double * x,
+				  double * y)
+{
+    assert(proj);
+    assert(x);
+    assert(y);
+
+    const double width = hpix_bmp_projection_width(proj);
+    const double height = hpix_bmp_projection_height(proj);
+
+    *y = theta / M_PI * height;
+    if(*y >= height - 0.5)
+	return FALSE; /* Below the last row of the bitmap */
+
+    *x = fmod(phi, 2.0 * M_PI) / (2.0 * M_PI) * width;
+    if(*x < -0.5)
+	*x += width;
+    else if(*x >= width - 0.5)
+	*x -= width;
+    return TRUE;
+}
@@ -0,0 +1,114 @@
+/* gnomonic_projection.c -- Gnomonic (tangent plane) projection
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <math.h>
+#include <assert.h>
+
+#include "constants.h"
+#include "bmp_projection.h"
+
+/* The gnomonic projection maps the point (X, Y) of the tangent plane
+ * into the direction of center - X east + Y north. Great circles are
+ * drawn as straight lines. Only the hemisphere around the center is
+ * visible. */
+
+/**********************************************************************/
+
+
+int
+hpix_gnomonic_is_xy_inside(const hpix_bmp_projection_t * proj,
+			   unsigned int x,
+			   unsigned int y)
+{
+    assert(proj);
+    return x < proj->width && y < proj->height;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_gnomonic_fxy_to_angles(const hpix_bmp_projection_t * proj,
+			    double x,
+			    double y,
+			    double * theta,
+			    double * phi)
+{
+    assert(proj);
+    assert(theta);
+    assert(phi);
+
+    if(x < -0.5 || x >= proj->width - 0.5
+       || y < -0.5 || y >= proj->height - 0.5)
+	return FALSE;
+
+    double plane_x, plane_y;
+    bmp_projection_xy_to_plane(proj, x, y, &plane_x, &plane_y);
+
+    const hpix_vector_t direction = {
+	proj->center.x - plane_x * proj->east.x + plane_y * proj->north.x,
+	proj->center.y - plane_x * proj->east.y + plane_y * proj->north.y,
+	proj->center.z - plane_x * proj->east.z + plane_y * proj->north.z
+    };
+    hpix_vector_to_angles(&direction, theta, phi);
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_gnomonic_xy_to_angles(const hpix_bmp_projection_t * proj,
+			   unsigned int x,
+			   unsigned int y,
+			   double * theta,
+			   double * phi)
+{
+    return hpix_gnomonic_fxy_to_angles(proj, x, y, theta, phi);
+}
+
+/**********************************************************************/
+
+
+int
+hpix_gnomonic_angles_to_xy(const hpix_bmp_projection_t * proj,
+			   double theta,
+			   double phi,
+			   double * x,
+			   double * y)
+{
+    assert(proj);
+    assert(x);
+    assert(y);
+
+    hpix_vector_t direction;
+    hpix_angles_to_vector(theta, phi, &direction);
+
+    const double cos_distance = hpix_dot_product(&direction, &proj->center);
+    if(cos_distance <= 0.0)
+	return FALSE; /* The other hemisphere */
+
+    return bmp_projection_plane_to_xy(proj,
+				      -hpix_dot_product(&direction, &proj->east)
+				      / cos_distance,
+				      hpix_dot_product(&direction, &proj->north)
+				      / cos_distance,
+				      x, y);
+}
@@ -0,0 +1,474 @@
+/* hips.c -- Cut a map into a pyramid of tiles, like those used by HiPS
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+/* A tile of order K is a NEST pixel of order K. If the tile is
+ * 2^W x 2^W pixels wide, each of them is a NEST pixel of order K + W,
+ * and since NEST indexes are hierarchical, the pixels of the tile
+ * have contiguous indexes.
+ *
+ * The pyramid keeps a copy of the map in NEST order for each of the
+ * orders used by the tiles, from W (tiles of order 0) to the order of
+ * the map. Each level is computed from the one below by averaging
+ * every group of four children, and only the ancestors of the pixels
+ * which have changed need to be updated. For each tile, a flag
+ * records whether it must be rendered again. */
+
+struct ___hpix_hips_pyramid_t {
+    unsigned int           tile_width;
+    /* Base-2 logarithm of `tile_width` */
+    unsigned int           tile_width_order;
+    /* Order of the map, and of the deepest level */
+    unsigned int           map_order;
+    /* Order of the coarsest level */
+    unsigned int           min_level_order;
+    /* Order of the smallest tiles */
+    unsigned int           max_tile_order;
+
+    /* levels[order] contains the 12 * 4^order pixels of the given
+     * order, or NULL if the tiles do not need them */
+    double              ** levels;
+    /* changed_tiles[order] contains one flag for each tile */
+    unsigned char       ** changed_tiles;
+};
+
+/**********************************************************************/
+
+
+static size_t
+num_of_pixels_for_order(unsigned int order)
+{
+    return ((size_t) 12) << (2 * order);
+}
+
+/**********************************************************************/
+
+
+/* Average the unmasked values among the four children of a pixel. If
+ * all of them are masked, the parent is masked too. */
+static double
+average_of_children(const double * children)
+{
+    double sum = 0.0;
+    unsigned int num_of_values = 0;
+
+    for(unsigned int idx = 0; idx < 4; ++idx)
+    {
+	if(! HPIX_IS_MASKED(children[idx]))
+	{
+	    sum += children[idx];
+	    ++num_of_values;
+	}
+    }
+
+    return num_of_values > 0 ? sum / num_of_values : NAN;
+}
+
+/**********************************************************************/
+
+
+static void
+copy_map_into_deepest_level(hpix_hips_pyramid_t * pyramid,
+			    const hpix_map_t * map)
+{
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    const double * pixels = hpix_map_pixels(map);
+    double * level = pyramid->levels[pyramid->map_order];
+    const size_t num_of_pixels = hpix_map_num_of_pixels(map);
+
+    if(hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST)
+    {
+	memcpy(level, pixels, num_of_pixels * sizeof(level[0]));
+	return;
+    }
+
+#pragma omp parallel for default(shared)
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+	level[idx] = pixels[hpix_nest_to_ring_idx(resolution, idx)];
+}
+
+/**********************************************************************/
+
+
+hpix_hips_pyramid_t *
+hpix_create_hips_pyramid(const hpix_map_t * map, unsigned int tile_width)
+{
+    assert(map);
+    assert(tile_width > 0 && (tile_width & (tile_width - 1)) == 0);
+
+    /* HiPS tiles are NEST pixels of some order, which only exist if
+     * NSIDE is a power of two (RING maps can have any NSIDE) */
+    const hpix_nside_t nside = hpix_map_nside(map);
+    if((nside & (nside - 1)) != 0)
+	return NULL;
+
+    hpix_hips_pyramid_t * pyramid = hpix_malloc(sizeof(*pyramid), 1);
+
+    pyramid->tile_width = tile_width;
+    pyramid->tile_width_order = hpix_ilog2(tile_width);
+    pyramid->map_order = hpix_map_resolution(map)->order;
+    if(pyramid->map_order >= pyramid->tile_width_order)
+    {
+	pyramid->min_level_order = pyramid->tile_width_order;
+	pyramid->max_tile_order =
+	    pyramid->map_order - pyramid->tile_width_order;
+    } else {
+	/* The map is too coarse even for tiles of order zero: their
+	 * pixels are taken from the map itself */
+	pyramid->min_level_order = pyramid->map_order;
+	pyramid->max_tile_order = 0;
+    }
+
+    pyramid->levels = hpix_calloc(sizeof(pyramid->levels[0]),
+				  pyramid->map_order + 1);
+    for(unsigned int order = pyramid->min_level_order;
+	order <= pyramid->map_order;
+	++order)
+    {
+	pyramid->levels[order] =
+	    hpix_malloc(sizeof(double), num_of_pixels_for_order(order));
+    }
+
+    pyramid->changed_tiles =
+	hpix_malloc(sizeof(pyramid->changed_tiles[0]),
+		    pyramid->max_tile_order + 1);
+    for(unsigned int order = 0; order <= pyramid->max_tile_order; ++order)
+    {
+	pyramid->changed_tiles[order] =
+	    hpix_malloc(1, num_of_pixels_for_order(order));
+    }
+
+    hpix_update_hips_pyramid(pyramid, map, NULL, 0);
+    return pyramid;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_free_hips_pyramid(hpix_hips_pyramid_t * pyramid)
+{
+    if(pyramid == NULL)
+	return;
+
+    for(unsigned int order = 0; order <= pyramid->map_order; ++order)
+	hpix_free(pyramid->levels[order]);
+    hpix_free(pyramid->levels);
+
+    for(unsigned int order = 0; order <= pyramid->max_tile_order; ++order)
+	hpix_free(pyramid->changed_tiles[order]);
+    hpix_free(pyramid->changed_tiles);
+
+    hpix_free(pyramid);
+}
+
+/**********************************************************************/
+
+
+unsigned int
+hpix_hips_pyramid_tile_width(const hpix_hips_pyramid_t * pyramid)
+{
+    assert(pyramid);
+    return pyramid->tile_width;
+}
+
+/**********************************************************************/
+
+
+unsigned int
+hpix_hips_pyramid_max_order(const hpix_hips_pyramid_t * pyramid)
+{
+    assert(pyramid);
+    return pyramid->max_tile_order;
+}
+
+/**********************************************************************/
+
+
+size_t
+hpix_hips_pyramid_num_of_changed_tiles(const hpix_hips_pyramid_t * pyramid)
+{
+    assert(pyramid);
+
+    size_t result = 0;
+    for(unsigned int order = 0; order <= pyramid->max_tile_order; ++order)
+    {
+	const size_t num_of_tiles = num_of_pixels_for_order(order);
+	for(size_t tile = 0; tile < num_of_tiles; ++tile)
+	    result += pyramid->changed_tiles[order][tile];
+    }
+
+    return result;
+}
+
+/**********************************************************************/
+
+
+static int
+compare_pixel_indexes(const void * a, const void * b)
+{
+    const hpix_pixel_num_t index_a = *((const hpix_pixel_num_t *) a);
+    const hpix_pixel_num_t index_b = *((const hpix_pixel_num_t *) b);
+
+    return (index_a > index_b) - (index_a < index_b);
+}
+
+/**********************************************************************/
+
+
+/* Sort the indexes and remove duplicates. Return the number of
+ * indexes left. */
+static size_t
+sort_and_remove_duplicates(hpix_pixel_num_t * indexes,
+			   size_t num_of_indexes)
+{
+    if(num_of_indexes == 0)
+	return 0;
+
+    qsort(indexes, num_of_indexes, sizeof(indexes[0]),
+	  compare_pixel_indexes);
+
+    size_t num_of_unique_indexes = 1;
+    for(size_t idx = 1; idx < num_of_indexes; ++idx)
+    {
+	if(indexes[idx] != indexes[num_of_unique_indexes - 1])
+	    indexes[num_of_unique_indexes++] = indexes[idx];
+    }
+
+    return num_of_unique_indexes;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_update_hips_pyramid(hpix_hips_pyramid_t * pyramid,
+			 const hpix_map_t * map,
+			 const hpix_pixel_num_t * changed_pixels,
+			 size_t num_of_changed_pixels)
+{
+    assert(pyramid);
+    assert(map);
+    assert(hpix_map_resolution(map)->order == pyramid->map_order);
+
+    if(changed_pixels == NULL)
+    {
+	/* Rebuild the whole pyramid */
+	copy_map_into_deepest_level(pyramid, map);
+
+	for(unsigned int order = pyramid->map_order;
+	    order > pyramid->min_level_order;
+	    --order)
+	{
+	    const double * children = pyramid->levels[order];
+	    double * parents = pyramid->levels[order - 1];
+	    const size_t num_of_parents = num_of_pixels_for_order(order - 1);
+
+#pragma omp parallel for default(shared)
+	    for(size_t idx = 0; idx < num_of_parents; ++idx)
+		parents[idx] = average_of_children(children + 4 * idx);
+	}
+
+	for(unsigned int order = 0; order <= pyramid->max_tile_order; ++order)
+	{
+	    memset(pyramid->changed_tiles[order], 1,
+		   num_of_pixels_for_order(order));
+	}
+
+	return;
+    }
+
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    const double * pixels = hpix_map_pixels(map);
+    const int is_ring = hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_RING;
+    hpix_pixel_num_t * indexes =
+	hpix_malloc(sizeof(indexes[0]), num_of_changed_pixels);
+
+    for(size_t idx = 0; idx < num_of_changed_pixels; ++idx)
+    {
+	const hpix_pixel_num_t pixel = changed_pixels[idx];
+
+	assert(pixel < hpix_map_num_of_pixels(map));
+	indexes[idx] = is_ring
+	    ? hpix_ring_to_nest_idx(resolution, pixel)
+	    : pixel;
+	pyramid->levels[pyramid->map_order][indexes[idx]] = pixels[pixel];
+    }
+
+    size_t num_of_indexes =
+	sort_and_remove_duplicates(indexes, num_of_changed_pixels);
+
+    for(unsigned int order = 0; order <= pyramid->max_tile_order; ++order)
+    {
+	const unsigned int shift = 2 * (pyramid->map_order - order);
+	for(size_t idx = 0; idx < num_of_indexes; ++idx)
+	    pyramid->changed_tiles[order][indexes[idx] >> shift] = 1;
+    }
+
+    /* Move up the pyramid: since the indexes are sorted, the parents
+     * of consecutive indexes are either equal or consecutive too */
+    for(unsigned int order = pyramid->map_order;
+	order > pyramid->min_level_order;
+	--order)
+    {
+	const double * children = pyramid->levels[order];
+	double * parents = pyramid->levels[order - 1];
+	size_t num_of_parents = 0;
+
+	for(size_t idx = 0; idx < num_of_indexes; ++idx)
+	{
+	    const hpix_pixel_num_t parent = indexes[idx] >> 2;
+
+	    if(num_of_parents == 0 || indexes[num_of_parents - 1] != parent)
+	    {
+		indexes[num_of_parents++] = parent;
+		parents[parent] = average_of_children(children + 4 * parent);
+	    }
+	}
+
+	num_of_indexes = num_of_parents;
+    }
+
+    hpix_free(indexes);
+}
+
+/**********************************************************************/
+
+
+/* Compute the NEST index within its tile of every pixel of the tile
+ * image. The northern corner of the tile is at the top left, and the
+ * eastern one at the bottom left, so that the sky is seen from the
+ * inside. */
+static hpix_pixel_num_t *
+subpixels_of_tile_image(unsigned int tile_width)
+{
+    hpix_pixel_num_t * subpixels =
+	hpix_malloc(sizeof(subpixels[0]), (size_t) tile_width * tile_width);
+
+    for(unsigned int row = 0; row < tile_width; ++row)
+    {
+	for(unsigned int column = 0; column < tile_width; ++column)
+	{
+	    subpixels[(size_t) row * tile_width + column] =
+		hpix_xy_to_nest_subpixel(tile_width - 1 - column,
+					 tile_width - 1 - row);
+	}
+    }
+
+    return subpixels;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_hips_render_tiles(hpix_hips_pyramid_t * pyramid,
+		       const hpix_palette_lut_t * lut,
+		       double min_value,
+		       double max_value,
+		       int only_changed,
+		       hpix_hips_tile_fn_t * tile_fn,
+		       void * user_data)
+{
+    assert(pyramid);
+    assert(lut);
+    assert(tile_fn);
+
+    const unsigned int tile_width = pyramid->tile_width;
+    const size_t pixels_per_tile = (size_t) tile_width * tile_width;
+    hpix_pixel_num_t * subpixels = subpixels_of_tile_image(tile_width);
+    int is_failed = 0;
+
+#pragma omp parallel default(shared)
+    {
+	double * values = hpix_malloc(sizeof(double), pixels_per_tile);
+	uint32_t * image = hpix_malloc(sizeof(uint32_t), pixels_per_tile);
+
+	for(unsigned int order = 0; order <= pyramid->max_tile_order; ++order)
+	{
+	    /* If the map is coarser than the pixels of the tiles, each
+	     * pixel of the map covers several pixels of the tile */
+	    const unsigned int pixel_order = order + pyramid->tile_width_order;
+	    const unsigned int level_order =
+		pixel_order < pyramid->map_order ? pixel_order : pyramid->map_order;
+	    const unsigned int shift = 2 * (pixel_order - level_order);
+	    const double * level = pyramid->levels[level_order];
+	    unsigned char * changed_tiles = pyramid->changed_tiles[order];
+	    const size_t num_of_tiles = num_of_pixels_for_order(order);
+
+#pragma omp for schedule(dynamic)
+	    for(size_t tile = 0; tile < num_of_tiles; ++tile)
+	    {
+		int skip;
+
+#pragma omp atomic read
+		skip = is_failed;
+		if(skip || (only_changed && ! changed_tiles[tile]))
+		    continue;
+
+		const hpix_pixel_num_t first_pixel = tile * pixels_per_tile;
+		for(size_t idx = 0; idx < pixels_per_tile; ++idx)
+		    values[idx] = level[(first_pixel + subpixels[idx]) >> shift];
+
+		hpix_bitmap_to_argb32(lut, values, tile_width, tile_width,
+				      min_value, max_value,
+				      (unsigned char *) image,
+				      tile_width * sizeof(uint32_t), FALSE);
+
+		if(tile_fn(order, tile, image, tile_width, user_data))
+		    changed_tiles[tile] = 0;
+		else
+		{
+#pragma omp atomic write
+		    is_failed = 1;
+		}
+	    }
+	}
+
+	hpix_free(image);
+	hpix_free(values);
+    }
+
+    hpix_free(subpixels);
+    return ! is_failed;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_hips_tile_path(unsigned int order, hpix_pixel_num_t tile,
+		    const char * extension,
+		    char * path, size_t size)
+{
+    assert(extension);
+    assert(path);
+
+    const int length =
+	snprintf(path, size, "Norder%u/Dir%" PRIu64 "/Npix%" PRIu64 ".%s",
+		 order, (uint64_t) (tile / 10000) * 10000, (uint64_t) tile,
+		 extension);
+
+    return length >= 0 && (size_t) length < size;
+}
@@ -37,6 +37,13 @@ void
 hpix_bmp_configure_linear_gradient(cairo_pattern_t * pattern, 
 				   const hpix_color_palette_t * palette);
 
+int
+hpix_save_hips_tiles_to_png(hpix_hips_pyramid_t * pyramid,
+			    const hpix_color_palette_t * palette,
+			    double map_min, double map_max,
+			    int only_changed,
+			    const char * root_path);
+
 #ifdef __cplusplus
 };
 #endif /* __cplusplus */
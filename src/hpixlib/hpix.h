@@ -23,6 +23,7 @@ extern "C"{
 #endif /* __cplusplus */
 
 #include <inttypes.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <fitsio.h>
 
@@ -45,6 +46,22 @@ typedef enum {
     HPIX_COORD_CELESTIAL
 } hpix_coordinates_t;
 
+typedef enum {
+    HPIX_BIN_COUNTS,
+    HPIX_BIN_SUM,
+    HPIX_BIN_MEAN
+} hpix_binning_mode_t;
+
+typedef enum {
+    HPIX_ROTATE_PIXEL,
+    HPIX_ROTATE_HARMONIC
+} hpix_rotation_mode_t;
+
+typedef enum {
+    HPIX_KEEP_POINT_ORDER,
+    HPIX_SORT_POINTS_BY_RING
+} hpix_point_sorting_t;
+
 typedef struct {
     hpix_nside_t           nside;
     hpix_nside_t           nside_times_two;
@@ -58,8 +75,17 @@ typedef struct {
     unsigned int           ncap;
     double                 fact2;
     double                 fact1;
+
+    /* Resolutions are shared among maps: these fields are private */
+    unsigned int           reference_count;
+    void *                 caches;
 } hpix_resolution_t;
 
+/* Functions used to build and free the data attached to a resolution
+ * by hpix_resolution_cache */
+typedef void * hpix_resolution_cache_create_fn_t(const hpix_resolution_t * resolution);
+typedef void hpix_resolution_cache_free_fn_t(void * data);
+
 typedef struct {
     hpix_ordering_scheme_t scheme;
     hpix_coordinates_t     coord;
@@ -79,6 +105,65 @@ typedef struct {
     double m[3][3];
 } hpix_matrix_t;
 
+/* Sequence of vectors, stored as a structure of arrays. If `memory`
+ * is NULL, the arrays are owned by the caller. */
+typedef struct {
+    size_t   num_of_vectors;
+    double * x;
+    double * y;
+    double * z;
+    void   * memory;
+} hpix_vector_batch_t;
+
+/* Pair of indexes into two catalogues of points */
+typedef struct {
+    size_t index1;
+    size_t index2;
+} hpix_pair_t;
+
+/* Quaternion w + x i + y j + z k */
+typedef struct {
+    double w;
+    double x;
+    double y;
+    double z;
+} hpix_quaternion_t;
+
+/* Sequence of quaternions, stored as a structure of arrays */
+typedef struct {
+    const double * w;
+    const double * x;
+    const double * y;
+    const double * z;
+} hpix_quaternion_arrays_t;
+
+/* Alignment (in bytes) of the memory returned by hpix_malloc and
+ * hpix_calloc */
+#define HPIX_MEMORY_ALIGNMENT 64
+
+/* Functions used by hpix_malloc to get memory, instead of malloc and
+ * free. `release` receives the same size passed to `allocate`. */
+typedef struct {
+    void * (* allocate)(size_t size, void * user_data);
+    void   (* release)(void * ptr, size_t size, void * user_data);
+    void *    user_data;
+} hpix_allocator_t;
+
+/* How hpix_parallel_calloc distributes pages among NUMA nodes */
+typedef enum {
+    HPIX_PAGES_FIRST_TOUCH,
+    HPIX_PAGES_INTERLEAVED
+} hpix_page_placement_t;
+
+typedef struct {
+    size_t num_of_allocations;
+    size_t current_bytes;
+    size_t peak_bytes;
+} hpix_memory_stats_t;
+
+struct ___hpix_arena_t;
+typedef struct ___hpix_arena_t hpix_arena_t;
+
 /* The most basic structure: a RGB color. Following Cairo's
  * conventions, each component is a floating-point number between 0.0
  * and 1.0. */
@@ -91,18 +176,57 @@ typedef struct {
 
 typedef struct hpix_color_palette_t hpix_color_palette_t;
 
+/* Number of colors in the lookup tables created by
+ * hpix_create_palette_lut */
+#define HPIX_PALETTE_LUT_SIZE 4096
+
+struct hpix_palette_lut_t;
+typedef struct hpix_palette_lut_t hpix_palette_lut_t;
+
 #define HPIX_MAP_PIXEL(map, index)				\
     (*((double *) (((char *) map->pixels)			\
 		   + (index) * sizeof(map->pixels[0]))))
 
 typedef enum { HPIX_PROJ_NULL, 
 	       HPIX_PROJ_MOLLWEIDE, 
-	       HPIX_PROJ_EQUIRECTANGULAR }
+	       HPIX_PROJ_EQUIRECTANGULAR,
+	       HPIX_PROJ_GNOMONIC,
+	       HPIX_PROJ_ORTHOGRAPHIC }
     hpix_projection_type_t;
 
 struct ___hpix_bmp_projection_t;
 typedef struct ___hpix_bmp_projection_t hpix_bmp_projection_t;
 
+/* Called by hpix_bmp_projection_render_strips for each strip of the
+ * image, from top to bottom. It must return nonzero to continue. */
+typedef int hpix_strip_fn_t(const uint32_t * strip,
+			    unsigned int first_row,
+			    unsigned int num_of_rows,
+			    void * user_data);
+
+struct ___hpix_projection_plan_t;
+typedef struct ___hpix_projection_plan_t hpix_projection_plan_t;
+
+struct ___hpix_hips_pyramid_t;
+typedef struct ___hpix_hips_pyramid_t hpix_hips_pyramid_t;
+
+/* Called by hpix_hips_render_tiles for each tile, possibly from many
+ * threads at once. It must return nonzero if the tile has been
+ * saved. */
+typedef int hpix_hips_tile_fn_t(unsigned int order,
+				hpix_pixel_num_t tile,
+				const uint32_t * image,
+				unsigned int tile_width,
+				void * user_data);
+
+/* Value used by projection plans for the bitmap cells that fall
+ * outside the projection */
+#define HPIX_PLAN_OUTSIDE ((hpix_pixel_num_t) -1)
+
+/* Upper limit for the number of subsamples along each side of a cell
+ * in a supersampled projection plan */
+#define HPIX_PLAN_MAX_SAMPLES_PER_SIDE 16
+
 /* Functions implemented in math.c */
 
 double hpix_average_pixel_value(const hpix_map_t * map);
@@ -110,12 +234,44 @@ void hpix_scale_pixels_by_constant_inplace(hpix_map_t * map, double constant);
 void hpix_add_constant_to_pixels_inplace(hpix_map_t * map, double constant);
 void hpix_remove_monopole_from_map_inplace(hpix_map_t * map);
 
+/* Functions implemented in smoothing.c */
+
+double * hpix_gaussian_window_function(double fwhm_rad, int lmax, int spin);
+void hpix_smooth_map_inplace(hpix_map_t * map, const double * window,
+			     int lmax);
+void hpix_smooth_map_gaussian_inplace(hpix_map_t * map, double fwhm_rad,
+				      int lmax);
+void hpix_smooth_pol_maps_inplace(hpix_map_t * map_i,
+				  hpix_map_t * map_q,
+				  hpix_map_t * map_u,
+				  const double * window_i,
+				  const double * window_pol,
+				  int lmax);
+void hpix_smooth_pol_maps_gaussian_inplace(hpix_map_t * map_i,
+					   hpix_map_t * map_q,
+					   hpix_map_t * map_u,
+					   double fwhm_rad,
+					   int lmax);
+
 /* Functions implemented in mem.c */
 
 void * hpix_malloc(size_t size, size_t num);
 void * hpix_calloc(size_t size, size_t num);
 void * hpix_realloc(void * ptr, size_t size);
 void hpix_free(void * ptr);
+void * hpix_parallel_calloc(size_t size, size_t num);
+
+void hpix_set_allocator(const hpix_allocator_t * allocator);
+void hpix_set_huge_page_threshold(size_t size);
+void hpix_set_page_placement(hpix_page_placement_t placement);
+
+void hpix_get_memory_stats(hpix_memory_stats_t * result);
+void hpix_reset_memory_stats(void);
+
+hpix_arena_t * hpix_create_arena(size_t chunk_size);
+void * hpix_arena_alloc(hpix_arena_t * arena, size_t size, size_t num);
+void hpix_clear_arena(hpix_arena_t * arena);
+void hpix_free_arena(hpix_arena_t * arena);
 
 /* Functions implemented in misc.c */
 
@@ -153,10 +309,43 @@ const hpix_resolution_t * hpix_map_resolution(const hpix_map_t * map);
 
 void hpix_free_resolution(hpix_resolution_t * resolution);
 
+void hpix_release_cached_resolutions(void);
+
+const void *
+hpix_resolution_cache(const hpix_resolution_t * resolution,
+		      hpix_resolution_cache_create_fn_t * create_fn,
+		      hpix_resolution_cache_free_fn_t * free_fn);
+
 hpix_nside_t hpix_nside(const hpix_resolution_t * resolution);
 
 size_t hpix_num_of_pixels(const hpix_resolution_t * resolution);
 
+/* Functions implemented in hips.c */
+
+hpix_hips_pyramid_t *
+hpix_create_hips_pyramid(const hpix_map_t * map, unsigned int tile_width);
+void hpix_free_hips_pyramid(hpix_hips_pyramid_t * pyramid);
+unsigned int
+hpix_hips_pyramid_tile_width(const hpix_hips_pyramid_t * pyramid);
+unsigned int
+hpix_hips_pyramid_max_order(const hpix_hips_pyramid_t * pyramid);
+size_t
+hpix_hips_pyramid_num_of_changed_tiles(const hpix_hips_pyramid_t * pyramid);
+void hpix_update_hips_pyramid(hpix_hips_pyramid_t * pyramid,
+			      const hpix_map_t * map,
+			      const hpix_pixel_num_t * changed_pixels,
+			      size_t num_of_changed_pixels);
+int hpix_hips_render_tiles(hpix_hips_pyramid_t * pyramid,
+			   const hpix_palette_lut_t * lut,
+			   double min_value,
+			   double max_value,
+			   int only_changed,
+			   hpix_hips_tile_fn_t * tile_fn,
+			   void * user_data);
+int hpix_hips_tile_path(unsigned int order, hpix_pixel_num_t tile,
+			const char * extension,
+			char * path, size_t size);
+
 /* Functions implemented in integer_functions.c */
 
 unsigned int hpix_ilog2 (const unsigned int argument);
@@ -228,6 +417,48 @@ hpix_save_fits_pol_map(const char * file_name,
 			 const char * measure_unit,
 			 int * status);
 
+/* Functions implemented in interpolation.c */
+
+void hpix_interpolation_weights(const hpix_resolution_t * resolution,
+				hpix_ordering_scheme_t scheme,
+				double theta, double phi,
+				hpix_pixel_num_t * pixels,
+				double * weights);
+double hpix_interpolate_value(const hpix_map_t * map,
+			      double theta, double phi);
+void hpix_interpolate_map(const hpix_map_t * map,
+			  const double * theta,
+			  const double * phi,
+			  double * values,
+			  size_t num_of_points,
+			  hpix_point_sorting_t sorting);
+
+/* Functions implemented in pairs.c */
+
+hpix_pair_t * hpix_find_pairs(const hpix_vector_batch_t * catalogue1,
+			      const hpix_vector_batch_t * catalogue2,
+			      double radius,
+			      size_t * num_of_pairs);
+
+/* Functions implemented in pointing.c */
+
+void hpix_quaternion_to_matrix(const hpix_quaternion_t * quaternion,
+			       hpix_matrix_t * matrix);
+void hpix_quaternions_to_pixels(const hpix_resolution_t * resolution,
+				hpix_ordering_scheme_t scheme,
+				const hpix_quaternion_arrays_t * pointings,
+				size_t num_of_samples,
+				const hpix_quaternion_t * detector_offset,
+				hpix_pixel_num_t * pixels,
+				double * pol_angles);
+void hpix_matrices_to_pixels(const hpix_resolution_t * resolution,
+			     hpix_ordering_scheme_t scheme,
+			     const hpix_matrix_t * pointings,
+			     size_t num_of_samples,
+			     const hpix_matrix_t * detector_offset,
+			     hpix_pixel_num_t * pixels,
+			     double * pol_angles);
+
 /* Functions implemented in positions.c */
 
 void hpix_angles_to_vector(double theta, double phi,
@@ -280,6 +511,20 @@ void hpix_nest_pixel_to_vector(const hpix_resolution_t * resolution,
 			       hpix_pixel_num_t pixel_index,
 			       hpix_vector_t * vector);
 
+/* Functions implemented in binning.c */
+
+void hpix_bin_pixels_to_map(hpix_map_t * map,
+			    const hpix_pixel_num_t * pixels,
+			    const double * weights,
+			    size_t num_of_points,
+			    hpix_binning_mode_t mode);
+void hpix_bin_points_to_map(hpix_map_t * map,
+			    const double * theta,
+			    const double * phi,
+			    const double * weights,
+			    size_t num_of_points,
+			    hpix_binning_mode_t mode);
+
 /* Functions implemented in bitmap.c */
 
 hpix_bmp_projection_t * 
@@ -305,6 +550,18 @@ hpix_set_bmp_projection_height(hpix_bmp_projection_t * proj,
 hpix_projection_type_t hpix_bmp_projection_type(const hpix_bmp_projection_t * proj);
 void hpix_set_equirectangular_projection(hpix_bmp_projection_t * proj);
 void hpix_set_mollweide_projection(hpix_bmp_projection_t * proj);
+void hpix_set_gnomonic_projection(hpix_bmp_projection_t * proj,
+				  double center_theta,
+				  double center_phi,
+				  double field_of_view);
+void hpix_set_orthographic_projection(hpix_bmp_projection_t * proj,
+				      double center_theta,
+				      double center_phi,
+				      double field_of_view);
+void hpix_set_bmp_projection_tile(hpix_bmp_projection_t * proj,
+				  unsigned int zoom,
+				  unsigned int tile_x,
+				  unsigned int tile_y);
 int hpix_bmp_projection_is_xy_inside(const hpix_bmp_projection_t * proj,
 				     unsigned int x,
 				     unsigned int y);
@@ -313,11 +570,76 @@ int hpix_bmp_projection_xy_to_angles(const hpix_bmp_projection_t * proj,
 				     unsigned int y,
 				     double * theta,
 				     double * phi);
+int hpix_bmp_projection_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				      double x,
+				      double y,
+				      double * theta,
+				      double * phi);
+int hpix_bmp_projection_angles_to_xy(const hpix_bmp_projection_t * proj,
+				     double theta,
+				     double phi,
+				     double * x,
+				     double * y);
+void
+hpix_bmp_projection_trace_row(const hpix_bmp_projection_t * proj,
+			      const hpix_map_t * map,
+			      unsigned int y,
+			      double * row);
 double *
 hpix_bmp_projection_trace(const hpix_bmp_projection_t * proj,
 			  const hpix_map_t * map,
 			  double * min_value,
 			  double * max_value);
+double *
+hpix_bmp_projection_splat(const hpix_bmp_projection_t * proj,
+			  const hpix_map_t * map,
+			  double * min_value,
+			  double * max_value);
+double *
+hpix_bmp_projection_render(const hpix_bmp_projection_t * proj,
+			   const hpix_map_t * map,
+			   double * min_value,
+			   double * max_value);
+void
+hpix_bmp_projection_render_argb32(const hpix_bmp_projection_t * proj,
+				  const hpix_map_t * map,
+				  const hpix_palette_lut_t * lut,
+				  double min_value,
+				  double max_value,
+				  unsigned char * image,
+				  size_t stride,
+				  int flip_rows);
+int
+hpix_bmp_projection_render_strips(const hpix_bmp_projection_t * proj,
+				  const hpix_map_t * map,
+				  const hpix_palette_lut_t * lut,
+				  double min_value,
+				  double max_value,
+				  unsigned int strip_height,
+				  hpix_strip_fn_t * strip_fn,
+				  void * user_data);
+int
+hpix_bmp_projection_estimate_range(const hpix_bmp_projection_t * proj,
+				   const hpix_map_t * map,
+				   double * min_value,
+				   double * max_value);
+double *
+hpix_bmp_projection_trace_tile(const hpix_bmp_projection_t * proj,
+			       const hpix_map_t * map,
+			       unsigned int zoom,
+			       unsigned int tile_x,
+			       unsigned int tile_y,
+			       double * min_value,
+			       double * max_value);
+void
+hpix_bmp_projection_tile_pixels(const hpix_bmp_projection_t * proj,
+				unsigned int zoom,
+				unsigned int tile_x,
+				unsigned int tile_y,
+				const hpix_resolution_t * resolution,
+				hpix_ordering_scheme_t scheme,
+				hpix_pixel_num_t ** pixels,
+				size_t * num_of_pixels);
 
 /* Functions implemented in cairo_interface.c */
 
@@ -350,6 +672,13 @@ hpix_ring_to_nest_idx(const hpix_resolution_t * resolution,
 void
 hpix_switch_order(hpix_map_t * map);
 
+hpix_pixel_num_t
+hpix_xy_to_nest_subpixel(unsigned int x, unsigned int y);
+
+void
+hpix_nest_subpixel_to_xy(hpix_pixel_num_t subpixel,
+			 unsigned int * x, unsigned int * y);
+
 /* Functions implemented in palette.c */
 
 hpix_color_t hpix_create_color(double red, double green, double blue);
@@ -381,6 +710,19 @@ void hpix_set_level_for_step_in_palette(hpix_color_palette_t * palette,
 void hpix_sort_levels_in_color_palette(hpix_color_palette_t * palette);
 void hpix_palette_color(const hpix_color_palette_t * palette,
 			double level, hpix_color_t * color);
+hpix_palette_lut_t *
+hpix_create_palette_lut(const hpix_color_palette_t * palette);
+void hpix_free_palette_lut(hpix_palette_lut_t * lut);
+uint32_t hpix_palette_lut_color(const hpix_palette_lut_t * lut, double level);
+void hpix_bitmap_to_argb32(const hpix_palette_lut_t * lut,
+			   const double * bitmap,
+			   unsigned int width,
+			   unsigned int height,
+			   double min_value,
+			   double max_value,
+			   unsigned char * image,
+			   size_t stride,
+			   int flip_rows);
 
 /* Functions implemented in matrices.c */
 
@@ -399,12 +741,19 @@ void hpix_print_matrix(FILE * output_file,
 void hpix_matrix_vector_mul(hpix_vector_t * result,
 			   const hpix_matrix_t * matrix,
 			   const hpix_vector_t * vector);
+void hpix_matrix_vector_batch_mul(hpix_vector_batch_t * result,
+				  const hpix_matrix_t * matrix,
+				  const hpix_vector_batch_t * batch);
 void hpix_matrix_mul(hpix_matrix_t * result,
 		     const hpix_matrix_t * matrix1,
 		     const hpix_matrix_t * matrix2);
 double hpix_matrix_determinant(const hpix_matrix_t * matrix);
 int hpix_matrix_inverse(hpix_matrix_t * result,
 			const hpix_matrix_t * matrix);
+void hpix_euler_angles_to_matrix(hpix_matrix_t * matrix,
+				 double psi, double theta, double phi);
+void hpix_matrix_to_euler_angles(const hpix_matrix_t * matrix,
+				 double * psi, double * theta, double * phi);
 
 /* Functions implemented in equirectangular_projection.c */
 
@@ -418,6 +767,18 @@ int hpix_equirectangular_xy_to_angles(const hpix_bmp_projection_t * proj,
 				      double * theta,
 				      double * phi);
 
+int hpix_equirectangular_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				       double x,
+				       double y,
+				       double * theta,
+				       double * phi);
+
+int hpix_equirectangular_angles_to_xy(const hpix_bmp_projection_t * proj,
+				      double theta,
+				      double phi,
+				      double * x,
+				      double * y);
+
 /* Functions implemented in mollweide_projection.c */
 
 int hpix_mollweide_is_xy_inside(const hpix_bmp_projection_t * proj,
@@ -430,13 +791,109 @@ int hpix_mollweide_xy_to_angles(const hpix_bmp_projection_t * proj,
 				double * theta,
 				double * phi);
 
+int hpix_mollweide_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				 double x,
+				 double y,
+				 double * theta,
+				 double * phi);
+
+int hpix_mollweide_angles_to_xy(const hpix_bmp_projection_t * proj,
+				double theta,
+				double phi,
+				double * x,
+				double * y);
+
+/* Functions implemented in gnomonic_projection.c */
+
+int hpix_gnomonic_is_xy_inside(const hpix_bmp_projection_t * proj,
+			       unsigned int x,
+			       unsigned int y);
+
+int hpix_gnomonic_xy_to_angles(const hpix_bmp_projection_t * proj,
+			       unsigned int x,
+			       unsigned int y,
+			       double * theta,
+			       double * phi);
+
+int hpix_gnomonic_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				double x,
+				double y,
+				double * theta,
+				double * phi);
+
+int hpix_gnomonic_angles_to_xy(const hpix_bmp_projection_t * proj,
+			       double theta,
+			       double phi,
+			       double * x,
+			       double * y);
+
+/* Functions implemented in orthographic_projection.c */
+
+int hpix_orthographic_is_xy_inside(const hpix_bmp_projection_t * proj,
+				   unsigned int x,
+				   unsigned int y);
+
+int hpix_orthographic_xy_to_angles(const hpix_bmp_projection_t * proj,
+				   unsigned int x,
+				   unsigned int y,
+				   double * theta,
+				   double * phi);
+
+int hpix_orthographic_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				    double x,
+				    double y,
+				    double * theta,
+				    double * phi);
+
+int hpix_orthographic_angles_to_xy(const hpix_bmp_projection_t * proj,
+				   double theta,
+				   double phi,
+				   double * x,
+				   double * y);
+
+/* Functions implemented in projection_plan.c */
+
+hpix_projection_plan_t *
+hpix_create_projection_plan(const hpix_bmp_projection_t * proj,
+			    hpix_nside_t nside,
+			    hpix_ordering_scheme_t scheme);
+hpix_projection_plan_t *
+hpix_create_supersampled_projection_plan(const hpix_bmp_projection_t * proj,
+					 hpix_nside_t nside,
+					 hpix_ordering_scheme_t scheme,
+					 unsigned int samples_per_side);
+void hpix_free_projection_plan(hpix_projection_plan_t * plan);
+unsigned int hpix_projection_plan_width(const hpix_projection_plan_t * plan);
+unsigned int hpix_projection_plan_height(const hpix_projection_plan_t * plan);
+hpix_nside_t hpix_projection_plan_nside(const hpix_projection_plan_t * plan);
+hpix_ordering_scheme_t
+hpix_projection_plan_ordering_scheme(const hpix_projection_plan_t * plan);
+hpix_projection_type_t
+hpix_projection_plan_type(const hpix_projection_plan_t * plan);
+unsigned int
+hpix_projection_plan_samples_per_side(const hpix_projection_plan_t * plan);
+const hpix_pixel_num_t *
+hpix_projection_plan_pixels(const hpix_projection_plan_t * plan);
+double *
+hpix_projection_plan_trace(const hpix_projection_plan_t * plan,
+			   const hpix_map_t * map,
+			   double * min_value,
+			   double * max_value);
+int hpix_save_projection_plan(FILE * file,
+			      const hpix_projection_plan_t * plan);
+hpix_projection_plan_t * hpix_load_projection_plan(FILE * file);
+
 /* Functions implemented in query_disc.c */
 
-void hpix_query_disc(double theta, double phi, double radius,
+void hpix_query_disc(const hpix_resolution_t * resolution,
+		     hpix_ordering_scheme_t scheme,
+		     double theta, double phi, double radius,
 		     hpix_pixel_num_t ** pixels,
 		     size_t * num_of_matches);
 
-void hpix_query_disc_inclusive(double theta, double phi, double radius,
+void hpix_query_disc_inclusive(const hpix_resolution_t * resolution,
+			       hpix_ordering_scheme_t scheme,
+			       double theta, double phi, double radius,
 			       hpix_pixel_num_t ** pixels,
 			       size_t * num_of_matches);
 
@@ -447,6 +904,27 @@ double hpix_calc_angular_distance_from_vectors(const hpix_vector_t * vector1,
 double hpix_calc_angular_distance_from_angles(double theta1_rad, double phi1_rad,
 					      double theta2_rad, double phi2_rad);
 
+int hpix_coordinate_rotation_matrix(hpix_coordinates_t source_coord,
+				    hpix_coordinates_t target_coord,
+				    hpix_matrix_t * matrix);
+void hpix_rotate_alm(int lmax, const ptrdiff_t * mstart, ptrdiff_t stride,
+		     double * alm, double psi, double theta, double phi);
+hpix_map_t * hpix_rotate_map(const hpix_map_t * map,
+			     const hpix_matrix_t * matrix,
+			     hpix_rotation_mode_t mode);
+hpix_map_t * hpix_rotate_map_coords(const hpix_map_t * map,
+				    hpix_coordinates_t target_coord,
+				    hpix_rotation_mode_t mode);
+
+
+/* Functions implemented in tiff_output.c */
+
+int hpix_save_bmp_projection_to_tiff(FILE * file,
+				     const hpix_bmp_projection_t * proj,
+				     const hpix_map_t * map,
+				     const hpix_palette_lut_t * lut,
+				     double min_value,
+				     double max_value);
 
 /* Functions defined in vectors.c */
 
@@ -459,6 +937,19 @@ double hpix_dot_product(const hpix_vector_t * vector1,
 
 void hpix_normalize_vector(hpix_vector_t * vector);
 
+hpix_vector_batch_t * hpix_create_vector_batch(size_t num_of_vectors);
+void hpix_free_vector_batch(hpix_vector_batch_t * batch);
+void hpix_vector_batch_normalize(hpix_vector_batch_t * batch);
+void hpix_vector_batch_dot_product(const hpix_vector_batch_t * batch1,
+				   const hpix_vector_batch_t * batch2,
+				   double * result);
+void hpix_vector_batch_cross_product(hpix_vector_batch_t * result,
+				     const hpix_vector_batch_t * batch1,
+				     const hpix_vector_batch_t * batch2);
+void hpix_vector_batch_angular_distance(const hpix_vector_batch_t * batch1,
+					const hpix_vector_batch_t * batch2,
+					double * result);
+
 #ifdef __cplusplus
 };
 #endif /* __cplusplus */
@@ -0,0 +1,456 @@
+/* interpolation.c -- Estimate the value of a map between pixel centers
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <math.h>
+#include <assert.h>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#include "rings.h"
+
+#ifndef M_PI
+#define M_PI 3.141592653589793
+#endif
+
+/* The interpolation uses the four pixels whose centers surround the
+ * point: two on the ring just north of it, two on the ring just
+ * south. The value is interpolated linearly in phi along each ring,
+ * then linearly in theta between the rings. Near the poles, where one
+ * of the two rings is missing, the four pixels of the polar ring are
+ * used instead. This is the same scheme used by `get_interpol` in
+ * Healpix C++. */
+
+/* Number of points interpolated together by `hpix_interpolate_map`.
+ * Each step of the computation is applied to the whole block before
+ * moving to the next, so that the simple ones can be vectorized */
+#define INTERPOLATION_BLOCK_SIZE 256
+
+/**********************************************************************/
+
+
+/* Geometry of a ring of pixels */
+typedef struct {
+    hpix_pixel_num_t first_pixel;
+    unsigned int     num_of_pixels;
+    double           theta;
+    _Bool            shifted;
+} ring_t;
+
+/**********************************************************************/
+
+
+/* Return the index of the first pixel in the ring, the number of
+ * pixels in it, its colatitude and whether its first pixel is
+ * shifted by half a pixel from phi = 0 */
+static void
+ring_info(const hpix_resolution_t * resolution,
+	  unsigned int ring,
+	  ring_t * info)
+{
+    const unsigned int nside = resolution->nside;
+    const unsigned int north_ring =
+	(ring > resolution->nside_times_two)
+	? resolution->nside_times_four - ring
+	: ring;
+
+    if(north_ring < nside)
+    {
+	const double tmp = north_ring * north_ring * resolution->fact2;
+	const double cos_theta = 1.0 - tmp;
+	const double sin_theta = sqrt(tmp * (2.0 - tmp));
+
+	info->theta = atan2(sin_theta, cos_theta);
+	info->num_of_pixels = 4 * north_ring;
+	info->shifted = TRUE;
+	info->first_pixel = 2 * north_ring * (north_ring - 1);
+    } else {
+	info->theta = acos((resolution->nside_times_two - (double) north_ring)
+			   * resolution->fact1);
+	info->num_of_pixels = resolution->nside_times_four;
+	info->shifted = ((north_ring - nside) & 1) == 0;
+	info->first_pixel = resolution->ncap
+	    + (hpix_pixel_num_t) (north_ring - nside) * info->num_of_pixels;
+    }
+
+    if(north_ring != ring)
+    {
+	info->theta = M_PI - info->theta;
+	info->first_pixel =
+	    resolution->num_of_pixels - info->first_pixel - info->num_of_pixels;
+    }
+}
+
+/**********************************************************************/
+
+
+/* Find the two pixels of a ring which surround `phi`, and the weight
+ * of each of them */
+static void
+pixels_on_ring(const ring_t * ring,
+	       double phi,
+	       hpix_pixel_num_t * pixels,
+	       double * weights)
+{
+    const double dphi = 2.0 * M_PI / ring->num_of_pixels;
+    const double position = phi / dphi - 0.5 * ring->shifted;
+    const double floor_position = floor(position);
+    const double weight = position - floor_position;
+    long idx1 = (long) floor_position % (long) ring->num_of_pixels;
+
+    if(idx1 < 0)
+	idx1 += ring->num_of_pixels;
+
+    const long idx2 = (idx1 + 1 < (long) ring->num_of_pixels) ? idx1 + 1 : 0;
+
+    pixels[0] = ring->first_pixel + idx1;
+    pixels[1] = ring->first_pixel + idx2;
+    weights[0] = 1.0 - weight;
+    weights[1] = weight;
+}
+
+/**********************************************************************/
+
+
+/* Compute the four RING pixels and weights for the direction (theta,
+ * phi), which lies between `north_ring` and `south_ring`. Either of
+ * the two is NULL if the point is beyond the first or last ring. */
+static void
+weights_between_rings(const hpix_resolution_t * resolution,
+		      const ring_t * north_ring,
+		      const ring_t * south_ring,
+		      double theta, double phi,
+		      hpix_pixel_num_t * pixels,
+		      double * weights)
+{
+    if(north_ring != NULL)
+	pixels_on_ring(north_ring, phi, pixels, weights);
+
+    if(south_ring != NULL)
+	pixels_on_ring(south_ring, phi, pixels + 2, weights + 2);
+
+    if(north_ring == NULL)
+    {
+	/* North of the first ring: the other two pixels are the
+	 * opposite ones on the same ring */
+	const double weight_theta = theta / south_ring->theta;
+	const double polar_weight = (1.0 - weight_theta) * 0.25;
+
+	weights[2] *= weight_theta;
+	weights[3] *= weight_theta;
+	pixels[0] = (pixels[2] + 2) & 3;
+	pixels[1] = (pixels[3] + 2) & 3;
+	weights[0] = weights[1] = polar_weight;
+	weights[2] += polar_weight;
+	weights[3] += polar_weight;
+    } else if(south_ring == NULL)
+    {
+	/* South of the last ring */
+	const double weight_theta =
+	    (theta - north_ring->theta) / (M_PI - north_ring->theta);
+	const double polar_weight = weight_theta * 0.25;
+
+	weights[0] = weights[0] * (1.0 - weight_theta) + polar_weight;
+	weights[1] = weights[1] * (1.0 - weight_theta) + polar_weight;
+	pixels[2] = ((pixels[0] + 2) & 3) + resolution->num_of_pixels - 4;
+	pixels[3] = ((pixels[1] + 2) & 3) + resolution->num_of_pixels - 4;
+	weights[2] = weights[3] = polar_weight;
+    } else {
+	const double weight_theta =
+	    (theta - north_ring->theta) / (south_ring->theta - north_ring->theta);
+
+	weights[0] *= 1.0 - weight_theta;
+	weights[1] *= 1.0 - weight_theta;
+	weights[2] *= weight_theta;
+	weights[3] *= weight_theta;
+    }
+}
+
+/**********************************************************************/
+
+
+void
+hpix_interpolation_weights(const hpix_resolution_t * resolution,
+			   hpix_ordering_scheme_t scheme,
+			   double theta, double phi,
+			   hpix_pixel_num_t * pixels,
+			   double * weights)
+{
+    assert(resolution);
+    assert(pixels);
+    assert(weights);
+
+    const unsigned int ring1 = ring_above(resolution, cos(theta));
+    const unsigned int ring2 = ring1 + 1;
+    ring_t north_ring, south_ring;
+
+    if(ring1 > 0)
+	ring_info(resolution, ring1, &north_ring);
+    if(ring2 < resolution->nside_times_four)
+	ring_info(resolution, ring2, &south_ring);
+
+    weights_between_rings(resolution,
+			  (ring1 > 0) ? &north_ring : NULL,
+			  (ring2 < resolution->nside_times_four) ? &south_ring : NULL,
+			  theta, phi, pixels, weights);
+
+    if(scheme == HPIX_ORDER_SCHEME_NEST)
+    {
+	for(int idx = 0; idx < 4; ++idx)
+	    pixels[idx] = hpix_ring_to_nest_idx(resolution, pixels[idx]);
+    }
+}
+
+/**********************************************************************/
+
+
+double
+hpix_interpolate_value(const hpix_map_t * map, double theta, double phi)
+{
+    assert(map);
+
+    const double * map_pixels = hpix_map_pixels(map);
+    hpix_pixel_num_t pixels[4];
+    double weights[4];
+    double sum = 0.0;
+    double sum_of_weights = 0.0;
+
+    hpix_interpolation_weights(hpix_map_resolution(map),
+			       hpix_map_ordering_scheme(map),
+			       theta, phi, pixels, weights);
+
+    /* Masked pixels are skipped, and the weights of the others are
+     * normalized again */
+    for(int idx = 0; idx < 4; ++idx)
+    {
+	const double value = map_pixels[pixels[idx]];
+
+	if(! HPIX_IS_MASKED(value))
+	{
+	    sum += weights[idx] * value;
+	    sum_of_weights += weights[idx];
+	}
+    }
+
+    return (sum_of_weights > 0.0) ? sum / sum_of_weights : NAN;
+}
+
+/**********************************************************************/
+
+
+/* Return a table with the geometry of every ring. The table has
+ * 4*NSIDE elements, so that it can be indexed by the ring number. It
+ * is attached to the resolution, so that it is computed only once. */
+static void *
+create_ring_table(const hpix_resolution_t * resolution)
+{
+    ring_t * rings = hpix_malloc(sizeof(ring_t), resolution->nside_times_four);
+
+    for(unsigned int ring = 1; ring < resolution->nside_times_four; ++ring)
+	ring_info(resolution, ring, &rings[ring]);
+
+    return rings;
+}
+
+/**********************************************************************/
+
+
+static void
+interpolate_block(const hpix_map_t * map,
+		  const ring_t * rings,
+		  const double * theta,
+		  const double * phi,
+		  double * values,
+		  size_t num_of_points)
+{
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    const double * map_pixels = hpix_map_pixels(map);
+    const unsigned int last_ring = resolution->nside_times_four - 1;
+    double z[INTERPOLATION_BLOCK_SIZE];
+    hpix_pixel_num_t pixels[INTERPOLATION_BLOCK_SIZE][4];
+    double weights[INTERPOLATION_BLOCK_SIZE][4];
+
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+	z[idx] = cos(theta[idx]);
+
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+    {
+	const unsigned int ring = ring_above(resolution, z[idx]);
+
+	weights_between_rings(resolution,
+			      (ring > 0) ? &rings[ring] : NULL,
+			      (ring < last_ring) ? &rings[ring + 1] : NULL,
+			      theta[idx], phi[idx],
+			      pixels[idx], weights[idx]);
+    }
+
+    if(hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST)
+    {
+	for(size_t idx = 0; idx < num_of_points; ++idx)
+	{
+	    for(int k = 0; k < 4; ++k)
+		pixels[idx][k] = hpix_ring_to_nest_idx(resolution, pixels[idx][k]);
+	}
+    }
+
+    /* Masked pixels are skipped, as in `hpix_interpolate_value` */
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+    {
+	double sum = 0.0;
+	double sum_of_weights = 0.0;
+
+	for(int k = 0; k < 4; ++k)
+	{
+	    const double value = map_pixels[pixels[idx][k]];
+	    const double weight =
+		HPIX_IS_MASKED(value) ? 0.0 : weights[idx][k];
+
+	    sum += weight * (HPIX_IS_MASKED(value) ? 0.0 : value);
+	    sum_of_weights += weight;
+	}
+
+	values[idx] = (sum_of_weights > 0.0) ? sum / sum_of_weights : NAN;
+    }
+}
+
+/**********************************************************************/
+
+
+/* Return a permutation of the points which sorts them by ring, keeping
+ * the original order within each ring. This is a counting sort, where
+ * each thread counts the points in its own share of the input. */
+static size_t *
+sort_points_by_ring(const hpix_resolution_t * resolution,
+		    const double * theta,
+		    size_t num_of_points)
+{
+    const size_t num_of_rings = resolution->nside_times_four;
+#ifdef HAVE_OPENMP
+    const int max_threads = omp_get_max_threads();
+#else
+    const int max_threads = 1;
+#endif
+    size_t * offsets = hpix_calloc(sizeof(size_t), num_of_rings * max_threads);
+    unsigned int * point_rings =
+	hpix_malloc(sizeof(unsigned int), num_of_points);
+    size_t * order = hpix_malloc(sizeof(size_t), num_of_points);
+
+#pragma omp parallel default(shared)
+    {
+#ifdef HAVE_OPENMP
+	const int thread = omp_get_thread_num();
+	const int num_of_team_threads = omp_get_num_threads();
+#else
+	const int thread = 0;
+	const int num_of_team_threads = 1;
+#endif
+	const size_t first = num_of_points * thread / num_of_team_threads;
+	const size_t last = num_of_points * (thread + 1) / num_of_team_threads;
+	size_t * thread_offsets = offsets + thread * num_of_rings;
+
+	for(size_t idx = first; idx < last; ++idx)
+	{
+	    point_rings[idx] = ring_above(resolution, cos(theta[idx]));
+	    thread_offsets[point_rings[idx]]++;
+	}
+
+#pragma omp barrier
+#pragma omp single
+	{
+	    size_t position = 0;
+
+	    for(size_t ring = 0; ring < num_of_rings; ++ring)
+	    {
+		for(int t = 0; t < num_of_team_threads; ++t)
+		{
+		    const size_t count = offsets[t * num_of_rings + ring];
+
+		    offsets[t * num_of_rings + ring] = position;
+		    position += count;
+		}
+	    }
+	}
+
+	for(size_t idx = first; idx < last; ++idx)
+	    order[thread_offsets[point_rings[idx]]++] = idx;
+    }
+
+    hpix_free(point_rings);
+    hpix_free(offsets);
+
+    return order;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_interpolate_map(const hpix_map_t * map,
+		     const double * theta,
+		     const double * phi,
+		     double * values,
+		     size_t num_of_points,
+		     hpix_point_sorting_t sorting)
+{
+    assert(map);
+    assert((theta && phi && values) || num_of_points == 0);
+
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    const ring_t * rings =
+	hpix_resolution_cache(resolution, create_ring_table, hpix_free);
+    size_t * order = (sorting == HPIX_SORT_POINTS_BY_RING)
+	? sort_points_by_ring(resolution, theta, num_of_points)
+	: NULL;
+
+#pragma omp parallel for default(shared) schedule(static)
+    for(size_t first = 0; first < num_of_points;
+	first += INTERPOLATION_BLOCK_SIZE)
+    {
+	const size_t block_size =
+	    (first + INTERPOLATION_BLOCK_SIZE < num_of_points)
+	    ? INTERPOLATION_BLOCK_SIZE
+	    : num_of_points - first;
+
+	if(order == NULL)
+	{
+	    interpolate_block(map, rings, theta + first, phi + first,
+			      values + first, block_size);
+	} else {
+	    double block_theta[INTERPOLATION_BLOCK_SIZE];
+	    double block_phi[INTERPOLATION_BLOCK_SIZE];
+	    double block_values[INTERPOLATION_BLOCK_SIZE];
+
+	    for(size_t idx = 0; idx < block_size; ++idx)
+	    {
+		block_theta[idx] = theta[order[first + idx]];
+		block_phi[idx] = phi[order[first + idx]];
+	    }
+
+	    interpolate_block(map, rings, block_theta, block_phi,
+			      block_values, block_size);
+
+	    for(size_t idx = 0; idx < block_size; ++idx)
+		values[order[first + idx]] = block_values[idx];
+	}
+    }
+
+    hpix_free(order);
+}
@@ -24,8 +24,31 @@
 /**********************************************************************/
 
 
-hpix_resolution_t *
-hpix_create_resolution(hpix_nside_t nside)
+/* Resolutions with the same NSIDE are shared: hpix_create_resolution
+ * always returns the same object, so that the data attached to it by
+ * hpix_resolution_cache (e.g., tables describing the rings) are
+ * computed only once. Only power-of-two values of NSIDE are shared.
+ * Shared resolutions are kept alive even when no map uses them, so
+ * that loops creating and freeing maps do not rebuild their caches;
+ * hpix_release_cached_resolutions frees the unused ones. All the
+ * accesses to `interned_resolutions` and to the reference counts are
+ * serialized. */
+#define MAX_INTERNED_ORDER 15
+
+typedef struct cache_entry_t {
+    struct cache_entry_t *              next;
+    hpix_resolution_cache_create_fn_t * create_fn;
+    hpix_resolution_cache_free_fn_t *   free_fn;
+    void *                              data;
+} cache_entry_t;
+
+static hpix_resolution_t * interned_resolutions[MAX_INTERNED_ORDER + 1];
+
+/**********************************************************************/
+
+
+static hpix_resolution_t *
+new_resolution(hpix_nside_t nside)
 {
     hpix_resolution_t * resolution =
 	(hpix_resolution_t *) hpix_malloc(sizeof(hpix_resolution_t), 1);
@@ -40,17 +63,179 @@ hpix_create_resolution(hpix_nside_t nside)
     resolution->ncap             = 2 * (resolution->pixels_per_face - nside);
     resolution->fact2            = 4.0 / resolution->num_of_pixels;
     resolution->fact1            = (2 * nside) * resolution->fact2;
-    
+
+    resolution->reference_count  = 0;
+    resolution->caches           = NULL;
+
     return resolution;
 }
 
 /**********************************************************************/
 
+hpix_resolution_t *
+hpix_create_resolution(hpix_nside_t nside)
+{
+    hpix_resolution_t * resolution;
+
+    if(nside == 0 || (nside & (nside - 1)) != 0)
+    {
+	resolution = new_resolution(nside);
+	resolution->reference_count = 1;
+	return resolution;
+    }
+
+#pragma omp critical (hpix_resolutions)
+    {
+	const unsigned int order = hpix_ilog2(nside);
+
+	assert(order <= MAX_INTERNED_ORDER);
+	resolution = interned_resolutions[order];
+	if(resolution == NULL)
+	{
+	    resolution = new_resolution(nside);
+	    interned_resolutions[order] = resolution;
+	}
+
+	resolution->reference_count++;
+    }
+
+    return resolution;
+}
+
+/**********************************************************************/
+
+static void
+destroy_resolution(hpix_resolution_t * resolution)
+{
+    cache_entry_t * entry = resolution->caches;
+
+    while(entry != NULL)
+    {
+	cache_entry_t * next = entry->next;
+
+	entry->free_fn(entry->data);
+	hpix_free(entry);
+	entry = next;
+    }
+
+    hpix_free(resolution);
+}
+
+/**********************************************************************/
+
+
 void
 hpix_free_resolution(hpix_resolution_t * resolution)
 {
+    _Bool must_be_destroyed;
+
     assert(resolution != NULL);
-    hpix_free(resolution);
+
+#pragma omp critical (hpix_resolutions)
+    {
+	assert(resolution->reference_count > 0);
+
+	/* Shared resolutions stay in `interned_resolutions` until
+	 * hpix_release_cached_resolutions is called */
+	must_be_destroyed =
+	    (--resolution->reference_count == 0)
+	    && ! (resolution->order <= MAX_INTERNED_ORDER
+		  && interned_resolutions[resolution->order] == resolution);
+    }
+
+    if(must_be_destroyed)
+	destroy_resolution(resolution);
+}
+
+/**********************************************************************/
+
+
+void
+hpix_release_cached_resolutions(void)
+{
+    hpix_resolution_t * unused[MAX_INTERNED_ORDER + 1];
+    size_t num_of_unused = 0;
+
+#pragma omp critical (hpix_resolutions)
+    {
+	for(size_t order = 0; order <= MAX_INTERNED_ORDER; ++order)
+	{
+	    hpix_resolution_t * resolution = interned_resolutions[order];
+
+	    if(resolution != NULL && resolution->reference_count == 0)
+	    {
+		unused[num_of_unused++] = resolution;
+		interned_resolutions[order] = NULL;
+	    }
+	}
+    }
+
+    for(size_t idx = 0; idx < num_of_unused; ++idx)
+	destroy_resolution(unused[idx]);
+}
+
+/**********************************************************************/
+
+static cache_entry_t *
+find_cache(const hpix_resolution_t * resolution,
+	   hpix_resolution_cache_create_fn_t * create_fn)
+{
+    for(cache_entry_t * entry = resolution->caches;
+	entry != NULL;
+	entry = entry->next)
+    {
+	if(entry->create_fn == create_fn)
+	    return entry;
+    }
+
+    return NULL;
+}
+
+/**********************************************************************/
+
+const void *
+hpix_resolution_cache(const hpix_resolution_t * resolution,
+		      hpix_resolution_cache_create_fn_t * create_fn,
+		      hpix_resolution_cache_free_fn_t * free_fn)
+{
+    cache_entry_t * entry;
+
+    assert(resolution);
+    assert(create_fn);
+    assert(free_fn);
+
+#pragma omp critical (hpix_resolutions)
+    entry = find_cache(resolution, create_fn);
+
+    if(entry != NULL)
+	return entry->data;
+
+    /* Build the data outside the critical section, as it can take
+     * long and `create_fn` might need other caches */
+    void * data = create_fn(resolution);
+    _Bool is_duplicate = FALSE;
+
+#pragma omp critical (hpix_resolutions)
+    {
+	entry = find_cache(resolution, create_fn);
+	if(entry == NULL)
+	{
+	    entry = hpix_malloc(sizeof(cache_entry_t), 1);
+	    entry->create_fn = create_fn;
+	    entry->free_fn = free_fn;
+	    entry->data = data;
+	    entry->next = resolution->caches;
+	    /* The cache is not part of the value of the resolution */
+	    ((hpix_resolution_t *) resolution)->caches = entry;
+	} else
+	    is_duplicate = TRUE;
+    }
+
+    /* Another thread built the same data in the meantime */
+    if(is_duplicate)
+	free_fn(data);
+
+    return entry->data;
 }
 
 /**********************************************************************/
@@ -80,8 +265,10 @@ hpix_create_map(hpix_nside_t nside, hpix_ordering_scheme_t scheme)
     map->scheme	= scheme;
     map->coord	= HPIX_COORD_GALACTIC;
 
-    map->pixels	= hpix_calloc(sizeof(map->pixels[0]),
-			      hpix_nside_to_npixel(nside));
+    /* Zero the pixels in parallel, so that the pages of large maps
+     * are spread among the NUMA nodes of the threads using them */
+    map->pixels	= hpix_parallel_calloc(sizeof(map->pixels[0]),
+				       hpix_nside_to_npixel(nside));
     map->free_pixels_flag = TRUE;
 
     map->resolution = hpix_create_resolution(nside);
@@ -123,7 +310,7 @@ hpix_free_map(hpix_map_t * map)
 	hpix_free(map->pixels);
 
     if(map->resolution != NULL)
-	hpix_free(map->resolution);
+	hpix_free_resolution(map->resolution);
 
     hpix_free(map);
 }
@@ -27,6 +27,8 @@ hpix_average_pixel_value(const hpix_map_t * map)
     double sum_of_pixels = 0.0;
     double * pixels = hpix_map_pixels(map);
     size_t num_of_pixels = hpix_map_num_of_pixels(map);
+#pragma omp parallel for default(shared) schedule(static) \
+    reduction(+:good_pixels,sum_of_pixels)
     for(size_t idx = 0; idx < num_of_pixels; ++idx)
     {
 	if(! HPIX_IS_MASKED(pixels[idx]))
@@ -49,6 +51,7 @@ hpix_scale_pixels_by_constant_inplace(hpix_map_t * map, double constant)
     /* Multiply the pixels in the map by `scale_factor` */
     double * pixels = hpix_map_pixels(map);
     size_t num_of_pixels = hpix_map_num_of_pixels(map);
+#pragma omp parallel for default(shared) schedule(static)
     for(size_t idx = 0; idx < num_of_pixels; ++idx)
     {
 	if(! HPIX_IS_MASKED(pixels[idx]))
@@ -64,6 +67,7 @@ hpix_add_constant_to_pixels_inplace(hpix_map_t * map, double constant)
     /* Multiply the pixels in the map by `scale_factor` */
     double * pixels = hpix_map_pixels(map);
     size_t num_of_pixels = hpix_map_num_of_pixels(map);
+#pragma omp parallel for default(shared) schedule(static)
     for(size_t idx = 0; idx < num_of_pixels; ++idx)
     {
 	if(! HPIX_IS_MASKED(pixels[idx]))
@@ -133,6 +133,38 @@ hpix_matrix_vector_mul(hpix_vector_t * result,
 	matrix->m[2][2] * vector->z;
 }
 
+/**********************************************************************/
+
+
+void
+hpix_matrix_vector_batch_mul(hpix_vector_batch_t * result,
+			     const hpix_matrix_t * matrix,
+			     const hpix_vector_batch_t * batch)
+{
+    assert(result);
+    assert(matrix);
+    assert(batch);
+    assert(result->num_of_vectors == batch->num_of_vectors);
+
+    /* Copy the matrix into local variables, so that the compiler does
+     * not reload it after every store. `result` and `batch` can be
+     * the same. */
+    const double m00 = matrix->m[0][0], m01 = matrix->m[0][1], m02 = matrix->m[0][2];
+    const double m10 = matrix->m[1][0], m11 = matrix->m[1][1], m12 = matrix->m[1][2];
+    const double m20 = matrix->m[2][0], m21 = matrix->m[2][1], m22 = matrix->m[2][2];
+
+    for(size_t idx = 0; idx < batch->num_of_vectors; ++idx)
+    {
+	const double x = batch->x[idx];
+	const double y = batch->y[idx];
+	const double z = batch->z[idx];
+
+	result->x[idx] = m00 * x + m01 * y + m02 * z;
+	result->y[idx] = m10 * x + m11 * y + m12 * z;
+	result->z[idx] = m20 * x + m21 * y + m22 * z;
+    }
+}
+
 /**********************************************************************/
 
 
@@ -242,3 +274,62 @@ hpix_matrix_inverse(hpix_matrix_t * result,
 
     return TRUE;
 }
+
+/**********************************************************************/
+
+
+void
+hpix_euler_angles_to_matrix(hpix_matrix_t * matrix,
+			    double psi, double theta, double phi)
+{
+    assert(matrix);
+
+    const double cos_psi = cos(psi), sin_psi = sin(psi);
+    const double cos_theta = cos(theta), sin_theta = sin(theta);
+    const double cos_phi = cos(phi), sin_phi = sin(phi);
+
+    /* Rz(phi) * Ry(theta) * Rz(psi) */
+    matrix->m[0][0] = cos_phi * cos_theta * cos_psi - sin_phi * sin_psi;
+    matrix->m[0][1] = -cos_phi * cos_theta * sin_psi - sin_phi * cos_psi;
+    matrix->m[0][2] = cos_phi * sin_theta;
+
+    matrix->m[1][0] = sin_phi * cos_theta * cos_psi + cos_phi * sin_psi;
+    matrix->m[1][1] = -sin_phi * cos_theta * sin_psi + cos_phi * cos_psi;
+    matrix->m[1][2] = sin_phi * sin_theta;
+
+    matrix->m[2][0] = -sin_theta * cos_psi;
+    matrix->m[2][1] = sin_theta * sin_psi;
+    matrix->m[2][2] = cos_theta;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_matrix_to_euler_angles(const hpix_matrix_t * matrix,
+			    double * psi, double * theta, double * phi)
+{
+    assert(matrix);
+    assert(psi && theta && phi);
+
+    double cos_theta = matrix->m[2][2];
+    if(cos_theta > 1.0)
+	cos_theta = 1.0;
+    else if(cos_theta < -1.0)
+	cos_theta = -1.0;
+
+    *theta = acos(cos_theta);
+    if(sqrt(matrix->m[0][2] * matrix->m[0][2]
+	    + matrix->m[1][2] * matrix->m[1][2]) > 1e-12)
+    {
+	*psi = atan2(matrix->m[2][1], -matrix->m[2][0]);
+	*phi = atan2(matrix->m[1][2], matrix->m[0][2]);
+    } else {
+	/* Only psi + phi (or phi - psi) is defined: choose psi = 0 */
+	*psi = 0.0;
+	if(cos_theta > 0.0)
+	    *phi = atan2(matrix->m[1][0], matrix->m[0][0]);
+	else
+	    *phi = atan2(-matrix->m[1][0], -matrix->m[0][0]);
+    }
+}
@@ -1,6 +1,6 @@
 /* mem.c -- Allocation/deallocation routines
  *
- * Copyright 2011-2012 Maurizio Tomasi.
+ * Copyright 2011-2013 Maurizio Tomasi.
  *
  * This program is free software: you can redistribute it and/or modify
  * it under the terms of the GNU General Public License as published by
@@ -19,36 +19,525 @@
 
 #include <hpixlib/hpix.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
 #include <assert.h>
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+/* Anonymous mappings are not part of POSIX, so they might be missing
+ * even if sys/mman.h is present */
+#if defined(HAVE_SYS_MMAN_H) && defined(MAP_ANONYMOUS)
+#define USE_MMAP 1
+#endif
+
+/* Every block returned by hpix_malloc is preceded by a header, which
+ * records where the memory comes from. In this way hpix_free and
+ * hpix_realloc work even if the allocator has been changed after the
+ * block was allocated. The header takes a whole alignment unit, so
+ * that the block itself stays aligned. */
+#define HEADER_SIZE HPIX_MEMORY_ALIGNMENT
+
+/* Granularity of the interleaved placement of pages */
+#define PAGE_SIZE ((size_t) 4096)
+
+/* Blocks smaller than this are zeroed by hpix_parallel_calloc in the
+ * calling thread: starting a team of threads would cost more than
+ * writing them, and they span too few pages to matter for NUMA */
+#define PARALLEL_CALLOC_THRESHOLD ((size_t) 256 * 1024)
+
+/* Size of the huge pages used for large blocks */
+#define HUGE_PAGE_SIZE ((size_t) 2 * 1024 * 1024)
+
+typedef enum {
+    SOURCE_MALLOC,
+    SOURCE_MMAP,
+    SOURCE_CUSTOM
+} memory_source_t;
+
+typedef struct {
+    void *          base;
+    size_t          size;
+    size_t          allocated_size;
+    memory_source_t source;
+    void         (* release)(void * ptr, size_t size, void * user_data);
+    void *          user_data;
+} block_header_t;
+
+/* A chunk of memory used by an arena */
+typedef struct arena_chunk_t {
+    struct arena_chunk_t * next;
+    size_t                 size;
+    size_t                 used;
+    char *                 data;
+} arena_chunk_t;
+
+struct ___hpix_arena_t {
+    size_t          chunk_size;
+    arena_chunk_t * chunks;
+};
+
+static hpix_allocator_t custom_allocator;
+static _Bool use_custom_allocator = FALSE;
+static size_t huge_page_threshold = 0;
+static hpix_page_placement_t page_placement = HPIX_PAGES_FIRST_TOUCH;
+static hpix_memory_stats_t stats = { 0, 0, 0 };
+
+/**********************************************************************/
+
+
+static char *
+align_pointer(char * ptr)
+{
+    const uintptr_t address = (uintptr_t) ptr;
+    const uintptr_t mask = HPIX_MEMORY_ALIGNMENT - 1;
+
+    return ptr + (((address + mask) & ~mask) - address);
+}
+
+/**********************************************************************/
+
+
+static block_header_t *
+header_of(void * ptr)
+{
+    return (block_header_t *) ((char *) ptr - HEADER_SIZE);
+}
+
+/**********************************************************************/
+
+
+static void
+record_allocation(size_t size)
+{
+    size_t current;
+
+#pragma omp atomic
+    stats.num_of_allocations++;
+
+#pragma omp atomic capture
+    current = stats.current_bytes += size;
+
+    if(current > stats.peak_bytes)
+    {
+#pragma omp critical (hpix_memory_stats)
+	{
+	    if(current > stats.peak_bytes)
+		stats.peak_bytes = current;
+	}
+    }
+}
+
+/**********************************************************************/
+
+
+static void
+record_release(size_t size)
+{
+#pragma omp atomic
+    stats.current_bytes -= size;
+}
+
+/**********************************************************************/
+
+
+#ifdef USE_MMAP
+
+/* Map `size` bytes of memory, possibly using huge pages. Return NULL
+ * if this is not possible. The memory is always zeroed. */
+static void *
+map_huge_pages(size_t size)
+{
+    void * base = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    /* This works only if the administrator has reserved some huge
+     * pages; otherwise, we ask for transparent huge pages below */
+    base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+
+    if(base == MAP_FAILED)
+    {
+	base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(base == MAP_FAILED)
+	    return NULL;
+
+#ifdef MADV_HUGEPAGE
+	madvise(base, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    return base;
+}
+
+#endif
+
+/**********************************************************************/
+
+
+static void *
+allocate(size_t size, _Bool zero)
+{
+    if(size > SIZE_MAX - HEADER_SIZE - HPIX_MEMORY_ALIGNMENT)
+	return NULL;
+
+    block_header_t header = {
+	.base = NULL,
+	.size = size,
+	.allocated_size = size + HEADER_SIZE + HPIX_MEMORY_ALIGNMENT - 1,
+	.source = SOURCE_MALLOC,
+	.release = NULL,
+	.user_data = NULL
+    };
+
+#ifdef USE_MMAP
+    if(! use_custom_allocator
+       && huge_page_threshold > 0
+       && size >= huge_page_threshold)
+    {
+	/* mmap returns page-aligned memory, so no padding is needed */
+	header.allocated_size =
+	    (size + HEADER_SIZE + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+	header.base = map_huge_pages(header.allocated_size);
+	if(header.base != NULL)
+	    header.source = SOURCE_MMAP;
+    }
+#endif
+
+    if(header.base == NULL)
+    {
+	header.allocated_size = size + HEADER_SIZE + HPIX_MEMORY_ALIGNMENT - 1;
+
+	if(use_custom_allocator)
+	{
+	    header.source = SOURCE_CUSTOM;
+	    header.release = custom_allocator.release;
+	    header.user_data = custom_allocator.user_data;
+	    header.base = custom_allocator.allocate(header.allocated_size,
+						    header.user_data);
+	    if(header.base != NULL && zero)
+		memset(header.base, 0, header.allocated_size);
+	} else {
+	    header.base = zero
+		? calloc(1, header.allocated_size)
+		: malloc(header.allocated_size);
+	}
+    }
+
+    if(header.base == NULL)
+	return NULL;
+
+    char * ptr = align_pointer((char *) header.base + HEADER_SIZE);
+    memcpy(header_of(ptr), &header, sizeof(header));
+    record_allocation(size);
+
+    return ptr;
+}
+
+/**********************************************************************/
+
+
 void *
 hpix_malloc(size_t size, size_t num)
 {
     if(size == 0)
 	return NULL;
+    if(num > SIZE_MAX / size)
+	return NULL;
 
-    return malloc(size * num);
+    return allocate(size * num, FALSE);
 }
 
+/**********************************************************************/
+
+
 void *
 hpix_calloc(size_t size, size_t num)
 {
     if(size == 0)
 	return NULL;
+    if(num > SIZE_MAX / size)
+	return NULL;
 
-    return calloc(size, num);
+    return allocate(size * num, TRUE);
 }
 
+/**********************************************************************/
+
+
 void *
 hpix_realloc(void * ptr, size_t size)
 {
     assert(ptr);
-    return realloc(ptr, size);
+
+    const size_t old_size = header_of(ptr)->size;
+    void * new_ptr = allocate(size, FALSE);
+
+    if(new_ptr == NULL)
+	return NULL;
+
+    memcpy(new_ptr, ptr, (old_size < size) ? old_size : size);
+    hpix_free(ptr);
+
+    return new_ptr;
 }
 
+/**********************************************************************/
+
+
 void
 hpix_free(void * ptr)
 {
-    if(ptr != NULL)
-	free(ptr);
+    if(ptr == NULL)
+	return;
+
+    block_header_t header;
+    memcpy(&header, header_of(ptr), sizeof(header));
+    record_release(header.size);
+
+    switch(header.source)
+    {
+    case SOURCE_MALLOC:
+	free(header.base);
+	break;
+    case SOURCE_MMAP:
+#ifdef USE_MMAP
+	munmap(header.base, header.allocated_size);
+#endif
+	break;
+    case SOURCE_CUSTOM:
+	header.release(header.base, header.allocated_size, header.user_data);
+	break;
+    default:
+	assert(0);
+    }
+}
+
+/**********************************************************************/
+
+
+void *
+hpix_parallel_calloc(size_t size, size_t num)
+{
+    char * ptr = hpix_malloc(size, num);
+
+    if(ptr == NULL)
+	return NULL;
+
+    const size_t num_of_bytes = size * num;
+
+    /* The kernel places each page on the NUMA node of the thread which
+     * first writes it. Small blocks, and blocks allocated within a
+     * parallel region (e.g., maps created by concurrent tasks), are
+     * zeroed serially. */
+    if(page_placement == HPIX_PAGES_INTERLEAVED)
+    {
+	const size_t num_of_pages = (num_of_bytes + PAGE_SIZE - 1) / PAGE_SIZE;
+
+#pragma omp parallel for default(shared) schedule(static, 1) \
+    if(num_of_bytes > PARALLEL_CALLOC_THRESHOLD && ! omp_in_parallel())
+	for(size_t page = 0; page < num_of_pages; ++page)
+	{
+	    const size_t first = page * PAGE_SIZE;
+	    const size_t last = (first + PAGE_SIZE < num_of_bytes)
+		? first + PAGE_SIZE
+		: num_of_bytes;
+
+	    memset(ptr + first, 0, last - first);
+	}
+    } else {
+	/* Split the elements in contiguous ranges, one per thread, as
+	 * "schedule(static)" does in the loops over pixels */
+#pragma omp parallel default(shared) \
+    if(num_of_bytes > PARALLEL_CALLOC_THRESHOLD && ! omp_in_parallel())
+	{
+#ifdef HAVE_OPENMP
+	    const size_t thread = omp_get_thread_num();
+	    const size_t num_of_threads = omp_get_num_threads();
+#else
+	    const size_t thread = 0;
+	    const size_t num_of_threads = 1;
+#endif
+	    const size_t first = num * thread / num_of_threads;
+	    const size_t last = num * (thread + 1) / num_of_threads;
+
+	    memset(ptr + first * size, 0, (last - first) * size);
+	}
+    }
+
+    return ptr;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_set_page_placement(hpix_page_placement_t placement)
+{
+    page_placement = placement;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_set_allocator(const hpix_allocator_t * allocator)
+{
+    if(allocator != NULL)
+    {
+	assert(allocator->allocate);
+	assert(allocator->release);
+
+	custom_allocator = *allocator;
+	use_custom_allocator = TRUE;
+    } else
+	use_custom_allocator = FALSE;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_set_huge_page_threshold(size_t size)
+{
+    huge_page_threshold = size;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_get_memory_stats(hpix_memory_stats_t * result)
+{
+    assert(result);
+
+#pragma omp critical (hpix_memory_stats)
+    {
+	*result = stats;
+    }
+}
+
+/**********************************************************************/
+
+
+void
+hpix_reset_memory_stats(void)
+{
+#pragma omp critical (hpix_memory_stats)
+    {
+	stats.num_of_allocations = 0;
+	stats.peak_bytes = stats.current_bytes;
+    }
+}
+
+/**********************************************************************/
+
+
+hpix_arena_t *
+hpix_create_arena(size_t chunk_size)
+{
+    hpix_arena_t * arena = hpix_malloc(sizeof(hpix_arena_t), 1);
+
+    arena->chunk_size = (chunk_size > 0) ? chunk_size : 65536;
+    arena->chunks = NULL;
+
+    return arena;
+}
+
+/**********************************************************************/
+
+
+void *
+hpix_arena_alloc(hpix_arena_t * arena, size_t size, size_t num)
+{
+    assert(arena);
+
+    if(size == 0)
+	return NULL;
+    if(num > (SIZE_MAX - HPIX_MEMORY_ALIGNMENT) / size)
+	return NULL;
+
+    const size_t bytes = size * num;
+    arena_chunk_t * chunk = arena->chunks;
+    char * ptr = NULL;
+
+    if(chunk != NULL)
+    {
+	ptr = align_pointer(chunk->data + chunk->used);
+	if((size_t) (ptr - chunk->data) + bytes > chunk->size)
+	    ptr = NULL;
+    }
+
+    if(ptr == NULL)
+    {
+	/* Blocks larger than a chunk get a chunk of their own */
+	const size_t chunk_size =
+	    (bytes > arena->chunk_size) ? bytes : arena->chunk_size;
+
+	chunk = hpix_malloc(sizeof(arena_chunk_t), 1);
+	chunk->data = hpix_malloc(1, chunk_size);
+	chunk->size = chunk_size;
+	chunk->next = arena->chunks;
+	arena->chunks = chunk;
+
+	/* hpix_malloc returns aligned memory */
+	ptr = chunk->data;
+    }
+
+    chunk->used = (size_t) (ptr - chunk->data) + bytes;
+    return ptr;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_clear_arena(hpix_arena_t * arena)
+{
+    assert(arena);
+
+    if(arena->chunks == NULL)
+	return;
+
+    /* Keep the most recent chunk, so that an arena reused many times
+     * does not allocate memory at every cycle */
+    arena_chunk_t * chunk = arena->chunks->next;
+    while(chunk != NULL)
+    {
+	arena_chunk_t * next = chunk->next;
+
+	hpix_free(chunk->data);
+	hpix_free(chunk);
+	chunk = next;
+    }
+
+    arena->chunks->next = NULL;
+    arena->chunks->used = 0;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_free_arena(hpix_arena_t * arena)
+{
+    if(arena == NULL)
+	return;
+
+    hpix_clear_arena(arena);
+    if(arena->chunks != NULL)
+    {
+	hpix_free(arena->chunks->data);
+	hpix_free(arena->chunks);
+    }
+
+    hpix_free(arena);
 }
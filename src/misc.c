@@ -20,6 +20,8 @@
 #include <hpixlib/hpix.h>
 #include <math.h>
 
+#include "constants.h"
+
 int
 hpix_valid_nside(hpix_nside_t nside)
 {
@@ -45,9 +47,19 @@ hpix_npixel_to_nside(hpix_pixel_num_t npixels)
 	return nside_estimate;
 }
 
+/* Upper bound for the angular distance between the center of a pixel
+ * and its corners. The largest pixels are the ones at the edges of the
+ * equatorial faces. */
 double
 hpix_max_pixel_radius(hpix_nside_t nside)
 {
-    return 0.0;
+    double t1 = 1.0 - 1.0 / nside;
+    hpix_vector_t a, b;
+
+    t1 *= t1;
+    hpix_angles_to_vector(acos(2.0 / 3.0), M_PI / (4.0 * nside), &a);
+    hpix_angles_to_vector(acos(1.0 - t1 / 3.0), 0.0, &b);
+
+    return acos(fmin(hpix_dot_product(&a, &b), 1.0));
 }
 
@@ -29,8 +29,8 @@
 
 static inline void
 mollweide_xy_to_uv(const hpix_bmp_projection_t * proj,
-		   unsigned int x,
-		   unsigned int y,
+		   double x,
+		   double y,
 		   double * u,
 		   double * v)
 {
@@ -76,11 +76,11 @@ hpix_mollweide_is_xy_inside(const hpix_bmp_projection_t * proj,
 
 
 int
-hpix_mollweide_xy_to_angles(const hpix_bmp_projection_t * proj,
-			    unsigned int x,
-			    unsigned int y,
-			    double * theta,
-			    double * phi)
+hpix_mollweide_fxy_to_angles(const hpix_bmp_projection_t * proj,
+			     double x,
+			     double y,
+			     double * theta,
+			     double * phi)
 {
     assert(proj);
     assert(theta);
@@ -97,3 +97,65 @@ hpix_mollweide_xy_to_angles(const hpix_bmp_projection_t * proj,
     *phi = -M_PI_2 * u / fmax(cos_asin_v, 1e-6);
     return TRUE;
 }
+
+/**********************************************************************/
+
+
+int
+hpix_mollweide_xy_to_angles(const hpix_bmp_projection_t * proj,
+			    unsigned int x,
+			    unsigned int y,
+			    double * theta,
+			    double * phi)
+{
+    return hpix_mollweide_fxy_to_angles(proj, x, y, theta, phi);
+}
+
+/**********************************************************************/
+
+
+int
+hpix_mollweide_angles_to_xy(const hpix_bmp_projection_t * proj,
+			    double theta,
+			    double phi,
+			    double * x,
+			    double * y)
+{
+    assert(proj);
+    assert(x);
+    assert(y);
+
+    const double center_x = hpix_bmp_projection_width(proj) / 2.0;
+    const double center_y = hpix_bmp_projection_height(proj) / 2.0;
+    const double target = M_PI * cos(theta); /* pi * sin(latitude) */
+
+    /* Solve 2 gamma + sin(2 gamma) = pi sin(latitude) for the
+     * auxiliary angle gamma using Newton's method. The derivative
+     * vanishes at the poles, where the solution is trivial. */
+    double gamma;
+    if(fabs(target) >= M_PI * (1.0 - 1e-12))
+	gamma = copysign(M_PI_2, target);
+    else
+    {
+	double two_gamma = 2.0 * (M_PI_2 - theta);
+	for(int iter = 0; iter < 50; ++iter)
+	{
+	    const double delta =
+		(two_gamma + sin(two_gamma) - target)
+		/ fmax(1.0 + cos(two_gamma), 1e-12);
+	    two_gamma -= delta;
+	    if(fabs(delta) < 1e-12)
+		break;
+	}
+	gamma = 0.5 * two_gamma;
+    }
+
+    /* Bring phi into [-pi, pi] */
+    phi = remainder(phi, 2.0 * M_PI);
+
+    const double u = -2.0 * phi * cos(gamma) / M_PI;
+    const double v = sin(gamma);
+    *x = center_x + u * center_x / 2.0;
+    *y = center_y + v * center_y;
+    return TRUE;
+}
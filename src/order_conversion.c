@@ -140,6 +140,29 @@ compress_bits(uint64_t v)
 
 /**********************************************************************/
 
+
+hpix_pixel_num_t
+hpix_xy_to_nest_subpixel(unsigned int x, unsigned int y)
+{
+    return spread_bits(x) + 2 * spread_bits(y);
+}
+
+/**********************************************************************/
+
+
+void
+hpix_nest_subpixel_to_xy(hpix_pixel_num_t subpixel,
+			 unsigned int * x, unsigned int * y)
+{
+    assert(x != NULL);
+    assert(y != NULL);
+
+    *x = compress_bits(subpixel);
+    *y = compress_bits(subpixel / 2);
+}
+
+/**********************************************************************/
+
 
 typedef struct {
     uint64_t ix;
@@ -300,8 +323,10 @@ xyf2ring(const hpix_resolution_t * resolution,
     get_ring_info_small(resolution, jr, &n_before, &nr, &shifted);
     nr >>= 2;
     kshift = 1 - shifted;
-    unsigned jp = (jpll[xyf.face_num] * nr + xyf.ix - xyf.iy + 1 + kshift) / 2;
-    assert(jp <= 4 * nr);
+    /* This must be signed, as ix - iy can be negative */
+    long jp = (jpll[xyf.face_num] * (long) nr
+	       + (long) xyf.ix - (long) xyf.iy + 1 + (long) kshift) / 2;
+    assert(jp <= 4 * (long) nr);
     if (jp < 1)
     {
 	/* Assumption: if this triggers, then resolution->nsidetimes_four==4*nr */
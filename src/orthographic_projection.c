@@ -0,0 +1,138 @@
+/* orthographic_projection.c -- Orthographic projection
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <math.h>
+#include <assert.h>
+
+#include "constants.h"
+#include "bmp_projection.h"
+
+/* The orthographic projection shows the hemisphere around the center
+ * as seen from an infinite distance: the point (X, Y) of the plane,
+ * with X^2 + Y^2 < 1, is the direction of center sqrt(1 - X^2 - Y^2)
+ * - X east + Y north. */
+
+/**********************************************************************/
+
+
+static _Bool
+orthographic_plane_to_vector(const hpix_bmp_projection_t * proj,
+			     double plane_x,
+			     double plane_y,
+			     hpix_vector_t * direction)
+{
+    const double rho_squared = plane_x * plane_x + plane_y * plane_y;
+    if(rho_squared >= 1.0)
+	return FALSE;
+
+    const double height = sqrt(1.0 - rho_squared);
+    direction->x = height * proj->center.x
+	- plane_x * proj->east.x + plane_y * proj->north.x;
+    direction->y = height * proj->center.y
+	- plane_x * proj->east.y + plane_y * proj->north.y;
+    direction->z = height * proj->center.z
+	- plane_x * proj->east.z + plane_y * proj->north.z;
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_orthographic_is_xy_inside(const hpix_bmp_projection_t * proj,
+			       unsigned int x,
+			       unsigned int y)
+{
+    assert(proj);
+
+    double plane_x, plane_y;
+    if(x >= proj->width || y >= proj->height)
+	return FALSE;
+
+    bmp_projection_xy_to_plane(proj, x, y, &plane_x, &plane_y);
+    return plane_x * plane_x + plane_y * plane_y < 1.0;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_orthographic_fxy_to_angles(const hpix_bmp_projection_t * proj,
+				double x,
+				double y,
+				double * theta,
+				double * phi)
+{
+    assert(proj);
+    assert(theta);
+    assert(phi);
+
+    if(x < -0.5 || x >= proj->width - 0.5
+       || y < -0.5 || y >= proj->height - 0.5)
+	return FALSE;
+
+    double plane_x, plane_y;
+    hpix_vector_t direction;
+    bmp_projection_xy_to_plane(proj, x, y, &plane_x, &plane_y);
+    if(! orthographic_plane_to_vector(proj, plane_x, plane_y, &direction))
+	return FALSE;
+
+    hpix_vector_to_angles(&direction, theta, phi);
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_orthographic_xy_to_angles(const hpix_bmp_projection_t * proj,
+			       unsigned int x,
+			       unsigned int y,
+			       double * theta,
+			       double * phi)
+{
+    return hpix_orthographic_fxy_to_angles(proj, x, y, theta, phi);
+}
+
+/**********************************************************************/
+
+
+int
+hpix_orthographic_angles_to_xy(const hpix_bmp_projection_t * proj,
+			       double theta,
+			       double phi,
+			       double * x,
+			       double * y)
+{
+    assert(proj);
+    assert(x);
+    assert(y);
+
+    hpix_vector_t direction;
+    hpix_angles_to_vector(theta, phi, &direction);
+
+    if(hpix_dot_product(&direction, &proj->center) < 0.0)
+	return FALSE; /* The other hemisphere */
+
+    return bmp_projection_plane_to_xy(proj,
+				      -hpix_dot_product(&direction, &proj->east),
+				      hpix_dot_product(&direction, &proj->north),
+				      x, y);
+}
@@ -0,0 +1,340 @@
+/* pairs.c -- Find all the pairs of close points in two catalogues
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "constants.h"
+
+/* The points of both catalogues are sorted into the pixels of a NEST
+ * map, used as a spatial hash. For every pixel containing points of
+ * the first catalogue, a disc query finds the pixels which can contain
+ * matches, and the points in them are compared with a dot product.
+ * Since the points are sorted, the points in each pixel are contiguous
+ * in memory.
+ *
+ * The resolution is chosen so that pixels are roughly as large as the
+ * search radius, but never much smaller than the average distance
+ * between the points of the second catalogue. */
+#define MAX_PAIRS_NSIDE 8192
+
+/* Number of pixels of the first catalogue processed by each iteration
+ * ("task") of the dynamically scheduled OpenMP loop in
+ * hpix_find_pairs. The pairs found by each task are kept in a separate
+ * buffer, and the buffers are concatenated in order at the end, so
+ * that the result does not depend on the number of threads. */
+#define PIXELS_PER_TASK 64
+
+/* Points of a catalogue, normalized and sorted by pixel */
+typedef struct {
+    double * x;
+    double * y;
+    double * z;
+    size_t * original_index;
+    /* Points in pixel p have indexes pixel_start[p]...pixel_start[p+1]-1 */
+    size_t * pixel_start;
+} bucketed_catalogue_t;
+
+typedef struct {
+    hpix_pair_t * pairs;
+    size_t num_of_pairs;
+    size_t allocated;
+} pair_buffer_t;
+
+/**********************************************************************/
+
+
+static hpix_nside_t
+choose_nside(double radius, size_t num_of_points)
+{
+    /* The side of a pixel is roughly sqrt(pi / 3) / NSIDE */
+    const double max_nside_radius = (radius > 0.0)
+	? sqrt(M_PI / 3.0) / radius
+	: MAX_PAIRS_NSIDE;
+    const double max_nside_points = sqrt(num_of_points / 12.0);
+    hpix_nside_t nside = 1;
+
+    while(nside < MAX_PAIRS_NSIDE
+	  && 2.0 * nside <= max_nside_radius
+	  && 2.0 * nside <= max_nside_points)
+    {
+	nside *= 2;
+    }
+
+    return nside;
+}
+
+/**********************************************************************/
+
+
+/* Sort the points of `catalogue` by pixel using a counting sort,
+ * which keeps the original order of the points within each pixel */
+static void
+bucket_catalogue(const hpix_resolution_t * resolution,
+		 const hpix_vector_batch_t * catalogue,
+		 bucketed_catalogue_t * result)
+{
+    const size_t num_of_points = catalogue->num_of_vectors;
+    const size_t num_of_pixels = resolution->num_of_pixels;
+    hpix_pixel_num_t * pixels =
+	hpix_malloc(sizeof(hpix_pixel_num_t), num_of_points);
+    size_t * next = hpix_malloc(sizeof(size_t), num_of_pixels);
+
+#pragma omp parallel for default(shared) schedule(static)
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+    {
+	const hpix_vector_t vector = {
+	    .x = catalogue->x[idx],
+	    .y = catalogue->y[idx],
+	    .z = catalogue->z[idx]
+	};
+	pixels[idx] = hpix_vector_to_nest_pixel(resolution, &vector);
+    }
+
+    result->pixel_start = hpix_calloc(sizeof(size_t), num_of_pixels + 1);
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+	result->pixel_start[pixels[idx] + 1]++;
+    for(size_t pixel = 0; pixel < num_of_pixels; ++pixel)
+	result->pixel_start[pixel + 1] += result->pixel_start[pixel];
+    memcpy(next, result->pixel_start, sizeof(size_t) * num_of_pixels);
+
+    result->x = hpix_malloc(sizeof(double), num_of_points);
+    result->y = hpix_malloc(sizeof(double), num_of_points);
+    result->z = hpix_malloc(sizeof(double), num_of_points);
+    result->original_index = hpix_malloc(sizeof(size_t), num_of_points);
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+    {
+	const size_t dest = next[pixels[idx]]++;
+
+	result->x[dest] = catalogue->x[idx];
+	result->y[dest] = catalogue->y[idx];
+	result->z[dest] = catalogue->z[idx];
+	result->original_index[dest] = idx;
+    }
+
+    hpix_vector_batch_t sorted = {
+	.num_of_vectors = num_of_points,
+	.x = result->x, .y = result->y, .z = result->z,
+	.memory = NULL
+    };
+    hpix_vector_batch_normalize(&sorted);
+
+    hpix_free(next);
+    hpix_free(pixels);
+}
+
+/**********************************************************************/
+
+
+static void
+free_bucketed_catalogue(bucketed_catalogue_t * catalogue)
+{
+    hpix_free(catalogue->pixel_start);
+    hpix_free(catalogue->original_index);
+    hpix_free(catalogue->z);
+    hpix_free(catalogue->y);
+    hpix_free(catalogue->x);
+}
+
+/**********************************************************************/
+
+
+static void
+add_pair(pair_buffer_t * buffer, size_t index1, size_t index2)
+{
+    if(buffer->num_of_pairs == buffer->allocated)
+    {
+	if(buffer->allocated == 0)
+	{
+	    buffer->allocated = 256;
+	    buffer->pairs = hpix_malloc(sizeof(hpix_pair_t), buffer->allocated);
+	} else {
+	    buffer->allocated *= 2;
+	    buffer->pairs = hpix_realloc(buffer->pairs,
+					 sizeof(hpix_pair_t) * buffer->allocated);
+	}
+    }
+
+    buffer->pairs[buffer->num_of_pairs].index1 = index1;
+    buffer->pairs[buffer->num_of_pairs].index2 = index2;
+    buffer->num_of_pairs++;
+}
+
+/**********************************************************************/
+
+
+/* Compare the points of `catalogue1` in `pixel1` with all the points
+ * of `catalogue2` in the pixels which are closer than `search_radius` */
+static void
+match_pixel(const hpix_resolution_t * resolution,
+	    const bucketed_catalogue_t * catalogue1,
+	    const bucketed_catalogue_t * catalogue2,
+	    hpix_pixel_num_t pixel1,
+	    double search_radius,
+	    double cos_radius,
+	    pair_buffer_t * buffer,
+	    double * dot_products)
+{
+    hpix_pixel_num_t * pixels2;
+    size_t num_of_pixels2;
+    double theta, phi;
+
+    hpix_nest_pixel_to_angles(resolution, pixel1, &theta, &phi);
+    hpix_query_disc_inclusive(resolution, HPIX_ORDER_SCHEME_NEST,
+			      theta, phi, search_radius,
+			      &pixels2, &num_of_pixels2);
+
+    for(size_t point1 = catalogue1->pixel_start[pixel1];
+	point1 < catalogue1->pixel_start[pixel1 + 1];
+	++point1)
+    {
+	const double x1 = catalogue1->x[point1];
+	const double y1 = catalogue1->y[point1];
+	const double z1 = catalogue1->z[point1];
+
+	for(size_t pixel_idx = 0; pixel_idx < num_of_pixels2; ++pixel_idx)
+	{
+	    const size_t first = catalogue2->pixel_start[pixels2[pixel_idx]];
+	    const size_t last = catalogue2->pixel_start[pixels2[pixel_idx] + 1];
+	    const double * restrict x2 = catalogue2->x + first;
+	    const double * restrict y2 = catalogue2->y + first;
+	    const double * restrict z2 = catalogue2->z + first;
+
+	    /* First compute all the dot products in a vectorizable
+	     * loop, then pick the matches */
+	    for(size_t idx = 0; idx < last - first; ++idx)
+		dot_products[idx] = x1 * x2[idx] + y1 * y2[idx] + z1 * z2[idx];
+
+	    for(size_t idx = 0; idx < last - first; ++idx)
+	    {
+		if(dot_products[idx] >= cos_radius)
+		{
+		    add_pair(buffer,
+			     catalogue1->original_index[point1],
+			     catalogue2->original_index[first + idx]);
+		}
+	    }
+	}
+    }
+
+    hpix_free(pixels2);
+}
+
+/**********************************************************************/
+
+
+hpix_pair_t *
+hpix_find_pairs(const hpix_vector_batch_t * catalogue1,
+		const hpix_vector_batch_t * catalogue2,
+		double radius,
+		size_t * num_of_pairs)
+{
+    assert(catalogue1);
+    assert(catalogue2);
+    assert(num_of_pairs);
+    assert(radius >= 0.0);
+
+    *num_of_pairs = 0;
+    if(catalogue1->num_of_vectors == 0 || catalogue2->num_of_vectors == 0)
+	return NULL;
+
+    hpix_resolution_t * resolution =
+	hpix_create_resolution(choose_nside(radius, catalogue2->num_of_vectors));
+    const double cos_radius = (radius < M_PI) ? cos(radius) : -1.0;
+    /* A point of catalogue 1 can be anywhere within its pixel */
+    const double search_radius =
+	radius + hpix_max_pixel_radius(resolution->nside);
+    bucketed_catalogue_t bucketed1, bucketed2;
+    size_t max_points_per_pixel = 0;
+
+    bucket_catalogue(resolution, catalogue1, &bucketed1);
+    bucket_catalogue(resolution, catalogue2, &bucketed2);
+
+    /* List the pixels which contain points of catalogue 1 */
+    hpix_pixel_num_t * busy_pixels =
+	hpix_malloc(sizeof(hpix_pixel_num_t), resolution->num_of_pixels);
+    size_t num_of_busy_pixels = 0;
+    for(hpix_pixel_num_t pixel = 0; pixel < resolution->num_of_pixels; ++pixel)
+    {
+	const size_t count2 =
+	    bucketed2.pixel_start[pixel + 1] - bucketed2.pixel_start[pixel];
+
+	if(bucketed1.pixel_start[pixel + 1] > bucketed1.pixel_start[pixel])
+	    busy_pixels[num_of_busy_pixels++] = pixel;
+	if(count2 > max_points_per_pixel)
+	    max_points_per_pixel = count2;
+    }
+
+    const size_t num_of_tasks =
+	(num_of_busy_pixels + PIXELS_PER_TASK - 1) / PIXELS_PER_TASK;
+    pair_buffer_t * buffers = hpix_calloc(sizeof(pair_buffer_t), num_of_tasks);
+
+#pragma omp parallel default(shared)
+    {
+	double * dot_products = hpix_malloc(sizeof(double),
+					    max_points_per_pixel);
+
+#pragma omp for schedule(dynamic)
+	for(size_t task = 0; task < num_of_tasks; ++task)
+	{
+	    const size_t first = task * PIXELS_PER_TASK;
+	    const size_t last = (first + PIXELS_PER_TASK < num_of_busy_pixels)
+		? first + PIXELS_PER_TASK
+		: num_of_busy_pixels;
+
+	    for(size_t idx = first; idx < last; ++idx)
+	    {
+		match_pixel(resolution, &bucketed1, &bucketed2,
+			    busy_pixels[idx], search_radius, cos_radius,
+			    &buffers[task], dot_products);
+	    }
+	}
+
+	hpix_free(dot_products);
+    }
+
+    /* Concatenate the buffers */
+    for(size_t task = 0; task < num_of_tasks; ++task)
+	*num_of_pairs += buffers[task].num_of_pairs;
+
+    hpix_pair_t * result = (*num_of_pairs > 0)
+	? hpix_malloc(sizeof(hpix_pair_t), *num_of_pairs)
+	: NULL;
+    size_t offset = 0;
+    for(size_t task = 0; task < num_of_tasks; ++task)
+    {
+	if(buffers[task].num_of_pairs > 0)
+	{
+	    memcpy(result + offset, buffers[task].pairs,
+		   sizeof(hpix_pair_t) * buffers[task].num_of_pairs);
+	    offset += buffers[task].num_of_pairs;
+	}
+	hpix_free(buffers[task].pairs);
+    }
+
+    hpix_free(buffers);
+    hpix_free(busy_pixels);
+    free_bucketed_catalogue(&bucketed2);
+    free_bucketed_catalogue(&bucketed1);
+    hpix_free_resolution(resolution);
+
+    return result;
+}
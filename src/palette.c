@@ -20,6 +20,15 @@
 #include <hpixlib/hpix.h>
 #include <assert.h>
 #include <stdlib.h>
+#include <math.h>
+
+#ifdef HAVE_OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 /* The following code is used to define the color gradient used to
  * draw the Mollview projection and the color bar. The purpose is to
@@ -386,3 +395,183 @@ hpix_palette_color(const hpix_color_palette_t * palette,
 
 #undef INTERPOLATE_COMPONENT
 }
+
+/**********************************************************************/
+
+/* A palette LUT samples the palette at HPIX_PALETTE_LUT_SIZE evenly
+ * spaced levels, each already packed in the 32-bit ARGB format used
+ * by Cairo (0xAARRGGBB in the byte order of the machine). */
+
+struct hpix_palette_lut_t {
+    uint32_t colors[HPIX_PALETTE_LUT_SIZE];
+    uint32_t color_for_unseen_pixels;
+    uint32_t color_for_outside_pixels;
+};
+
+/**********************************************************************/
+
+static uint32_t
+pack_argb32_color(double opacity, const hpix_color_t * color)
+{
+    return ((uint32_t) (int) (255 * opacity) << 24)
+	| ((uint32_t) (int) (255 * color->red) << 16)
+	| ((uint32_t) (int) (255 * color->green) << 8)
+	| (uint32_t) (int) (255 * color->blue);
+}
+
+/**********************************************************************/
+
+hpix_palette_lut_t *
+hpix_create_palette_lut(const hpix_color_palette_t * palette)
+{
+    assert(palette != NULL);
+
+    hpix_palette_lut_t * lut = hpix_malloc(sizeof(hpix_palette_lut_t), 1);
+    const hpix_color_t white_color = hpix_create_color(1.0, 1.0, 1.0);
+
+    for(size_t idx = 0; idx < HPIX_PALETTE_LUT_SIZE; ++idx)
+    {
+	hpix_color_t color;
+	hpix_palette_color(palette, idx / (HPIX_PALETTE_LUT_SIZE - 1.0),
+			   &color);
+	lut->colors[idx] = pack_argb32_color(1.0, &color);
+    }
+
+    lut->color_for_unseen_pixels =
+	pack_argb32_color(1.0, &palette->color_for_unseen_pixels);
+    /* Transparent */
+    lut->color_for_outside_pixels = pack_argb32_color(0.0, &white_color);
+
+    return lut;
+}
+
+/**********************************************************************/
+
+void
+hpix_free_palette_lut(hpix_palette_lut_t * lut)
+{
+    if(lut)
+	hpix_free(lut);
+}
+
+/**********************************************************************/
+
+uint32_t
+hpix_palette_lut_color(const hpix_palette_lut_t * lut, double level)
+{
+    assert(lut != NULL);
+
+    /* This handles NaNs as well */
+    if(! (level > 0.0))
+	return lut->colors[0];
+    if(level >= 1.0)
+	return lut->colors[HPIX_PALETTE_LUT_SIZE - 1];
+
+    return lut->colors[(int) (level * (HPIX_PALETTE_LUT_SIZE - 1) + 0.5)];
+}
+
+/**********************************************************************/
+
+/* Pick the color of a bitmap element from the result of the tests
+ * on its value */
+static inline uint32_t
+select_argb32_color(const hpix_palette_lut_t * lut,
+		    int lut_index, _Bool is_unseen, _Bool is_outside)
+{
+    if(is_outside)
+	return lut->color_for_outside_pixels;
+    else if(is_unseen)
+	return lut->color_for_unseen_pixels;
+    else
+	return lut->colors[lut_index];
+}
+
+/**********************************************************************/
+
+void
+hpix_bitmap_to_argb32(const hpix_palette_lut_t * lut,
+		      const double * bitmap,
+		      unsigned int width,
+		      unsigned int height,
+		      double min_value,
+		      double max_value,
+		      unsigned char * image,
+		      size_t stride,
+		      int flip_rows)
+{
+    assert(lut != NULL);
+    assert(bitmap != NULL);
+    assert(image != NULL);
+    assert(stride >= width * sizeof(uint32_t));
+
+    /* A value is mapped into an index of the LUT by a multiplication
+     * and a rounding. Infinite values are outside the projection,
+     * NaNs and very negative values are unseen pixels. */
+    const double max_index = HPIX_PALETTE_LUT_SIZE - 1;
+    const double scale =
+	(max_value > min_value) ? max_index / (max_value - min_value) : 0.0;
+
+    /* The renderers call this function on one band of rows from each
+     * thread of their own parallel region: in that case the rows are
+     * converted serially, instead of opening a nested region */
+#pragma omp parallel for default(shared) if(! omp_in_parallel())
+    for(unsigned int y = 0; y < height; ++y)
+    {
+	const double *restrict row = bitmap + (size_t) y * width;
+	uint32_t *restrict pixels = (uint32_t *)
+	    (image + (flip_rows ? height - y - 1 : y) * stride);
+	unsigned int x = 0;
+
+#ifdef __SSE2__
+	const __m128d sse_min = _mm_set1_pd(min_value);
+	const __m128d sse_scale = _mm_set1_pd(scale);
+	const __m128d sse_zero = _mm_setzero_pd();
+	const __m128d sse_max_index = _mm_set1_pd(max_index);
+	const __m128d sse_half = _mm_set1_pd(0.5);
+	const __m128d sse_unseen_limit = _mm_set1_pd(-1.6e+30);
+	const __m128d sse_infinity = _mm_set1_pd(INFINITY);
+	const __m128d sse_abs_mask =
+	    _mm_castsi128_pd(_mm_set1_epi64x(0x7FFFFFFFFFFFFFFFLL));
+
+	for(; x + 2 <= width; x += 2)
+	{
+	    const __m128d value = _mm_loadu_pd(row + x);
+
+	    /* _mm_max_pd returns its second argument if the first one
+	     * is a NaN, so unseen pixels get a valid index */
+	    __m128d index = _mm_mul_pd(_mm_sub_pd(value, sse_min), sse_scale);
+	    index = _mm_min_pd(_mm_max_pd(index, sse_zero), sse_max_index);
+	    const __m128i int_index = _mm_cvttpd_epi32(_mm_add_pd(index, sse_half));
+
+	    const int unseen_mask =
+		_mm_movemask_pd(_mm_or_pd(_mm_cmpunord_pd(value, value),
+					  _mm_cmplt_pd(value, sse_unseen_limit)));
+	    const int outside_mask =
+		_mm_movemask_pd(_mm_cmpeq_pd(_mm_and_pd(value, sse_abs_mask),
+					     sse_infinity));
+
+	    pixels[x] = select_argb32_color(lut,
+					    _mm_cvtsi128_si32(int_index),
+					    unseen_mask & 1, outside_mask & 1);
+	    pixels[x + 1] =
+		select_argb32_color(lut,
+				    _mm_cvtsi128_si32(_mm_shuffle_epi32(int_index, 1)),
+				    unseen_mask & 2, outside_mask & 2);
+	}
+#endif
+
+	for(; x < width; ++x)
+	{
+	    const double value = row[x];
+	    double index = (value - min_value) * scale;
+
+	    if(! (index > 0.0))
+		index = 0.0;
+	    else if(index > max_index)
+		index = max_index;
+
+	    pixels[x] = select_argb32_color(lut, (int) (index + 0.5),
+					    HPIX_IS_MASKED(value), isinf(value));
+	}
+    }
+}
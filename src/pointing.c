@@ -0,0 +1,380 @@
+/* pointing.c -- Convert long timelines of pointings into pixel indexes
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <assert.h>
+#include <math.h>
+
+#include "constants.h"
+
+/* The samples are processed in blocks. For each block, a first loop
+ * computes the direction of the beam and of the polarization axis
+ * (this loop has no branches nor function calls, so that the compiler
+ * can vectorize it), and a second loop turns the directions into
+ * pixels. The blocks are distributed among the OpenMP threads, and
+ * the temporary arrays of each block fit in the L1 cache. */
+#define POINTING_BLOCK_SIZE 256
+
+/* Storage for the direction of the beam and of the polarimeter in a
+ * block of samples */
+typedef struct {
+    double beam_x[POINTING_BLOCK_SIZE];
+    double beam_y[POINTING_BLOCK_SIZE];
+    double beam_z[POINTING_BLOCK_SIZE];
+    double pol_x[POINTING_BLOCK_SIZE];
+    double pol_y[POINTING_BLOCK_SIZE];
+    double pol_z[POINTING_BLOCK_SIZE];
+} pointing_block_t;
+
+/**********************************************************************/
+
+
+void
+hpix_quaternion_to_matrix(const hpix_quaternion_t * quaternion,
+			  hpix_matrix_t * matrix)
+{
+    assert(quaternion);
+    assert(matrix);
+
+    const double w = quaternion->w;
+    const double x = quaternion->x;
+    const double y = quaternion->y;
+    const double z = quaternion->z;
+    const double scale = 2.0 / (w * w + x * x + y * y + z * z);
+
+    matrix->m[0][0] = 1.0 - scale * (y * y + z * z);
+    matrix->m[0][1] = scale * (x * y - w * z);
+    matrix->m[0][2] = scale * (x * z + w * y);
+
+    matrix->m[1][0] = scale * (x * y + w * z);
+    matrix->m[1][1] = 1.0 - scale * (x * x + z * z);
+    matrix->m[1][2] = scale * (y * z - w * x);
+
+    matrix->m[2][0] = scale * (x * z - w * y);
+    matrix->m[2][1] = scale * (y * z + w * x);
+    matrix->m[2][2] = 1.0 - scale * (x * x + y * y);
+}
+
+/**********************************************************************/
+
+
+/* Angle between the polarization direction and the meridian passing
+ * through the beam direction, measured from North towards East. Since
+ * the two directions are orthogonal, this reduces to a single call to
+ * atan2. */
+static inline double
+polarization_angle(double x, double y,
+		   double pol_x, double pol_y, double pol_z)
+{
+    return atan2(pol_y * x - pol_x * y, pol_z);
+}
+
+/**********************************************************************/
+
+
+/* These two functions are equivalent to hpix_vector_to_ring_pixel and
+ * hpix_vector_to_nest_pixel, but they take z = cos(theta) and
+ * tt = 2 phi / pi in [0, 4), which are cheaper to compute, and are
+ * inlined in the main loop. */
+static inline hpix_pixel_num_t
+ring_pixel(const hpix_resolution_t * resolution, double z, double tt)
+{
+    const long nside = resolution->nside;
+    const long nl4 = resolution->nside_times_four;
+    const double z_abs = fabs(z);
+
+    if(z_abs <= 2.0 / 3.0)
+    {
+	const double temp1 = nside * (0.5 + tt);
+	const double temp2 = nside * z * 0.75;
+	const long jp = (long) (temp1 - temp2);
+	const long jm = (long) (temp1 + temp2);
+	const long ir = nside + 1 + jp - jm; /* In the range 1...2 NSIDE + 1 */
+	const long kshift = 1 - (ir & 1);
+	const long ip = ((jp + jm - nside + kshift + 1 + 2 * nl4) / 2) % nl4;
+
+	return resolution->ncap + (hpix_pixel_num_t) (ir - 1) * nl4 + ip;
+    } else {
+	const double tp = tt - (long) tt;
+	const double tmp = nside * sqrt(3.0 * (1.0 - z_abs));
+	const long jp = (long) (tp * tmp);
+	const long jm = (long) ((1.0 - tp) * tmp);
+	const long ir = jp + jm + 1; /* In the range 1...NSIDE */
+	long ip = (long) (tt * ir);
+
+	if(ip >= 4 * ir)
+	    ip -= 4 * ir;
+
+	return (z > 0)
+	    ? (hpix_pixel_num_t) 2 * ir * (ir - 1) + ip
+	    : resolution->num_of_pixels - (hpix_pixel_num_t) 2 * ir * (ir + 1) + ip;
+    }
+}
+
+/**********************************************************************/
+
+
+static inline hpix_pixel_num_t
+nest_pixel(const hpix_resolution_t * resolution, double z, double tt)
+{
+    const long nside = resolution->nside;
+    const double z_abs = fabs(z);
+    long face, ix, iy;
+
+    if(z_abs <= 2.0 / 3.0)
+    {
+	const double temp1 = nside * (0.5 + tt);
+	const double temp2 = nside * z * 0.75;
+	const long jp = (long) (temp1 - temp2);
+	const long jm = (long) (temp1 + temp2);
+	const long ifp = jp / nside;
+	const long ifm = jm / nside;
+
+	if(ifp == ifm)
+	    face = ifp | 4;
+	else if(ifp < ifm)
+	    face = ifp;
+	else
+	    face = ifm + 8;
+
+	ix = jm & (nside - 1);
+	iy = nside - (jp & (nside - 1)) - 1;
+    } else {
+	const long ntt = (tt < 3.0) ? (long) tt : 3;
+	const double tp = tt - ntt;
+	const double tmp = nside * sqrt(3.0 * (1.0 - z_abs));
+	long jp = (long) (tp * tmp);
+	long jm = (long) ((1.0 - tp) * tmp);
+
+	if(jp >= nside)
+	    jp = nside - 1;
+	if(jm >= nside)
+	    jm = nside - 1;
+
+	if(z >= 0)
+	{
+	    face = ntt;
+	    ix = nside - jm - 1;
+	    iy = nside - jp - 1;
+	} else {
+	    face = ntt + 8;
+	    ix = jp;
+	    iy = jm;
+	}
+    }
+
+    return (hpix_pixel_num_t) face * resolution->pixels_per_face
+	+ hpix_xy_to_nest_subpixel(ix, iy);
+}
+
+/**********************************************************************/
+
+
+/* Compute the pixel index and the polarization angle for a block of
+ * samples. The beam directions must be normalized. */
+static void
+block_to_pixels(const hpix_resolution_t * resolution,
+		hpix_ordering_scheme_t scheme,
+		const hpix_vector_batch_t * beam,
+		const hpix_vector_batch_t * pol,
+		hpix_pixel_num_t * pixels,
+		double * pol_angles)
+{
+    const size_t num_of_samples = beam->num_of_vectors;
+
+    if(scheme == HPIX_ORDER_SCHEME_NEST)
+    {
+	for(size_t idx = 0; idx < num_of_samples; ++idx)
+	{
+	    double tt = atan2(beam->y[idx], beam->x[idx]) * (2.0 / M_PI);
+	    if(tt < 0.0)
+		tt += 4.0;
+	    pixels[idx] = nest_pixel(resolution, beam->z[idx], tt);
+	}
+    } else {
+	for(size_t idx = 0; idx < num_of_samples; ++idx)
+	{
+	    double tt = atan2(beam->y[idx], beam->x[idx]) * (2.0 / M_PI);
+	    if(tt < 0.0)
+		tt += 4.0;
+	    pixels[idx] = ring_pixel(resolution, beam->z[idx], tt);
+	}
+    }
+
+    if(pol_angles != NULL)
+    {
+	for(size_t idx = 0; idx < num_of_samples; ++idx)
+	{
+	    pol_angles[idx] = polarization_angle(beam->x[idx], beam->y[idx],
+						 pol->x[idx], pol->y[idx],
+						 pol->z[idx]);
+	}
+    }
+}
+
+/**********************************************************************/
+
+
+/* Wrap the arrays in `block` into two batches of `num_of_samples`
+ * vectors */
+static void
+init_block_batches(pointing_block_t * block, size_t num_of_samples,
+		   hpix_vector_batch_t * beam, hpix_vector_batch_t * pol)
+{
+    *beam = (hpix_vector_batch_t) {
+	.num_of_vectors = num_of_samples,
+	.x = block->beam_x, .y = block->beam_y, .z = block->beam_z,
+	.memory = NULL
+    };
+    *pol = (hpix_vector_batch_t) {
+	.num_of_vectors = num_of_samples,
+	.x = block->pol_x, .y = block->pol_y, .z = block->pol_z,
+	.memory = NULL
+    };
+}
+
+/**********************************************************************/
+
+
+void
+hpix_quaternions_to_pixels(const hpix_resolution_t * resolution,
+			   hpix_ordering_scheme_t scheme,
+			   const hpix_quaternion_arrays_t * pointings,
+			   size_t num_of_samples,
+			   const hpix_quaternion_t * detector_offset,
+			   hpix_pixel_num_t * pixels,
+			   double * pol_angles)
+{
+    assert(resolution);
+    assert(pointings);
+    assert(pixels);
+
+    const hpix_quaternion_t offset =
+	detector_offset
+	? *detector_offset
+	: (hpix_quaternion_t) { .w = 1.0, .x = 0.0, .y = 0.0, .z = 0.0 };
+    const double * restrict qw = pointings->w;
+    const double * restrict qx = pointings->x;
+    const double * restrict qy = pointings->y;
+    const double * restrict qz = pointings->z;
+
+#pragma omp parallel for default(shared) schedule(static)
+    for(size_t first = 0; first < num_of_samples; first += POINTING_BLOCK_SIZE)
+    {
+	const size_t block_size =
+	    (first + POINTING_BLOCK_SIZE < num_of_samples)
+	    ? POINTING_BLOCK_SIZE
+	    : num_of_samples - first;
+	pointing_block_t block;
+	hpix_vector_batch_t beam_batch, pol_batch;
+
+	init_block_batches(&block, block_size, &beam_batch, &pol_batch);
+	for(size_t idx = 0; idx < block_size; ++idx)
+	{
+	    const double aw = qw[first + idx];
+	    const double ax = qx[first + idx];
+	    const double ay = qy[first + idx];
+	    const double az = qz[first + idx];
+
+	    /* Hamilton product of the pointing and the offset */
+	    const double w = aw * offset.w - ax * offset.x
+		- ay * offset.y - az * offset.z;
+	    const double x = aw * offset.x + ax * offset.w
+		+ ay * offset.z - az * offset.y;
+	    const double y = aw * offset.y - ax * offset.z
+		+ ay * offset.w + az * offset.x;
+	    const double z = aw * offset.z + ax * offset.y
+		- ay * offset.x + az * offset.w;
+	    const double scale = 2.0 / (w * w + x * x + y * y + z * z);
+
+	    /* The beam is the z axis of the rotated frame, the
+	     * polarization direction is its x axis */
+	    block.beam_x[idx] = scale * (x * z + w * y);
+	    block.beam_y[idx] = scale * (y * z - w * x);
+	    block.beam_z[idx] = 1.0 - scale * (x * x + y * y);
+	    block.pol_x[idx] = 1.0 - scale * (y * y + z * z);
+	    block.pol_y[idx] = scale * (x * y + w * z);
+	    block.pol_z[idx] = scale * (x * z - w * y);
+	}
+
+	block_to_pixels(resolution, scheme, &beam_batch, &pol_batch,
+			pixels + first,
+			pol_angles ? pol_angles + first : NULL);
+    }
+}
+
+/**********************************************************************/
+
+
+void
+hpix_matrices_to_pixels(const hpix_resolution_t * resolution,
+			hpix_ordering_scheme_t scheme,
+			const hpix_matrix_t * pointings,
+			size_t num_of_samples,
+			const hpix_matrix_t * detector_offset,
+			hpix_pixel_num_t * pixels,
+			double * pol_angles)
+{
+    assert(resolution);
+    assert(pointings);
+    assert(pixels);
+
+    hpix_vector_t beam = { .x = 0.0, .y = 0.0, .z = 1.0 };
+    hpix_vector_t pol = { .x = 1.0, .y = 0.0, .z = 0.0 };
+
+    /* Only two columns of the product between each pointing and the
+     * offset are needed: compute them once */
+    if(detector_offset != NULL)
+    {
+	beam = (hpix_vector_t) { .x = detector_offset->m[0][2],
+				 .y = detector_offset->m[1][2],
+				 .z = detector_offset->m[2][2] };
+	pol = (hpix_vector_t) { .x = detector_offset->m[0][0],
+				.y = detector_offset->m[1][0],
+				.z = detector_offset->m[2][0] };
+    }
+
+#pragma omp parallel for default(shared) schedule(static)
+    for(size_t first = 0; first < num_of_samples; first += POINTING_BLOCK_SIZE)
+    {
+	const size_t block_size =
+	    (first + POINTING_BLOCK_SIZE < num_of_samples)
+	    ? POINTING_BLOCK_SIZE
+	    : num_of_samples - first;
+	pointing_block_t block;
+	hpix_vector_batch_t beam_batch, pol_batch;
+
+	init_block_batches(&block, block_size, &beam_batch, &pol_batch);
+	for(size_t idx = 0; idx < block_size; ++idx)
+	{
+	    const double (* m)[3] = pointings[first + idx].m;
+
+	    block.beam_x[idx] = m[0][0] * beam.x + m[0][1] * beam.y + m[0][2] * beam.z;
+	    block.beam_y[idx] = m[1][0] * beam.x + m[1][1] * beam.y + m[1][2] * beam.z;
+	    block.beam_z[idx] = m[2][0] * beam.x + m[2][1] * beam.y + m[2][2] * beam.z;
+	    block.pol_x[idx] = m[0][0] * pol.x + m[0][1] * pol.y + m[0][2] * pol.z;
+	    block.pol_y[idx] = m[1][0] * pol.x + m[1][1] * pol.y + m[1][2] * pol.z;
+	    block.pol_z[idx] = m[2][0] * pol.x + m[2][1] * pol.y + m[2][2] * pol.z;
+	}
+
+	block_to_pixels(resolution, scheme, &beam_batch, &pol_batch,
+			pixels + first,
+			pol_angles ? pol_angles + first : NULL);
+    }
+}
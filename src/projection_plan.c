@@ -0,0 +1,469 @@
+/* projection_plan.c -- Precomputed pixel lookup tables for projections
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+/* A projection plan stores, for each cell of the bitmap, the index of
+ * the map pixel that falls in it (or HPIX_PLAN_OUTSIDE). Tracing a
+ * map through a plan is therefore a gather, with no trigonometry.
+ *
+ * Supersampled plans split each cell into samples_per_side x
+ * samples_per_side subcells and keep one index for each of them:
+ * tracing averages the samples, so that a map with many more pixels
+ * than the bitmap does not produce aliasing. */
+
+struct ___hpix_projection_plan_t {
+    unsigned int           width;
+    unsigned int           height;
+    hpix_nside_t           nside;
+    hpix_ordering_scheme_t scheme;
+    hpix_projection_type_t type;
+    unsigned int           samples_per_side;
+
+    hpix_pixel_num_t     * pixels;
+};
+
+/* Layout of the files written by hpix_save_projection_plan: the magic
+ * string, then PLAN_FILE_VERSION, PLAN_BYTE_ORDER_MARK, width,
+ * height, nside, ordering scheme, projection type and number of
+ * samples per side (all 32-bit unsigned integers), then the 64-bit
+ * pixel indexes. All numbers use the byte order of the machine that
+ * wrote the file. Version 1 files lack the number of samples per side
+ * (which is 1). */
+
+static const char PLAN_FILE_MAGIC[8] = { 'H', 'P', 'I', 'X', 'P', 'L', 'A', 'N' };
+#define PLAN_FILE_VERSION    2
+#define PLAN_BYTE_ORDER_MARK 0x01020304
+
+/**********************************************************************/
+
+
+static hpix_projection_plan_t *
+alloc_projection_plan(unsigned int width,
+		      unsigned int height,
+		      hpix_nside_t nside,
+		      hpix_ordering_scheme_t scheme,
+		      hpix_projection_type_t type,
+		      unsigned int samples_per_side)
+{
+    hpix_projection_plan_t * plan = hpix_malloc(sizeof(*plan), 1);
+
+    plan->width = width;
+    plan->height = height;
+    plan->nside = nside;
+    plan->scheme = scheme;
+    plan->type = type;
+    plan->samples_per_side = samples_per_side;
+    plan->pixels = hpix_malloc(sizeof(plan->pixels[0]),
+			       (size_t) width * height
+			       * samples_per_side * samples_per_side);
+
+    return plan;
+}
+
+/**********************************************************************/
+
+
+/* Choose the number of samples per side so that the samples are
+ * roughly as many as the pixels in the map */
+static unsigned int
+default_samples_per_side(unsigned int width,
+			 unsigned int height,
+			 hpix_nside_t nside)
+{
+    const double pixels_per_cell =
+	hpix_nside_to_npixel(nside) / ((double) width * height);
+    const double samples = ceil(sqrt(pixels_per_cell));
+
+    if(samples <= 1.0)
+	return 1;
+    else if(samples >= HPIX_PLAN_MAX_SAMPLES_PER_SIDE)
+	return HPIX_PLAN_MAX_SAMPLES_PER_SIDE;
+    else
+	return (unsigned int) samples;
+}
+
+/**********************************************************************/
+
+
+hpix_projection_plan_t *
+hpix_create_projection_plan(const hpix_bmp_projection_t * proj,
+			    hpix_nside_t nside,
+			    hpix_ordering_scheme_t scheme)
+{
+    return hpix_create_supersampled_projection_plan(proj, nside, scheme, 1);
+}
+
+/**********************************************************************/
+
+
+hpix_projection_plan_t *
+hpix_create_supersampled_projection_plan(const hpix_bmp_projection_t * proj,
+					 hpix_nside_t nside,
+					 hpix_ordering_scheme_t scheme,
+					 unsigned int samples_per_side)
+{
+    assert(proj);
+    assert(hpix_valid_nside(nside));
+    assert(samples_per_side <= HPIX_PLAN_MAX_SAMPLES_PER_SIDE);
+
+    const unsigned int width = hpix_bmp_projection_width(proj);
+    const unsigned int height = hpix_bmp_projection_height(proj);
+
+    if(samples_per_side == 0)
+	samples_per_side = default_samples_per_side(width, height, nside);
+
+    const unsigned int k = samples_per_side;
+    const size_t samples_per_cell = (size_t) k * k;
+    hpix_projection_plan_t * plan =
+	alloc_projection_plan(width, height, nside, scheme,
+			      hpix_bmp_projection_type(proj), k);
+    hpix_resolution_t * resolution = hpix_create_resolution(nside);
+    hpix_angles_to_pixel_fn_t * angles_to_pixel_fn =
+	(scheme == HPIX_ORDER_SCHEME_NEST)
+	? hpix_angles_to_nest_pixel
+	: hpix_angles_to_ring_pixel;
+
+    /* Each cell covers [x - 1/2, x + 1/2[ x [y - 1/2, y + 1/2[ and is
+     * sampled at the centers of its subcells: with one sample per
+     * cell, this is the point (x, y) used by hpix_bmp_projection_trace */
+#pragma omp parallel for default(shared)
+    for (unsigned int y = 0; y < height; ++y)
+    {
+	hpix_pixel_num_t * cell_ptr =
+	    plan->pixels + (size_t) y * width * samples_per_cell;
+
+	for (unsigned int x = 0; x < width; ++x)
+	{
+	    for (unsigned int j = 0; j < k; ++j)
+	    {
+		const double sample_y = y + (j + 0.5) / k - 0.5;
+
+		for (unsigned int i = 0; i < k; ++i, ++cell_ptr)
+		{
+		    const double sample_x = x + (i + 0.5) / k - 0.5;
+		    double theta, phi;
+
+		    if(! hpix_bmp_projection_fxy_to_angles(proj,
+							   sample_x, sample_y,
+							   &theta, &phi))
+			*cell_ptr = HPIX_PLAN_OUTSIDE;
+		    else
+			*cell_ptr = angles_to_pixel_fn(resolution,
+						       theta, phi);
+		}
+	    }
+	}
+    }
+
+    hpix_free_resolution(resolution);
+    return plan;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_free_projection_plan(hpix_projection_plan_t * plan)
+{
+    if(plan)
+    {
+	hpix_free(plan->pixels);
+	hpix_free(plan);
+    }
+}
+
+/**********************************************************************/
+
+
+unsigned int
+hpix_projection_plan_width(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->width;
+}
+
+/**********************************************************************/
+
+
+unsigned int
+hpix_projection_plan_height(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->height;
+}
+
+/**********************************************************************/
+
+
+hpix_nside_t
+hpix_projection_plan_nside(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->nside;
+}
+
+/**********************************************************************/
+
+
+hpix_ordering_scheme_t
+hpix_projection_plan_ordering_scheme(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->scheme;
+}
+
+/**********************************************************************/
+
+
+hpix_projection_type_t
+hpix_projection_plan_type(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->type;
+}
+
+/**********************************************************************/
+
+
+unsigned int
+hpix_projection_plan_samples_per_side(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->samples_per_side;
+}
+
+/**********************************************************************/
+
+
+const hpix_pixel_num_t *
+hpix_projection_plan_pixels(const hpix_projection_plan_t * plan)
+{
+    assert(plan);
+    return plan->pixels;
+}
+
+/**********************************************************************/
+
+
+double *
+hpix_projection_plan_trace(const hpix_projection_plan_t * plan,
+			   const hpix_map_t * map,
+			   double * min_value,
+			   double * max_value)
+{
+    assert(plan);
+    assert(map);
+    assert(hpix_map_nside(map) == plan->nside);
+    assert(hpix_map_ordering_scheme(map) == plan->scheme);
+
+    const size_t samples_per_cell =
+	(size_t) plan->samples_per_side * plan->samples_per_side;
+    const hpix_pixel_num_t *restrict plan_pixels = plan->pixels;
+    const double *restrict pixels = hpix_map_pixels(map);
+    double *restrict bitmap =
+	hpix_malloc(sizeof(bitmap[0]), (size_t) plan->width * plan->height);
+    double min = DBL_MAX;
+    double max = -DBL_MAX;
+
+    /* A cell is outside the projection if all its samples are, and
+     * masked if all the samples inside the projection are masked.
+     * Otherwise, it is the average of the unmasked samples. */
+#pragma omp parallel for default(shared) reduction(min:min) reduction(max:max)
+    for(unsigned int y = 0; y < plan->height; ++y)
+    {
+	const hpix_pixel_num_t * cell_ptr =
+	    plan_pixels + (size_t) y * plan->width * samples_per_cell;
+	double * line_ptr = bitmap + (size_t) y * plan->width;
+
+	for(unsigned int x = 0; x < plan->width; ++x, ++line_ptr)
+	{
+	    size_t num_inside = 0;
+	    size_t num_good = 0;
+	    double sum = 0.0;
+
+	    for(size_t sample = 0; sample < samples_per_cell;
+		++sample, ++cell_ptr)
+	    {
+		if(*cell_ptr == HPIX_PLAN_OUTSIDE)
+		    continue;
+
+		++num_inside;
+		const double value = pixels[*cell_ptr];
+		if(! HPIX_IS_MASKED(value))
+		{
+		    sum += value;
+		    ++num_good;
+		}
+	    }
+
+	    if(num_inside == 0)
+	    {
+		*line_ptr = INFINITY; /* Skip the pixel */
+		continue;
+	    }
+
+	    if(num_good == 0)
+	    {
+		*line_ptr = NAN;
+		continue;
+	    }
+
+	    const double value = sum / num_good;
+	    *line_ptr = value;
+	    if(value < min)
+		min = value;
+	    if(value > max)
+		max = value;
+	}
+    }
+
+    if(min_value)
+	*min_value = min;
+    if(max_value)
+	*max_value = max;
+
+    return bitmap;
+}
+
+/**********************************************************************/
+
+
+static int
+write_uint32(FILE * file, uint32_t value)
+{
+    return fwrite(&value, sizeof(value), 1, file) == 1;
+}
+
+/**********************************************************************/
+
+
+static int
+read_uint32(FILE * file, uint32_t * value)
+{
+    return fread(value, sizeof(*value), 1, file) == 1;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_save_projection_plan(FILE * file,
+			  const hpix_projection_plan_t * plan)
+{
+    assert(file);
+    assert(plan);
+
+    const size_t num_of_pixels = (size_t) plan->width * plan->height
+	* plan->samples_per_side * plan->samples_per_side;
+
+    if(fwrite(PLAN_FILE_MAGIC, sizeof(PLAN_FILE_MAGIC), 1, file) != 1
+       || ! write_uint32(file, PLAN_FILE_VERSION)
+       || ! write_uint32(file, PLAN_BYTE_ORDER_MARK)
+       || ! write_uint32(file, plan->width)
+       || ! write_uint32(file, plan->height)
+       || ! write_uint32(file, plan->nside)
+       || ! write_uint32(file, plan->scheme)
+       || ! write_uint32(file, plan->type)
+       || ! write_uint32(file, plan->samples_per_side))
+	return 0;
+
+    if(fwrite(plan->pixels, sizeof(plan->pixels[0]),
+	      num_of_pixels, file) != num_of_pixels)
+	return 0;
+
+    return 1;
+}
+
+/**********************************************************************/
+
+
+hpix_projection_plan_t *
+hpix_load_projection_plan(FILE * file)
+{
+    char magic[sizeof(PLAN_FILE_MAGIC)];
+    uint32_t version, byte_order, width, height, nside, scheme, type;
+    uint32_t samples_per_side = 1;
+    hpix_projection_plan_t * plan;
+    size_t samples_per_cell;
+    size_t num_of_pixels;
+    hpix_pixel_num_t num_of_map_pixels;
+
+    assert(file);
+
+    if(fread(magic, sizeof(magic), 1, file) != 1
+       || memcmp(magic, PLAN_FILE_MAGIC, sizeof(magic)) != 0
+       || ! read_uint32(file, &version)
+       || version < 1 || version > PLAN_FILE_VERSION
+       || ! read_uint32(file, &byte_order)
+       || byte_order != PLAN_BYTE_ORDER_MARK
+       || ! read_uint32(file, &width)
+       || ! read_uint32(file, &height)
+       || ! read_uint32(file, &nside)
+       || ! read_uint32(file, &scheme)
+       || ! read_uint32(file, &type)
+       || (version >= 2 && ! read_uint32(file, &samples_per_side)))
+	return NULL;
+
+    if(nside > 0xFFFF || ! hpix_valid_nside(nside)
+       || samples_per_side == 0
+       || samples_per_side > HPIX_PLAN_MAX_SAMPLES_PER_SIDE
+       || (scheme != HPIX_ORDER_SCHEME_RING
+	   && scheme != HPIX_ORDER_SCHEME_NEST)
+       || type > HPIX_PROJ_ORTHOGRAPHIC)
+	return NULL;
+
+    /* A corrupted header must not make us allocate a wrapped-around
+     * (and therefore too small) array */
+    samples_per_cell = (size_t) samples_per_side * samples_per_side;
+    if(width != 0
+       && height > SIZE_MAX / sizeof(plan->pixels[0])
+		   / samples_per_cell / width)
+	return NULL;
+
+    plan = alloc_projection_plan(width, height, nside, scheme, type,
+				 samples_per_side);
+    num_of_pixels = (size_t) width * height * samples_per_cell;
+    if(fread(plan->pixels, sizeof(plan->pixels[0]),
+	     num_of_pixels, file) != num_of_pixels)
+    {
+	hpix_free_projection_plan(plan);
+	return NULL;
+    }
+
+    /* Do not trust the indexes blindly, as they will be used to
+     * address the pixels of a map */
+    num_of_map_pixels = hpix_nside_to_npixel(nside);
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+    {
+	if(plan->pixels[idx] != HPIX_PLAN_OUTSIDE
+	   && plan->pixels[idx] >= num_of_map_pixels)
+	{
+	    hpix_free_projection_plan(plan);
+	    return NULL;
+	}
+    }
+
+    return plan;
+}
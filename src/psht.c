@@ -32,6 +32,10 @@
 #include "config.h"
 
 #include <math.h>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "ls_fft.h"
 #include "sse_utils.h"
 #include "ylmgen_c.h"
@@ -50,6 +54,96 @@ static void get_chunk_info (int ndata, int *nchunks, int *chunksize)
   *nchunks = (ndata+*chunksize-1) / *chunksize;
   }
 
+/* Returns the elapsed wall clock time in seconds since some fixed point. */
+static double psht_wallclock (void)
+  {
+#ifdef _OPENMP
+  return omp_get_wtime();
+#else
+  return clock()/(double)CLOCKS_PER_SEC;
+#endif
+  }
+
+/* Returns the minimum length of an array which holds a map with the
+   geometry \a ginfo. */
+static ptrdiff_t geom_npix (const psht_geom_info *ginfo)
+  {
+  ptrdiff_t npix=0;
+  int i;
+  for (i=0; i<ginfo->npairs; ++i)
+    {
+    const psht_ringinfo *ri[2] = { &ginfo->pair[i].r1, &ginfo->pair[i].r2 };
+    int r;
+    for (r=0; r<2; ++r)
+      if (ri[r]->nph>0)
+        {
+        ptrdiff_t first=ri[r]->ofs,
+                  last=ri[r]->ofs+(ptrdiff_t)(ri[r]->nph-1)*ri[r]->stride;
+        npix = IMAX(npix,IMAX(first,last)+1);
+        }
+    }
+  return npix;
+  }
+
+/* A set of Ylm generators (one for every chunk of rings and every thread)
+   which survive across several passes over the same geometry, so that
+   the theta-dependent setup is done only once. */
+typedef struct
+  {
+  int nchunks, nthreads;
+  Ylmgen_C *gen;
+  int *ready;
+  } genpool;
+
+static void genpool_init (genpool *pool, int nchunks)
+  {
+  int i;
+#ifdef _OPENMP
+  pool->nthreads = omp_get_max_threads();
+#else
+  pool->nthreads = 1;
+#endif
+  pool->nchunks = nchunks;
+  pool->gen = RALLOC(Ylmgen_C,nchunks*pool->nthreads);
+  pool->ready = RALLOC(int,nchunks*pool->nthreads);
+  for (i=0; i<nchunks*pool->nthreads; ++i)
+    pool->ready[i]=0;
+  }
+
+static void genpool_destroy (genpool *pool)
+  {
+  int i;
+  for (i=0; i<pool->nchunks*pool->nthreads; ++i)
+    if (pool->ready[i]) Ylmgen_destroy(&pool->gen[i]);
+  DEALLOC(pool->gen);
+  DEALLOC(pool->ready);
+  }
+
+/* Returns the generator of the calling thread for the rings llim..ulim-1
+   of chunk number \a chunk, initialising it on first use. */
+static Ylmgen_C *genpool_get (genpool *pool, int chunk,
+  const psht_geom_info *ginfo, int llim, int ulim, int lmax, int mmax,
+  int spinrec)
+  {
+#ifdef _OPENMP
+  int idx = chunk*pool->nthreads + omp_get_thread_num();
+#else
+  int idx = chunk;
+#endif
+  if (!pool->ready[idx])
+    {
+    int i;
+    double *theta = RALLOC(double,ulim-llim);
+    for (i=0; i<ulim-llim; ++i)
+      theta[i] = ginfo->pair[i+llim].r1.theta;
+    Ylmgen_init (&pool->gen[idx],lmax,mmax,spinrec,1e-30);
+    Ylmgen_set_theta (&pool->gen[idx],theta,ulim-llim);
+    DEALLOC(theta);
+    pool->ready[idx]=1;
+    }
+  return &pool->gen[idx];
+  }
+
 typedef struct
   {
   double phi0_;
@@ -119,11 +213,8 @@ static int ringpair_compare (const void *xa, const void *xb)
   return 0;
   }
 
-static void assert_jobspace (int njobs_now)
-  {
-  UTIL_ASSERT (njobs_now<psht_maxjobs,
-    "Too many jobs added to a libpsht joblist. Exiting ...");
-  }
+static int joblist_newsize (int njobs_now)
+  { return IMAX(8,2*njobs_now); }
 
 void psht_make_alm_info (int lmax, int mmax, int stride,
   const ptrdiff_t *mstart, psht_alm_info **alm_info)
@@ -201,6 +292,129 @@ void psht_destroy_geom_info (psht_geom_info *geom_info)
   DEALLOC (geom_info);
   }
 
+void psht_make_ylm_table (const psht_geom_info *geom_info, int lmax, int mmax,
+  int single_precision, psht_ylm_table **table)
+  {
+  psht_ylm_table *tab = RALLOC(psht_ylm_table,1);
+  int npairs = geom_info->npairs;
+  size_t bytes=0;
+
+  UTIL_ASSERT((mmax>=0)&&(mmax<=lmax),"bad mmax in psht_make_ylm_table()");
+  tab->lmax = lmax;
+  tab->mmax = mmax;
+  tab->npairs = npairs;
+  tab->single = single_precision!=0;
+  tab->firstl = RALLOC(int,(mmax+1)*npairs);
+  tab->ofs = RALLOC(ptrdiff_t,(mmax+1)*npairs);
+  tab->data = RALLOC(void *,mmax+1);
+
+#pragma omp parallel reduction(+:bytes)
+{
+  Ylmgen_C generator;
+  double *theta = RALLOC(double,npairs),
+         *buf = RALLOC(double,(size_t)npairs*(lmax+1));
+  int m, ith;
+  for (ith=0; ith<npairs; ++ith)
+    theta[ith] = geom_info->pair[ith].r1.theta;
+  Ylmgen_init (&generator,lmax,mmax,0,1e-30);
+  Ylmgen_set_theta (&generator,theta,npairs);
+  DEALLOC(theta);
+
+/* every m block is allocated (and first touched) by the thread that
+   computes it */
+#pragma omp for schedule(dynamic,1)
+  for (m=0; m<=mmax; ++m)
+    {
+    ptrdiff_t cnt=0, i;
+    for (ith=0; ith<npairs; ++ith)
+      {
+      ptrdiff_t idx = (ptrdiff_t)m*npairs+ith;
+      int l;
+      Ylmgen_prepare(&generator,ith,m);
+      Ylmgen_recalc_Ylm(&generator);
+      tab->firstl[idx] = generator.firstl[0];
+      tab->ofs[idx] = cnt;
+      for (l=generator.firstl[0]; l<=lmax; ++l)
+        buf[cnt++] = generator.ylm[l];
+      }
+    if (tab->single)
+      {
+      float *dst = RALLOC(float,cnt);
+      for (i=0; i<cnt; ++i) dst[i] = (float)buf[i];
+      tab->data[m] = dst;
+      bytes += cnt*sizeof(float);
+      }
+    else
+      {
+      double *dst = RALLOC(double,cnt);
+      for (i=0; i<cnt; ++i) dst[i] = buf[i];
+      tab->data[m] = dst;
+      bytes += cnt*sizeof(double);
+      }
+    }
+
+  Ylmgen_destroy(&generator);
+  DEALLOC(buf);
+} /* end of parallel region */
+
+  tab->bytes = bytes + (mmax+1)*(size_t)npairs*(sizeof(int)+sizeof(ptrdiff_t));
+  *table = tab;
+  }
+
+size_t psht_ylm_table_size (const psht_ylm_table *table)
+  { return table->bytes; }
+
+void psht_destroy_ylm_table (psht_ylm_table *table)
+  {
+  int m;
+  for (m=0; m<=table->mmax; ++m)
+    DEALLOC(table->data[m]);
+  DEALLOC(table->data);
+  DEALLOC(table->firstl);
+  DEALLOC(table->ofs);
+  DEALLOC(table);
+  }
+
+/* Aborts if \a tab (if not NULL) was not computed for the given geometry
+   and a_lm structure. */
+static void check_ylm_table (const psht_ylm_table *tab,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info)
+  {
+  if (!tab) return;
+  UTIL_ASSERT((tab->lmax==alm_info->lmax)&&(tab->mmax==alm_info->mmax)
+    &&(tab->npairs==geom_info->npairs),
+    "Y_lm table does not match the transform");
+  }
+
+/* Number of rings whose table rows are combined in one pass over the
+   a_lm of a given m. */
+#define YLMTAB_BLOCK 4
+
+/* Stores the Y_lm of ring pair \a ith and \a m in row[l*stride] for
+   l=m..lmax (zero below the first non-negligible value, which is
+   returned). */
+static int ylm_table_row (const psht_ylm_table *tab, int ith, int m,
+  double *row, int stride)
+  {
+  ptrdiff_t idx = (ptrdiff_t)m*tab->npairs+ith;
+  int l, fl = tab->firstl[idx];
+  for (l=m; l<IMIN(fl,tab->lmax+1); ++l)
+    row[l*stride] = 0.;
+  if (tab->single)
+    {
+    const float *src = (const float *)tab->data[m] + tab->ofs[idx];
+    for (l=fl; l<=tab->lmax; ++l)
+      row[l*stride] = src[l-fl];
+    }
+  else
+    {
+    const double *src = (const double *)tab->data[m] + tab->ofs[idx];
+    for (l=fl; l<=tab->lmax; ++l)
+      row[l*stride] = src[l-fl];
+    }
+  return fl;
+  }
+
 #define CONCAT(a,b) a ## b
 
 #define FLT double
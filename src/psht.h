@@ -83,6 +83,21 @@ typedef struct
   int npairs;
   } psht_geom_info;
 
+/*! Type holding precomputed spin-0 Y_lm(theta) values for all rings of a
+    geometry, see psht_make_ylm_table().
+    \note No user serviceable parts inside! */
+typedef struct
+  {
+  int lmax, mmax, npairs, single;
+  /*! first non-negligible \a l and offset of the stored values, indexed by
+      \a m*npairs+ith */
+  int *firstl;
+  ptrdiff_t *ofs;
+  /*! one block of float or double values per \a m */
+  void **data;
+  size_t bytes;
+  } psht_ylm_table;
+
 /*! Type holding all required information about a double precision SHT.
     \note No user serviceable parts inside! */
 typedef struct
@@ -105,14 +120,20 @@ typedef struct
     } alm_tmp;
   } pshtd_job;
 
-enum { psht_maxjobs=10 };
+/*! Upper limit (in bytes) for the temporary a_lm storage of all jobs which
+    are processed together in a single pass over the map. Job lists that
+    exceed it are split into batches by execute_jobs() and
+    execute_map2alm_iter(), so that the working set of the innermost loop
+    stays in the cache. */
+enum { psht_batch_cache_bytes=256*1024 };
 
 /*! Type holding a list of simultaneous double precision SHT jobs.
     \note No user serviceable parts inside! */
 typedef struct
   {
-  pshtd_job job[psht_maxjobs];
-  int njobs;
+  pshtd_job *job;
+  int njobs, maxjobs;
+  const psht_ylm_table *ylm_table;
   } pshtd_joblist;
 
 /*! Type holding all required information about a single precision SHT.
@@ -141,8 +162,9 @@ typedef struct
     \note No user serviceable parts inside! */
 typedef struct
   {
-  pshts_job job[psht_maxjobs];
-  int njobs;
+  pshts_job *job;
+  int njobs, maxjobs;
+  const psht_ylm_table *ylm_table;
   } pshts_joblist;
 
 /*! \defgroup almgroup Helpers for calculation of a_lm indices */
@@ -202,6 +224,29 @@ void psht_destroy_geom_info (psht_geom_info *info);
 
 /* \} */
 
+/*! \defgroup ylmtablegroup Precomputed Y_lm tables
+    When the same geometry is transformed many times, the recursion for the
+    spin-0 Y_lm can be replaced by a table lookup. The table holds one value
+    for every ring pair, \a m and \a l (apart from the negligible ones
+    near the poles), i.e. roughly npairs*(lmax+1)*(mmax+1)/2 numbers, so this
+    is only sensible for moderate \a lmax. */
+/*! \{ */
+
+/*! Computes the spin-0 Y_lm of all rings in \a geom_info up to \a lmax and
+    \a mmax, which must match the a_lm structure of the transforms that will
+    use the table. If \a single_precision is nonzero, the values are stored
+    as float, halving the memory (and bandwidth) at the cost of about
+    1e-7 relative accuracy.
+    \param table will hold a pointer to the newly created data structure */
+void psht_make_ylm_table (const psht_geom_info *geom_info, int lmax, int mmax,
+  int single_precision, psht_ylm_table **table);
+/*! Returns the number of bytes used by \a table. */
+size_t psht_ylm_table_size (const psht_ylm_table *table);
+/*! Deallocates the table. */
+void psht_destroy_ylm_table (psht_ylm_table *table);
+
+/* \} */
+
 /*! \defgroup sjoblistgroup Functions for dealing with single precision job lists
 \note All pointers to maps or a_lm that are passed to the job-adding functions
 must not be de-allocated until after the last call of execute_jobs() for
@@ -216,6 +261,12 @@ void pshts_make_joblist (pshts_joblist **joblist);
 void pshts_clear_joblist (pshts_joblist *joblist);
 /*! Deallocates the given joblist object. */
 void pshts_destroy_joblist (pshts_joblist *joblist);
+/*! Makes all spin-0 jobs in \a joblist take their Y_lm from \a table
+    instead of computing them by recursion; passing NULL switches back to
+    the recursion. \a table must have been computed for the geometry and
+    a_lm structure passed to the execute functions, and must not be
+    deallocated while it is attached to \a joblist. */
+void pshts_set_ylm_table (pshts_joblist *joblist, const psht_ylm_table *table);
 
 /*! Adds a new scalar alm2map job to \a joblist, which reads data from \a alm
     and writes data to \a map. If \a add_output is 0, \a map will be
@@ -273,10 +324,31 @@ void pshts_add_job_alm2map_deriv1 (pshts_joblist *joblist,
     (specified by calls to the job-adding functions) are consistent with the
     specified geometry and a_lm structure, and that the output arrays are
     large enough to hold the produced results.
+    \note There is no limit on the number of jobs in \a joblist. Jobs are
+    executed in batches whose temporary a_lm storage fits into
+    \a psht_batch_cache_bytes; all jobs of a batch share the same evaluation
+    of the spherical harmonics.
  */
 void pshts_execute_jobs (pshts_joblist *joblist,
   const psht_geom_info *geom_info, const psht_alm_info *alm_info);
 
+/*! Executes the map2alm jobs in \a joblist iteratively: after a first
+    analysis, the a_lm are synthesised back into a map, and the difference
+    to the input map is analysed and added to the a_lm (Jacobi iteration).
+    This is repeated at most \a maxiter times, or until the rms of the
+    residual map divided by the rms of the input map drops below
+    \a epsilon. The Ylm generators, phase arrays and scratch maps are
+    set up only once for all iterations.
+    \a joblist must only contain map2alm jobs with \a add_output equal to 0.
+    If \a walltime is not NULL, it must hold \a maxiter+1 entries; entry 0
+    receives the wall clock time of the first analysis and entry i that of
+    iteration i. If \a residual is not NULL, it must hold \a maxiter entries
+    and receives the relative residual measured in each iteration.
+    \return the number of iterations which corrected the a_lm. */
+int pshts_execute_map2alm_iter (pshts_joblist *joblist,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info,
+  int maxiter, double epsilon, double *walltime, double *residual);
+
 /* \} */
 
 /*! \defgroup djoblistgroup Functions for dealing with double precision job lists
@@ -293,6 +365,12 @@ void pshtd_make_joblist (pshtd_joblist **joblist);
 void pshtd_clear_joblist (pshtd_joblist *joblist);
 /*! Deallocates the given joblist object. */
 void pshtd_destroy_joblist (pshtd_joblist *joblist);
+/*! Makes all spin-0 jobs in \a joblist take their Y_lm from \a table
+    instead of computing them by recursion; passing NULL switches back to
+    the recursion. \a table must have been computed for the geometry and
+    a_lm structure passed to the execute functions, and must not be
+    deallocated while it is attached to \a joblist. */
+void pshtd_set_ylm_table (pshtd_joblist *joblist, const psht_ylm_table *table);
 
 /*! Adds a new scalar alm2map job to \a joblist, which reads data from \a alm
     and writes data to \a map. If \a add_output is 0, \a map will be
@@ -350,10 +428,31 @@ void pshtd_add_job_alm2map_deriv1 (pshtd_joblist *joblist,
     (specified by calls to the job-adding functions) are consistent with the
     specified geometry and a_lm structure, and that the output arrays are
     large enough to hold the produced results.
+    \note There is no limit on the number of jobs in \a joblist. Jobs are
+    executed in batches whose temporary a_lm storage fits into
+    \a psht_batch_cache_bytes; all jobs of a batch share the same evaluation
+    of the spherical harmonics.
  */
 void pshtd_execute_jobs (pshtd_joblist *joblist,
   const psht_geom_info *geom_info, const psht_alm_info *alm_info);
 
+/*! Executes the map2alm jobs in \a joblist iteratively: after a first
+    analysis, the a_lm are synthesised back into a map, and the difference
+    to the input map is analysed and added to the a_lm (Jacobi iteration).
+    This is repeated at most \a maxiter times, or until the rms of the
+    residual map divided by the rms of the input map drops below
+    \a epsilon. The Ylm generators, phase arrays and scratch maps are
+    set up only once for all iterations.
+    \a joblist must only contain map2alm jobs with \a add_output equal to 0.
+    If \a walltime is not NULL, it must hold \a maxiter+1 entries; entry 0
+    receives the wall clock time of the first analysis and entry i that of
+    iteration i. If \a residual is not NULL, it must hold \a maxiter entries
+    and receives the relative residual measured in each iteration.
+    \return the number of iterations which corrected the a_lm. */
+int pshtd_execute_map2alm_iter (pshtd_joblist *joblist,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info,
+  int maxiter, double epsilon, double *walltime, double *residual);
+
 /* \} */
 
 #ifdef __cplusplus
@@ -256,6 +256,21 @@ static void X(dealloc_almtmp) (X(joblist) *jobs)
     }
   }
 
+/* Returns nonzero if the Y_lm needed by \a job can be taken from a
+   psht_ylm_table. */
+static int X(table_job) (const X(job) *job)
+  { return (job->spin==0) && (job->type!=ALM2MAP_DERIV1); }
+
+/* Returns the number of jobs in \a jobs which need the Ylm generator. */
+static int X(generator_jobs) (const X(joblist) *jobs)
+  {
+  int ijob, res=0;
+  for (ijob=0; ijob<jobs->njobs; ++ijob)
+    if ((!jobs->ylm_table) || (!X(table_job)(&jobs->job[ijob])))
+      ++res;
+  return res;
+  }
+
 static void X(alm2almtmp) (X(joblist) *jobs, int lmax, int m,
   const psht_alm_info *alm)
   {
@@ -422,6 +437,7 @@ static void X(inner_loop) (X(joblist) *jobs, const psht_geom_info *ginfo,
   {
   const v2df2 v2df2_zero = zero_v2df2();
   int ith,ijob;
+  if (X(generator_jobs)(jobs)==0) return;
   for (ith=0; ith<ulim-llim; ith+=2)
     {
     pshtd_cmplx dum;
@@ -435,6 +451,7 @@ static void X(inner_loop) (X(joblist) *jobs, const psht_geom_info *ginfo,
     for (ijob=0; ijob<jobs->njobs; ++ijob)
       {
       X(job) *curjob = &jobs->job[ijob];
+      if (jobs->ylm_table && X(table_job)(curjob)) continue;
       switch (curjob->type)
         {
         case ALM2MAP:
@@ -666,6 +683,7 @@ static void X(inner_loop) (X(joblist) *jobs, const psht_geom_info *ginfo,
   int lmax, int mmax, int llim, int ulim, Ylmgen_C *generator, int m)
   {
   int ith,ijob;
+  if (X(generator_jobs)(jobs)==0) return;
   for (ith=0; ith<ulim-llim; ++ith)
     {
     pshtd_cmplx dum;
@@ -676,6 +694,7 @@ static void X(inner_loop) (X(joblist) *jobs, const psht_geom_info *ginfo,
     for (ijob=0; ijob<jobs->njobs; ++ijob)
       {
       X(job) *curjob = &jobs->job[ijob];
+      if (jobs->ylm_table && X(table_job)(curjob)) continue;
       switch (curjob->type)
         {
         case ALM2MAP:
@@ -855,6 +874,187 @@ static void X(inner_loop) (X(joblist) *jobs, const psht_geom_info *ginfo,
 
 #endif
 
+#ifdef PLANCK_HAVE_SSE2
+
+/* The accumulators hold the values of YLMTAB_BLOCK rings in
+   YLMTAB_BLOCK/2 vectors. */
+#define TABLE_NACC (YLMTAB_BLOCK/2)
+#define TABLE_VAL(acc,b) ((acc)[(b)>>1].d[(b)&1])
+#define ALMTMP(job) ((job)->alm_tmp.v[0])
+#define ALMTMP_TYPE v2df
+
+#define TABLE_ALM2MAP_STEP(par) \
+  { \
+  const v2df ar_=_mm_shuffle_pd(almtmp[l],almtmp[l],_MM_SHUFFLE2(0,0)), \
+             ai_=_mm_shuffle_pd(almtmp[l],almtmp[l],_MM_SHUFFLE2(1,1)); \
+  const v2df *y_=(const v2df *)(ybuf+l*YLMTAB_BLOCK); \
+  for (b=0; b<TABLE_NACC; ++b) \
+    { \
+    pr[par][b].v=_mm_add_pd(pr[par][b].v,_mm_mul_pd(y_[b],ar_)); \
+    pi[par][b].v=_mm_add_pd(pi[par][b].v,_mm_mul_pd(y_[b],ai_)); \
+    } \
+  ++l; \
+  }
+
+#define TABLE_MAP2ALM_STEP(par) \
+  { \
+  const v2df *y_=(const v2df *)(ybuf+l*YLMTAB_BLOCK); \
+  v2df re_=_mm_mul_pd(y_[0],pr[par][0].v), im_=_mm_mul_pd(y_[0],pi[par][0].v); \
+  for (b=1; b<TABLE_NACC; ++b) \
+    { \
+    re_=_mm_add_pd(re_,_mm_mul_pd(y_[b],pr[par][b].v)); \
+    im_=_mm_add_pd(im_,_mm_mul_pd(y_[b],pi[par][b].v)); \
+    } \
+  almtmp[l]=_mm_add_pd(almtmp[l], \
+    _mm_add_pd(_mm_shuffle_pd(re_,im_,_MM_SHUFFLE2(0,0)), \
+               _mm_shuffle_pd(re_,im_,_MM_SHUFFLE2(1,1)))); \
+  ++l; \
+  }
+
+#else
+
+#define TABLE_NACC YLMTAB_BLOCK
+#define TABLE_VAL(acc,b) ((acc)[b])
+#define ALMTMP(job) ((job)->alm_tmp.c[0])
+#define ALMTMP_TYPE pshtd_cmplx
+
+#define TABLE_ALM2MAP_STEP(par) \
+  { \
+  const double ar_=almtmp[l].re, ai_=almtmp[l].im, *y_=ybuf+l*YLMTAB_BLOCK; \
+  for (b=0; b<TABLE_NACC; ++b) \
+    { pr[par][b] += y_[b]*ar_; pi[par][b] += y_[b]*ai_; } \
+  ++l; \
+  }
+
+#define TABLE_MAP2ALM_STEP(par) \
+  { \
+  const double *y_=ybuf+l*YLMTAB_BLOCK; \
+  double re_=0, im_=0; \
+  for (b=0; b<TABLE_NACC; ++b) \
+    { re_ += y_[b]*pr[par][b]; im_ += y_[b]*pi[par][b]; } \
+  almtmp[l].re += re_; almtmp[l].im += im_; \
+  ++l; \
+  }
+
+#endif
+
+/* Counterpart of inner_loop() for the jobs which take their Y_lm from the
+   table attached to \a jobs. The table rows of YLMTAB_BLOCK rings are
+   expanded into \a ybuf (YLMTAB_BLOCK*(lmax+1) entries, interleaved so that
+   the values of all rings for a given l are adjacent), and every a_lm is
+   loaded only once for all of them, i.e. the transform becomes a blocked
+   matrix-vector product. */
+static void X(inner_loop_table) (X(joblist) *jobs,
+  const psht_geom_info *ginfo, int lmax, int mmax, int llim, int ulim,
+  double *ybuf, int m)
+  {
+  int ith0,ijob,b;
+  if (X(generator_jobs)(jobs)==jobs->njobs) return;
+  for (ith0=0; ith0<ulim-llim; ith0+=YLMTAB_BLOCK)
+    {
+    int nb = IMIN(YLMTAB_BLOCK,ulim-llim-ith0), lmin=lmax+1;
+    int rpair[YLMTAB_BLOCK];
+    for (b=0; b<YLMTAB_BLOCK; ++b)
+      {
+      if (b<nb)
+        {
+        lmin = IMIN(lmin,ylm_table_row(jobs->ylm_table,ith0+b+llim,m,
+          ybuf+b,YLMTAB_BLOCK));
+        rpair[b] = ginfo->pair[ith0+b+llim].r2.nph>0;
+        }
+      else
+        {
+        int l;
+        for (l=m; l<=lmax; ++l)
+          ybuf[l*YLMTAB_BLOCK+b] = 0.;
+        rpair[b] = 0;
+        }
+      }
+
+    for (ijob=0; ijob<jobs->njobs; ++ijob)
+      {
+      X(job) *curjob = &jobs->job[ijob];
+#ifdef PLANCK_HAVE_SSE2
+      V2DF pr[2][TABLE_NACC], pi[2][TABLE_NACC];
+#else
+      double pr[2][TABLE_NACC], pi[2][TABLE_NACC];
+#endif
+      int l=lmin;
+      if (!X(table_job)(curjob)) continue;
+      switch (curjob->type)
+        {
+        case ALM2MAP:
+          {
+          const ALMTMP_TYPE *almtmp = ALMTMP(curjob);
+          for (b=0; b<YLMTAB_BLOCK; ++b)
+            TABLE_VAL(pr[0],b) = TABLE_VAL(pr[1],b) =
+            TABLE_VAL(pi[0],b) = TABLE_VAL(pi[1],b) = 0.;
+          if ((l<=lmax) && ((l-m)&1))
+            TABLE_ALM2MAP_STEP(1)
+          for (;l<lmax;)
+            {
+            TABLE_ALM2MAP_STEP(0)
+            TABLE_ALM2MAP_STEP(1)
+            }
+          if (l==lmax)
+            TABLE_ALM2MAP_STEP(0)
+          for (b=0; b<nb; ++b)
+            {
+            int phas_idx = (ith0+b)*(mmax+1)+m;
+            pshtd_cmplx *ph1 = &curjob->phas1[0][phas_idx];
+            double r0=TABLE_VAL(pr[0],b), r1=TABLE_VAL(pr[1],b),
+                   i0=TABLE_VAL(pi[0],b), i1=TABLE_VAL(pi[1],b);
+            ph1->re = r0+r1; ph1->im = i0+i1;
+            if (rpair[b])
+              {
+              pshtd_cmplx *ph2 = &curjob->phas2[0][phas_idx];
+              ph2->re = r0-r1; ph2->im = i0-i1;
+              }
+            }
+          break;
+          }
+        case MAP2ALM:
+          {
+          ALMTMP_TYPE *almtmp = ALMTMP(curjob);
+          for (b=0; b<YLMTAB_BLOCK; ++b)
+            {
+            pshtd_cmplx ph1=pshtd_cmplx_null, ph2=pshtd_cmplx_null;
+            if (b<nb)
+              {
+              int phas_idx = (ith0+b)*(mmax+1)+m;
+              ph1 = curjob->phas1[0][phas_idx];
+              if (rpair[b]) ph2 = curjob->phas2[0][phas_idx];
+              }
+            TABLE_VAL(pr[0],b) = ph1.re+ph2.re;
+            TABLE_VAL(pi[0],b) = ph1.im+ph2.im;
+            TABLE_VAL(pr[1],b) = ph1.re-ph2.re;
+            TABLE_VAL(pi[1],b) = ph1.im-ph2.im;
+            }
+          if ((l<=lmax) && ((l-m)&1))
+            TABLE_MAP2ALM_STEP(1)
+          for (;l<lmax;)
+            {
+            TABLE_MAP2ALM_STEP(0)
+            TABLE_MAP2ALM_STEP(1)
+            }
+          if (l==lmax)
+            TABLE_MAP2ALM_STEP(0)
+          break;
+          }
+        default:
+          break;
+        }
+      }
+    }
+  }
+
+#undef TABLE_ALM2MAP_STEP
+#undef TABLE_MAP2ALM_STEP
+#undef TABLE_NACC
+#undef TABLE_VAL
+#undef ALMTMP
+#undef ALMTMP_TYPE
+
 static void X(almtmp2alm) (X(joblist) *jobs, int lmax, int m,
   const psht_alm_info *alm)
   {
@@ -933,89 +1133,176 @@ static void X(phase2map) (X(joblist) *jobs, const psht_geom_info *ginfo,
 } /* end of parallel region */
   }
 
-void X(execute_jobs) (X(joblist) *joblist, const psht_geom_info *geom_info,
-  const psht_alm_info *alm_info)
+/* Executes the jobs in \a joblist for the rings llim..ulim-1. The phase
+   arrays must have been allocated. If \a pool is not NULL, the Ylm
+   generators are taken from it (and kept there), otherwise they are created
+   and destroyed by each thread. */
+static void X(execute_chunk) (X(joblist) *joblist,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info,
+  int llim, int ulim, int spinrec, genpool *pool, int chunk)
   {
   int lmax = alm_info->lmax, mmax = alm_info->mmax;
-  int nchunks, chunksize, chunk, spinrec=0, ijob;
-
-  for (ijob=0; ijob<joblist->njobs; ++ijob)
-    if (joblist->job[ijob].spin<=1) { spinrec=1; break; }
-
-  for (ijob=0; ijob<joblist->njobs; ++ijob)
-    joblist->job[ijob].norm_l =
-      Ylmgen_get_norm (lmax, joblist->job[ijob].spin, spinrec);
-
-/* clear output arrays if requested */
-  X(init_output) (joblist, geom_info, alm_info);
-
-  get_chunk_info(geom_info->npairs,&nchunks,&chunksize);
-  X(alloc_phase) (joblist,mmax,chunksize);
-
-/* chunk loop */
-  for (chunk=0; chunk<nchunks; ++chunk)
-    {
-    int llim=chunk*chunksize, ulim=IMIN(llim+chunksize,geom_info->npairs);
 
 /* map->phase where necessary */
-    X(map2phase) (joblist, geom_info, mmax, llim, ulim);
+  X(map2phase) (joblist, geom_info, mmax, llim, ulim);
 
 #pragma omp parallel
 {
-    int m;
-    X(joblist) ljobs = *joblist;
-    Ylmgen_C generator;
+  int m;
+  X(joblist) ljobs = *joblist;
+  Ylmgen_C lgenerator, *generator;
+  double *ybuf = joblist->ylm_table ? RALLOC(double,YLMTAB_BLOCK*(lmax+1))
+                                    : NULL;
+  if (pool)
+    generator = genpool_get (pool,chunk,geom_info,llim,ulim,lmax,mmax,spinrec);
+  else
+    {
     double *theta = RALLOC(double,ulim-llim);
     for (m=0; m<ulim-llim; ++m)
       theta[m] = geom_info->pair[m+llim].r1.theta;
-    Ylmgen_init (&generator,lmax,mmax,spinrec,1e-30);
-    Ylmgen_set_theta (&generator,theta,ulim-llim);
+    Ylmgen_init (&lgenerator,lmax,mmax,spinrec,1e-30);
+    Ylmgen_set_theta (&lgenerator,theta,ulim-llim);
     DEALLOC(theta);
-    X(alloc_almtmp)(&ljobs,lmax);
+    generator = &lgenerator;
+    }
+  ljobs.job = RALLOC(X(job),joblist->njobs);
+  COPY_ARRAY(joblist->job,ljobs.job,0,joblist->njobs);
+  X(alloc_almtmp)(&ljobs,lmax);
 
 #pragma omp for schedule(dynamic,1)
-    for (m=0; m<=mmax; ++m)
-      {
+  for (m=0; m<=mmax; ++m)
+    {
 /* alm->alm_tmp where necessary */
-      X(alm2almtmp) (&ljobs, lmax, m, alm_info);
+    X(alm2almtmp) (&ljobs, lmax, m, alm_info);
 
 /* inner conversion loop */
-      X(inner_loop) (&ljobs, geom_info, lmax, mmax, llim, ulim, &generator, m);
+    X(inner_loop) (&ljobs, geom_info, lmax, mmax, llim, ulim, generator, m);
+    if (ybuf)
+      X(inner_loop_table) (&ljobs, geom_info, lmax, mmax, llim, ulim, ybuf, m);
 
 /* alm_tmp->alm where necessary */
-      X(almtmp2alm) (&ljobs, lmax, m, alm_info);
-      }
+    X(almtmp2alm) (&ljobs, lmax, m, alm_info);
+    }
 
-    Ylmgen_destroy(&generator);
-    X(dealloc_almtmp)(&ljobs);
+  if (!pool)
+    Ylmgen_destroy(&lgenerator);
+  X(dealloc_almtmp)(&ljobs);
+  DEALLOC(ljobs.job);
+  DEALLOC(ybuf);
 } /* end of parallel region */
 
 /* phase->map where necessary */
-    X(phase2map) (joblist, geom_info, mmax, llim, ulim);
-    } /* end of chunk loop */
+  X(phase2map) (joblist, geom_info, mmax, llim, ulim);
+  }
+
+static int X(need_spinrec) (const X(joblist) *joblist)
+  {
+  int ijob;
+  for (ijob=0; ijob<joblist->njobs; ++ijob)
+    if (joblist->job[ijob].spin<=1) return 1;
+  return 0;
+  }
+
+static void X(execute_batch) (X(joblist) *joblist,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info)
+  {
+  int lmax = alm_info->lmax, mmax = alm_info->mmax;
+  int nchunks, chunksize, chunk, spinrec, ijob;
+
+  spinrec = X(need_spinrec) (joblist);
+  for (ijob=0; ijob<joblist->njobs; ++ijob)
+    joblist->job[ijob].norm_l =
+      Ylmgen_get_norm (lmax, joblist->job[ijob].spin, spinrec);
+
+/* clear output arrays if requested */
+  X(init_output) (joblist, geom_info, alm_info);
+
+  get_chunk_info(geom_info->npairs,&nchunks,&chunksize);
+  X(alloc_phase) (joblist,mmax,chunksize);
+
+/* chunk loop */
+  for (chunk=0; chunk<nchunks; ++chunk)
+    {
+    int llim=chunk*chunksize, ulim=IMIN(llim+chunksize,geom_info->npairs);
+    X(execute_chunk) (joblist, geom_info, alm_info, llim, ulim, spinrec,
+      NULL, chunk);
+    }
 
   for (ijob=0; ijob<joblist->njobs; ++ijob)
     DEALLOC(joblist->job[ijob].norm_l);
   X(dealloc_phase) (joblist);
   }
 
+/* Returns the number of jobs, starting from job[first], whose temporary
+   a_lm arrays fit together into psht_batch_cache_bytes (at least one). */
+static int X(batch_size) (const X(joblist) *joblist, int first, int lmax)
+  {
+  size_t bytes=0;
+  int ijob;
+  for (ijob=first; ijob<joblist->njobs; ++ijob)
+    {
+    const X(job) *curjob = &joblist->job[ijob];
+#ifdef PLANCK_HAVE_SSE2
+    size_t sz = (curjob->spin==0) ? sizeof(v2df) : sizeof(v2df2);
+#else
+    size_t sz = sizeof(pshtd_cmplx);
+#endif
+    bytes += sz*curjob->nalm*(size_t)(lmax+1);
+    if ((ijob>first) && (bytes>psht_batch_cache_bytes)) break;
+    }
+  return ijob-first;
+  }
+
+void X(execute_jobs) (X(joblist) *joblist, const psht_geom_info *geom_info,
+  const psht_alm_info *alm_info)
+  {
+  int first=0;
+  check_ylm_table (joblist->ylm_table, geom_info, alm_info);
+  while (first<joblist->njobs)
+    {
+    X(joblist) batch;
+    batch.ylm_table = joblist->ylm_table;
+    batch.job = joblist->job+first;
+    batch.njobs = batch.maxjobs =
+      X(batch_size) (joblist, first, alm_info->lmax);
+    X(execute_batch) (&batch, geom_info, alm_info);
+    first += batch.njobs;
+    }
+  }
+
 void X(make_joblist) (X(joblist) **joblist)
   {
   *joblist = RALLOC(X(joblist),1);
-  (*joblist)->njobs=0;
+  (*joblist)->job=NULL;
+  (*joblist)->njobs=(*joblist)->maxjobs=0;
+  (*joblist)->ylm_table=NULL;
   }
 
+void X(set_ylm_table) (X(joblist) *joblist, const psht_ylm_table *table)
+  { joblist->ylm_table = table; }
+
 void X(clear_joblist) (X(joblist) *joblist)
   { joblist->njobs=0; }
 
 void X(destroy_joblist) (X(joblist) *joblist)
-  { DEALLOC(joblist); }
+  {
+  DEALLOC(joblist->job);
+  DEALLOC(joblist);
+  }
 
 static void X(addjob) (X(joblist) *joblist, psht_jobtype type, int spin,
   int add_output, int nalm, int nmaps, X(cmplx) *alm0, X(cmplx) *alm1,
   X(cmplx) *alm2, FLT *map0, FLT *map1, FLT *map2)
   {
-  assert_jobspace(joblist->njobs);
+  if (joblist->njobs==joblist->maxjobs)
+    {
+    int newsize = joblist_newsize(joblist->njobs);
+    X(job) *tmp = RALLOC(X(job),newsize);
+    COPY_ARRAY(joblist->job,tmp,0,joblist->njobs);
+    DEALLOC(joblist->job);
+    joblist->job = tmp;
+    joblist->maxjobs = newsize;
+    }
   joblist->job[joblist->njobs].type = type;
   joblist->job[joblist->njobs].spin = spin;
   joblist->job[joblist->njobs].norm_l = NULL;
@@ -1079,3 +1366,166 @@ void X(add_job_alm2map_deriv1) (X(joblist) *joblist, const X(cmplx) *alm,
   X(addjob) (joblist, ALM2MAP_DERIV1, 1, add_output, 1, 2,
     (X(cmplx) *)alm, NULL, NULL, mapdtheta, mapdphi, NULL);
   }
+
+/* Computes map-res for all pixels of the geometry and stores it in res.
+   Returns the sum of the squared residuals. */
+static double X(make_residual) (const psht_geom_info *ginfo, const FLT *map,
+  FLT *res)
+  {
+  double sum=0;
+  int ith;
+#pragma omp parallel for schedule(dynamic,1) reduction(+:sum)
+  for (ith=0; ith<ginfo->npairs; ++ith)
+    {
+    const psht_ringinfo *ri[2] = { &ginfo->pair[ith].r1, &ginfo->pair[ith].r2 };
+    int r,i;
+    for (r=0; r<2; ++r)
+      for (i=0; i<ri[r]->nph; ++i)
+        {
+        ptrdiff_t idx = ri[r]->ofs+(ptrdiff_t)i*ri[r]->stride;
+        res[idx] = map[idx]-res[idx];
+        sum += (double)res[idx]*res[idx];
+        }
+    }
+  return sum;
+  }
+
+/* Returns the sum of the squared pixel values of map. */
+static double X(map_norm) (const psht_geom_info *ginfo, const FLT *map)
+  {
+  double sum=0;
+  int ith;
+#pragma omp parallel for schedule(dynamic,1) reduction(+:sum)
+  for (ith=0; ith<ginfo->npairs; ++ith)
+    {
+    const psht_ringinfo *ri[2] = { &ginfo->pair[ith].r1, &ginfo->pair[ith].r2 };
+    int r,i;
+    for (r=0; r<2; ++r)
+      for (i=0; i<ri[r]->nph; ++i)
+        {
+        FLT v = map[ri[r]->ofs+(ptrdiff_t)i*ri[r]->stride];
+        sum += (double)v*v;
+        }
+    }
+  return sum;
+  }
+
+/* Runs all jobs of joblist over the whole geometry, reusing the phase
+   arrays, normalisation factors and Ylm generators set up by the caller.
+   Like execute_jobs(), the jobs are processed in batches whose temporary
+   a_lm fit into psht_batch_cache_bytes. */
+static void X(execute_pass) (X(joblist) *joblist,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info,
+  int nchunks, int chunksize, int spinrec, genpool *pool)
+  {
+  int first=0;
+  X(init_output) (joblist, geom_info, alm_info);
+  while (first<joblist->njobs)
+    {
+    int chunk;
+    X(joblist) batch;
+    batch.ylm_table = joblist->ylm_table;
+    batch.job = joblist->job+first;
+    batch.njobs = batch.maxjobs =
+      X(batch_size) (joblist, first, alm_info->lmax);
+    for (chunk=0; chunk<nchunks; ++chunk)
+      {
+      int llim=chunk*chunksize, ulim=IMIN(llim+chunksize,geom_info->npairs);
+      X(execute_chunk) (&batch, geom_info, alm_info, llim, ulim, spinrec,
+        pool, chunk);
+      }
+    first += batch.njobs;
+    }
+  }
+
+int X(execute_map2alm_iter) (X(joblist) *joblist,
+  const psht_geom_info *geom_info, const psht_alm_info *alm_info,
+  int maxiter, double epsilon, double *walltime, double *residual)
+  {
+  int lmax = alm_info->lmax, mmax = alm_info->mmax;
+  int nchunks, chunksize, spinrec, ijob, i, iter;
+  ptrdiff_t npix = geom_npix(geom_info);
+  double mapnorm=0, t0;
+  X(joblist) synth, corr;
+  genpool pool;
+
+  UTIL_ASSERT(maxiter>=0,"negative maxiter in execute_map2alm_iter()");
+  for (ijob=0; ijob<joblist->njobs; ++ijob)
+    UTIL_ASSERT((joblist->job[ijob].type==MAP2ALM)
+      &&(!joblist->job[ijob].add_output),
+      "execute_map2alm_iter() only accepts map2alm jobs without add_output");
+
+  check_ylm_table (joblist->ylm_table, geom_info, alm_info);
+
+  spinrec = X(need_spinrec) (joblist);
+  for (ijob=0; ijob<joblist->njobs; ++ijob)
+    joblist->job[ijob].norm_l =
+      Ylmgen_get_norm (lmax, joblist->job[ijob].spin, spinrec);
+  get_chunk_info(geom_info->npairs,&nchunks,&chunksize);
+  X(alloc_phase) (joblist,mmax,chunksize);
+  genpool_init(&pool,nchunks);
+
+/* The synthesis jobs write the current estimate of the maps into scratch
+   arrays, which are then replaced by the residuals and analysed into
+   corrections that are added to the a_lm. Both lists share the phase
+   arrays and normalisation factors of the original jobs. */
+  synth.njobs = synth.maxjobs = corr.njobs = corr.maxjobs = joblist->njobs;
+  synth.ylm_table = corr.ylm_table = joblist->ylm_table;
+  synth.job = RALLOC(X(job),IMAX(joblist->njobs,1));
+  corr.job = RALLOC(X(job),IMAX(joblist->njobs,1));
+  for (ijob=0; ijob<joblist->njobs; ++ijob)
+    {
+    X(job) *curjob = &joblist->job[ijob];
+    synth.job[ijob] = *curjob;
+    synth.job[ijob].type = ALM2MAP;
+    for (i=0; i<curjob->nmaps; ++i)
+      synth.job[ijob].map[i] = RALLOC(FLT,npix);
+    corr.job[ijob] = synth.job[ijob];
+    corr.job[ijob].type = MAP2ALM;
+    corr.job[ijob].add_output = 1;
+    }
+
+  t0 = psht_wallclock();
+  X(execute_pass) (joblist, geom_info, alm_info, nchunks, chunksize, spinrec,
+    &pool);
+  if (walltime) walltime[0] = psht_wallclock()-t0;
+
+  if (maxiter>0)
+    for (ijob=0; ijob<joblist->njobs; ++ijob)
+      for (i=0; i<joblist->job[ijob].nmaps; ++i)
+        mapnorm += X(map_norm) (geom_info, joblist->job[ijob].map[i]);
+
+  for (iter=0; iter<maxiter; ++iter)
+    {
+    double resnorm=0, rel;
+    t0 = psht_wallclock();
+    X(execute_pass) (&synth, geom_info, alm_info, nchunks, chunksize, spinrec,
+      &pool);
+    for (ijob=0; ijob<joblist->njobs; ++ijob)
+      for (i=0; i<joblist->job[ijob].nmaps; ++i)
+        resnorm += X(make_residual) (geom_info, joblist->job[ijob].map[i],
+          synth.job[ijob].map[i]);
+    rel = (mapnorm>0) ? sqrt(resnorm/mapnorm) : 0.;
+    if (residual) residual[iter] = rel;
+    if (rel<epsilon)
+      {
+      if (walltime) walltime[iter+1] = psht_wallclock()-t0;
+      break;
+      }
+    X(execute_pass) (&corr, geom_info, alm_info, nchunks, chunksize, spinrec,
+      &pool);
+    if (walltime) walltime[iter+1] = psht_wallclock()-t0;
+    }
+
+  for (ijob=0; ijob<joblist->njobs; ++ijob)
+    {
+    for (i=0; i<synth.job[ijob].nmaps; ++i)
+      DEALLOC(synth.job[ijob].map[i]);
+    DEALLOC(joblist->job[ijob].norm_l);
+    }
+  DEALLOC(synth.job);
+  DEALLOC(corr.job);
+  genpool_destroy(&pool);
+  X(dealloc_phase) (joblist);
+  return iter;
+  }
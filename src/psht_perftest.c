@@ -32,9 +32,14 @@
     The individual job types are also given by the user
     and can be "alm2map", "map2alm", "alm2map_pol", "map2alm_pol",
     "alm2map_spin[1-3]", "map2alm_spin[1-3]", and "alm2map_deriv1".
-    Any combination of job types is allowed.
+    Any combination of job types is allowed, and each type can be followed
+    by ":<count>" to request several copies of the same job
+    (e.g. "map2alm:40").
 
-    All requested jobs are executed simultaneously.
+    All requested jobs are executed simultaneously; afterwards they are
+    executed once more one at a time, and the throughput of both runs
+    is reported. If the last argument is "--table", the jobs are finally
+    run once more using a precomputed (single precision) Y_lm table.
 
     Copyright (C) 2006-2010 Max-Planck-Society
     \author Martin Reinecke
@@ -63,31 +68,90 @@ static void get_alm(pshts_cmplx **alm, ptrdiff_t nalm)
   SET_ARRAY(*alm,0,nalm,pshts_cmplx_one);
   }
 
-static void prepare_job (const char *jobname, float **map,
-  pshts_cmplx **alm, ptrdiff_t npix, ptrdiff_t nalm, int ofs_m, int ofs_a,
-  int num_m, int num_a)
+typedef char jobname[32];
+
+static void get_job_size (const char *type, int *num_m, int *num_a)
+  {
+  if ((strcmp(type,"alm2map")==0) || (strcmp(type,"map2alm")==0))
+    { *num_m=1; *num_a=1; }
+  else if ((strcmp(type,"alm2map_pol")==0) || (strcmp(type,"map2alm_pol")==0))
+    { *num_m=3; *num_a=3; }
+  else if ((strncmp(type,"alm2map_spin",12)==0)
+        || (strncmp(type,"map2alm_spin",12)==0))
+    { *num_m=2; *num_a=2; }
+  else if (strcmp(type,"alm2map_deriv1")==0)
+    { *num_m=2; *num_a=1; }
+  else
+    UTIL_FAIL("unknown transform type");
+  }
+
+static void prepare_job (float **map, pshts_cmplx **alm, ptrdiff_t npix,
+  ptrdiff_t nalm, int num_m, int num_a)
   {
   int m;
-  printf("adding job: %s\n", jobname);
   for (m=0; m<num_m; ++m)
-    get_map (&map[ofs_m+m],npix);
+    get_map (&map[m],npix);
   for (m=0; m<num_a; ++m)
-    get_alm (&alm[ofs_a+m],nalm);
+    get_alm (&alm[m],nalm);
+  }
+
+static void add_job (pshts_joblist *joblist, const char *type, float **map,
+  pshts_cmplx **alm)
+  {
+  if (strcmp(type,"alm2map")==0)
+    pshts_add_job_alm2map(joblist,alm[0],map[0],0);
+  else if (strcmp(type,"map2alm")==0)
+    pshts_add_job_map2alm(joblist,map[0],alm[0],0);
+  else if (strcmp(type,"alm2map_pol")==0)
+    pshts_add_job_alm2map_pol(joblist,alm[0],alm[1],alm[2],
+                              map[0],map[1],map[2],0);
+  else if (strcmp(type,"map2alm_pol")==0)
+    pshts_add_job_map2alm_pol(joblist,map[0],map[1],map[2],
+                              alm[0],alm[1],alm[2],0);
+  else if (strncmp(type,"alm2map_spin",12)==0)
+    pshts_add_job_alm2map_spin(joblist,alm[0],alm[1],map[0],map[1],
+                               atoi(type+12),0);
+  else if (strncmp(type,"map2alm_spin",12)==0)
+    pshts_add_job_map2alm_spin(joblist,map[0],map[1],alm[0],alm[1],
+                               atoi(type+12),0);
+  else if (strcmp(type,"alm2map_deriv1")==0)
+    pshts_add_job_alm2map_deriv1(joblist,alm[0],map[0],map[1],0);
+  else
+    UTIL_FAIL("unknown transform type");
+  }
+
+/* Splits "<type>[:<count>]" into the job type and the number of copies. */
+static int parse_job (const char *arg, char *type, size_t typesize)
+  {
+  const char *colon = strchr(arg,':');
+  size_t len = colon ? (size_t)(colon-arg) : strlen(arg);
+  int count = colon ? atoi(colon+1) : 1;
+  UTIL_ASSERT(len<typesize,"transform type name too long");
+  UTIL_ASSERT(count>0,"the number of copies must be positive");
+  memcpy(type,arg,len);
+  type[len]='\0';
+  return count;
   }
 
 int main(int argc, char **argv)
   {
   ptrdiff_t npix=0,lmax,nalm;
-  float *map[100];
-  pshts_cmplx *alm[100];
+  float **map;
+  pshts_cmplx **alm;
+  jobname *jobtype;
+  int *jobofs_m, *jobofs_a;
   psht_alm_info *alms;
   psht_geom_info *tinfo;
   pshts_joblist *joblist;
-  int ofs_m, ofs_a, m;
-  double wtimer;
+  int ofs_m, ofs_a, m, njobs, ijob, use_table=0;
+  double wtimer, wtime_batch, wtime_single;
+
+  if ((argc>1) && (strcmp(argv[argc-1],"--table")==0))
+    { use_table=1; --argc; }
 
   UTIL_ASSERT (argc>=5,
-    "usage: psht_perftest <healpix|ecp|gauss> <lmax> <nside|nphi> <type>+\n"
+    "usage: psht_perftest <healpix|ecp|gauss> <lmax> <nside|nphi> "
+    "<type>[:<count>]+ [--table]\n"
     "  where <type> can be 'alm2map', 'map2alm', 'alm2map_pol',\n"
     "  'map2alm_pol', 'alm2map_spin[1-3]', 'map2alm_spin[1-3]',\n"
     "  or 'alm2map_deriv1'");
@@ -127,91 +191,77 @@ int main(int argc, char **argv)
   nalm = ((ptrdiff_t)(lmax+1)*(lmax+2))/2;
   pshts_make_joblist (&joblist);
 
-  ofs_m=ofs_a=0;
+  njobs=0;
   for (m=4; m<argc; ++m)
     {
-    if (strcmp(argv[m],"alm2map")==0)
-      {
-      prepare_job ("alm2map",map,alm,npix,nalm,ofs_m,ofs_a,1,1);
-      pshts_add_job_alm2map(joblist,alm[ofs_a],map[ofs_m],0);
-      ++ofs_m; ++ofs_a;
-      }
-    else if (strcmp(argv[m],"map2alm")==0)
-      {
-      prepare_job ("map2alm",map,alm,npix,nalm,ofs_m,ofs_a,1,1);
-      pshts_add_job_map2alm(joblist,map[ofs_m],alm[ofs_a],0);
-      ++ofs_m; ++ofs_a;
-      }
-    else if (strcmp(argv[m],"alm2map_pol")==0)
-      {
-      prepare_job ("alm2map_pol",map,alm,npix,nalm,ofs_m,ofs_a,3,3);
-      pshts_add_job_alm2map_pol(joblist,alm[ofs_a],alm[ofs_a+1],alm[ofs_a+2],
-                                map[ofs_m],map[ofs_m+1],map[ofs_m+2],0);
-      ofs_m+=3; ofs_a+=3;
-      }
-    else if (strcmp(argv[m],"map2alm_pol")==0)
-      {
-      prepare_job ("map2alm_pol",map,alm,npix,nalm,ofs_m,ofs_a,3,3);
-      pshts_add_job_map2alm_pol(joblist,map[ofs_m],map[ofs_m+1],map[ofs_m+2],
-                                alm[ofs_a],alm[ofs_a+1],alm[ofs_a+2],0);
-      ofs_m+=3; ofs_a+=3;
-      }
-    else if (strcmp(argv[m],"alm2map_spin1")==0)
-      {
-      prepare_job ("alm2map_spin1",map,alm,npix,nalm,ofs_m,ofs_a,2,2);
-      pshts_add_job_alm2map_spin(joblist,alm[ofs_a],alm[ofs_a+1],
-                                 map[ofs_m],map[ofs_m+1],1,0);
-      ofs_m+=2; ofs_a+=2;
-      }
-    else if (strcmp(argv[m],"map2alm_spin1")==0)
-      {
-      prepare_job ("map2alm_spin1",map,alm,npix,nalm,ofs_m,ofs_a,2,2);
-      pshts_add_job_map2alm_spin(joblist,map[ofs_m],map[ofs_m+1],
-                                 alm[ofs_a],alm[ofs_a+1],1,0);
-      ofs_m+=2; ofs_a+=2;
-      }
-    else if (strcmp(argv[m],"alm2map_spin2")==0)
-      {
-      prepare_job ("alm2map_spin2",map,alm,npix,nalm,ofs_m,ofs_a,2,2);
-      pshts_add_job_alm2map_spin(joblist,alm[ofs_a],alm[ofs_a+1],
-                                 map[ofs_m],map[ofs_m+1],2,0);
-      ofs_m+=2; ofs_a+=2;
-      }
-    else if (strcmp(argv[m],"map2alm_spin2")==0)
-      {
-      prepare_job ("map2alm_spin2",map,alm,npix,nalm,ofs_m,ofs_a,2,2);
-      pshts_add_job_map2alm_spin(joblist,map[ofs_m],map[ofs_m+1],
-                                 alm[ofs_a],alm[ofs_a+1],2,0);
-      ofs_m+=2; ofs_a+=2;
-      }
-    else if (strcmp(argv[m],"alm2map_spin3")==0)
-      {
-      prepare_job ("alm2map_spin3",map,alm,npix,nalm,ofs_m,ofs_a,2,2);
-      pshts_add_job_map2alm_spin(joblist,map[ofs_m],map[ofs_m+1],
-                                 alm[ofs_a],alm[ofs_a+1],3,0);
-      ofs_m+=2; ofs_a+=2;
-      }
-    else if (strcmp(argv[m],"map2alm_spin3")==0)
-      {
-      prepare_job ("map2alm_spin3",map,alm,npix,nalm,ofs_m,ofs_a,2,2);
-      pshts_add_job_map2alm_spin(joblist,map[ofs_m],map[ofs_m+1],
-                                 alm[ofs_a],alm[ofs_a+1],3,0);
-      ofs_m+=2; ofs_a+=2;
-      }
-    else if (strcmp(argv[m],"alm2map_deriv1")==0)
+    jobname type;
+    njobs += parse_job (argv[m],type,sizeof(type));
+    }
+  map=RALLOC(float *,3*njobs);
+  alm=RALLOC(pshts_cmplx *,3*njobs);
+  jobtype=RALLOC(jobname,njobs);
+  jobofs_m=RALLOC(int,njobs);
+  jobofs_a=RALLOC(int,njobs);
+
+  ofs_m=ofs_a=ijob=0;
+  for (m=4; m<argc; ++m)
+    {
+    jobname type;
+    int count = parse_job (argv[m],type,sizeof(type)), i;
+    printf("adding job: %s (x%d)\n", type, count);
+    for (i=0; i<count; ++i, ++ijob)
       {
-      prepare_job ("alm2map_deriv1",map,alm,npix,nalm,ofs_m,ofs_a,2,1);
-      pshts_add_job_alm2map_deriv1(joblist,alm[ofs_a], map[ofs_m],
-                                   map[ofs_m+1],0);
-      ofs_m+=2; ofs_a+=1;
+      int num_m=0, num_a=0;
+      get_job_size (type,&num_m,&num_a);
+      prepare_job (&map[ofs_m],&alm[ofs_a],npix,nalm,num_m,num_a);
+      add_job (joblist,type,&map[ofs_m],&alm[ofs_a]);
+      strcpy(jobtype[ijob],type);
+      jobofs_m[ijob]=ofs_m;
+      jobofs_a[ijob]=ofs_a;
+      ofs_m+=num_m; ofs_a+=num_a;
       }
-    else
-      UTIL_FAIL("unknown transform type");
     }
 
   wtimer=wallTime();
   pshts_execute_jobs (joblist, tinfo, alms);
-  printf("wall time for transform: %fs\n",wallTime()-wtimer);
+  wtime_batch=wallTime()-wtimer;
+  printf("wall time for transform: %fs\n",wtime_batch);
+
+  wtime_single=0.;
+  for (ijob=0; ijob<njobs; ++ijob)
+    {
+    pshts_clear_joblist (joblist);
+    add_job (joblist,jobtype[ijob],&map[jobofs_m[ijob]],&alm[jobofs_a[ijob]]);
+    wtimer=wallTime();
+    pshts_execute_jobs (joblist, tinfo, alms);
+    wtime_single+=wallTime()-wtimer;
+    }
+  printf("wall time for %d jobs executed one at a time: %fs\n",
+         njobs,wtime_single);
+  printf("throughput: %f jobs/s (batched) vs. %f jobs/s (single), "
+         "speedup %.2fx\n", njobs/wtime_batch, njobs/wtime_single,
+         wtime_single/wtime_batch);
+
+  if (use_table)
+    {
+    psht_ylm_table *table;
+    pshts_clear_joblist (joblist);
+    for (ijob=0; ijob<njobs; ++ijob)
+      add_job (joblist,jobtype[ijob],&map[jobofs_m[ijob]],
+        &alm[jobofs_a[ijob]]);
+    wtimer=wallTime();
+    psht_make_ylm_table (tinfo, lmax, lmax, 1, &table);
+    printf("wall time for Y_lm table (%.1f MB): %fs\n",
+           psht_ylm_table_size(table)/1e6, wallTime()-wtimer);
+    pshts_set_ylm_table (joblist, table);
+    wtimer=wallTime();
+    pshts_execute_jobs (joblist, tinfo, alms);
+    wtimer=wallTime()-wtimer;
+    printf("wall time for transform with Y_lm table: %fs, speedup %.2fx\n",
+           wtimer, wtime_batch/wtimer);
+    pshts_set_ylm_table (joblist, NULL);
+    psht_destroy_ylm_table (table);
+    }
 
   pshts_destroy_joblist(joblist);
   psht_destroy_geom_info(tinfo);
@@ -220,6 +270,11 @@ int main(int argc, char **argv)
     DEALLOC(map[m]);
   for (m=0; m<ofs_a; ++m)
     DEALLOC(alm[m]);
+  DEALLOC(map);
+  DEALLOC(alm);
+  DEALLOC(jobtype);
+  DEALLOC(jobofs_m);
+  DEALLOC(jobofs_a);
 
   return 0;
   }
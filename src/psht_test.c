@@ -31,11 +31,16 @@
     random numbers of the interval [-1;1[.
     Afterwards, the random a_lm are converted to a map.
     This map is analyzed (optionally using an iterative scheme
-    with a user-supplied number of steps).
+    with a user-supplied number of steps), first by driving the iterations
+    explicitly and then through pshtd_execute_map2alm_iter().
     After every iteration, the code then outputs the RMS of the residual a_lm
     (i.e. the difference between the current and original a_lm), divided by
     the RMS of the original a_lm, as well as the maximum absolute change of any
     real or imaginary part between the current and original a_lm.
+    For spin 0, the map and the a_lm are finally recomputed in single and
+    double precision with a table of Y_lm attached to the job list (see
+    psht_make_ylm_table()), and compared with the ones obtained through
+    the recursion.
 
     This operation can be performed for several different pixelisations:
       - a Gaussian with the minimal number of rings for exact analysis
@@ -161,6 +166,159 @@ static void map2alm_iter (psht_geom_info *tinfo, double **map,
   pshtd_destroy_joblist(joblist);
   }
 
+static void map2alm_iter_internal (psht_geom_info *tinfo, double **map,
+  pshtd_cmplx **alm_orig, pshtd_cmplx **alm, int lmax, int mmax,
+  ptrdiff_t nalms, int spin, int niter)
+  {
+  psht_alm_info *alms;
+  pshtd_joblist *joblist;
+  int ncomp = (spin==0) ? 1 : 2;
+  int iter,ndone;
+  double *walltime=RALLOC(double,niter+1), *residual=RALLOC(double,niter+1);
+
+  psht_make_triangular_alm_info(lmax,mmax,1,&alms);
+  pshtd_make_joblist (&joblist);
+
+  if (spin==0)
+    pshtd_add_job_map2alm(joblist,map[0],alm[0],0);
+  else
+    pshtd_add_job_map2alm_spin(joblist,map[0],map[1],alm[0],alm[1],spin,0);
+  ndone=pshtd_execute_map2alm_iter (joblist, tinfo, alms, niter, 0.,
+    walltime, residual);
+
+  printf("\ninternal iteration:\n");
+  printf("wall time for map2alm: %fs\n",walltime[0]);
+  for (iter=0; iter<ndone; ++iter)
+    printf("iteration %i: wall time %fs, map residual %e\n", iter+1,
+      walltime[iter+1], residual[iter]);
+  measure_errors(alm_orig,alm,nalms,ncomp);
+
+  DEALLOC(walltime);
+  DEALLOC(residual);
+  psht_destroy_alm_info(alms);
+  pshtd_destroy_joblist(joblist);
+  }
+
+static double max_rel_diff (const double *a, const double *b, ptrdiff_t n)
+  {
+  double maxdiff=0, maxval=0;
+  ptrdiff_t i;
+  for (i=0; i<n; ++i)
+    {
+    if (fabs(a[i]-b[i])>maxdiff) maxdiff=fabs(a[i]-b[i]);
+    if (fabs(a[i])>maxval) maxval=fabs(a[i]);
+    }
+  return (maxval>0) ? maxdiff/maxval : maxdiff;
+  }
+
+static double max_rel_diff_f (const float *a, const float *b, ptrdiff_t n)
+  {
+  double maxdiff=0, maxval=0;
+  ptrdiff_t i;
+  for (i=0; i<n; ++i)
+    {
+    if (fabs(a[i]-b[i])>maxdiff) maxdiff=fabs(a[i]-b[i]);
+    if (fabs(a[i])>maxval) maxval=fabs(a[i]);
+    }
+  return (maxval>0) ? maxdiff/maxval : maxdiff;
+  }
+
+/* Runs alm2map and map2alm with and without a table of Y_lm attached to
+   the job list, and checks that the two paths agree. */
+static void check_ylm_table_d (psht_geom_info *tinfo, psht_alm_info *alms,
+  const pshtd_cmplx *alm, ptrdiff_t nalms, ptrdiff_t npix)
+  {
+  psht_ylm_table *table;
+  pshtd_joblist *joblist;
+  double *map=RALLOC(double,npix), *map2=RALLOC(double,npix);
+  pshtd_cmplx *alm1=RALLOC(pshtd_cmplx,nalms), *alm2=RALLOC(pshtd_cmplx,nalms);
+  double errmap, erralm;
+
+  psht_make_ylm_table(tinfo,alms->lmax,alms->mmax,0,&table);
+  pshtd_make_joblist (&joblist);
+
+  /* The jobs in a list run at the same time, so the analysis of the
+     map needs a list of its own */
+  pshtd_add_job_alm2map(joblist,alm,map,0);
+  pshtd_execute_jobs (joblist, tinfo, alms);
+  pshtd_clear_joblist (joblist);
+  pshtd_add_job_map2alm(joblist,map,alm1,0);
+  pshtd_execute_jobs (joblist, tinfo, alms);
+  pshtd_clear_joblist (joblist);
+
+  pshtd_set_ylm_table (joblist, table);
+  pshtd_add_job_alm2map(joblist,alm,map2,0);
+  pshtd_execute_jobs (joblist, tinfo, alms);
+  pshtd_clear_joblist (joblist);
+  pshtd_add_job_map2alm(joblist,map,alm2,0);
+  pshtd_execute_jobs (joblist, tinfo, alms);
+
+  errmap=max_rel_diff(map,map2,npix);
+  erralm=max_rel_diff(&alm1[0].re,&alm2[0].re,2*nalms);
+  printf("double precision Y_lm table: map error %e, alm error %e\n",
+    errmap, erralm);
+  UTIL_ASSERT((errmap<1e-12)&&(erralm<1e-12),
+    "double precision Y_lm table disagrees with the recursion");
+
+  pshtd_destroy_joblist(joblist);
+  psht_destroy_ylm_table(table);
+  DEALLOC(map);
+  DEALLOC(map2);
+  DEALLOC(alm1);
+  DEALLOC(alm2);
+  }
+
+static void check_ylm_table_s (psht_geom_info *tinfo, psht_alm_info *alms,
+  const pshtd_cmplx *alm, ptrdiff_t nalms, ptrdiff_t npix)
+  {
+  psht_ylm_table *table;
+  pshts_joblist *joblist;
+  float *map=RALLOC(float,npix), *map2=RALLOC(float,npix);
+  pshts_cmplx *alm0=RALLOC(pshts_cmplx,nalms),
+    *alm1=RALLOC(pshts_cmplx,nalms), *alm2=RALLOC(pshts_cmplx,nalms);
+  double errmap, erralm;
+  ptrdiff_t i;
+
+  for (i=0; i<nalms; ++i)
+    {
+    alm0[i].re=(float)alm[i].re;
+    alm0[i].im=(float)alm[i].im;
+    }
+
+  psht_make_ylm_table(tinfo,alms->lmax,alms->mmax,1,&table);
+  pshts_make_joblist (&joblist);
+
+  pshts_add_job_alm2map(joblist,alm0,map,0);
+  pshts_execute_jobs (joblist, tinfo, alms);
+  pshts_clear_joblist (joblist);
+  pshts_add_job_map2alm(joblist,map,alm1,0);
+  pshts_execute_jobs (joblist, tinfo, alms);
+  pshts_clear_joblist (joblist);
+
+  pshts_set_ylm_table (joblist, table);
+  pshts_add_job_alm2map(joblist,alm0,map2,0);
+  pshts_execute_jobs (joblist, tinfo, alms);
+  pshts_clear_joblist (joblist);
+  pshts_add_job_map2alm(joblist,map,alm2,0);
+  pshts_execute_jobs (joblist, tinfo, alms);
+
+  /* The table holds floats, whose relative accuracy is about 1e-7 */
+  errmap=max_rel_diff_f(map,map2,npix);
+  erralm=max_rel_diff_f(&alm1[0].re,&alm2[0].re,2*nalms);
+  printf("single precision Y_lm table: map error %e, alm error %e\n",
+    errmap, erralm);
+  UTIL_ASSERT((errmap<1e-5)&&(erralm<1e-5),
+    "single precision Y_lm table disagrees with the recursion");
+
+  pshts_destroy_joblist(joblist);
+  psht_destroy_ylm_table(table);
+  DEALLOC(map);
+  DEALLOC(map2);
+  DEALLOC(alm0);
+  DEALLOC(alm1);
+  DEALLOC(alm2);
+  }
+
 static void check_accuracy (psht_geom_info *tinfo, ptrdiff_t lmax,
   ptrdiff_t mmax, ptrdiff_t npix, int spin, int niter)
   {
@@ -196,6 +354,14 @@ static void check_accuracy (psht_geom_info *tinfo, ptrdiff_t lmax,
   pshtd_clear_joblist (joblist);
 
   map2alm_iter(tinfo, map, alm, alm2, lmax, mmax, npix, nalms, spin, niter);
+  map2alm_iter_internal(tinfo, map, alm, alm2, lmax, mmax, nalms, spin, niter);
+
+  if (spin==0)
+    {
+    printf ("\nY_lm tables:\n");
+    check_ylm_table_d(tinfo, alms, alm[0], nalms, npix);
+    check_ylm_table_s(tinfo, alms, alm[0], nalms, npix);
+    }
 
   DEALLOC2D(map);
   DEALLOC2D(alm);
@@ -20,28 +20,221 @@
 
 #include <hpixlib/hpix.h>
 #include <stdlib.h>
+#include <math.h>
 #include <assert.h>
 
+#include "constants.h"
+#include "rings.h"
+
+/* Geometry of a ring of pixels in the RING scheme. The rings are
+ * numbered from 1 (North) to 4 nside - 1 (South). */
+typedef struct {
+    hpix_pixel_num_t first_pixel;
+    unsigned int     num_of_pixels;
+    double           z;       /* cos(theta) of the centers */
+    _Bool            shifted; /* Is the first center at phi = pi / npix? */
+} ring_info_t;
+
+/**********************************************************************/
+
+
+static void
+get_ring_info(const hpix_resolution_t * resolution,
+	      unsigned int ring,
+	      ring_info_t * info)
+{
+    const unsigned int nside = resolution->nside;
+    const unsigned int north_ring =
+	(ring < 2 * nside) ? ring : 4 * nside - ring;
+
+    if(north_ring < nside)
+    {
+	/* Polar caps */
+	info->num_of_pixels = 4 * north_ring;
+	info->z = 1.0 - north_ring * (double) north_ring
+	    / (3.0 * nside * (double) nside);
+	info->shifted = TRUE;
+	info->first_pixel = 2 * (hpix_pixel_num_t) north_ring
+	    * (north_ring - 1);
+    } else {
+	/* Equatorial region */
+	info->num_of_pixels = 4 * nside;
+	info->z = (2.0 * nside - north_ring) * 2.0 / (3.0 * nside);
+	info->shifted = ((north_ring - nside) & 1) == 0;
+	info->first_pixel = resolution->ncap
+	    + (hpix_pixel_num_t) (north_ring - nside) * 4 * nside;
+    }
+
+    if(ring != north_ring)
+    {
+	/* Southern hemisphere */
+	info->z = -info->z;
+	info->first_pixel = resolution->num_of_pixels - info->first_pixel
+	    - info->num_of_pixels;
+    }
+}
+
+/**********************************************************************/
+
+
+static int
+compare_pixels(const void * a, const void * b)
+{
+    const hpix_pixel_num_t pixel_a = *((const hpix_pixel_num_t *) a);
+    const hpix_pixel_num_t pixel_b = *((const hpix_pixel_num_t *) b);
+
+    return (pixel_a > pixel_b) - (pixel_a < pixel_b);
+}
+
+/**********************************************************************/
+
+
+/* Find the pixels whose center is closer than "radius" to the
+ * direction (theta, phi), ring by ring. In each ring the pixels form
+ * (at most) one interval of longitudes around phi. */
+static void
+query_disc_centers(const hpix_resolution_t * resolution,
+		   hpix_ordering_scheme_t scheme,
+		   double theta, double phi, double radius,
+		   hpix_pixel_num_t ** pixels,
+		   size_t * num_of_matches)
+{
+    if(radius > M_PI)
+	radius = M_PI;
+
+    const unsigned int num_of_rings = 4 * resolution->nside - 1;
+    const double z0 = cos(theta);
+    const double sin_theta0 = sin(theta);
+    const double cos_radius = cos(radius);
+    size_t allocated = 64;
+    size_t count = 0;
+    hpix_pixel_num_t * result = hpix_malloc(sizeof(result[0]), allocated);
+
+    /* Only the rings between these colatitudes can intersect the disc */
+    const double z_max = (theta - radius <= 0.0) ? 1.0 : cos(theta - radius);
+    const double z_min = (theta + radius >= M_PI) ? -1.0 : cos(theta + radius);
+
+    const unsigned int first_ring =
+	(ring_above(resolution, z_max) > 1) ? ring_above(resolution, z_max) : 1;
+    const unsigned int last_ring =
+	(ring_above(resolution, z_min) + 1 < num_of_rings)
+	? ring_above(resolution, z_min) + 1
+	: num_of_rings;
+
+    for(unsigned int ring = first_ring; ring <= last_ring; ++ring)
+    {
+	ring_info_t info;
+	get_ring_info(resolution, ring, &info);
+	if(info.z > z_max || info.z < z_min)
+	    continue;
+
+	/* Half-width in longitude of the intersection between the
+	 * ring and the disc */
+	const double sin_theta = sqrt((1.0 - info.z) * (1.0 + info.z));
+	const double denominator = sin_theta * sin_theta0;
+	double half_width;
+
+	if(denominator < 1e-15)
+	    half_width = (z0 * info.z >= cos_radius) ? M_PI : -1.0;
+	else
+	{
+	    const double cos_dphi = (cos_radius - z0 * info.z) / denominator;
+	    if(cos_dphi > 1.0)
+		continue;
+	    half_width = (cos_dphi <= -1.0) ? M_PI : acos(cos_dphi);
+	}
+
+	if(half_width < 0.0)
+	    continue;
+
+	/* Centers are at phi = (j + offset) * dphi, j = 0..npix-1 */
+	const double dphi = 2.0 * M_PI / info.num_of_pixels;
+	const double offset = info.shifted ? 0.5 : 0.0;
+	long first, last;
+
+	if(half_width >= M_PI)
+	{
+	    first = 0;
+	    last = info.num_of_pixels - 1;
+	} else {
+	    first = (long) ceil((phi - half_width) / dphi - offset);
+	    last = (long) floor((phi + half_width) / dphi - offset);
+	    if(last - first + 1 >= (long) info.num_of_pixels)
+	    {
+		first = 0;
+		last = info.num_of_pixels - 1;
+	    }
+	}
+
+	if(last < first)
+	    continue;
+
+	if(count + (last - first + 1) > allocated)
+	{
+	    while(count + (last - first + 1) > allocated)
+		allocated *= 2;
+	    result = hpix_realloc(result, sizeof(result[0]) * allocated);
+	}
+
+	for(long j = first; j <= last; ++j)
+	{
+	    long wrapped = j % (long) info.num_of_pixels;
+	    if(wrapped < 0)
+		wrapped += info.num_of_pixels;
+
+	    result[count++] = info.first_pixel + wrapped;
+	}
+    }
+
+    if(scheme == HPIX_ORDER_SCHEME_NEST)
+    {
+	for(size_t idx = 0; idx < count; ++idx)
+	    result[idx] = hpix_ring_to_nest_idx(resolution, result[idx]);
+    }
+    qsort(result, count, sizeof(result[0]), compare_pixels);
+
+    *pixels = result;
+    *num_of_matches = count;
+}
+
+/**********************************************************************/
+
+
 void
-hpix_query_disc(double theta, double phi, double radius,
+hpix_query_disc(const hpix_resolution_t * resolution,
+		hpix_ordering_scheme_t scheme,
+		double theta, double phi, double radius,
 		hpix_pixel_num_t ** pixels,
 		size_t * num_of_matches)
 {
+    assert(resolution != NULL);
     assert(pixels != NULL);
     assert(num_of_matches != NULL);
+    assert(radius >= 0.0);
 
-    *pixels = NULL;
-    *num_of_matches = 0;
+    query_disc_centers(resolution, scheme, theta, phi, radius,
+		       pixels, num_of_matches);
 }
 
+/**********************************************************************/
+
+
 void
-hpix_query_disc_inclusive(double theta, double phi, double radius,
+hpix_query_disc_inclusive(const hpix_resolution_t * resolution,
+			  hpix_ordering_scheme_t scheme,
+			  double theta, double phi, double radius,
 			  hpix_pixel_num_t ** pixels,
 			  size_t * num_of_matches)
 {
+    assert(resolution != NULL);
     assert(pixels != NULL);
     assert(num_of_matches != NULL);
+    assert(radius >= 0.0);
 
-    *pixels = NULL;
-    *num_of_matches = 0;
+    /* A pixel overlaps the disc only if its center is closer than
+     * the radius plus the size of the pixel. A few more pixels than
+     * necessary can be returned. */
+    query_disc_centers(resolution, scheme, theta, phi,
+		       radius + hpix_max_pixel_radius(resolution->nside),
+		       pixels, num_of_matches);
 }
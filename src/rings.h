@@ -0,0 +1,42 @@
+/* rings.h -- Private helpers for the rings of Healpix maps
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef RINGS_H
+#define RINGS_H
+
+#include <hpixlib/hpix.h>
+#include <math.h>
+
+/* Return the number of the ring (counted from 1 at the North pole)
+ * just north of the point with the given z = cos(theta), or 0 if the
+ * point is north of the first ring. This is inline because the
+ * interpolation functions call it once per point. */
+static inline unsigned int
+ring_above(const hpix_resolution_t * resolution, double z)
+{
+    const double abs_z = fabs(z);
+
+    if(abs_z <= 2.0 / 3.0)
+	return (unsigned int) (resolution->nside * (2.0 - 1.5 * z));
+
+    const unsigned int ring =
+	(unsigned int) (resolution->nside * sqrt(3.0 * (1.0 - abs_z)));
+    return (z > 0.0) ? ring : resolution->nside_times_four - ring - 1;
+}
+
+#endif
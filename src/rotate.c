@@ -21,11 +21,61 @@
 #include <math.h>
 #include <assert.h>
 
+#include "psht.h"
+#include "psht_geomhelpers.h"
+#include "psht_almhelpers.h"
+#include "sht_geometry.h"
+
+#ifndef M_PI
+#define M_PI 3.141592653589793
+#endif
+
+/* Rotation from equatorial (ICRS) to Galactic coordinates, as defined
+ * by the Hipparcos catalogue (ESA 1997, vol. 1, sect. 1.5.3) */
+static const hpix_matrix_t equatorial_to_galactic = { {
+	{ -0.0548755604162154, -0.8734370902348850, -0.4838350155487132 },
+	{  0.4941094278755837, -0.4448296299600112,  0.7469822444972189 },
+	{ -0.8676661490190047, -0.1980763734312015,  0.4559837761750669 }
+    } };
+
+/* Obliquity of the ecliptic at J2000, in degrees */
+#define OBLIQUITY_J2000_DEG 23.4392911
+
+/* Number of pixels rotated at a time by each thread in
+ * rotate_map_in_pixel_space */
+#define PIXEL_ROTATION_BATCH 1024
+
+/* Maximum number of Jacobi iterations used to improve the a_lm of
+ * the map before rotating them, and the relative residual at which
+ * they stop. Below l = 2 NSIDE each iteration reduces the residual by
+ * about one order of magnitude */
+#define HARMONIC_ROTATION_ITERATIONS 8
+#define HARMONIC_ROTATION_EPSILON 1e-10
+
+/**********************************************************************/
+
+
+/* Both functions use atan2(|v1 x v2|, v1 . v2), which, unlike
+ * acos(v1 . v2), is accurate for very small and very large angles */
 double
 hpix_calc_angular_distance_from_vectors(const hpix_vector_t * vector1,
 					const hpix_vector_t * vector2)
 {
-    return 0.0;
+    assert(vector1);
+    assert(vector2);
+
+    const hpix_vector_t cross = {
+	.x = vector1->y * vector2->z - vector1->z * vector2->y,
+	.y = vector1->z * vector2->x - vector1->x * vector2->z,
+	.z = vector1->x * vector2->y - vector1->y * vector2->x
+    };
+
+    if(hpix_vector_length(vector1) == 0.0
+       || hpix_vector_length(vector2) == 0.0)
+	return NAN;
+
+    return atan2(hpix_vector_length(&cross),
+		 hpix_dot_product(vector1, vector2));
 }
 
 /**********************************************************************/
@@ -35,9 +85,493 @@ double
 hpix_calc_angular_distance_from_angles(double theta1_rad, double phi1_rad,
 				       double theta2_rad, double phi2_rad)
 {
-    return 0.0;
+    const double delta_phi = phi2_rad - phi1_rad;
+    const double sin_theta1 = sin(theta1_rad), cos_theta1 = cos(theta1_rad);
+    const double sin_theta2 = sin(theta2_rad), cos_theta2 = cos(theta2_rad);
+    const double term1 = sin_theta2 * sin(delta_phi);
+    const double term2 = sin_theta1 * cos_theta2
+	- cos_theta1 * sin_theta2 * cos(delta_phi);
+
+    return atan2(sqrt(term1 * term1 + term2 * term2),
+		 cos_theta1 * cos_theta2
+		 + sin_theta1 * sin_theta2 * cos(delta_phi));
 }
 
 /**********************************************************************/
 
 
+
+/**********************************************************************/
+
+
+/* Compute the matrix which converts equatorial coordinates into
+ * `coord`. Return FALSE if the system is unknown. */
+static int
+matrix_from_equatorial(hpix_coordinates_t coord, hpix_matrix_t * matrix)
+{
+    switch(coord)
+    {
+    case HPIX_COORD_CELESTIAL:
+	hpix_set_matrix_to_unity(matrix);
+	return TRUE;
+
+    case HPIX_COORD_GALACTIC:
+	*matrix = equatorial_to_galactic;
+	return TRUE;
+
+    case HPIX_COORD_ECLIPTIC:
+    {
+	const double obliquity = OBLIQUITY_J2000_DEG * M_PI / 180.0;
+
+	hpix_set_matrix_to_unity(matrix);
+	matrix->m[1][1] = matrix->m[2][2] = cos(obliquity);
+	matrix->m[1][2] = sin(obliquity);
+	matrix->m[2][1] = -sin(obliquity);
+	return TRUE;
+    }
+
+    default:
+	return FALSE;
+    }
+}
+
+/**********************************************************************/
+
+
+static void
+transpose_matrix(hpix_matrix_t * result, const hpix_matrix_t * matrix)
+{
+    for(int i = 0; i < 3; ++i)
+    {
+	for(int j = 0; j < 3; ++j)
+	    result->m[i][j] = matrix->m[j][i];
+    }
+}
+
+/**********************************************************************/
+
+
+int
+hpix_coordinate_rotation_matrix(hpix_coordinates_t source_coord,
+				hpix_coordinates_t target_coord,
+				hpix_matrix_t * matrix)
+{
+    hpix_matrix_t from_equatorial, to_equatorial;
+
+    assert(matrix);
+
+    if(source_coord == target_coord)
+    {
+	hpix_set_matrix_to_unity(matrix);
+	return TRUE;
+    }
+
+    if(! matrix_from_equatorial(source_coord, &from_equatorial)
+       || ! matrix_from_equatorial(target_coord, matrix))
+	return FALSE;
+
+    /* Rotation matrices are orthogonal */
+    transpose_matrix(&to_equatorial, &from_equatorial);
+    hpix_matrix_mul(&from_equatorial, matrix, &to_equatorial);
+    *matrix = from_equatorial;
+
+    return TRUE;
+}
+
+/**********************************************************************/
+
+
+/* Each pixel of `result` takes the value interpolated at the
+ * direction which the rotation moves into its center */
+static void
+rotate_map_in_pixel_space(const hpix_map_t * map,
+			  const hpix_matrix_t * inverse_matrix,
+			  hpix_map_t * result)
+{
+    const hpix_resolution_t * resolution = hpix_map_resolution(result);
+    const size_t num_of_pixels = hpix_map_num_of_pixels(result);
+    double * result_pixels = hpix_map_pixels(result);
+    hpix_pixel_to_vector * pixel_to_vector_fn =
+	(hpix_map_ordering_scheme(result) == HPIX_ORDER_SCHEME_NEST)
+	? hpix_nest_pixel_to_vector
+	: hpix_ring_pixel_to_vector;
+
+#pragma omp parallel for default(shared) schedule(static)
+    for(size_t first_pixel = 0;
+	first_pixel < num_of_pixels;
+	first_pixel += PIXEL_ROTATION_BATCH)
+    {
+	const size_t batch_size =
+	    (first_pixel + PIXEL_ROTATION_BATCH < num_of_pixels)
+	    ? PIXEL_ROTATION_BATCH
+	    : num_of_pixels - first_pixel;
+	double x[PIXEL_ROTATION_BATCH];
+	double y[PIXEL_ROTATION_BATCH];
+	double z[PIXEL_ROTATION_BATCH];
+	hpix_vector_batch_t batch = {
+	    .num_of_vectors = batch_size,
+	    .x = x, .y = y, .z = z,
+	    .memory = NULL
+	};
+	double theta[PIXEL_ROTATION_BATCH];
+	double phi[PIXEL_ROTATION_BATCH];
+
+	for(size_t idx = 0; idx < batch_size; ++idx)
+	{
+	    hpix_vector_t vector;
+
+	    pixel_to_vector_fn(resolution, first_pixel + idx, &vector);
+	    x[idx] = vector.x;
+	    y[idx] = vector.y;
+	    z[idx] = vector.z;
+	}
+
+	hpix_matrix_vector_batch_mul(&batch, inverse_matrix, &batch);
+
+	for(size_t idx = 0; idx < batch_size; ++idx)
+	{
+	    const hpix_vector_t source = { .x = x[idx], .y = y[idx], .z = z[idx] };
+	    hpix_vector_to_angles(&source, &theta[idx], &phi[idx]);
+	}
+
+	/* The rotated directions of neighbouring pixels are close to
+	 * each other, so there is no need to sort them. Unless nested
+	 * parallelism is enabled, the call runs in the current thread. */
+	hpix_interpolate_map(map, theta, phi, result_pixels + first_pixel,
+			     batch_size, HPIX_KEEP_POINT_ORDER);
+    }
+}
+
+/**********************************************************************/
+
+
+/* Compute rows 0...`max_row` of the Wigner matrix for 2j = n + 1
+ * from the ones for 2j = n. Row k and column i of the matrix for
+ * 2j = n contain d^j_{j-k, j-i}; the new column n + 1 is added on the
+ * right. The recursion adds one spin-1/2 to the representation, as in
+ * Risbo (1996), J. Geodesy 70, 383: each element of the new matrix is
+ * a combination of four elements of the old one, whose weights are
+ * never larger than one, so that rounding errors do not grow with l.
+ * Each row depends only on the old values of itself and of the row
+ * above, so the rows are shared among the threads of the enclosing
+ * parallel region. */
+static void
+wigner_half_step(const double * old_d, double * new_d, size_t row_width,
+		 unsigned int n, unsigned int max_row,
+		 const double * sqrt_table, double p, double q)
+{
+    const unsigned int j = n + 1;
+    const double inv_j = 1.0 / j;
+
+#pragma omp for schedule(static)
+    for(unsigned int row = 0; row <= max_row; ++row)
+    {
+	const double * current = old_d + row * row_width;
+	const double * previous = (row > 0) ? current - row_width : NULL;
+	double * dest = new_d + row * row_width;
+	/* Weights of the old rows `row` and `row - 1` */
+	const double a = sqrt_table[j - row] * inv_j;
+	const double b = sqrt_table[row] * inv_j;
+
+	for(unsigned int col = 0; col <= j; ++col)
+	{
+	    const double c = sqrt_table[j - col];
+	    const double s = sqrt_table[col];
+	    double value = 0.0;
+
+	    if(col <= n)
+		value += q * a * c * current[col];
+	    if(col >= 1)
+		value -= p * a * s * current[col - 1];
+
+	    if(previous != NULL)
+	    {
+		if(col <= n)
+		    value += p * b * c * previous[col];
+		if(col >= 1)
+		    value += q * b * s * previous[col - 1];
+	    }
+
+	    dest[col] = value;
+	}
+    }
+}
+
+/**********************************************************************/
+
+
+void
+hpix_rotate_alm(int lmax, const ptrdiff_t * mstart, ptrdiff_t stride,
+		double * alm, double psi, double theta, double phi)
+{
+    const size_t row_width = 2 * lmax + 2;
+    const double p = sin(0.5 * theta);
+    const double q = cos(0.5 * theta);
+
+    assert(lmax >= 0);
+    assert(alm);
+
+    /* Since d^l_{m,m'} = d^l_{-m',-m}, only the rows with m >= 0 (plus
+     * one row used by the recursion) are needed. The recursion goes
+     * back and forth between two matrices. */
+    double * d1 = hpix_calloc(sizeof(double), (lmax + 2) * row_width);
+    double * d2 = hpix_calloc(sizeof(double), (lmax + 2) * row_width);
+    double * sqrt_table = hpix_malloc(sizeof(double), row_width + 1);
+    double * exp_psi = hpix_malloc(sizeof(double), 2 * (lmax + 1));
+    double * exp_phi = hpix_malloc(sizeof(double), 2 * (lmax + 1));
+    double * rotated = hpix_malloc(sizeof(double), 2 * (lmax + 1));
+    ptrdiff_t * triangular_mstart = NULL;
+
+    if(mstart == NULL)
+    {
+	triangular_mstart = hpix_malloc(sizeof(ptrdiff_t), lmax + 1);
+	for(int m = 0; m <= lmax; ++m)
+	    triangular_mstart[m] = stride * ((m * (2 * lmax + 1 - m)) / 2);
+	mstart = triangular_mstart;
+    }
+
+    for(size_t idx = 0; idx <= row_width; ++idx)
+	sqrt_table[idx] = sqrt(idx);
+
+    for(int m = 0; m <= lmax; ++m)
+    {
+	exp_psi[2 * m] = cos(m * psi);
+	exp_psi[2 * m + 1] = -sin(m * psi);
+	exp_phi[2 * m] = cos(m * phi);
+	exp_phi[2 * m + 1] = -sin(m * phi);
+    }
+
+    d1[0] = 1.0;
+
+    /* Each value of l depends on the previous one, so the threads
+     * split the work for every l among themselves */
+#pragma omp parallel default(shared)
+    {
+	double * d = d1;
+	double * scratch = d2;
+
+	for(int l = 0; l <= lmax; ++l)
+	{
+	    if(l > 0)
+	    {
+		const unsigned int n = 2 * l - 2;
+
+		/* Fill row l from row l - 2 using the symmetry
+		 * d^j_{-m,-m'} = (-1)^{m-m'} d^j_{m,m'} */
+		if(l >= 2)
+		{
+		    double * row = d + l * row_width;
+		    const double * mirror = d + (l - 2) * row_width;
+
+#pragma omp for schedule(static)
+		    for(unsigned int col = 0; col <= n; ++col)
+		    {
+			row[col] = ((n - col - l) & 1)
+			    ? -mirror[n - col] : mirror[n - col];
+		    }
+		}
+
+		wigner_half_step(d, scratch, row_width, n, l,
+				 sqrt_table, p, q);
+		wigner_half_step(scratch, d, row_width, n + 1, l,
+				 sqrt_table, p, q);
+	    }
+
+	    /* Row l - m, column l - m' now contains d^l_{m,m'}. The
+	     * terms with m' < 0 are folded into the ones with m' > 0
+	     * using a_{l,-m'} = (-1)^m' conj(a_{l,m'}). */
+#pragma omp for schedule(static)
+	    for(int m = 0; m <= l; ++m)
+	    {
+		const double * row = d + (l - m) * row_width;
+		const double * a0 = alm + 2 * (mstart[0] + stride * l);
+		double sum_re = a0[0] * row[l];
+		double sum_im = a0[1] * row[l];
+
+		for(int m1 = 1; m1 <= l; ++m1)
+		{
+		    const double * a = alm + 2 * (mstart[m1] + stride * l);
+		    const double t_re = a[0] * exp_psi[2 * m1]
+			- a[1] * exp_psi[2 * m1 + 1];
+		    const double t_im = a[0] * exp_psi[2 * m1 + 1]
+			+ a[1] * exp_psi[2 * m1];
+		    const double d_plus = row[l - m1];
+		    const double d_minus = (m1 & 1) ? -row[l + m1] : row[l + m1];
+
+		    sum_re += t_re * (d_plus + d_minus);
+		    sum_im += t_im * (d_plus - d_minus);
+		}
+
+		rotated[2 * m] = sum_re;
+		rotated[2 * m + 1] = sum_im;
+	    }
+
+#pragma omp for schedule(static)
+	    for(int m = 0; m <= l; ++m)
+	    {
+		double * dest = alm + 2 * (mstart[m] + stride * l);
+
+		dest[0] = rotated[2 * m] * exp_phi[2 * m]
+		    - rotated[2 * m + 1] * exp_phi[2 * m + 1];
+		dest[1] = rotated[2 * m] * exp_phi[2 * m + 1]
+		    + rotated[2 * m + 1] * exp_phi[2 * m];
+	    }
+	}
+    }
+
+    hpix_free(triangular_mstart);
+    hpix_free(rotated);
+    hpix_free(exp_phi);
+    hpix_free(exp_psi);
+    hpix_free(sqrt_table);
+    hpix_free(d2);
+    hpix_free(d1);
+}
+
+/**********************************************************************/
+
+
+/* Decompose the map in spherical harmonics, rotate the a_lm and
+ * synthesize them back. The result is accurate for maps whose band
+ * limit is not larger than 2 NSIDE: beyond that, the HEALPix
+ * quadrature makes the iterations converge too slowly. Masked pixels
+ * are set to zero before the decomposition; the mask itself is
+ * rotated in pixel space. */
+static void
+rotate_map_in_harmonic_space(const hpix_map_t * map,
+			     const hpix_matrix_t * matrix,
+			     const hpix_matrix_t * inverse_matrix,
+			     hpix_map_t * result)
+{
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    const size_t num_of_pixels = hpix_map_num_of_pixels(map);
+    const double * pixels = hpix_map_pixels(map);
+    const int is_nest = hpix_map_ordering_scheme(map) == HPIX_ORDER_SCHEME_NEST;
+    const int lmax = 2 * hpix_map_nside(map);
+    double * ring_pixels = hpix_malloc(sizeof(double), num_of_pixels);
+    _Bool has_masked_pixels = FALSE;
+    const psht_geom_info * geom_info;
+    psht_alm_info * alm_info;
+    pshtd_joblist * joblist;
+    pshtd_cmplx * alm;
+    double psi, theta, phi;
+
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+    {
+	const double value =
+	    pixels[is_nest ? hpix_ring_to_nest_idx(resolution, idx) : idx];
+
+	if(HPIX_IS_MASKED(value))
+	{
+	    ring_pixels[idx] = 0.0;
+	    has_masked_pixels = TRUE;
+	} else
+	    ring_pixels[idx] = value;
+    }
+
+    geom_info = sht_geometry(resolution);
+    psht_make_triangular_alm_info(lmax, lmax, 1, &alm_info);
+    alm = hpix_calloc(sizeof(alm[0]), (size_t) (lmax + 1) * (lmax + 2) / 2);
+
+    pshtd_make_joblist(&joblist);
+    pshtd_add_job_map2alm(joblist, ring_pixels, alm, 0);
+    pshtd_execute_map2alm_iter(joblist, geom_info, alm_info,
+			       HARMONIC_ROTATION_ITERATIONS,
+			       HARMONIC_ROTATION_EPSILON, NULL, NULL);
+
+    hpix_matrix_to_euler_angles(matrix, &psi, &theta, &phi);
+    hpix_rotate_alm(lmax, alm_info->mstart, alm_info->stride,
+		    (double *) alm, psi, theta, phi);
+
+    pshtd_clear_joblist(joblist);
+    pshtd_add_job_alm2map(joblist, alm, ring_pixels, 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    pshtd_destroy_joblist(joblist);
+    hpix_free(alm);
+    psht_destroy_alm_info(alm_info);
+
+    double * result_pixels = hpix_map_pixels(result);
+    hpix_pixel_to_vector * pixel_to_vector_fn =
+	is_nest ? hpix_nest_pixel_to_vector : hpix_ring_pixel_to_vector;
+    hpix_vector_to_pixel_fn_t * vector_to_pixel_fn =
+	is_nest ? hpix_vector_to_nest_pixel : hpix_vector_to_ring_pixel;
+
+#pragma omp parallel for default(shared)
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+    {
+	result_pixels[idx] =
+	    ring_pixels[is_nest ? hpix_nest_to_ring_idx(resolution, idx) : idx];
+
+	if(has_masked_pixels)
+	{
+	    hpix_vector_t vector, source;
+
+	    pixel_to_vector_fn(resolution, idx, &vector);
+	    hpix_matrix_vector_mul(&source, inverse_matrix, &vector);
+	    if(HPIX_IS_MASKED(pixels[vector_to_pixel_fn(resolution, &source)]))
+		result_pixels[idx] = NAN;
+	}
+    }
+
+    hpix_free(ring_pixels);
+}
+
+/**********************************************************************/
+
+
+hpix_map_t *
+hpix_rotate_map(const hpix_map_t * map,
+		const hpix_matrix_t * matrix,
+		hpix_rotation_mode_t mode)
+{
+    hpix_matrix_t inverse_matrix;
+    hpix_map_t * result;
+
+    assert(map);
+    assert(matrix);
+
+    transpose_matrix(&inverse_matrix, matrix);
+    result = hpix_create_map(hpix_map_nside(map),
+			     hpix_map_ordering_scheme(map));
+    result->coord = map->coord;
+
+    switch(mode)
+    {
+    case HPIX_ROTATE_PIXEL:
+	rotate_map_in_pixel_space(map, &inverse_matrix, result);
+	break;
+
+    case HPIX_ROTATE_HARMONIC:
+	rotate_map_in_harmonic_space(map, matrix, &inverse_matrix, result);
+	break;
+
+    default:
+	assert(0);
+    }
+
+    return result;
+}
+
+/**********************************************************************/
+
+
+hpix_map_t *
+hpix_rotate_map_coords(const hpix_map_t * map,
+		       hpix_coordinates_t target_coord,
+		       hpix_rotation_mode_t mode)
+{
+    hpix_matrix_t matrix;
+    hpix_map_t * result;
+
+    assert(map);
+
+    if(! hpix_coordinate_rotation_matrix(hpix_map_coordinate_system(map),
+					 target_coord, &matrix))
+	return NULL;
+
+    result = hpix_rotate_map(map, &matrix, mode);
+    result->coord = target_coord;
+
+    return result;
+}
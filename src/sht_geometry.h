@@ -0,0 +1,32 @@
+/* sht_geometry.h -- Geometry of Healpix maps used by spherical harmonic
+ *                   transforms
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+
+#ifndef SHT_GEOMETRY_H
+#define SHT_GEOMETRY_H
+
+#include <hpixlib/hpix.h>
+#include "psht.h"
+
+/* Return the psht description of a RING map with the given
+ * resolution. The object is shared by all the maps with the same
+ * resolution and must not be destroyed. Implemented in smoothing.c. */
+const psht_geom_info *
+sht_geometry(const hpix_resolution_t * resolution);
+
+#endif
@@ -0,0 +1,330 @@
+/* smoothing.c -- Convolve maps with a beam using spherical harmonics
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <math.h>
+#include <assert.h>
+
+#include "psht.h"
+#include "psht_geomhelpers.h"
+#include "psht_almhelpers.h"
+#include "sht_geometry.h"
+
+static void *
+create_sht_geometry(const hpix_resolution_t * resolution)
+{
+    psht_geom_info * geom_info;
+
+    psht_make_healpix_geom_info(resolution->nside, 1, &geom_info);
+    return geom_info;
+}
+
+/******************************************************************************/
+
+static void
+free_sht_geometry(void * geom_info)
+{
+    psht_destroy_geom_info(geom_info);
+}
+
+/******************************************************************************/
+
+const psht_geom_info *
+sht_geometry(const hpix_resolution_t * resolution)
+{
+    return hpix_resolution_cache(resolution,
+				 create_sht_geometry,
+				 free_sht_geometry);
+}
+
+/******************************************************************************/
+
+/* The maps passed to psht must be in RING order and must not contain
+ * masked pixels. The following two functions take care of this: the
+ * first one converts the map (and remembers where the masked pixels
+ * were and what they contained, as masks can be marked both by NaN
+ * and by the UNSEEN value), the second one restores the original
+ * state. */
+
+typedef struct {
+    size_t num_of_pixels;
+    size_t * indexes;
+    double * values;
+} masked_pixels_t;
+
+static void
+prepare_map_for_sht(hpix_map_t * map, masked_pixels_t * masked)
+{
+    size_t num_of_pixels = hpix_map_num_of_pixels(map);
+    double * pixels = hpix_map_pixels(map);
+    size_t count = 0;
+
+    if(map->scheme == HPIX_ORDER_SCHEME_NEST)
+	hpix_switch_order(map);
+
+    masked->num_of_pixels = 0;
+    masked->indexes = NULL;
+    masked->values = NULL;
+
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+    {
+	if(HPIX_IS_MASKED(pixels[idx]))
+	    ++count;
+    }
+
+    if(count == 0)
+	return;
+
+    masked->indexes = hpix_malloc(sizeof(masked->indexes[0]), count);
+    masked->values = hpix_malloc(sizeof(masked->values[0]), count);
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+    {
+	if(HPIX_IS_MASKED(pixels[idx]))
+	{
+	    masked->indexes[masked->num_of_pixels] = idx;
+	    masked->values[masked->num_of_pixels] = pixels[idx];
+	    ++masked->num_of_pixels;
+	    pixels[idx] = 0.0;
+	}
+    }
+}
+
+/******************************************************************************/
+
+static void
+restore_map_after_sht(hpix_map_t * map,
+		      hpix_ordering_scheme_t original_scheme,
+		      masked_pixels_t * masked)
+{
+    double * pixels = hpix_map_pixels(map);
+
+    for(size_t idx = 0; idx < masked->num_of_pixels; ++idx)
+	pixels[masked->indexes[idx]] = masked->values[idx];
+
+    hpix_free(masked->indexes);
+    hpix_free(masked->values);
+
+    if(map->scheme != original_scheme)
+	hpix_switch_order(map);
+}
+
+/******************************************************************************/
+
+static int
+default_lmax(const hpix_map_t * map, int lmax)
+{
+    if(lmax > 0)
+	return lmax;
+
+    return 3 * hpix_map_nside(map) - 1;
+}
+
+/******************************************************************************/
+
+double *
+hpix_gaussian_window_function(double fwhm_rad, int lmax, int spin)
+{
+    const double sigma = fwhm_rad / sqrt(8.0 * log(2.0));
+    double * window = hpix_malloc(sizeof(window[0]), lmax + 1);
+
+    assert(lmax >= 0);
+
+    /* For spin-s fields (e.g. polarization, s = 2), the window
+     * function of a Gaussian beam gets an additional factor exp(s^2
+     * sigma^2 / 2), see Challinor et al. (2000). */
+    for(int l = 0; l <= lmax; ++l)
+    {
+	if(l < spin)
+	    window[l] = 0.0;
+	else
+	    window[l] = exp(-0.5 * (l * (l + 1.0) - spin * spin)
+			    * sigma * sigma);
+    }
+
+    return window;
+}
+
+/******************************************************************************/
+
+/* Multiply the a_lm in "alm" by the window function "window" */
+static void
+apply_window_function(const psht_alm_info * alm_info,
+		      pshtd_cmplx * alm,
+		      const double * window,
+		      int lmax)
+{
+#pragma omp parallel for default(shared) schedule(dynamic, 1)
+    for(int m = 0; m <= lmax; ++m)
+    {
+	for(int l = m; l <= lmax; ++l)
+	{
+	    const ptrdiff_t idx = psht_alm_index(alm_info, l, m);
+
+	    alm[idx].re *= window[l];
+	    alm[idx].im *= window[l];
+	}
+    }
+}
+
+/******************************************************************************/
+
+static size_t
+num_of_alm(int lmax)
+{
+    return (size_t) (lmax + 1) * (lmax + 2) / 2;
+}
+
+/******************************************************************************/
+
+void
+hpix_smooth_map_inplace(hpix_map_t * map, const double * window, int lmax)
+{
+    hpix_ordering_scheme_t original_scheme;
+    const psht_geom_info * geom_info;
+    psht_alm_info * alm_info;
+    pshtd_joblist * joblist;
+    pshtd_cmplx * alm;
+    masked_pixels_t masked;
+
+    assert(map);
+    assert(window);
+
+    lmax = default_lmax(map, lmax);
+    original_scheme = map->scheme;
+    prepare_map_for_sht(map, &masked);
+
+    geom_info = sht_geometry(hpix_map_resolution(map));
+    psht_make_triangular_alm_info(lmax, lmax, 1, &alm_info);
+    alm = hpix_malloc(sizeof(alm[0]), num_of_alm(lmax));
+
+    pshtd_make_joblist(&joblist);
+    pshtd_add_job_map2alm(joblist, map->pixels, alm, 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    apply_window_function(alm_info, alm, window, lmax);
+
+    pshtd_clear_joblist(joblist);
+    pshtd_add_job_alm2map(joblist, alm, map->pixels, 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    pshtd_destroy_joblist(joblist);
+    hpix_free(alm);
+    psht_destroy_alm_info(alm_info);
+
+    restore_map_after_sht(map, original_scheme, &masked);
+}
+
+/******************************************************************************/
+
+void
+hpix_smooth_map_gaussian_inplace(hpix_map_t * map, double fwhm_rad, int lmax)
+{
+    double * window;
+
+    assert(map);
+
+    lmax = default_lmax(map, lmax);
+    window = hpix_gaussian_window_function(fwhm_rad, lmax, 0);
+    hpix_smooth_map_inplace(map, window, lmax);
+    hpix_free(window);
+}
+
+/******************************************************************************/
+
+void
+hpix_smooth_pol_maps_inplace(hpix_map_t * map_i,
+			     hpix_map_t * map_q,
+			     hpix_map_t * map_u,
+			     const double * window_i,
+			     const double * window_pol,
+			     int lmax)
+{
+    hpix_ordering_scheme_t original_scheme[3];
+    hpix_map_t * maps[3] = { map_i, map_q, map_u };
+    masked_pixels_t masked[3];
+    const psht_geom_info * geom_info;
+    psht_alm_info * alm_info;
+    pshtd_joblist * joblist;
+    pshtd_cmplx * alm[3];
+
+    assert(map_i && map_q && map_u);
+    assert(window_i && window_pol);
+    assert(hpix_map_nside(map_i) == hpix_map_nside(map_q)
+	   && hpix_map_nside(map_i) == hpix_map_nside(map_u));
+
+    lmax = default_lmax(map_i, lmax);
+    for(int i = 0; i < 3; ++i)
+    {
+	original_scheme[i] = maps[i]->scheme;
+	prepare_map_for_sht(maps[i], &masked[i]);
+	alm[i] = hpix_malloc(sizeof(alm[i][0]), num_of_alm(lmax));
+    }
+
+    geom_info = sht_geometry(hpix_map_resolution(map_i));
+    psht_make_triangular_alm_info(lmax, lmax, 1, &alm_info);
+
+    /* The gradient and curl components (alm[1] and alm[2]) are both
+     * smoothed using "window_pol" */
+    pshtd_make_joblist(&joblist);
+    pshtd_add_job_map2alm_pol(joblist,
+			      map_i->pixels, map_q->pixels, map_u->pixels,
+			      alm[0], alm[1], alm[2], 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    apply_window_function(alm_info, alm[0], window_i, lmax);
+    apply_window_function(alm_info, alm[1], window_pol, lmax);
+    apply_window_function(alm_info, alm[2], window_pol, lmax);
+
+    pshtd_clear_joblist(joblist);
+    pshtd_add_job_alm2map_pol(joblist, alm[0], alm[1], alm[2],
+			      map_i->pixels, map_q->pixels, map_u->pixels, 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    pshtd_destroy_joblist(joblist);
+    psht_destroy_alm_info(alm_info);
+
+    for(int i = 0; i < 3; ++i)
+    {
+	hpix_free(alm[i]);
+	restore_map_after_sht(maps[i], original_scheme[i], &masked[i]);
+    }
+}
+
+/******************************************************************************/
+
+void
+hpix_smooth_pol_maps_gaussian_inplace(hpix_map_t * map_i,
+				      hpix_map_t * map_q,
+				      hpix_map_t * map_u,
+				      double fwhm_rad,
+				      int lmax)
+{
+    double * window_i;
+    double * window_pol;
+
+    assert(map_i);
+
+    lmax = default_lmax(map_i, lmax);
+    window_i = hpix_gaussian_window_function(fwhm_rad, lmax, 0);
+    window_pol = hpix_gaussian_window_function(fwhm_rad, lmax, 2);
+    hpix_smooth_pol_maps_inplace(map_i, map_q, map_u,
+				 window_i, window_pol, lmax);
+    hpix_free(window_pol);
+    hpix_free(window_i);
+}
@@ -0,0 +1,231 @@
+/* tiff_output.c -- Save projections of very large maps as TIFF files
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include "config.h"
+
+#include <hpixlib/hpix.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+/* The image is written as an uncompressed baseline TIFF file with 8-bit
+ * RGBA samples, one TIFF strip for each strip produced by
+ * hpix_bmp_projection_render_strips. Since the size of every strip is
+ * known in advance, the header and the directory are written before
+ * the image, and the file never needs to be rewound: it can be a
+ * pipe. Only one strip at a time is kept in memory by each thread.
+ *
+ * All numbers are little-endian, as stated by the first two bytes of
+ * the file ("II"). */
+
+/* Number of rows in each TIFF strip */
+#define TIFF_ROWS_PER_STRIP 64
+
+/* Number of entries in the image file directory (IFD) */
+#define TIFF_NUM_OF_TAGS 11
+
+/* Size of the header and of the IFD, which is stored just after it */
+#define TIFF_HEADER_SIZE 8
+#define TIFF_IFD_SIZE    (2 + TIFF_NUM_OF_TAGS * 12 + 4)
+
+enum {
+    TIFF_SHORT = 3,
+    TIFF_LONG = 4
+};
+
+/**********************************************************************/
+
+
+static unsigned char *
+put_uint16(unsigned char * buf, uint16_t value)
+{
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    return buf + 2;
+}
+
+/**********************************************************************/
+
+
+static unsigned char *
+put_uint32(unsigned char * buf, uint32_t value)
+{
+    buf[0] = value & 0xFF;
+    buf[1] = (value >> 8) & 0xFF;
+    buf[2] = (value >> 16) & 0xFF;
+    buf[3] = (value >> 24) & 0xFF;
+    return buf + 4;
+}
+
+/**********************************************************************/
+
+
+/* Write one entry of the IFD. Values which fit in four bytes are
+ * stored in the entry itself, otherwise `value` is an offset. */
+static unsigned char *
+put_tag(unsigned char * buf, uint16_t tag, uint16_t type,
+	uint32_t count, uint32_t value)
+{
+    buf = put_uint16(buf, tag);
+    buf = put_uint16(buf, type);
+    buf = put_uint32(buf, count);
+
+    if(type == TIFF_SHORT && count == 1)
+    {
+	buf = put_uint16(buf, value);
+	return put_uint16(buf, 0);
+    }
+
+    return put_uint32(buf, value);
+}
+
+/**********************************************************************/
+
+
+typedef struct {
+    FILE * file;
+    unsigned int width;
+    /* Buffer for one strip, converted into RGBA bytes */
+    unsigned char * bytes;
+} tiff_writer_t;
+
+static int
+write_strip(const uint32_t * strip,
+	    unsigned int first_row,
+	    unsigned int num_of_rows,
+	    void * user_data)
+{
+    tiff_writer_t * writer = user_data;
+    const size_t num_of_cells = (size_t) writer->width * num_of_rows;
+    unsigned char * dest = writer->bytes;
+
+    (void) first_row;
+
+    for(size_t idx = 0; idx < num_of_cells; ++idx, dest += 4)
+    {
+	const uint32_t color = strip[idx];
+
+	dest[0] = (color >> 16) & 0xFF;
+	dest[1] = (color >> 8) & 0xFF;
+	dest[2] = color & 0xFF;
+	dest[3] = (color >> 24) & 0xFF;
+    }
+
+    return fwrite(writer->bytes, 4, num_of_cells, writer->file)
+	== num_of_cells;
+}
+
+/**********************************************************************/
+
+
+int
+hpix_save_bmp_projection_to_tiff(FILE * file,
+				 const hpix_bmp_projection_t * proj,
+				 const hpix_map_t * map,
+				 const hpix_palette_lut_t * lut,
+				 double min_value,
+				 double max_value)
+{
+    assert(file);
+    assert(proj);
+    assert(map);
+    assert(lut);
+
+    const unsigned int width = hpix_bmp_projection_width(proj);
+    const unsigned int height = hpix_bmp_projection_height(proj);
+    const uint32_t num_of_strips =
+	(height + TIFF_ROWS_PER_STRIP - 1) / TIFF_ROWS_PER_STRIP;
+    const uint64_t strip_size = (uint64_t) width * TIFF_ROWS_PER_STRIP * 4;
+    /* Arrays which do not fit in the IFD: bits per sample, strip
+     * offsets and strip sizes. A single offset (or size) is stored in
+     * the IFD itself. */
+    const uint32_t bits_offset = TIFF_HEADER_SIZE + TIFF_IFD_SIZE;
+    const uint32_t offsets_offset = bits_offset + 4 * 2;
+    const uint32_t sizes_offset =
+	offsets_offset + (num_of_strips > 1 ? 4 * num_of_strips : 0);
+    const uint32_t image_offset =
+	sizes_offset + (num_of_strips > 1 ? 4 * num_of_strips : 0);
+
+    if(width == 0 || height == 0)
+	return 0;
+
+    /* Offsets are 32-bit numbers: larger images would need BigTIFF */
+    if(image_offset + (uint64_t) width * height * 4 > UINT32_MAX)
+	return 0;
+
+    unsigned char * header = hpix_malloc(1, image_offset);
+    unsigned char * buf = header;
+
+    buf = put_uint16(buf, 0x4949); /* "II" */
+    buf = put_uint16(buf, 42);
+    buf = put_uint32(buf, TIFF_HEADER_SIZE);
+
+    buf = put_uint16(buf, TIFF_NUM_OF_TAGS);
+    buf = put_tag(buf, 256, TIFF_LONG, 1, width);  /* ImageWidth */
+    buf = put_tag(buf, 257, TIFF_LONG, 1, height); /* ImageLength */
+    buf = put_tag(buf, 258, TIFF_SHORT, 4, bits_offset); /* BitsPerSample */
+    buf = put_tag(buf, 259, TIFF_SHORT, 1, 1);     /* No compression */
+    buf = put_tag(buf, 262, TIFF_SHORT, 1, 2);     /* RGB */
+    buf = put_tag(buf, 273, TIFF_LONG, num_of_strips, /* StripOffsets */
+		  num_of_strips > 1 ? offsets_offset : image_offset);
+    buf = put_tag(buf, 277, TIFF_SHORT, 1, 4);     /* SamplesPerPixel */
+    buf = put_tag(buf, 278, TIFF_LONG, 1, TIFF_ROWS_PER_STRIP);
+    buf = put_tag(buf, 279, TIFF_LONG, num_of_strips, /* StripByteCounts */
+		  num_of_strips > 1 ? sizes_offset : (uint32_t) width * height * 4);
+    buf = put_tag(buf, 284, TIFF_SHORT, 1, 1);     /* Chunky samples */
+    buf = put_tag(buf, 338, TIFF_SHORT, 1, 2);     /* Unassociated alpha */
+    buf = put_uint32(buf, 0); /* No more IFDs */
+
+    for(int sample = 0; sample < 4; ++sample)
+	buf = put_uint16(buf, 8);
+
+    if(num_of_strips > 1)
+    {
+	for(uint32_t strip = 0; strip < num_of_strips; ++strip)
+	    buf = put_uint32(buf, image_offset + strip * strip_size);
+
+	for(uint32_t strip = 0; strip < num_of_strips; ++strip)
+	{
+	    const uint32_t num_of_rows =
+		(strip + 1 < num_of_strips)
+		? TIFF_ROWS_PER_STRIP
+		: height - strip * TIFF_ROWS_PER_STRIP;
+	    buf = put_uint32(buf, (uint32_t) width * num_of_rows * 4);
+	}
+    }
+
+    assert(buf == header + image_offset);
+
+    int result = fwrite(header, 1, image_offset, file) == image_offset;
+    hpix_free(header);
+
+    if(result)
+    {
+	tiff_writer_t writer;
+
+	writer.file = file;
+	writer.width = width;
+	writer.bytes = hpix_malloc(1, strip_size);
+	result = hpix_bmp_projection_render_strips(proj, map, lut,
+						   min_value, max_value,
+						   TIFF_ROWS_PER_STRIP,
+						   write_strip, &writer);
+	hpix_free(writer.bytes);
+    }
+
+    return result;
+}
@@ -20,6 +20,12 @@
 #include <hpixlib/hpix.h>
 #include <math.h>
 #include <assert.h>
+#include <stdint.h>
+
+/* The three arrays of a batch are allocated in the same block, each
+ * one aligned to a cache line, so that loads and stores in the
+ * kernels below never straddle two lines */
+#define VECTOR_BATCH_ALIGNMENT 64
 
 /**********************************************************************/
 
@@ -88,3 +94,156 @@ hpix_normalize_vector(hpix_vector_t * vector)
 	vector->z /= len;
     }
 }
+
+/**********************************************************************/
+
+
+hpix_vector_batch_t *
+hpix_create_vector_batch(size_t num_of_vectors)
+{
+    const size_t doubles_per_line = VECTOR_BATCH_ALIGNMENT / sizeof(double);
+    const size_t padded_size =
+	(num_of_vectors + doubles_per_line - 1) / doubles_per_line
+	* doubles_per_line;
+    hpix_vector_batch_t * batch = hpix_malloc(sizeof(hpix_vector_batch_t), 1);
+    uintptr_t address;
+
+    batch->num_of_vectors = num_of_vectors;
+    batch->memory = hpix_malloc(sizeof(double),
+				3 * padded_size + doubles_per_line);
+
+    address = (uintptr_t) batch->memory;
+    address = (address + VECTOR_BATCH_ALIGNMENT - 1)
+	& ~(uintptr_t) (VECTOR_BATCH_ALIGNMENT - 1);
+    batch->x = (double *) address;
+    batch->y = batch->x + padded_size;
+    batch->z = batch->y + padded_size;
+
+    return batch;
+}
+
+/**********************************************************************/
+
+
+void
+hpix_free_vector_batch(hpix_vector_batch_t * batch)
+{
+    if(batch == NULL)
+	return;
+
+    hpix_free(batch->memory);
+    hpix_free(batch);
+}
+
+/**********************************************************************/
+
+
+void
+hpix_vector_batch_normalize(hpix_vector_batch_t * batch)
+{
+    assert(batch);
+
+    double * restrict x = batch->x;
+    double * restrict y = batch->y;
+    double * restrict z = batch->z;
+
+    for(size_t idx = 0; idx < batch->num_of_vectors; ++idx)
+    {
+	const double len = sqrt(x[idx] * x[idx]
+				+ y[idx] * y[idx]
+				+ z[idx] * z[idx]);
+	/* Null vectors are left untouched, as in hpix_normalize_vector */
+	const double factor = (len > 0.0) ? 1.0 / len : 1.0;
+
+	x[idx] *= factor;
+	y[idx] *= factor;
+	z[idx] *= factor;
+    }
+}
+
+/**********************************************************************/
+
+
+void
+hpix_vector_batch_dot_product(const hpix_vector_batch_t * batch1,
+			      const hpix_vector_batch_t * batch2,
+			      double * result)
+{
+    assert(batch1);
+    assert(batch2);
+    assert(result);
+    assert(batch1->num_of_vectors == batch2->num_of_vectors);
+
+    const double * restrict x1 = batch1->x;
+    const double * restrict y1 = batch1->y;
+    const double * restrict z1 = batch1->z;
+    const double * restrict x2 = batch2->x;
+    const double * restrict y2 = batch2->y;
+    const double * restrict z2 = batch2->z;
+
+    for(size_t idx = 0; idx < batch1->num_of_vectors; ++idx)
+	result[idx] = x1[idx] * x2[idx] + y1[idx] * y2[idx] + z1[idx] * z2[idx];
+}
+
+/**********************************************************************/
+
+
+void
+hpix_vector_batch_cross_product(hpix_vector_batch_t * result,
+				const hpix_vector_batch_t * batch1,
+				const hpix_vector_batch_t * batch2)
+{
+    assert(result);
+    assert(batch1);
+    assert(batch2);
+    assert(batch1->num_of_vectors == batch2->num_of_vectors);
+    assert(result->num_of_vectors == batch1->num_of_vectors);
+
+    /* No "restrict" here: `result` can be one of the two inputs */
+    for(size_t idx = 0; idx < batch1->num_of_vectors; ++idx)
+    {
+	const double x1 = batch1->x[idx], y1 = batch1->y[idx], z1 = batch1->z[idx];
+	const double x2 = batch2->x[idx], y2 = batch2->y[idx], z2 = batch2->z[idx];
+
+	result->x[idx] = y1 * z2 - z1 * y2;
+	result->y[idx] = z1 * x2 - x1 * z2;
+	result->z[idx] = x1 * y2 - y1 * x2;
+    }
+}
+
+/**********************************************************************/
+
+
+void
+hpix_vector_batch_angular_distance(const hpix_vector_batch_t * batch1,
+				   const hpix_vector_batch_t * batch2,
+				   double * result)
+{
+    assert(batch1);
+    assert(batch2);
+    assert(result);
+    assert(batch1->num_of_vectors == batch2->num_of_vectors);
+
+    const double * restrict x1 = batch1->x;
+    const double * restrict y1 = batch1->y;
+    const double * restrict z1 = batch1->z;
+    const double * restrict x2 = batch2->x;
+    const double * restrict y2 = batch2->y;
+    const double * restrict z2 = batch2->z;
+
+    /* atan2(|v1 x v2|, v1 . v2) does not require the vectors to be
+     * normalized, and it is accurate for both small and large
+     * angles, unlike acos(v1 . v2) */
+    for(size_t idx = 0; idx < batch1->num_of_vectors; ++idx)
+    {
+	const double cross_x = y1[idx] * z2[idx] - z1[idx] * y2[idx];
+	const double cross_y = z1[idx] * x2[idx] - x1[idx] * z2[idx];
+	const double cross_z = x1[idx] * y2[idx] - y1[idx] * x2[idx];
+	const double dot = x1[idx] * x2[idx] + y1[idx] * y2[idx] + z1[idx] * z2[idx];
+	const double sine = sqrt(cross_x * cross_x
+				 + cross_y * cross_y
+				 + cross_z * cross_z);
+
+	result[idx] = (sine == 0.0 && dot == 0.0) ? NAN : atan2(sine, dot);
+    }
+}
@@ -19,6 +19,8 @@
 #include <hpixlib/hpix.h>
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
+#include <unistd.h>
 #include <check.h>
 
 START_TEST(projection_size)
@@ -121,10 +123,852 @@ END_TEST
 
 /**********************************************************************/
 
+static void
+fill_map_with_indexes(hpix_map_t * map)
+{
+    double *restrict array_of_pixels = hpix_map_pixels(map);
+
+    for(hpix_pixel_num_t index = 0;
+	index < hpix_map_num_of_pixels(map);
+	++index)
+    {
+	array_of_pixels[index] = index;
+    }
+}
+
+/**********************************************************************/
+
+static void
+compare_bitmaps(const double * bitmap1, const double * bitmap2,
+		size_t num_of_pixels)
+{
+    for(size_t idx = 0; idx < num_of_pixels; ++idx)
+    {
+	if(isnan(bitmap1[idx]))
+	    fail_unless(isnan(bitmap2[idx]), "Pixel %u is not NAN",
+			(unsigned) idx);
+	else if(isinf(bitmap1[idx]))
+	    fail_unless(isinf(bitmap2[idx]), "Pixel %u is not INFINITY",
+			(unsigned) idx);
+	else
+	    fail_unless(bitmap1[idx] == bitmap2[idx],
+			"Pixel %u is different", (unsigned) idx);
+    }
+}
+
+/**********************************************************************/
+
+START_TEST(projection_plan)
+{
+    hpix_map_t * map = hpix_create_map(8, HPIX_ORDER_SCHEME_NEST);
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(64, 32);
+    hpix_projection_plan_t * plan;
+    double * direct_bmp;
+    double * plan_bmp;
+    double direct_min, direct_max, plan_min, plan_max;
+
+    fill_map_with_indexes(map);
+    hpix_map_pixels(map)[0] = NAN;
+    hpix_set_mollweide_projection(proj);
+
+    plan = hpix_create_projection_plan(proj, 8, HPIX_ORDER_SCHEME_NEST);
+    ck_assert_int_eq(hpix_projection_plan_width(plan), 64);
+    ck_assert_int_eq(hpix_projection_plan_height(plan), 32);
+    ck_assert_int_eq(hpix_projection_plan_nside(plan), 8);
+    fail_unless(hpix_projection_plan_pixels(plan)[0] == HPIX_PLAN_OUTSIDE);
+
+    direct_bmp = hpix_bmp_projection_trace(proj, map,
+					   &direct_min, &direct_max);
+    plan_bmp = hpix_projection_plan_trace(plan, map, &plan_min, &plan_max);
+
+    compare_bitmaps(direct_bmp, plan_bmp, 64 * 32);
+    fail_unless(direct_min == plan_min);
+    fail_unless(direct_max == plan_max);
+
+    hpix_free(plan_bmp);
+    hpix_free(direct_bmp);
+    hpix_free_projection_plan(plan);
+    hpix_free_bmp_projection(proj);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+/* Change one of the 32-bit fields in the header of a plan file, and
+ * rewind the file */
+static void
+overwrite_plan_field(FILE * file, long offset, uint32_t value)
+{
+    fail_unless(fseek(file, offset, SEEK_SET) == 0);
+    fail_unless(fwrite(&value, sizeof(value), 1, file) == 1);
+    fail_unless(fflush(file) == 0);
+    rewind(file);
+}
+
+/**********************************************************************/
+
+START_TEST(projection_plan_io)
+{
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(40, 20);
+    hpix_projection_plan_t * plan;
+    hpix_projection_plan_t * loaded_plan;
+    FILE * file = tmpfile();
+
+    fail_unless(file != NULL);
+    hpix_set_equirectangular_projection(proj);
+    plan = hpix_create_projection_plan(proj, 16, HPIX_ORDER_SCHEME_RING);
+
+    fail_unless(hpix_save_projection_plan(file, plan));
+    rewind(file);
+    loaded_plan = hpix_load_projection_plan(file);
+    fail_unless(loaded_plan != NULL);
+
+    ck_assert_int_eq(hpix_projection_plan_width(loaded_plan), 40);
+    ck_assert_int_eq(hpix_projection_plan_height(loaded_plan), 20);
+    ck_assert_int_eq(hpix_projection_plan_nside(loaded_plan), 16);
+    ck_assert_int_eq(hpix_projection_plan_ordering_scheme(loaded_plan),
+		     HPIX_ORDER_SCHEME_RING);
+    ck_assert_int_eq(hpix_projection_plan_type(loaded_plan),
+		     HPIX_PROJ_EQUIRECTANGULAR);
+    fail_unless(memcmp(hpix_projection_plan_pixels(plan),
+		       hpix_projection_plan_pixels(loaded_plan),
+		       40 * 20 * sizeof(hpix_pixel_num_t)) == 0);
+
+    /* So must a file with an unknown projection type (the 32-bit
+     * integer at byte 32), or whose size does not fit in memory */
+    overwrite_plan_field(file, 32, 99);
+    fail_unless(hpix_load_projection_plan(file) == NULL);
+    overwrite_plan_field(file, 32, HPIX_PROJ_EQUIRECTANGULAR);
+    overwrite_plan_field(file, 16, 0xFFFFFFFF);
+    overwrite_plan_field(file, 20, 0xFFFFFFFF);
+    fail_unless(hpix_load_projection_plan(file) == NULL);
+
+    /* A truncated file must be rejected */
+    rewind(file);
+    fail_unless(ftruncate(fileno(file), 64) == 0);
+    fail_unless(hpix_load_projection_plan(file) == NULL);
+
+    fclose(file);
+    hpix_free_projection_plan(loaded_plan);
+    hpix_free_projection_plan(plan);
+    hpix_free_bmp_projection(proj);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(supersampled_projection_plan)
+{
+    hpix_map_t * map = hpix_create_map(64, HPIX_ORDER_SCHEME_RING);
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(64, 32);
+    hpix_projection_plan_t * plan;
+    hpix_projection_plan_t * loaded_plan;
+    const hpix_pixel_num_t * plan_pixels;
+    double * bitmap;
+    FILE * file = tmpfile();
+
+    fail_unless(file != NULL);
+    fill_map_with_indexes(map);
+    hpix_set_mollweide_projection(proj);
+
+    /* With one sample per cell, a supersampled plan is a plain plan */
+    plan = hpix_create_supersampled_projection_plan(proj, 64,
+						    HPIX_ORDER_SCHEME_RING, 1);
+    loaded_plan = hpix_create_projection_plan(proj, 64,
+					      HPIX_ORDER_SCHEME_RING);
+    fail_unless(memcmp(hpix_projection_plan_pixels(plan),
+		       hpix_projection_plan_pixels(loaded_plan),
+		       64 * 32 * sizeof(hpix_pixel_num_t)) == 0);
+    hpix_free_projection_plan(loaded_plan);
+    hpix_free_projection_plan(plan);
+
+    /* 49152 pixels in 2048 cells need 5x5 samples per cell */
+    plan = hpix_create_supersampled_projection_plan(proj, 64,
+						    HPIX_ORDER_SCHEME_RING, 0);
+    ck_assert_int_eq(hpix_projection_plan_samples_per_side(plan), 5);
+    hpix_free_projection_plan(plan);
+
+    plan = hpix_create_supersampled_projection_plan(proj, 64,
+						    HPIX_ORDER_SCHEME_RING, 2);
+    ck_assert_int_eq(hpix_projection_plan_samples_per_side(plan), 2);
+    plan_pixels = hpix_projection_plan_pixels(plan);
+    bitmap = hpix_projection_plan_trace(plan, map, NULL, NULL);
+
+    fail_unless(isinf(bitmap[0]));
+    for(size_t idx = 0; idx < 64 * 32; ++idx)
+    {
+	const hpix_pixel_num_t * samples = plan_pixels + 4 * idx;
+	double sum = 0.0;
+	int num_inside = 0;
+
+	for(int i = 0; i < 4; ++i)
+	{
+	    if(samples[i] != HPIX_PLAN_OUTSIDE)
+	    {
+		sum += samples[i];
+		++num_inside;
+	    }
+	}
+
+	if(num_inside == 0)
+	    fail_unless(isinf(bitmap[idx]));
+	else
+	    fail_unless(fabs(bitmap[idx] - sum / num_inside) < 1e-9);
+    }
+
+    fail_unless(hpix_save_projection_plan(file, plan));
+    rewind(file);
+    loaded_plan = hpix_load_projection_plan(file);
+    fail_unless(loaded_plan != NULL);
+    ck_assert_int_eq(hpix_projection_plan_samples_per_side(loaded_plan), 2);
+    fail_unless(memcmp(plan_pixels,
+		       hpix_projection_plan_pixels(loaded_plan),
+		       4 * 64 * 32 * sizeof(hpix_pixel_num_t)) == 0);
+
+    fclose(file);
+    hpix_free(bitmap);
+    hpix_free_projection_plan(loaded_plan);
+    hpix_free_projection_plan(plan);
+    hpix_free_bmp_projection(proj);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(angles_to_xy)
+{
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(100, 50);
+
+    for(int type = 0; type < 4; ++type)
+    {
+	switch(type)
+	{
+	case 0: hpix_set_mollweide_projection(proj); break;
+	case 1: hpix_set_equirectangular_projection(proj); break;
+	case 2: hpix_set_gnomonic_projection(proj, 0.3, 5.0, 1.0); break;
+	case 3: hpix_set_orthographic_projection(proj, 2.0, 1.0, M_PI); break;
+	}
+
+	for(unsigned int y = 0; y < 50; ++y)
+	{
+	    for(unsigned int x = 0; x < 100; ++x)
+	    {
+		double theta, phi, proj_x, proj_y;
+
+		if(! hpix_bmp_projection_xy_to_angles(proj, x, y,
+						      &theta, &phi))
+		    continue;
+
+		fail_unless(hpix_bmp_projection_angles_to_xy(proj, theta, phi,
+							     &proj_x, &proj_y));
+		fail_unless(fabs(proj_x - x) < 1e-8,
+			    "Wrong x for (%u, %u)", x, y);
+		fail_unless(fabs(proj_y - y) < 1e-8,
+			    "Wrong y for (%u, %u)", x, y);
+	    }
+	}
+    }
+
+    hpix_free_bmp_projection(proj);
+}
+END_TEST
+
+/**********************************************************************/
+
+/* Check that splatting gives exactly the same bitmap as tracing, cell
+ * by cell */
+static void
+check_splat(hpix_nside_t nside, hpix_ordering_scheme_t scheme,
+	    unsigned int width, unsigned int height, _Bool mollweide)
+{
+    hpix_map_t * map = hpix_create_map(nside, scheme);
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(width, height);
+    double * direct_bmp;
+    double * splat_bmp;
+    double direct_min, direct_max, splat_min, splat_max;
+
+    fill_map_with_indexes(map);
+    hpix_map_pixels(map)[0] = NAN;
+    if(mollweide)
+	hpix_set_mollweide_projection(proj);
+    else
+	hpix_set_equirectangular_projection(proj);
+
+    direct_bmp = hpix_bmp_projection_trace(proj, map,
+					   &direct_min, &direct_max);
+    splat_bmp = hpix_bmp_projection_splat(proj, map, &splat_min, &splat_max);
+    compare_bitmaps(direct_bmp, splat_bmp, (size_t) width * height);
+    fail_unless(direct_min == splat_min);
+    fail_unless(direct_max == splat_max);
+
+    hpix_free(splat_bmp);
+    hpix_free(direct_bmp);
+    hpix_free_bmp_projection(proj);
+    hpix_free_map(map);
+}
+
+START_TEST(splat_projection)
+{
+    const hpix_nside_t nsides[] = { 1, 4, 8, 16 };
+    hpix_map_t * map = hpix_create_map(1, HPIX_ORDER_SCHEME_NEST);
+    hpix_bmp_projection_t * proj;
+    double * direct_bmp;
+    double * splat_bmp;
+    double * render_bmp;
+
+    for(size_t i = 0; i < sizeof(nsides) / sizeof(nsides[0]); ++i)
+    {
+	for(int mollweide = 0; mollweide < 2; ++mollweide)
+	{
+	    check_splat(nsides[i], HPIX_ORDER_SCHEME_RING, 256, 128, mollweide);
+	    check_splat(nsides[i], HPIX_ORDER_SCHEME_NEST, 256, 128, mollweide);
+	    check_splat(nsides[i], HPIX_ORDER_SCHEME_RING, 301, 157, mollweide);
+	    check_splat(nsides[i], HPIX_ORDER_SCHEME_NEST, 301, 157, mollweide);
+	}
+    }
+
+    fill_map_with_indexes(map);
+    hpix_map_pixels(map)[0] = NAN;
+    proj = hpix_create_bmp_projection(256, 128);
+    hpix_set_mollweide_projection(proj);
+    direct_bmp = hpix_bmp_projection_trace(proj, map, NULL, NULL);
+    splat_bmp = hpix_bmp_projection_splat(proj, map, NULL, NULL);
+
+    /* There are 12 pixels and 32768 cells, so splatting is used */
+    render_bmp = hpix_bmp_projection_render(proj, map, NULL, NULL);
+    compare_bitmaps(splat_bmp, render_bmp, 256 * 128);
+    hpix_free(render_bmp);
+
+    /* With 512 cells, each pixel covers too few cells */
+    hpix_free_bmp_projection(proj);
+    proj = hpix_create_bmp_projection(32, 16);
+    hpix_set_mollweide_projection(proj);
+    hpix_free(direct_bmp);
+    direct_bmp = hpix_bmp_projection_trace(proj, map, NULL, NULL);
+    render_bmp = hpix_bmp_projection_render(proj, map, NULL, NULL);
+    compare_bitmaps(direct_bmp, render_bmp, 32 * 16);
+
+    hpix_free(render_bmp);
+    hpix_free(splat_bmp);
+    hpix_free(direct_bmp);
+    hpix_free_bmp_projection(proj);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(local_projections)
+{
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(64, 64);
+    double theta, phi;
+
+    /* The center of the bitmap points towards the center of the
+     * projection, and North is up */
+    hpix_set_gnomonic_projection(proj, 1.0, 2.0, 0.5);
+    ck_assert_int_eq(hpix_bmp_projection_type(proj), HPIX_PROJ_GNOMONIC);
+    fail_unless(hpix_bmp_projection_fxy_to_angles(proj, 31.5, 31.5,
+						  &theta, &phi));
+    fail_unless(fabs(theta - 1.0) < 1e-12 && fabs(phi - 2.0) < 1e-12);
+    fail_unless(hpix_bmp_projection_fxy_to_angles(proj, 31.5, 63.0,
+						  &theta, &phi));
+    fail_unless(theta < 1.0 && fabs(phi - 2.0) < 1e-12);
+
+    /* The field of view spans the width of the bitmap */
+    fail_unless(hpix_bmp_projection_fxy_to_angles(proj, -0.5, 31.5,
+						  &theta, &phi));
+    {
+	hpix_vector_t center, border;
+	hpix_angles_to_vector(1.0, 2.0, &center);
+	hpix_angles_to_vector(theta, phi, &border);
+	fail_unless(fabs(acos(hpix_dot_product(&center, &border)) - 0.25)
+		    < 1e-12);
+    }
+
+    /* Only the disc of the visible hemisphere is inside an
+     * orthographic projection */
+    hpix_set_orthographic_projection(proj, 1.0, 2.0, M_PI);
+    fail_unless(! hpix_bmp_projection_is_xy_inside(proj, 0, 0));
+    fail_unless(hpix_bmp_projection_is_xy_inside(proj, 32, 32));
+    fail_unless(! hpix_bmp_projection_angles_to_xy(proj, M_PI - 1.0,
+						   2.0 + M_PI,
+						   &theta, &phi));
+
+    hpix_free_bmp_projection(proj);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(projection_tiles)
+{
+    hpix_map_t * map = hpix_create_map(64, HPIX_ORDER_SCHEME_NEST);
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(32, 32);
+    hpix_bmp_projection_t * big_proj = hpix_create_bmp_projection(64, 64);
+    double * big_bmp;
+
+    fill_map_with_indexes(map);
+    for(int type = 0; type < 2; ++type)
+    {
+	if(type == 0)
+	{
+	    hpix_set_gnomonic_projection(proj, 0.8, 1.5, 0.6);
+	    hpix_set_gnomonic_projection(big_proj, 0.8, 1.5, 0.6);
+	} else {
+	    hpix_set_orthographic_projection(proj, 0.8, 1.5, M_PI);
+	    hpix_set_orthographic_projection(big_proj, 0.8, 1.5, M_PI);
+	}
+
+	/* The four tiles at zoom level 1 make a bitmap twice as
+	 * large */
+	big_bmp = hpix_bmp_projection_trace(big_proj, map, NULL, NULL);
+	for(unsigned int tile_y = 0; tile_y < 2; ++tile_y)
+	{
+	    for(unsigned int tile_x = 0; tile_x < 2; ++tile_x)
+	    {
+		hpix_pixel_num_t * tile_pixels;
+		size_t num_of_tile_pixels;
+		double * tile_bmp =
+		    hpix_bmp_projection_trace_tile(proj, map, 1,
+						   tile_x, tile_y,
+						   NULL, NULL);
+
+		hpix_bmp_projection_tile_pixels(proj, 1, tile_x, tile_y,
+						hpix_map_resolution(map),
+						HPIX_ORDER_SCHEME_NEST,
+						&tile_pixels,
+						&num_of_tile_pixels);
+		fail_unless(num_of_tile_pixels > 0);
+		fail_unless(num_of_tile_pixels < hpix_map_num_of_pixels(map));
+
+		for(unsigned int y = 0; y < 32; ++y)
+		{
+		    for(unsigned int x = 0; x < 32; ++x)
+		    {
+			const double value = tile_bmp[y * 32 + x];
+			const double big_value =
+			    big_bmp[(tile_y * 32 + y) * 64 + tile_x * 32 + x];
+
+			fail_unless(value == big_value
+				    || (isinf(value) && isinf(big_value)));
+			if(isinf(value))
+			    continue;
+
+			/* The cell must use one of the pixels
+			 * returned by the region query */
+			_Bool found = FALSE;
+			for(size_t idx = 0; idx < num_of_tile_pixels; ++idx)
+			    found = found || tile_pixels[idx] == value;
+			fail_unless(found);
+		    }
+		}
+
+		hpix_free(tile_pixels);
+		hpix_free(tile_bmp);
+	    }
+	}
+	hpix_free(big_bmp);
+    }
+
+    hpix_free_bmp_projection(big_proj);
+    hpix_free_bmp_projection(proj);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(fused_rendering)
+{
+    hpix_map_t * map = hpix_create_map(1, HPIX_ORDER_SCHEME_RING);
+    hpix_color_palette_t * palette = hpix_create_grayscale_color_palette();
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    /* The first bitmap is splatted, the second one is traced */
+    const unsigned int sizes[][2] = { { 256, 128 }, { 32, 16 } };
+
+    fill_map_with_indexes(map);
+    hpix_map_pixels(map)[5] = NAN;
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+	const unsigned int width = sizes[i][0];
+	const unsigned int height = sizes[i][1];
+	hpix_bmp_projection_t * proj =
+	    hpix_create_bmp_projection(width, height);
+	uint32_t * expected = hpix_calloc(sizeof(uint32_t), width * height);
+	uint32_t * fused = hpix_calloc(sizeof(uint32_t), width * height);
+	double * bitmap;
+	double min, max, estimated_min, estimated_max;
+
+	hpix_set_mollweide_projection(proj);
+	bitmap = hpix_bmp_projection_render(proj, map, &min, &max);
+	hpix_bitmap_to_argb32(lut, bitmap, width, height, min, max,
+			      (unsigned char *) expected,
+			      width * sizeof(uint32_t), 1);
+	hpix_bmp_projection_render_argb32(proj, map, lut, min, max,
+					  (unsigned char *) fused,
+					  width * sizeof(uint32_t), 1);
+	fail_unless(memcmp(expected, fused,
+			   width * height * sizeof(uint32_t)) == 0);
+
+	/* The range estimated by sampling the bitmap is contained in
+	 * the full range */
+	fail_unless(hpix_bmp_projection_estimate_range(proj, map,
+						       &estimated_min,
+						       &estimated_max));
+	fail_unless(estimated_min >= min && estimated_max <= max);
+	fail_unless(estimated_min < estimated_max);
+
+	hpix_free(bitmap);
+	hpix_free(fused);
+	hpix_free(expected);
+	hpix_free_bmp_projection(proj);
+    }
+
+    hpix_free_palette_lut(lut);
+    hpix_free_color_palette(palette);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+typedef struct {
+    uint32_t * image;
+    unsigned int width;
+    unsigned int next_row;
+} strip_collector_t;
+
+static int
+collect_strip(const uint32_t * strip,
+	      unsigned int first_row,
+	      unsigned int num_of_rows,
+	      void * user_data)
+{
+    strip_collector_t * collector = user_data;
+
+    /* Strips must arrive in order, from the top of the image */
+    if(first_row != collector->next_row)
+	return 0;
+
+    memcpy(collector->image + (size_t) first_row * collector->width,
+	   strip, (size_t) num_of_rows * collector->width * sizeof(uint32_t));
+    collector->next_row += num_of_rows;
+    return 1;
+}
+
+static int
+abort_after_first_strip(const uint32_t * strip,
+			unsigned int first_row,
+			unsigned int num_of_rows,
+			void * user_data)
+{
+    ++*((int *) user_data);
+    return 0;
+}
+
+START_TEST(strip_rendering)
+{
+    hpix_map_t * map = hpix_create_map(1, HPIX_ORDER_SCHEME_RING);
+    hpix_color_palette_t * palette = hpix_create_grayscale_color_palette();
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    /* The first bitmap is splatted, the second one is traced */
+    const unsigned int sizes[][2] = { { 256, 128 }, { 32, 16 } };
+    const unsigned int strip_heights[] = { 0, 1, 7, 1000 };
+
+    fill_map_with_indexes(map);
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i)
+    {
+	const unsigned int width = sizes[i][0];
+	const unsigned int height = sizes[i][1];
+	hpix_bmp_projection_t * proj =
+	    hpix_create_bmp_projection(width, height);
+	uint32_t * expected = hpix_calloc(sizeof(uint32_t), width * height);
+	strip_collector_t collector;
+	const double min = 0.0, max = hpix_map_num_of_pixels(map);
+
+	hpix_set_mollweide_projection(proj);
+	hpix_bmp_projection_render_argb32(proj, map, lut, min, max,
+					  (unsigned char *) expected,
+					  width * sizeof(uint32_t), 1);
+
+	collector.image = hpix_calloc(sizeof(uint32_t), width * height);
+	collector.width = width;
+	for(size_t j = 0; j < sizeof(strip_heights) / sizeof(strip_heights[0]); ++j)
+	{
+	    memset(collector.image, 0, width * height * sizeof(uint32_t));
+	    collector.next_row = 0;
+	    fail_unless(hpix_bmp_projection_render_strips(proj, map, lut,
+							  min, max,
+							  strip_heights[j],
+							  collect_strip,
+							  &collector));
+	    fail_unless(collector.next_row == height);
+	    fail_unless(memcmp(expected, collector.image,
+			       width * height * sizeof(uint32_t)) == 0);
+	}
+
+	/* Once the callback fails, no more strips are produced */
+	int num_of_calls = 0;
+	fail_unless(! hpix_bmp_projection_render_strips(proj, map, lut,
+							min, max, 1,
+							abort_after_first_strip,
+							&num_of_calls));
+	fail_unless(num_of_calls == 1);
+
+	hpix_free(collector.image);
+	hpix_free(expected);
+	hpix_free_bmp_projection(proj);
+    }
+
+    hpix_free_palette_lut(lut);
+    hpix_free_color_palette(palette);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+static unsigned int
+read_uint16_le(const unsigned char * buf)
+{
+    return buf[0] | (buf[1] << 8);
+}
+
+static unsigned long
+read_uint32_le(const unsigned char * buf)
+{
+    return read_uint16_le(buf) | ((unsigned long) read_uint16_le(buf + 2) << 16);
+}
+
+START_TEST(tiff_output)
+{
+    hpix_map_t * map = hpix_create_map(8, HPIX_ORDER_SCHEME_RING);
+    hpix_color_palette_t * palette = hpix_create_grayscale_color_palette();
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    /* Two TIFF strips, the last one shorter than the others */
+    const unsigned int width = 128, height = 100;
+    hpix_bmp_projection_t * proj = hpix_create_bmp_projection(width, height);
+    uint32_t * expected = hpix_calloc(sizeof(uint32_t), width * height);
+    const double min = 0.0, max = hpix_map_num_of_pixels(map);
+    FILE * file = tmpfile();
+    unsigned char * contents;
+    long size;
+
+    fill_map_with_indexes(map);
+    hpix_set_mollweide_projection(proj);
+    hpix_bmp_projection_render_argb32(proj, map, lut, min, max,
+				      (unsigned char *) expected,
+				      width * sizeof(uint32_t), 1);
+
+    fail_unless(file != NULL);
+    fail_unless(hpix_save_bmp_projection_to_tiff(file, proj, map, lut,
+						 min, max));
+    size = ftell(file);
+    contents = hpix_malloc(1, size);
+    rewind(file);
+    fail_unless(fread(contents, 1, size, file) == (size_t) size);
+    fclose(file);
+
+    fail_unless(contents[0] == 'I' && contents[1] == 'I');
+    fail_unless(read_uint16_le(contents + 2) == 42);
+
+    /* Look for the size of the image and for the strip offsets in the
+     * image file directory */
+    const unsigned char * ifd = contents + read_uint32_le(contents + 4);
+    unsigned long strip_offsets = 0;
+    unsigned int num_of_strips = 0;
+    for(unsigned int i = 0; i < read_uint16_le(ifd); ++i)
+    {
+	const unsigned char * entry = ifd + 2 + 12 * i;
+
+	switch(read_uint16_le(entry))
+	{
+	case 256: fail_unless(read_uint32_le(entry + 8) == width); break;
+	case 257: fail_unless(read_uint32_le(entry + 8) == height); break;
+	case 273:
+	    num_of_strips = read_uint32_le(entry + 4);
+	    strip_offsets = read_uint32_le(entry + 8);
+	    break;
+	}
+    }
+    fail_unless(num_of_strips == 2);
+
+    const unsigned long image_offset = read_uint32_le(contents + strip_offsets);
+    fail_unless(image_offset + width * height * 4 == (unsigned long) size);
+
+    /* Samples are stored as R, G, B, A */
+    for(size_t idx = 0; idx < width * height; idx += 997)
+    {
+	const unsigned char * sample = contents + image_offset + 4 * idx;
+
+	fail_unless(sample[0] == ((expected[idx] >> 16) & 0xFF));
+	fail_unless(sample[1] == ((expected[idx] >> 8) & 0xFF));
+	fail_unless(sample[2] == (expected[idx] & 0xFF));
+	fail_unless(sample[3] == ((expected[idx] >> 24) & 0xFF));
+    }
+
+    hpix_free(contents);
+    hpix_free(expected);
+    hpix_free_bmp_projection(proj);
+    hpix_free_palette_lut(lut);
+    hpix_free_color_palette(palette);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+typedef struct {
+    const hpix_palette_lut_t * lut;
+    double max_value;
+    unsigned int num_of_tiles[2];
+    unsigned int num_of_wrong_pixels;
+    hpix_pixel_num_t last_tile[2];
+} tile_checker_t;
+
+/* The value of each pixel in the map is its NEST index, so the value
+ * of a pixel in a tile of order 1 is its NEST index at order 3, and
+ * the value of one in a tile of order 0 is the average of its four
+ * children. */
+static int
+check_tile(unsigned int order,
+	   hpix_pixel_num_t tile,
+	   const uint32_t * image,
+	   unsigned int tile_width,
+	   void * user_data)
+{
+    tile_checker_t * checker = user_data;
+    unsigned int num_of_wrong_pixels = 0;
+
+    for(unsigned int row = 0; row < tile_width; ++row)
+    {
+	for(unsigned int column = 0; column < tile_width; ++column)
+	{
+	    /* The northern corner is at the top left */
+	    const hpix_pixel_num_t subpixel =
+		hpix_xy_to_nest_subpixel(tile_width - 1 - column,
+					 tile_width - 1 - row);
+	    const hpix_pixel_num_t pixel = tile * 16 + subpixel;
+	    const double value = (order == 1) ? pixel : 4 * pixel + 1.5;
+	    const uint32_t color =
+		hpix_palette_lut_color(checker->lut,
+				       value / checker->max_value);
+
+	    if(image[row * tile_width + column] != color)
+		++num_of_wrong_pixels;
+	}
+    }
+
+#pragma omp critical
+    {
+	checker->num_of_wrong_pixels += num_of_wrong_pixels;
+	checker->num_of_tiles[order]++;
+	checker->last_tile[order] = tile;
+    }
+
+    return 1;
+}
+
+START_TEST(hips_tiles)
+{
+    /* With NSIDE=8 (order 3) and tiles 4x4 wide, there are tiles of
+     * order 0 and 1 */
+    hpix_map_t * map = hpix_create_map(8, HPIX_ORDER_SCHEME_RING);
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    hpix_color_palette_t * palette = hpix_create_grayscale_color_palette();
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    double * pixels = hpix_map_pixels(map);
+    tile_checker_t checker;
+
+    for(hpix_pixel_num_t idx = 0; idx < hpix_map_num_of_pixels(map); ++idx)
+	pixels[hpix_nest_to_ring_idx(resolution, idx)] = idx;
+
+    hpix_hips_pyramid_t * pyramid = hpix_create_hips_pyramid(map, 4);
+    ck_assert_int_eq(hpix_hips_pyramid_tile_width(pyramid), 4);
+    ck_assert_int_eq(hpix_hips_pyramid_max_order(pyramid), 1);
+    ck_assert_int_eq(hpix_hips_pyramid_num_of_changed_tiles(pyramid),
+		     12 + 48);
+
+    memset(&checker, 0, sizeof(checker));
+    checker.lut = lut;
+    checker.max_value = hpix_map_num_of_pixels(map) - 1;
+    fail_unless(hpix_hips_render_tiles(pyramid, lut, 0.0, checker.max_value,
+				       TRUE, check_tile, &checker));
+    ck_assert_int_eq(checker.num_of_tiles[0], 12);
+    ck_assert_int_eq(checker.num_of_tiles[1], 48);
+    ck_assert_int_eq(checker.num_of_wrong_pixels, 0);
+    ck_assert_int_eq(hpix_hips_pyramid_num_of_changed_tiles(pyramid), 0);
+
+    /* Change one pixel: only the two tiles containing it must be
+     * rendered again */
+    const hpix_pixel_num_t nest_pixel = 500;
+    const hpix_pixel_num_t ring_pixel =
+	hpix_nest_to_ring_idx(resolution, nest_pixel);
+
+    pixels[ring_pixel] = -1.0;
+    hpix_update_hips_pyramid(pyramid, map, &ring_pixel, 1);
+    ck_assert_int_eq(hpix_hips_pyramid_num_of_changed_tiles(pyramid), 2);
+
+    memset(&checker, 0, sizeof(checker));
+    checker.lut = lut;
+    checker.max_value = hpix_map_num_of_pixels(map) - 1;
+    fail_unless(hpix_hips_render_tiles(pyramid, lut, 0.0, checker.max_value,
+				       TRUE, check_tile, &checker));
+    ck_assert_int_eq(checker.num_of_tiles[0], 1);
+    ck_assert_int_eq(checker.num_of_tiles[1], 1);
+    ck_assert_int_eq(checker.last_tile[0], nest_pixel / 64);
+    ck_assert_int_eq(checker.last_tile[1], nest_pixel / 16);
+    /* The changed pixel, and its parent in the tile of order 0 */
+    ck_assert_int_eq(checker.num_of_wrong_pixels, 2);
+
+    hpix_free_hips_pyramid(pyramid);
+    hpix_free_palette_lut(lut);
+    hpix_free_color_palette(palette);
+    hpix_free_map(map);
+
+    /* RING maps whose NSIDE is not a power of two have no tiles */
+    map = hpix_create_map(6, HPIX_ORDER_SCHEME_RING);
+    fail_unless(hpix_create_hips_pyramid(map, 4) == NULL);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(hips_tile_path)
+{
+    char path[64];
+
+    fail_unless(hpix_hips_tile_path(3, 12345, "png", path, sizeof(path)));
+    fail_unless(strcmp(path, "Norder3/Dir10000/Npix12345.png") == 0);
+    fail_unless(hpix_hips_tile_path(0, 7, "jpg", path, sizeof(path)));
+    fail_unless(strcmp(path, "Norder0/Dir0/Npix7.jpg") == 0);
+    fail_unless(! hpix_hips_tile_path(0, 7, "jpg", path, 8));
+}
+END_TEST
+
+/**********************************************************************/
+
 void
 add_projection_tests_to_testcase(TCase * testcase)
 {
     tcase_add_test(testcase, projection_size);
+    tcase_add_test(testcase, projection_plan);
+    tcase_add_test(testcase, projection_plan_io);
+    tcase_add_test(testcase, supersampled_projection_plan);
+    tcase_add_test(testcase, angles_to_xy);
+    tcase_add_test(testcase, splat_projection);
+    tcase_add_test(testcase, local_projections);
+    tcase_add_test(testcase, projection_tiles);
+    tcase_add_test(testcase, fused_rendering);
+    tcase_add_test(testcase, strip_rendering);
+    tcase_add_test(testcase, tiff_output);
+    tcase_add_test(testcase, hips_tiles);
+    tcase_add_test(testcase, hips_tile_path);
 }
 
 /**********************************************************************/
@@ -0,0 +1,245 @@
+/* test_memory.c -- check the allocation functions
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <hpixlib/hpix.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <check.h>
+#include "check_helpers.h"
+
+#define IS_ALIGNED(ptr) (((uintptr_t) (ptr)) % HPIX_MEMORY_ALIGNMENT == 0)
+
+/**********************************************************************/
+
+START_TEST(aligned_allocation)
+{
+    for(size_t size = 1; size < 1000; size += 37)
+    {
+	char * block = hpix_malloc(1, size);
+	double * zeroes = hpix_calloc(sizeof(double), size);
+
+	fail_unless(IS_ALIGNED(block));
+	fail_unless(IS_ALIGNED(zeroes));
+	for(size_t idx = 0; idx < size; ++idx)
+	    fail_unless(zeroes[idx] == 0.0);
+
+	memset(block, 'a', size);
+	block = hpix_realloc(block, 2 * size);
+	fail_unless(IS_ALIGNED(block));
+	for(size_t idx = 0; idx < size; ++idx)
+	    fail_unless(block[idx] == 'a');
+
+	hpix_free(zeroes);
+	hpix_free(block);
+    }
+
+    fail_unless(hpix_malloc(0, 10) == NULL);
+    fail_unless(hpix_malloc(SIZE_MAX / 2, 4) == NULL);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(memory_statistics)
+{
+    hpix_memory_stats_t stats;
+    hpix_reset_memory_stats();
+
+    void * block1 = hpix_malloc(1, 1000);
+    void * block2 = hpix_malloc(1, 3000);
+    hpix_free(block1);
+    void * block3 = hpix_malloc(1, 500);
+
+    hpix_get_memory_stats(&stats);
+    ck_assert_int_eq(stats.num_of_allocations, 3);
+    fail_unless(stats.peak_bytes >= stats.current_bytes + 500);
+
+    const size_t current = stats.current_bytes;
+    hpix_free(block2);
+    hpix_free(block3);
+    hpix_get_memory_stats(&stats);
+    ck_assert_int_eq(stats.current_bytes, current - 3500);
+}
+END_TEST
+
+/**********************************************************************/
+
+typedef struct {
+    int num_of_allocations;
+    int num_of_releases;
+} counting_allocator_t;
+
+static void *
+counting_allocate(size_t size, void * user_data)
+{
+    ((counting_allocator_t *) user_data)->num_of_allocations++;
+    return malloc(size);
+}
+
+static void
+counting_release(void * ptr, size_t size, void * user_data)
+{
+    ((counting_allocator_t *) user_data)->num_of_releases++;
+    free(ptr);
+}
+
+START_TEST(custom_allocator)
+{
+    counting_allocator_t counter = { 0, 0 };
+    const hpix_allocator_t allocator = {
+	.allocate = counting_allocate,
+	.release = counting_release,
+	.user_data = &counter
+    };
+
+    hpix_set_allocator(&allocator);
+    hpix_map_t * map = hpix_create_map(4, HPIX_ORDER_SCHEME_RING);
+    double * block = hpix_calloc(sizeof(double), 100);
+    hpix_set_allocator(NULL);
+
+    fail_unless(counter.num_of_allocations >= 2);
+    fail_unless(IS_ALIGNED(block));
+    fail_unless(block[99] == 0.0);
+
+    /* Blocks go back to the allocator which provided them */
+    const int num_of_allocations = counter.num_of_allocations;
+    hpix_free(block);
+    hpix_free_map(map);
+    /* The resolution of the map survives it and must be freed too */
+    hpix_release_cached_resolutions();
+    ck_assert_int_eq(counter.num_of_releases, num_of_allocations);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(huge_pages)
+{
+    const size_t size = 3 * 1024 * 1024;
+
+    hpix_set_huge_page_threshold(1024 * 1024);
+    double * small = hpix_malloc(sizeof(double), 16);
+    double * large = hpix_calloc(1, size);
+    hpix_set_huge_page_threshold(0);
+
+    fail_unless(IS_ALIGNED(large));
+    fail_unless(((char *) large)[size - 1] == 0);
+    memset(large, 1, size);
+
+    hpix_free(large);
+    hpix_free(small);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(page_placement)
+{
+    const size_t num_of_elements = 100000;
+
+    hpix_set_page_placement(HPIX_PAGES_INTERLEAVED);
+    for(int placement = 0; placement < 2; ++placement)
+    {
+	double * block = hpix_parallel_calloc(sizeof(double), num_of_elements);
+
+	fail_unless(IS_ALIGNED(block));
+	for(size_t idx = 0; idx < num_of_elements; ++idx)
+	    fail_unless(block[idx] == 0.0);
+
+	hpix_free(block);
+	hpix_set_page_placement(HPIX_PAGES_FIRST_TOUCH);
+    }
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(arenas)
+{
+    hpix_arena_t * arena = hpix_create_arena(1024);
+    hpix_memory_stats_t stats;
+    char * blocks[100];
+
+    hpix_reset_memory_stats();
+    for(int cycle = 0; cycle < 3; ++cycle)
+    {
+	for(int idx = 0; idx < 100; ++idx)
+	{
+	    blocks[idx] = hpix_arena_alloc(arena, 1, idx + 1);
+	    fail_unless(IS_ALIGNED(blocks[idx]));
+	    memset(blocks[idx], idx, idx + 1);
+	}
+
+	/* Check that the blocks do not overlap */
+	for(int idx = 0; idx < 100; ++idx)
+	{
+	    for(int byte = 0; byte <= idx; ++byte)
+		fail_unless(blocks[idx][byte] == (char) idx);
+	}
+
+	hpix_clear_arena(arena);
+    }
+
+    /* Blocks larger than a chunk are allowed */
+    fail_unless(hpix_arena_alloc(arena, sizeof(double), 1000) != NULL);
+
+    /* The arena asks hpix_malloc for few large chunks */
+    hpix_get_memory_stats(&stats);
+    fail_unless(stats.num_of_allocations < 100);
+
+    hpix_free_arena(arena);
+}
+END_TEST
+
+/**********************************************************************/
+
+Suite *
+create_hpix_test_suite(void)
+{
+    Suite * suite = suite_create("Memory functions");
+    TCase * tc_core;
+
+    tc_core = tcase_create("Allocation");
+    tcase_add_test(tc_core, aligned_allocation);
+    tcase_add_test(tc_core, memory_statistics);
+    tcase_add_test(tc_core, custom_allocator);
+    tcase_add_test(tc_core, huge_pages);
+    tcase_add_test(tc_core, page_placement);
+    suite_add_tcase(suite, tc_core);
+
+    tc_core = tcase_create("Arenas");
+    tcase_add_test(tc_core, arenas);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+/**********************************************************************/
+
+int
+main(void)
+{
+    int number_failed;
+    Suite * suite = create_hpix_test_suite();
+    SRunner * runner = srunner_create(suite);
+    srunner_run_all(runner, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -169,6 +169,87 @@ END_TEST
 
 /**********************************************************************/
 
+/* Unpack a color from a palette LUT */
+#define ARGB32_COMPONENT(argb, shift) (((argb) >> (shift)) & 0xFF)
+
+START_TEST(palette_lut)
+{
+    hpix_color_palette_t * palette = hpix_create_healpix_color_palette();
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+
+    /* The LUT samples the palette finely enough that colors differ by
+     * at most one unit (out of 255) */
+    for(int i = 0; i <= 1000; ++i)
+    {
+	const double level = i / 1000.0;
+	hpix_color_t color;
+	uint32_t argb = hpix_palette_lut_color(lut, level);
+
+	hpix_palette_color(palette, level, &color);
+	ck_assert_int_eq(ARGB32_COMPONENT(argb, 24), 255);
+	fail_unless(abs((int) ARGB32_COMPONENT(argb, 16)
+			- (int) (255 * color.red)) <= 1);
+	fail_unless(abs((int) ARGB32_COMPONENT(argb, 8)
+			- (int) (255 * color.green)) <= 1);
+	fail_unless(abs((int) ARGB32_COMPONENT(argb, 0)
+			- (int) (255 * color.blue)) <= 1);
+    }
+
+    /* Levels are clipped */
+    ck_assert_int_eq(hpix_palette_lut_color(lut, -1.0),
+		     hpix_palette_lut_color(lut, 0.0));
+    ck_assert_int_eq(hpix_palette_lut_color(lut, 2.0),
+		     hpix_palette_lut_color(lut, 1.0));
+
+    hpix_free_palette_lut(lut);
+    hpix_free_color_palette(palette);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(bitmap_to_argb32)
+{
+    hpix_color_palette_t * palette = hpix_create_grayscale_color_palette();
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    hpix_color_t unseen_color = hpix_color_for_unseen_pixels_in_palette(palette);
+    /* An odd width exercises both the vectorized and the scalar code */
+    const double bitmap[2 * 5] = {
+	0.0, 10.0, 5.0, INFINITY, NAN,
+	-1.6375e+30, -INFINITY, -3.0, 20.0, 7.5
+    };
+    /* Rows are padded to 6 pixels */
+    uint32_t image[2 * 6];
+
+    hpix_bitmap_to_argb32(lut, bitmap, 5, 2, 0.0, 10.0,
+			  (unsigned char *) image, 6 * sizeof(uint32_t), 1);
+
+    /* The second row of the bitmap is the first of the image */
+    const uint32_t * first_row = image + 6;
+    const uint32_t * second_row = image;
+
+    ck_assert_int_eq(first_row[0], hpix_palette_lut_color(lut, 0.0));
+    ck_assert_int_eq(first_row[1], hpix_palette_lut_color(lut, 1.0));
+    ck_assert_int_eq(first_row[2], hpix_palette_lut_color(lut, 0.5));
+    ck_assert_int_eq(ARGB32_COMPONENT(first_row[3], 24), 0);
+    ck_assert_int_eq(first_row[4],
+		     0xFF000000
+		     | ((uint32_t) (int) (255 * unseen_color.red) << 16)
+		     | ((uint32_t) (int) (255 * unseen_color.green) << 8)
+		     | (uint32_t) (int) (255 * unseen_color.blue));
+    ck_assert_int_eq(second_row[0], first_row[4]);
+    ck_assert_int_eq(ARGB32_COMPONENT(second_row[1], 24), 0);
+    ck_assert_int_eq(second_row[2], hpix_palette_lut_color(lut, 0.0));
+    ck_assert_int_eq(second_row[3], hpix_palette_lut_color(lut, 1.0));
+    ck_assert_int_eq(second_row[4], hpix_palette_lut_color(lut, 0.75));
+
+    hpix_free_palette_lut(lut);
+    hpix_free_color_palette(palette);
+}
+END_TEST
+
+/**********************************************************************/
+
 void
 add_color_and_palette_tests_to_testcase(TCase * testcase)
 {
@@ -178,6 +259,8 @@ add_color_and_palette_tests_to_testcase(TCase * testcase)
     tcase_add_test(testcase, access_to_palettes);
     tcase_add_test(testcase, modify_colors_in_palette);
     tcase_add_test(testcase, check_interpolation);
+    tcase_add_test(testcase, palette_lut);
+    tcase_add_test(testcase, bitmap_to_argb32);
 }
 
 /**********************************************************************/
@@ -316,6 +316,68 @@ END_TEST
 
 /**********************************************************************/
 
+START_TEST(pointings_to_pixels)
+{
+    hpix_resolution_t * resolution = hpix_create_resolution(256);
+    /* The first quaternion points the beam towards (0.1, 0.2, 0.3)
+     * with the polarization axis along the meridian; the second is a
+     * rotation by 90 degrees around the y axis */
+    const double length = sqrt(0.14);
+    const double half_theta = 0.5 * acos(0.3 / length);
+    const double half_phi = 0.5 * atan2(0.2, 0.1);
+    double w[] = { cos(half_phi) * cos(half_theta), M_SQRT1_2 };
+    double x[] = { -sin(half_phi) * sin(half_theta), 0.0 };
+    double y[] = { cos(half_phi) * sin(half_theta), M_SQRT1_2 };
+    double z[] = { sin(half_phi) * cos(half_theta), 0.0 };
+    const hpix_quaternion_arrays_t pointings = { w, x, y, z };
+    hpix_pixel_num_t pixels[2];
+    double pol_angles[2];
+    hpix_matrix_t matrices[2];
+
+    hpix_quaternions_to_pixels(resolution, HPIX_ORDER_SCHEME_RING,
+			       &pointings, 2, NULL, pixels, pol_angles);
+    ck_assert_int_eq(pixels[0], 78151);
+    TEST_FOR_CLOSENESS(fabs(pol_angles[0]), M_PI);
+    TEST_FOR_CLOSENESS(fabs(pol_angles[1]), M_PI);
+
+    hpix_quaternions_to_pixels(resolution, HPIX_ORDER_SCHEME_NEST,
+			       &pointings, 2, NULL, pixels, NULL);
+    ck_assert_int_eq(pixels[0], 31281);
+
+    /* Rotating the detector by 30 degrees around the beam axis changes
+     * the polarization angle but not the pixel */
+    {
+	const hpix_quaternion_t offset =
+	    { .w = cos(M_PI / 12), .x = 0.0, .y = 0.0, .z = sin(M_PI / 12) };
+	hpix_matrix_t offset_matrix;
+
+	hpix_quaternions_to_pixels(resolution, HPIX_ORDER_SCHEME_NEST,
+				   &pointings, 2, &offset, pixels, pol_angles);
+	ck_assert_int_eq(pixels[0], 31281);
+	TEST_FOR_CLOSENESS(pol_angles[1], 5.0 * M_PI / 6.0);
+
+	/* The same using matrices */
+	for(int idx = 0; idx < 2; ++idx)
+	{
+	    const hpix_quaternion_t quaternion =
+		{ .w = w[idx], .x = x[idx], .y = y[idx], .z = z[idx] };
+	    hpix_quaternion_to_matrix(&quaternion, &matrices[idx]);
+	}
+	hpix_quaternion_to_matrix(&offset, &offset_matrix);
+
+	pol_angles[1] = 0.0;
+	hpix_matrices_to_pixels(resolution, HPIX_ORDER_SCHEME_NEST,
+				matrices, 2, &offset_matrix, pixels, pol_angles);
+	ck_assert_int_eq(pixels[0], 31281);
+	TEST_FOR_CLOSENESS(pol_angles[1], 5.0 * M_PI / 6.0);
+    }
+
+    hpix_free_resolution(resolution);
+}
+END_TEST
+
+/**********************************************************************/
+
 START_TEST(pixels_to_vectors)
 {
     hpix_resolution_t * resol;
@@ -449,9 +511,298 @@ END_TEST
 
 /**********************************************************************/
 
+START_TEST(nest_subpixels)
+{
+    unsigned int x, y;
+
+    /* The bits of x and y are interleaved, starting from x */
+    ck_assert_int_eq(hpix_xy_to_nest_subpixel(0, 0), 0);
+    ck_assert_int_eq(hpix_xy_to_nest_subpixel(1, 0), 1);
+    ck_assert_int_eq(hpix_xy_to_nest_subpixel(0, 1), 2);
+    ck_assert_int_eq(hpix_xy_to_nest_subpixel(1, 1), 3);
+    ck_assert_int_eq(hpix_xy_to_nest_subpixel(2, 0), 4);
+    ck_assert_int_eq(hpix_xy_to_nest_subpixel(5, 3), 27);
+
+    for(hpix_pixel_num_t subpixel = 0; subpixel < 65536; subpixel += 7)
+    {
+	hpix_nest_subpixel_to_xy(subpixel, &x, &y);
+	fail_unless(x < 256 && y < 256);
+	ck_assert_int_eq(hpix_xy_to_nest_subpixel(x, y), subpixel);
+    }
+
+    hpix_nest_subpixel_to_xy(((hpix_pixel_num_t) 1) << 40, &x, &y);
+    ck_assert_int_eq(x, 1 << 20);
+    ck_assert_int_eq(y, 0);
+}
+END_TEST
+
+/**********************************************************************/
+
+/* Compare hpix_query_disc with a search over all the pixels */
+static void
+check_query_disc(hpix_nside_t nside, hpix_ordering_scheme_t scheme,
+		 double theta, double phi, double radius)
+{
+    hpix_resolution_t * resolution = hpix_create_resolution(nside);
+    hpix_pixel_to_vector * pixel_to_vector_fn =
+	(scheme == HPIX_ORDER_SCHEME_NEST)
+	? hpix_nest_pixel_to_vector
+	: hpix_ring_pixel_to_vector;
+    hpix_pixel_num_t * pixels;
+    hpix_pixel_num_t * inclusive_pixels;
+    size_t num_of_matches, num_of_inclusive_matches;
+    size_t match_idx = 0, inclusive_idx = 0;
+    hpix_vector_t center;
+
+    hpix_angles_to_vector(theta, phi, &center);
+    hpix_query_disc(resolution, scheme, theta, phi, radius,
+		    &pixels, &num_of_matches);
+    hpix_query_disc_inclusive(resolution, scheme, theta, phi, radius,
+			      &inclusive_pixels, &num_of_inclusive_matches);
+    fail_unless(num_of_inclusive_matches >= num_of_matches);
+
+    for(hpix_pixel_num_t pixel = 0;
+	pixel < hpix_nside_to_npixel(nside);
+	++pixel)
+    {
+	hpix_vector_t vector;
+	pixel_to_vector_fn(resolution, pixel, &vector);
+
+	/* Skip pixels too close to the border of the disc */
+	const double cos_distance = hpix_dot_product(&center, &vector);
+	if(fabs(cos_distance - cos(radius)) < 1e-10)
+	    continue;
+
+	while(match_idx < num_of_matches && pixels[match_idx] < pixel)
+	    ++match_idx;
+	while(inclusive_idx < num_of_inclusive_matches
+	      && inclusive_pixels[inclusive_idx] < pixel)
+	    ++inclusive_idx;
+
+	const _Bool found =
+	    match_idx < num_of_matches && pixels[match_idx] == pixel;
+	const _Bool found_inclusive =
+	    inclusive_idx < num_of_inclusive_matches
+	    && inclusive_pixels[inclusive_idx] == pixel;
+
+	fail_unless(found == (cos_distance > cos(radius)),
+		    "Pixel %u (NSIDE %u) is wrong",
+		    (unsigned) pixel, (unsigned) nside);
+	if(found)
+	    fail_unless(found_inclusive);
+    }
+
+    /* The inclusive query must include the pixel of each point of the
+     * disc, including the ones on its border */
+    for(int i = 0; i < 64; ++i)
+    {
+	hpix_vector_t vector;
+	double point_theta, point_phi;
+	const double angle = 2.0 * M_PI * i / 64;
+	const double sin_radius = sin(radius), cos_radius = cos(radius);
+	const hpix_vector_t east = { -sin(phi), cos(phi), 0.0 };
+	const hpix_vector_t north = { -cos(theta) * cos(phi),
+				      -cos(theta) * sin(phi),
+				      sin(theta) };
+
+	vector.x = cos_radius * center.x
+	    + sin_radius * (cos(angle) * east.x + sin(angle) * north.x);
+	vector.y = cos_radius * center.y
+	    + sin_radius * (cos(angle) * east.y + sin(angle) * north.y);
+	vector.z = cos_radius * center.z
+	    + sin_radius * (cos(angle) * east.z + sin(angle) * north.z);
+	hpix_vector_to_angles(&vector, &point_theta, &point_phi);
+
+	const hpix_pixel_num_t pixel =
+	    (scheme == HPIX_ORDER_SCHEME_NEST)
+	    ? hpix_angles_to_nest_pixel(resolution, point_theta, point_phi)
+	    : hpix_angles_to_ring_pixel(resolution, point_theta, point_phi);
+	_Bool found = FALSE;
+	for(size_t idx = 0; idx < num_of_inclusive_matches; ++idx)
+	    found = found || inclusive_pixels[idx] == pixel;
+	fail_unless(found, "Pixel %u is missing from the inclusive query",
+		    (unsigned) pixel);
+    }
+
+    hpix_free(inclusive_pixels);
+    hpix_free(pixels);
+    hpix_free_resolution(resolution);
+}
+
+/**********************************************************************/
+
 START_TEST(query_disc)
 {
-    ck_assert_int_eq(1, 0);
+    const double directions[][3] = {
+	/* theta, phi, radius */
+	{ 1.0, 2.0, 0.3 },
+	{ 0.05, 4.0, 0.4 },   /* Around the North pole */
+	{ 3.1, 0.0, 0.2 },    /* Around the South pole */
+	{ M_PI_2, 0.0, 0.5 }, /* Across phi = 0 */
+	{ 2.0, 6.2, 1.5 },
+	{ 0.7, 3.0, 0.01 },   /* Smaller than a pixel */
+	{ 1.2, 1.0, 3.0 }     /* Almost the whole sphere */
+    };
+
+    for(size_t i = 0; i < sizeof(directions) / sizeof(directions[0]); ++i)
+    {
+	for(hpix_nside_t nside = 1; nside <= 32; nside *= 2)
+	{
+	    check_query_disc(nside, HPIX_ORDER_SCHEME_RING, directions[i][0],
+			     directions[i][1], directions[i][2]);
+	    check_query_disc(nside, HPIX_ORDER_SCHEME_NEST, directions[i][0],
+			     directions[i][1], directions[i][2]);
+	}
+    }
+}
+END_TEST
+
+/**********************************************************************/
+
+static int num_of_cache_creations = 0;
+static int num_of_cache_releases = 0;
+
+static void *
+create_test_cache(const hpix_resolution_t * resolution)
+{
+    double * data = hpix_malloc(sizeof(double), 1);
+
+    *data = resolution->nside;
+    num_of_cache_creations++;
+    return data;
+}
+
+static void
+free_test_cache(void * data)
+{
+    num_of_cache_releases++;
+    hpix_free(data);
+}
+
+START_TEST(shared_resolutions)
+{
+    hpix_map_t * map1 = hpix_create_map(32, HPIX_ORDER_SCHEME_RING);
+    hpix_map_t * map2 = hpix_create_map(32, HPIX_ORDER_SCHEME_NEST);
+    hpix_map_t * map3 = hpix_create_map(64, HPIX_ORDER_SCHEME_RING);
+
+    fail_unless(hpix_map_resolution(map1) == hpix_map_resolution(map2));
+    fail_unless(hpix_map_resolution(map1) != hpix_map_resolution(map3));
+    ck_assert_int_eq(hpix_map_resolution(map3)->num_of_pixels, 49152);
+
+    /* The data attached to a resolution are built only once... */
+    const double * data1 = hpix_resolution_cache(hpix_map_resolution(map1),
+						 create_test_cache,
+						 free_test_cache);
+    const double * data2 = hpix_resolution_cache(hpix_map_resolution(map2),
+						 create_test_cache,
+						 free_test_cache);
+    fail_unless(data1 == data2);
+    TEST_FOR_CLOSENESS(*data1, 32.0);
+    ck_assert_int_eq(num_of_cache_creations, 1);
+
+    /* ...and survive when no map uses the resolution any longer, so
+     * that creating a new map does not build them again... */
+    hpix_free_map(map1);
+    hpix_free_map(map2);
+    ck_assert_int_eq(num_of_cache_releases, 0);
+
+    map1 = hpix_create_map(32, HPIX_ORDER_SCHEME_RING);
+    fail_unless(hpix_resolution_cache(hpix_map_resolution(map1),
+				      create_test_cache,
+				      free_test_cache) == data1);
+    ck_assert_int_eq(num_of_cache_creations, 1);
+
+    /* ...until they are explicitly released. Resolutions still in
+     * use are not affected */
+    hpix_release_cached_resolutions();
+    ck_assert_int_eq(num_of_cache_releases, 0);
+
+    hpix_free_map(map1);
+    hpix_release_cached_resolutions();
+    ck_assert_int_eq(num_of_cache_releases, 1);
+
+    map1 = hpix_create_map(32, HPIX_ORDER_SCHEME_RING);
+    hpix_resolution_cache(hpix_map_resolution(map1),
+			  create_test_cache, free_test_cache);
+    ck_assert_int_eq(num_of_cache_creations, 2);
+
+    hpix_free_map(map1);
+    hpix_free_map(map3);
+    hpix_release_cached_resolutions();
+    ck_assert_int_eq(num_of_cache_releases, 2);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(bin_points)
+{
+    const hpix_pixel_num_t pixels[] = { 3, 7, 3, 3, 190, 7 };
+    const double weights[] = { 1.0, 2.0, 3.0, 4.0, 5.0, 6.0 };
+    const size_t num_of_points = sizeof(pixels) / sizeof(pixels[0]);
+    hpix_map_t * map = hpix_create_map(4, HPIX_ORDER_SCHEME_RING);
+    const double * map_pixels = hpix_map_pixels(map);
+
+    hpix_bin_pixels_to_map(map, pixels, weights, num_of_points,
+			   HPIX_BIN_COUNTS);
+    TEST_FOR_CLOSENESS(map_pixels[3], 3.0);
+    TEST_FOR_CLOSENESS(map_pixels[7], 2.0);
+    TEST_FOR_CLOSENESS(map_pixels[190], 1.0);
+    TEST_FOR_CLOSENESS(map_pixels[0], 0.0);
+
+    hpix_bin_pixels_to_map(map, pixels, weights, num_of_points,
+			   HPIX_BIN_SUM);
+    TEST_FOR_CLOSENESS(map_pixels[3], 8.0);
+    TEST_FOR_CLOSENESS(map_pixels[7], 8.0);
+    TEST_FOR_CLOSENESS(map_pixels[190], 5.0);
+    TEST_FOR_CLOSENESS(map_pixels[0], 0.0);
+
+    hpix_bin_pixels_to_map(map, pixels, weights, num_of_points,
+			   HPIX_BIN_MEAN);
+    TEST_FOR_CLOSENESS(map_pixels[3], 8.0 / 3.0);
+    TEST_FOR_CLOSENESS(map_pixels[7], 4.0);
+    TEST_FOR_CLOSENESS(map_pixels[190], 5.0);
+    fail_unless(isnan(map_pixels[0]));
+
+    /* No weights means that every point counts as 1 */
+    hpix_bin_pixels_to_map(map, pixels, NULL, num_of_points, HPIX_BIN_SUM);
+    TEST_FOR_CLOSENESS(map_pixels[3], 3.0);
+
+    hpix_free_map(map);
+
+    /* A few points on a large map are binned by sorting them instead
+     * of using one histogram per thread: the result must be the same */
+    {
+	const double theta[] = { 0.1, 0.1, 1.5, 3.0 };
+	const double phi[] = { 0.2, 0.2, 4.0, 6.0 };
+	const double large_weights[] = { 1.0, 3.0, 5.0, 7.0 };
+	const hpix_nside_t nside = 1024;
+
+	map = hpix_create_map(nside, HPIX_ORDER_SCHEME_NEST);
+	hpix_bin_points_to_map(map, theta, phi, large_weights, 4,
+			       HPIX_BIN_MEAN);
+	map_pixels = hpix_map_pixels(map);
+
+	const hpix_resolution_t * resolution = hpix_map_resolution(map);
+	const hpix_pixel_num_t pixel1 =
+	    hpix_angles_to_nest_pixel(resolution, 0.1, 0.2);
+	const hpix_pixel_num_t pixel2 =
+	    hpix_angles_to_nest_pixel(resolution, 1.5, 4.0);
+	const hpix_pixel_num_t pixel3 =
+	    hpix_angles_to_nest_pixel(resolution, 3.0, 6.0);
+
+	TEST_FOR_CLOSENESS(map_pixels[pixel1], 2.0);
+	TEST_FOR_CLOSENESS(map_pixels[pixel2], 5.0);
+	TEST_FOR_CLOSENESS(map_pixels[pixel3], 7.0);
+	fail_unless(isnan(map_pixels[pixel1 + 1]));
+
+	size_t num_of_unseen = 0;
+	for(size_t pixel = 0; pixel < hpix_map_num_of_pixels(map); ++pixel)
+	    num_of_unseen += isnan(map_pixels[pixel]);
+	ck_assert_int_eq(num_of_unseen, hpix_map_num_of_pixels(map) - 3);
+
+	hpix_free_map(map);
+    }
 }
 END_TEST
 
@@ -472,6 +823,9 @@ add_pixel_tests_to_testcase(TCase * testcase)
 
     tcase_add_test(testcase, vectors_to_pixels);
     tcase_add_test(testcase, pixels_to_vectors);
+
+    tcase_add_test(testcase, pointings_to_pixels);
+    tcase_add_test(testcase, shared_resolutions);
 }
 
 /**********************************************************************/
@@ -485,6 +839,7 @@ add_pixel_order_tests_to_testcase(TCase * testcase)
 
     tcase_add_test(testcase, nest_to_ring);
     tcase_add_test(testcase, ring_to_nest);
+    tcase_add_test(testcase, nest_subpixels);
 }
 
 /**********************************************************************/
@@ -505,6 +860,14 @@ add_query_disk_tests_to_testcase(TCase * testcase)
 
 /**********************************************************************/
 
+void
+add_binning_tests_to_testcase(TCase * testcase)
+{
+    tcase_add_test(testcase, bin_points);
+}
+
+/**********************************************************************/
+
 Suite *
 create_hpix_test_suite(void)
 {
@@ -531,6 +894,10 @@ create_hpix_test_suite(void)
     add_query_disk_tests_to_testcase(tc_core);
     suite_add_tcase(suite, tc_core);
 
+    tc_core = tcase_create("Binning points");
+    add_binning_tests_to_testcase(tc_core);
+    suite_add_tcase(suite, tc_core);
+
     return suite;
 }
 
@@ -18,6 +18,7 @@
 #include <hpixlib/hpix.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <check.h>
 #include "check_helpers.h"
 
@@ -66,6 +67,497 @@ END_TEST
 
 /**********************************************************************/
 
+START_TEST(angular_distance_from_angles)
+{
+    TEST_FOR_CLOSENESS(hpix_calc_angular_distance_from_angles(0.0, 0.0,
+							      M_PI, 0.0),
+		       M_PI);
+    TEST_FOR_CLOSENESS(hpix_calc_angular_distance_from_angles(M_PI / 2, 0.1,
+							      M_PI / 2, 0.4),
+		       0.3);
+    /* Very small angles are not lost in rounding errors */
+    fail_unless(fabs(hpix_calc_angular_distance_from_angles(1.0, 2.0,
+							    1.0 + 1e-9, 2.0)
+		     - 1e-9) < 1e-15);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(pair_search)
+{
+    const size_t num_of_points1 = 500;
+    const size_t num_of_points2 = 700;
+    const double radius = 0.15;
+    hpix_vector_batch_t * catalogue1 = hpix_create_vector_batch(num_of_points1);
+    hpix_vector_batch_t * catalogue2 = hpix_create_vector_batch(num_of_points2);
+    hpix_pair_t * pairs;
+    size_t num_of_pairs;
+    size_t num_of_expected_pairs = 0;
+
+    /* Points spread almost uniformly on the sphere, along two
+     * spirals. Vectors do not need to be normalized. */
+    for(size_t idx = 0; idx < num_of_points1; ++idx)
+    {
+	const double z = 1.0 - (2.0 * idx + 1.0) / num_of_points1;
+	const double phi = idx * 2.39996;
+	catalogue1->x[idx] = 2.0 * sqrt(1.0 - z * z) * cos(phi);
+	catalogue1->y[idx] = 2.0 * sqrt(1.0 - z * z) * sin(phi);
+	catalogue1->z[idx] = 2.0 * z;
+    }
+    for(size_t idx = 0; idx < num_of_points2; ++idx)
+    {
+	const double z = 1.0 - (2.0 * idx + 1.0) / num_of_points2;
+	const double phi = idx * 1.3;
+	catalogue2->x[idx] = sqrt(1.0 - z * z) * cos(phi);
+	catalogue2->y[idx] = sqrt(1.0 - z * z) * sin(phi);
+	catalogue2->z[idx] = z;
+    }
+
+    pairs = hpix_find_pairs(catalogue1, catalogue2, radius, &num_of_pairs);
+
+    /* Every pair must be closer than the radius... */
+    for(size_t idx = 0; idx < num_of_pairs; ++idx)
+    {
+	const size_t i = pairs[idx].index1;
+	const size_t j = pairs[idx].index2;
+	const hpix_vector_t vector1 =
+	    { catalogue1->x[i], catalogue1->y[i], catalogue1->z[i] };
+	const hpix_vector_t vector2 =
+	    { catalogue2->x[j], catalogue2->y[j], catalogue2->z[j] };
+
+	fail_unless(hpix_calc_angular_distance_from_vectors(&vector1, &vector2)
+		    <= radius);
+    }
+
+    /* ...and no pair can be missing */
+    for(size_t i = 0; i < num_of_points1; ++i)
+    {
+	for(size_t j = 0; j < num_of_points2; ++j)
+	{
+	    const hpix_vector_t vector1 =
+		{ catalogue1->x[i], catalogue1->y[i], catalogue1->z[i] };
+	    const hpix_vector_t vector2 =
+		{ catalogue2->x[j], catalogue2->y[j], catalogue2->z[j] };
+
+	    if(hpix_calc_angular_distance_from_vectors(&vector1, &vector2) < radius)
+		num_of_expected_pairs++;
+	}
+    }
+    ck_assert_int_eq(num_of_pairs, num_of_expected_pairs);
+
+    hpix_free(pairs);
+    hpix_free_vector_batch(catalogue2);
+    hpix_free_vector_batch(catalogue1);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(interpolation)
+{
+    hpix_map_t * map = hpix_create_map(8, HPIX_ORDER_SCHEME_NEST);
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    double * pixels = hpix_map_pixels(map);
+
+    for(size_t idx = 0; idx < hpix_map_num_of_pixels(map); ++idx)
+	pixels[idx] = idx;
+
+    /* At the center of a pixel away from the poles, only the pixel
+     * itself contributes */
+    {
+	const hpix_pixel_num_t pixel = 300;
+	hpix_pixel_num_t neighbours[4];
+	double weights[4];
+	double theta, phi, sum = 0.0;
+
+	hpix_nest_pixel_to_angles(resolution, pixel, &theta, &phi);
+	hpix_interpolation_weights(resolution, HPIX_ORDER_SCHEME_NEST,
+				   theta, phi, neighbours, weights);
+	for(int idx = 0; idx < 4; ++idx)
+	    sum += weights[idx];
+	TEST_FOR_CLOSENESS(sum, 1.0);
+	TEST_FOR_CLOSENESS(hpix_interpolate_value(map, theta, phi),
+			   (double) pixel);
+    }
+
+    /* Masked pixels do not contribute */
+    {
+	for(size_t idx = 0; idx < hpix_map_num_of_pixels(map); ++idx)
+	    pixels[idx] = (idx % 2 == 0) ? 1.0 : NAN;
+
+	fail_unless(fabs(hpix_interpolate_value(map, 0.3, 0.1) - 1.0) < 1e-12);
+	fail_unless(fabs(hpix_interpolate_value(map, M_PI - 0.01, 4.0) - 1.0) < 1e-12);
+    }
+
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(batch_interpolation)
+{
+    const size_t num_of_points = 1000;
+    double * theta = hpix_malloc(sizeof(double), num_of_points);
+    double * phi = hpix_malloc(sizeof(double), num_of_points);
+    double * values = hpix_malloc(sizeof(double), num_of_points);
+
+    /* Include both poles and points with negative longitude */
+    for(size_t idx = 0; idx < num_of_points; ++idx)
+    {
+	theta[idx] = M_PI * idx / (num_of_points - 1);
+	phi[idx] = 7.0 * sin(idx * 13.0);
+    }
+
+    for(int scheme = 0; scheme < 2; ++scheme)
+    {
+	hpix_map_t * map = hpix_create_map(16, scheme);
+	double * pixels = hpix_map_pixels(map);
+
+	for(size_t idx = 0; idx < hpix_map_num_of_pixels(map); ++idx)
+	    pixels[idx] = (idx % 5 == 0) ? NAN : cos(0.01 * idx);
+
+	for(int sorting = 0; sorting < 2; ++sorting)
+	{
+	    hpix_interpolate_map(map, theta, phi, values, num_of_points,
+				 (sorting == 0)
+				 ? HPIX_KEEP_POINT_ORDER
+				 : HPIX_SORT_POINTS_BY_RING);
+
+	    for(size_t idx = 0; idx < num_of_points; ++idx)
+	    {
+		const double expected =
+		    hpix_interpolate_value(map, theta[idx], phi[idx]);
+
+		fail_unless(values[idx] == expected
+			    || (isnan(values[idx]) && isnan(expected)),
+			    "Point %u differs", (unsigned) idx);
+	    }
+	}
+
+	hpix_free_map(map);
+    }
+
+    hpix_free(values);
+    hpix_free(phi);
+    hpix_free(theta);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(euler_angles)
+{
+    hpix_matrix_t matrix;
+    hpix_vector_t vector;
+    double psi, theta, phi;
+
+    /* A rotation around the z axis moves the x axis along y */
+    hpix_euler_angles_to_matrix(&matrix, M_PI / 2, 0.0, 0.0);
+    hpix_matrix_vector_mul(&vector, &matrix,
+			   &(hpix_vector_t) { .x = 1.0, .y = 0.0, .z = 0.0 });
+    ARE_VECTORS_EQUAL(vector,
+		      ((hpix_vector_t) { .x = 0.0, .y = 1.0, .z = 0.0 }));
+
+    hpix_euler_angles_to_matrix(&matrix, 0.3, 1.1, -2.0);
+    hpix_matrix_to_euler_angles(&matrix, &psi, &theta, &phi);
+    TEST_FOR_CLOSENESS(psi, 0.3);
+    TEST_FOR_CLOSENESS(theta, 1.1);
+    TEST_FOR_CLOSENESS(phi, -2.0);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(coordinate_matrices)
+{
+    hpix_matrix_t matrix, inverse, product, unity;
+    hpix_vector_t pole;
+    double theta, phi;
+
+    /* The Galactic north pole lies at RA = 192.859 deg,
+     * Dec = 27.128 deg */
+    fail_unless(hpix_coordinate_rotation_matrix(HPIX_COORD_GALACTIC,
+						HPIX_COORD_CELESTIAL,
+						&matrix));
+    hpix_matrix_vector_mul(&pole, &matrix,
+			   &(hpix_vector_t) { .x = 0.0, .y = 0.0, .z = 1.0 });
+    hpix_vector_to_angles(&pole, &theta, &phi);
+    fail_unless(fabs(90.0 - theta * 180.0 / M_PI - 27.128) < 1e-3);
+    fail_unless(fabs(phi * 180.0 / M_PI - 192.859) < 1e-3);
+
+    /* Going from Galactic to ecliptic and back */
+    hpix_set_matrix_to_unity(&unity);
+    fail_unless(hpix_coordinate_rotation_matrix(HPIX_COORD_GALACTIC,
+						HPIX_COORD_ECLIPTIC,
+						&matrix));
+    fail_unless(hpix_coordinate_rotation_matrix(HPIX_COORD_ECLIPTIC,
+						HPIX_COORD_GALACTIC,
+						&inverse));
+    hpix_matrix_mul(&product, &inverse, &matrix);
+    ARE_MATRICES_EQUAL(product, unity);
+
+    fail_unless(! hpix_coordinate_rotation_matrix(HPIX_COORD_CUSTOM,
+						  HPIX_COORD_GALACTIC,
+						  &matrix));
+}
+END_TEST
+
+/**********************************************************************/
+
+/* Fill the map with a dipole and a quadrupole, rotated by `matrix` */
+static void
+fill_low_multipole_map(hpix_map_t * map, const hpix_matrix_t * matrix)
+{
+    const hpix_resolution_t * resolution = hpix_map_resolution(map);
+    double * pixels = hpix_map_pixels(map);
+
+    for(size_t idx = 0; idx < hpix_map_num_of_pixels(map); ++idx)
+    {
+	hpix_vector_t vector, rotated;
+
+	hpix_ring_pixel_to_vector(resolution, idx, &vector);
+	hpix_matrix_vector_mul(&rotated, matrix, &vector);
+	pixels[idx] = 0.3 * rotated.x - 0.5 * rotated.y + 0.8 * rotated.z
+	    + 0.7 * rotated.x * rotated.y;
+    }
+}
+
+/**********************************************************************/
+
+static double
+max_map_difference(const hpix_map_t * map1, const hpix_map_t * map2)
+{
+    const double * pixels1 = hpix_map_pixels(map1);
+    const double * pixels2 = hpix_map_pixels(map2);
+    double result = 0.0;
+
+    for(size_t idx = 0; idx < hpix_map_num_of_pixels(map1); ++idx)
+    {
+	if(fabs(pixels1[idx] - pixels2[idx]) > result)
+	    result = fabs(pixels1[idx] - pixels2[idx]);
+    }
+
+    return result;
+}
+
+/**********************************************************************/
+
+START_TEST(map_rotation)
+{
+    hpix_map_t * map = hpix_create_map(16, HPIX_ORDER_SCHEME_RING);
+    hpix_map_t * expected = hpix_create_map(16, HPIX_ORDER_SCHEME_RING);
+    hpix_matrix_t matrix, inverse;
+
+    fill_low_multipole_map(map, &(hpix_matrix_t) { { { 1.0, 0.0, 0.0 },
+						      { 0.0, 1.0, 0.0 },
+						      { 0.0, 0.0, 1.0 } } });
+    fail_unless(hpix_coordinate_rotation_matrix(HPIX_COORD_CELESTIAL,
+						HPIX_COORD_GALACTIC,
+						&inverse));
+    fill_low_multipole_map(expected, &inverse);
+
+    /* The value at direction v in the new map is the one at M^-1 v in
+     * the old one */
+    {
+	hpix_map_t * rotated =
+	    hpix_rotate_map_coords(map, HPIX_COORD_CELESTIAL, HPIX_ROTATE_PIXEL);
+
+	fail_unless(hpix_map_coordinate_system(rotated) == HPIX_COORD_CELESTIAL);
+	fail_unless(max_map_difference(rotated, expected) < 1e-2);
+	hpix_free_map(rotated);
+    }
+
+    /* Rotating forth and back gives the original map */
+    hpix_euler_angles_to_matrix(&matrix, 0.4, 0.9, 1.3);
+    hpix_euler_angles_to_matrix(&inverse, -1.3, -0.9, -0.4);
+    {
+	hpix_map_t * rotated = hpix_rotate_map(map, &matrix, HPIX_ROTATE_PIXEL);
+	hpix_map_t * back = hpix_rotate_map(rotated, &inverse, HPIX_ROTATE_PIXEL);
+
+	fail_unless(max_map_difference(back, map) < 2e-2);
+	hpix_free_map(back);
+	hpix_free_map(rotated);
+    }
+
+    fail_unless(hpix_rotate_map_coords(map, HPIX_COORD_CUSTOM,
+				       HPIX_ROTATE_PIXEL) == NULL);
+
+    hpix_free_map(expected);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(harmonic_map_rotation)
+{
+    hpix_map_t * map = hpix_create_map(64, HPIX_ORDER_SCHEME_RING);
+    hpix_map_t * expected = hpix_create_map(64, HPIX_ORDER_SCHEME_RING);
+    hpix_matrix_t matrix, inverse;
+
+    /* The map is band-limited, so the rotation in harmonic space must
+     * match the analytic result up to the accuracy of the transforms */
+    fill_low_multipole_map(map, &(hpix_matrix_t) { { { 1.0, 0.0, 0.0 },
+						      { 0.0, 1.0, 0.0 },
+						      { 0.0, 0.0, 1.0 } } });
+    fail_unless(hpix_coordinate_rotation_matrix(HPIX_COORD_CELESTIAL,
+						HPIX_COORD_GALACTIC,
+						&inverse));
+    fill_low_multipole_map(expected, &inverse);
+
+    {
+	hpix_map_t * rotated =
+	    hpix_rotate_map_coords(map, HPIX_COORD_CELESTIAL, HPIX_ROTATE_HARMONIC);
+
+	fail_unless(hpix_map_coordinate_system(rotated) == HPIX_COORD_CELESTIAL);
+	fail_unless(max_map_difference(rotated, expected) < 1e-6);
+	hpix_free_map(rotated);
+    }
+
+    hpix_euler_angles_to_matrix(&matrix, 0.4, 0.9, 1.3);
+    hpix_euler_angles_to_matrix(&inverse, -1.3, -0.9, -0.4);
+    {
+	hpix_map_t * rotated = hpix_rotate_map(map, &matrix, HPIX_ROTATE_HARMONIC);
+	hpix_map_t * back = hpix_rotate_map(rotated, &inverse, HPIX_ROTATE_HARMONIC);
+
+	fail_unless(max_map_difference(back, map) < 1e-6);
+	hpix_free_map(back);
+	hpix_free_map(rotated);
+    }
+
+    hpix_free_map(expected);
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(alm_rotation)
+{
+    /* A dipole aligned with the z axis has a_10 = 1. Once rotated by
+     * theta around the y axis, it points towards (sin theta, 0, cos
+     * theta), which means a_10 = cos theta, a_11 = -sin theta / sqrt(2). */
+    {
+	double alm[2 * 3] = { 0.0, 0.0, 1.0, 0.0, 0.0, 0.0 };
+
+	hpix_rotate_alm(1, NULL, 1, alm, 0.0, 0.4, 0.0);
+	TEST_FOR_CLOSENESS(alm[0], 0.0);
+	TEST_FOR_CLOSENESS(alm[2], cos(0.4));
+	TEST_FOR_CLOSENESS(alm[3], 0.0);
+	TEST_FOR_CLOSENESS(alm[4], -sin(0.4) / M_SQRT2);
+	TEST_FOR_CLOSENESS(alm[5], 0.0);
+
+	/* A rotation by phi around the z axis multiplies a_lm by
+	 * exp(-i m phi) */
+	hpix_rotate_alm(1, NULL, 1, alm, 0.0, 0.0, 0.7);
+	TEST_FOR_CLOSENESS(alm[2], cos(0.4));
+	TEST_FOR_CLOSENESS(alm[4], -sin(0.4) / M_SQRT2 * cos(0.7));
+	TEST_FOR_CLOSENESS(alm[5], sin(0.4) / M_SQRT2 * sin(0.7));
+    }
+
+    /* Rotating forth and back, using a layout where coefficients with
+     * the same l are contiguous */
+    {
+	const int lmax = 12;
+	ptrdiff_t mstart[13];
+	double alm[2 * 13 * 13];
+	double original[2 * 13 * 13];
+	double max_difference = 0.0;
+
+	for(int m = 0; m <= lmax; ++m)
+	    mstart[m] = m;
+	for(int l = 0; l <= lmax; ++l)
+	{
+	    for(int m = 0; m <= lmax; ++m)
+	    {
+		double * a = alm + 2 * (mstart[m] + (lmax + 1) * l);
+		a[0] = (m <= l) ? cos(l + 3.0 * m) : 0.0;
+		a[1] = (m > 0 && m <= l) ? sin(2.0 * l - m) : 0.0;
+	    }
+	}
+	memcpy(original, alm, sizeof(alm));
+
+	hpix_rotate_alm(lmax, mstart, lmax + 1, alm, 0.4, 0.9, 1.3);
+	hpix_rotate_alm(lmax, mstart, lmax + 1, alm, -1.3, -0.9, -0.4);
+
+	for(size_t idx = 0; idx < sizeof(alm) / sizeof(alm[0]); ++idx)
+	{
+	    if(fabs(alm[idx] - original[idx]) > max_difference)
+		max_difference = fabs(alm[idx] - original[idx]);
+	}
+	fail_unless(max_difference < 1e-10);
+    }
+
+    /* At high l, a rotation must conserve the power of each l and the
+     * rotation back must return the input */
+    {
+	const int lmax = 300;
+	const size_t num_of_alm = (size_t) (lmax + 1) * (lmax + 2) / 2;
+	double * alm = hpix_malloc(2 * sizeof(double), num_of_alm);
+	double * original = hpix_malloc(2 * sizeof(double), num_of_alm);
+	double * power = hpix_calloc(sizeof(double), lmax + 1);
+	const double angles[][3] = { { 0.3, 0.9, 1.1 }, { 1.7, 2.0, -0.6 } };
+
+	/* The layout is triangular: a_lm is at index m (2 lmax + 1 - m) / 2 + l */
+	for(int m = 0; m <= lmax; ++m)
+	{
+	    for(int l = m; l <= lmax; ++l)
+	    {
+		double * a = alm + 2 * ((size_t) m * (2 * lmax + 1 - m) / 2 + l);
+		a[0] = cos(1.3 * l + 3.1 * m);
+		a[1] = (m > 0) ? sin(2.7 * l - 0.7 * m) : 0.0;
+		power[l] += ((m > 0) ? 2.0 : 1.0) * (a[0] * a[0] + a[1] * a[1]);
+	    }
+	}
+	memcpy(original, alm, 2 * sizeof(double) * num_of_alm);
+
+	for(size_t i = 0; i < sizeof(angles) / sizeof(angles[0]); ++i)
+	{
+	    const double psi = angles[i][0];
+	    const double theta = angles[i][1];
+	    const double phi = angles[i][2];
+	    double max_difference = 0.0;
+
+	    hpix_rotate_alm(lmax, NULL, 1, alm, psi, theta, phi);
+
+	    for(int l = 0; l <= lmax; ++l)
+	    {
+		double rotated_power = 0.0;
+
+		for(int m = 0; m <= l; ++m)
+		{
+		    const double * a =
+			alm + 2 * ((size_t) m * (2 * lmax + 1 - m) / 2 + l);
+		    rotated_power += ((m > 0) ? 2.0 : 1.0)
+			* (a[0] * a[0] + a[1] * a[1]);
+		}
+
+		fail_unless(fabs(rotated_power / power[l] - 1.0) < 1e-10,
+			    "Power at l = %d changes by a factor %g", l,
+			    rotated_power / power[l]);
+	    }
+
+	    hpix_rotate_alm(lmax, NULL, 1, alm, -phi, -theta, -psi);
+	    for(size_t idx = 0; idx < 2 * num_of_alm; ++idx)
+	    {
+		if(fabs(alm[idx] - original[idx]) > max_difference)
+		    max_difference = fabs(alm[idx] - original[idx]);
+	    }
+	    fail_unless(max_difference < 1e-10,
+			"Round-trip error is %g", max_difference);
+	}
+
+	hpix_free(power);
+	hpix_free(original);
+	hpix_free(alm);
+    }
+}
+END_TEST
+
+/**********************************************************************/
+
 Suite *
 create_hpix_test_suite(void)
 {
@@ -74,6 +566,18 @@ create_hpix_test_suite(void)
 
     tc_core = tcase_create("Vector operations");
     tcase_add_test(tc_core, angular_distance);
+    tcase_add_test(tc_core, angular_distance_from_angles);
+    tcase_add_test(tc_core, pair_search);
+    suite_add_tcase(suite, tc_core);
+
+    tc_core = tcase_create("Map rotations");
+    tcase_add_test(tc_core, interpolation);
+    tcase_add_test(tc_core, batch_interpolation);
+    tcase_add_test(tc_core, euler_angles);
+    tcase_add_test(tc_core, coordinate_matrices);
+    tcase_add_test(tc_core, alm_rotation);
+    tcase_add_test(tc_core, map_rotation);
+    tcase_add_test(tc_core, harmonic_map_rotation);
     suite_add_tcase(suite, tc_core);
 
     return suite;
@@ -0,0 +1,318 @@
+/* test_smoothing.c -- check the functions that smooth maps
+ *
+ * Copyright 2011-2013 Maurizio Tomasi.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.  */
+
+#include <hpixlib/hpix.h>
+#include <math.h>
+#include <stdlib.h>
+#include <check.h>
+#include "check_helpers.h"
+#include "psht.h"
+#include "psht_geomhelpers.h"
+#include "psht_almhelpers.h"
+
+#define NSIDE 16
+
+/* The value used by Healpix to mark masked pixels */
+#define UNSEEN (-1.6375e+30)
+
+/**********************************************************************/
+
+START_TEST(gaussian_window)
+{
+    double * window = hpix_gaussian_window_function(M_PI / 180.0, 100, 0);
+
+    TEST_FOR_CLOSENESS(window[0], 1.0);
+    for(int l = 1; l <= 100; ++l)
+	fail_unless(window[l] < window[l - 1]);
+
+    hpix_free(window);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(smooth_constant_map)
+{
+    hpix_map_t * map = hpix_create_map(NSIDE, HPIX_ORDER_SCHEME_RING);
+    double * pixels = hpix_map_pixels(map);
+    size_t num_of_pixels = hpix_map_num_of_pixels(map);
+
+    for(size_t i = 0; i < num_of_pixels; ++i)
+	pixels[i] = 1.0;
+
+    /* A constant map has only a monopole, which is not affected by
+     * the beam. The tolerance accounts for the HEALPix quadrature,
+     * which is not exact and leaks part of the monopole into the
+     * other a_l0 coefficients. */
+    hpix_smooth_map_gaussian_inplace(map, 10.0 * M_PI / 180.0, 2 * NSIDE);
+    for(size_t i = 0; i < num_of_pixels; ++i)
+	fail_unless(fabs(pixels[i] - 1.0) < 5e-2);
+
+    hpix_free_map(map);
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(smooth_nest_map)
+{
+    hpix_map_t * ring_map = hpix_create_map(NSIDE, HPIX_ORDER_SCHEME_RING);
+    hpix_map_t * nest_map;
+    double * ring_pixels = hpix_map_pixels(ring_map);
+    double * nest_pixels;
+    size_t num_of_pixels = hpix_map_num_of_pixels(ring_map);
+
+    for(size_t i = 0; i < num_of_pixels; ++i)
+	ring_pixels[i] = sin(0.01 * i);
+    ring_pixels[100] = NAN;
+    ring_pixels[200] = UNSEEN;
+
+    nest_map = hpix_create_copy_of_map(ring_map);
+    hpix_switch_order(nest_map);
+
+    hpix_smooth_map_gaussian_inplace(ring_map, 5.0 * M_PI / 180.0, 0);
+    hpix_smooth_map_gaussian_inplace(nest_map, 5.0 * M_PI / 180.0, 0);
+
+    /* The ordering of the NEST map must not change */
+    ck_assert_int_eq(hpix_map_ordering_scheme(nest_map),
+		     HPIX_ORDER_SCHEME_NEST);
+    hpix_switch_order(nest_map);
+    nest_pixels = hpix_map_pixels(nest_map);
+
+    /* Masked pixels must keep their value */
+    fail_unless(isnan(ring_pixels[100]));
+    fail_unless(isnan(nest_pixels[100]));
+    fail_unless(ring_pixels[200] == UNSEEN);
+    fail_unless(nest_pixels[200] == UNSEEN);
+
+    for(size_t i = 0; i < num_of_pixels; ++i)
+    {
+	if(i != 100 && i != 200)
+	    TEST_FOR_CLOSENESS(ring_pixels[i], nest_pixels[i]);
+    }
+
+    hpix_free_map(nest_map);
+    hpix_free_map(ring_map);
+}
+END_TEST
+
+/**********************************************************************/
+
+static void
+fill_with_noise(hpix_map_t * map)
+{
+    double * pixels = hpix_map_pixels(map);
+
+    for(size_t i = 0; i < hpix_map_num_of_pixels(map); ++i)
+	pixels[i] = rand() / (double) RAND_MAX - 0.5;
+}
+
+/**********************************************************************/
+
+static double
+max_difference(const hpix_map_t * map1, const hpix_map_t * map2)
+{
+    const double * pixels1 = hpix_map_pixels(map1);
+    const double * pixels2 = hpix_map_pixels(map2);
+    double result = 0.0;
+
+    for(size_t i = 0; i < hpix_map_num_of_pixels(map1); ++i)
+    {
+	if(fabs(pixels1[i] - pixels2[i]) > result)
+	    result = fabs(pixels1[i] - pixels2[i]);
+    }
+
+    return result;
+}
+
+/**********************************************************************/
+
+/* Smooth the three maps (the last two can be NULL) the slow way: the
+ * a_lm are computed, multiplied by the window functions and
+ * synthesized back */
+static void
+smooth_through_alm(hpix_map_t * map_i, hpix_map_t * map_q, hpix_map_t * map_u,
+		   const double * window_i, const double * window_pol,
+		   int lmax)
+{
+    const size_t num_of_alm = (size_t) (lmax + 1) * (lmax + 2) / 2;
+    pshtd_cmplx * alm[3];
+    psht_geom_info * geom_info;
+    psht_alm_info * alm_info;
+    pshtd_joblist * joblist;
+
+    psht_make_healpix_geom_info(hpix_map_nside(map_i), 1, &geom_info);
+    psht_make_triangular_alm_info(lmax, lmax, 1, &alm_info);
+    for(int i = 0; i < 3; ++i)
+	alm[i] = hpix_malloc(sizeof(pshtd_cmplx), num_of_alm);
+
+    pshtd_make_joblist(&joblist);
+    if(map_q)
+	pshtd_add_job_map2alm_pol(joblist, map_i->pixels, map_q->pixels,
+				  map_u->pixels, alm[0], alm[1], alm[2], 0);
+    else
+	pshtd_add_job_map2alm(joblist, map_i->pixels, alm[0], 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    for(int m = 0; m <= lmax; ++m)
+    {
+	for(int l = m; l <= lmax; ++l)
+	{
+	    const ptrdiff_t idx = psht_alm_index(alm_info, l, m);
+
+	    alm[0][idx].re *= window_i[l];
+	    alm[0][idx].im *= window_i[l];
+	    for(int i = 1; i < 3; ++i)
+	    {
+		alm[i][idx].re *= window_pol[l];
+		alm[i][idx].im *= window_pol[l];
+	    }
+	}
+    }
+
+    pshtd_clear_joblist(joblist);
+    if(map_q)
+	pshtd_add_job_alm2map_pol(joblist, alm[0], alm[1], alm[2],
+				  map_i->pixels, map_q->pixels,
+				  map_u->pixels, 0);
+    else
+	pshtd_add_job_alm2map(joblist, alm[0], map_i->pixels, 0);
+    pshtd_execute_jobs(joblist, geom_info, alm_info);
+
+    pshtd_destroy_joblist(joblist);
+    for(int i = 0; i < 3; ++i)
+	hpix_free(alm[i]);
+    psht_destroy_alm_info(alm_info);
+    psht_destroy_geom_info(geom_info);
+}
+
+/**********************************************************************/
+
+START_TEST(smooth_map_through_alm)
+{
+    /* At NSIDE 16 all the rings fit in one chunk, at NSIDE 128 they
+     * are split in several chunks */
+    const unsigned int nsides[] = { 16, 128 };
+
+    srand(1);
+    for(size_t k = 0; k < sizeof(nsides) / sizeof(nsides[0]); ++k)
+    {
+	const int lmax = 2 * nsides[k];
+	hpix_map_t * map = hpix_create_map(nsides[k], HPIX_ORDER_SCHEME_RING);
+	hpix_map_t * expected;
+	double * window = hpix_gaussian_window_function(M_PI / 90.0, lmax, 0);
+
+	fill_with_noise(map);
+	expected = hpix_create_copy_of_map(map);
+
+	hpix_smooth_map_inplace(map, window, lmax);
+	smooth_through_alm(expected, NULL, NULL, window, window, lmax);
+	fail_unless(max_difference(map, expected) < 1e-12);
+
+	hpix_free(window);
+	hpix_free_map(expected);
+	hpix_free_map(map);
+    }
+}
+END_TEST
+
+/**********************************************************************/
+
+START_TEST(smooth_pol_maps)
+{
+    const unsigned int nsides[] = { 16, 128 };
+
+    srand(2);
+    for(size_t k = 0; k < sizeof(nsides) / sizeof(nsides[0]); ++k)
+    {
+	/* Four times the pixel size */
+	const double fwhm = 4.0 * sqrt(M_PI / 3.0) / nsides[k];
+	const int lmax = 2 * nsides[k];
+	hpix_map_t * maps[3];
+	hpix_map_t * expected[3];
+	double * window_i = hpix_gaussian_window_function(fwhm, lmax, 0);
+	double * window_pol = hpix_gaussian_window_function(fwhm, lmax, 2);
+
+	for(int i = 0; i < 3; ++i)
+	{
+	    maps[i] = hpix_create_map(nsides[k], HPIX_ORDER_SCHEME_RING);
+	    fill_with_noise(maps[i]);
+	    expected[i] = hpix_create_copy_of_map(maps[i]);
+	}
+
+	hpix_smooth_pol_maps_inplace(maps[0], maps[1], maps[2],
+				     window_i, window_pol, lmax);
+	smooth_through_alm(expected[0], expected[1], expected[2],
+			   window_i, window_pol, lmax);
+	for(int i = 0; i < 3; ++i)
+	    fail_unless(max_difference(maps[i], expected[i]) < 1e-12);
+
+	/* The beam must have actually smoothed the maps */
+	for(int i = 0; i < 3; ++i)
+	{
+	    double variance = 0.0;
+	    for(size_t j = 0; j < hpix_map_num_of_pixels(maps[i]); ++j)
+		variance += hpix_map_pixels(maps[i])[j]
+		    * hpix_map_pixels(maps[i])[j];
+	    variance /= hpix_map_num_of_pixels(maps[i]);
+	    fail_unless(variance < 1.0 / 12.0 / 10.0);
+	}
+
+	for(int i = 0; i < 3; ++i)
+	{
+	    hpix_free_map(expected[i]);
+	    hpix_free_map(maps[i]);
+	}
+	hpix_free(window_pol);
+	hpix_free(window_i);
+    }
+}
+END_TEST
+
+/**********************************************************************/
+
+Suite *
+create_hpix_test_suite(void)
+{
+    Suite * suite = suite_create("Smoothing functions");
+    TCase * tc_core;
+
+    tc_core = tcase_create("Smoothing");
+    tcase_add_test(tc_core, gaussian_window);
+    tcase_add_test(tc_core, smooth_constant_map);
+    tcase_add_test(tc_core, smooth_nest_map);
+    tcase_add_test(tc_core, smooth_map_through_alm);
+    tcase_add_test(tc_core, smooth_pol_maps);
+    suite_add_tcase(suite, tc_core);
+
+    return suite;
+}
+
+/**********************************************************************/
+
+int
+main(void)
+{
+    int number_failed;
+    Suite * suite = create_hpix_test_suite();
+    SRunner * runner = srunner_create(suite);
+    srunner_run_all(runner, CK_VERBOSE);
+    number_failed = srunner_ntests_failed(runner);
+    srunner_free(runner);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -19,6 +19,7 @@
 #include <hpixlib/hpix.h>
 #include <math.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <check.h>
 #include "check_helpers.h"
 
@@ -107,6 +108,82 @@ END_TEST
 
 /**********************************************************************/
 
+START_TEST(vector_batches)
+{
+    const hpix_vector_t vectors1[] = {
+	{ .x = 0.1, .y = 0.2, .z = 0.3 },
+	{ .x = 0.3, .y = 0.0, .z = 0.0 },
+	{ .x = 0.0, .y = 0.0, .z = 0.0 }
+    };
+    const hpix_vector_t vectors2[] = {
+	{ .x = -0.4, .y = 0.5, .z = -0.6 },
+	{ .x = 0.0, .y = 2.0, .z = 0.0 },
+	{ .x = 1.0, .y = 1.0, .z = 1.0 }
+    };
+    hpix_vector_batch_t * batch1 = hpix_create_vector_batch(3);
+    hpix_vector_batch_t * batch2 = hpix_create_vector_batch(3);
+    hpix_vector_batch_t * result = hpix_create_vector_batch(3);
+    double values[3];
+
+    fail_unless(((uintptr_t) batch1->x) % 64 == 0);
+    fail_unless(((uintptr_t) batch1->y) % 64 == 0);
+    fail_unless(((uintptr_t) batch1->z) % 64 == 0);
+
+    for(size_t idx = 0; idx < 3; ++idx)
+    {
+	batch1->x[idx] = vectors1[idx].x;
+	batch1->y[idx] = vectors1[idx].y;
+	batch1->z[idx] = vectors1[idx].z;
+	batch2->x[idx] = vectors2[idx].x;
+	batch2->y[idx] = vectors2[idx].y;
+	batch2->z[idx] = vectors2[idx].z;
+    }
+
+    hpix_vector_batch_dot_product(batch1, batch2, values);
+    TEST_FOR_CLOSENESS(values[0], -0.12);
+    TEST_FOR_CLOSENESS(values[1], 0.0);
+    TEST_FOR_CLOSENESS(values[2], 0.0);
+
+    hpix_vector_batch_angular_distance(batch1, batch2, values);
+    TEST_FOR_CLOSENESS(values[1], M_PI / 2);
+    fail_unless(isnan(values[2]));
+
+    hpix_vector_batch_cross_product(result, batch1, batch2);
+    TEST_FOR_CLOSENESS(result->x[0], -0.27);
+    TEST_FOR_CLOSENESS(result->y[0], -0.06);
+    TEST_FOR_CLOSENESS(result->z[0], 0.13);
+    TEST_FOR_CLOSENESS(result->z[1], 0.6);
+
+    {
+	const hpix_matrix_t matrix =
+	    (hpix_matrix_t) { .m = { { 1, -2, 3 },
+				     { -4, 5, -6 },
+				     { 7, -8, 9 } } };
+	hpix_vector_t vector;
+
+	/* In-place multiplication */
+	hpix_matrix_vector_batch_mul(batch2, &matrix, batch2);
+	hpix_matrix_vector_mul(&vector, &matrix, &vectors2[0]);
+	TEST_FOR_CLOSENESS(batch2->x[0], vector.x);
+	TEST_FOR_CLOSENESS(batch2->y[0], vector.y);
+	TEST_FOR_CLOSENESS(batch2->z[0], vector.z);
+    }
+
+    hpix_vector_batch_normalize(batch1);
+    TEST_FOR_CLOSENESS(batch1->x[0], 0.26726124191242438468);
+    TEST_FOR_CLOSENESS(batch1->y[0], 0.53452248382484876937);
+    TEST_FOR_CLOSENESS(batch1->z[0], 0.80178372573727315405);
+    TEST_FOR_CLOSENESS(batch1->x[1], 1.0);
+    TEST_FOR_CLOSENESS(batch1->x[2], 0.0);
+
+    hpix_free_vector_batch(result);
+    hpix_free_vector_batch(batch2);
+    hpix_free_vector_batch(batch1);
+}
+END_TEST
+
+/**********************************************************************/
+
 START_TEST(matrix_initialization)
 {
     hpix_matrix_t test_matrix;
@@ -242,6 +319,10 @@ create_hpix_test_suite(void)
     tcase_add_test(tc_core, vector_to_versor);
     suite_add_tcase(suite, tc_core);
 
+    tc_core = tcase_create("Batches of vectors");
+    tcase_add_test(tc_core, vector_batches);
+    suite_add_tcase(suite, tc_core);
+
     tc_core = tcase_create("Operations with matrices");
     tcase_add_test(tc_core, matrix_initialization);
     tcase_add_test(tc_core, matrix_determinant);
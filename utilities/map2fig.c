@@ -41,6 +41,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <cairo.h>
 #include <cairo-ps.h>
@@ -57,7 +65,8 @@
 #endif
 
 /* Available file formats */
-typedef enum { FMT_NULL, FMT_PNG, FMT_PS, FMT_EPS, FMT_PDF, FMT_SVG }
+typedef enum { FMT_NULL, FMT_PNG, FMT_PS, FMT_EPS, FMT_PDF, FMT_SVG,
+	       FMT_TIFF }
     output_format_code_t;
 
 /* This structure holds information about one file format. It is only
@@ -68,7 +77,7 @@ typedef struct {
     const char * name;
     /* Description, used by `--list-formats` */
     const char * description;
-    /* Code, used to initialize the global variable `output_format` */
+    /* Code, used to initialize the field `output_format` of `figure_options_t` */
     output_format_code_t code;
 } output_format_t;
 
@@ -90,71 +99,30 @@ output_format_t list_of_output_formats[] = {
 #if CAIRO_HAS_SVG_SURFACE
     { "svg", "Scalable Vector Graphics", FMT_SVG },
 #endif
+    /* TIFF files are written by HPixLib itself */
+    { "tiff", "TIFF bitmap of the map only, rendered in strips", FMT_TIFF },
     { NULL, NULL, FMT_NULL }
 };
 
-/* Output format to use, see above */
-output_format_code_t output_format = FMT_PNG;
-
-/* Should we skip painting the image background? Set by `--no-background` */
-int no_background_flag = 0;
-
-/* Should we draw a color bar? Set by `-b`, `--draw-color-bar` */
-int draw_color_bar_flag = 0;
-
 /* Should we produce a number of diagnostic messages? Set by `--verbose` */
 int verbose_flag = 0;
 
-/* Should we show the logarithm of the pixel values? */
-int log_flag = 0;
-
-/* Shall we remove the average from the map? Set by `--remove-monopole' */
-int remove_monopole = 0;
-
-/* String to append to the measure unit, set by `-m`, `--measure-unit` */
-const char * measure_unit_str = "";
-
-/* Scale to use with the maps, set by `-s`, `--scale` */
-double scale_factor = 1.0;
-
-/* Title to be drawn above the map, set by `-t`, `--title` */
-const char * title_str = "";
-
-/* Name of the output file name, set by `-o`, `--output` */
-const char * output_file_name = NULL;
-
 /* C-like format string for numbers, currently unused */
 const char * number_format = "%g";
 
-const char * input_file_name = NULL;
-
-/* Number of the column to display, set by `-c`, `--column` */
-unsigned short column_number = 1;
-
-/* Relative height of the title and of the color bar. Together with
- * the height of the map, their sum is 1.0. */
-float title_height_fraction = 0.1;
-float colorbar_height_fraction = 0.1;
-
-/* Extrema of the color bar, optinally set by `--min` and `--max`. If
- * the user does not specify them, they will be initialized to NAN. In
- * this case, the code will use the extrema of the map. */
-double min_value;
-double max_value;
+/* Should we read jobs from stdin? Set by `--batch` */
+int batch_flag = 0;
 
-/* Size of the image. Depending on the output format, these number can
- * be pixels (PNG) or points (1/72 inch, used by PS, PDF, SVG).
- * Therefore, they are set once the format has been decided. */
-double image_width = -1;
-double image_height = -1;
+/* Path of the local socket to read jobs from, set by `--socket` */
+const char * socket_path = NULL;
 
-/* Number of pixels in the bitmapped representation of the map. Unlike
- * `image_width` and `image_height`, these numbers are always
- * expressed in pixel units. They provide the resolution of the bitmap
+/* Number of pixels in the bitmapped representation of the map, used
+ * for vector formats. (For PNG files, the bitmap has the same
+ * resolution as the image.) They provide the resolution of the bitmap
  * file containing the Mollview projection which is to be included in
  * e.g. the SVG file. */
-double bitmap_columns = 600;
-double bitmap_rows = 400;
+#define DEFAULT_BITMAP_COLUMNS 600
+#define DEFAULT_BITMAP_ROWS    400
 
 /* This structure represents a rectangle on the Cairo surface. It is
  * used to lay out things on the image. */
@@ -174,7 +142,7 @@ typedef struct {
     const char * name;
     /* Description, used by `--list-palettes` */
     const char * description;
-    /* Code, used to initialize the global variable `palette_type_code` */
+    /* Code, used to initialize the field `palette_type_code` of `figure_options_t` */
     palette_type_code_t code;
 } palette_type_t;
 
@@ -194,7 +162,7 @@ typedef struct {
     const char * name;
     /* Description, used by `--list-projection` */
     const char * description;
-    /* Code, used to initialize the global variable `palette_type_code` */
+    /* Code, used to initialize the field `projection_type_code` of `figure_options_t` */
     hpix_projection_type_t code;
 } projection_type_t;
 
@@ -205,8 +173,195 @@ projection_type_t list_of_projection_types[] = {
     { NULL, NULL, HPIX_PROJ_NULL }
 };
 
-palette_type_code_t palette_type_code = PAL_HEALPIX;
-hpix_projection_type_t projection_type_code = HPIX_PROJ_MOLLWEIDE;
+
+#define DEFAULT_PALETTE_TYPE    PAL_HEALPIX
+#define DEFAULT_PROJECTION_TYPE HPIX_PROJ_MOLLWEIDE
+
+/* Everything needed to draw one figure. In the normal mode, this is
+ * initialized by the command line. In batch mode, each job starts
+ * from the options on the command line and overrides some of them. */
+typedef struct {
+    /* Output format to use, see above */
+    output_format_code_t output_format;
+
+    /* Should we skip painting the image background? Set by `--no-background` */
+    int no_background_flag;
+
+    /* Should we draw a color bar? Set by `-b`, `--draw-color-bar` */
+    int draw_color_bar_flag;
+
+    /* Should we show the logarithm of the pixel values? */
+    int log_flag;
+
+    /* Shall we remove the average from the map? Set by `--remove-monopole' */
+    int remove_monopole;
+
+    /* String to append to the measure unit, set by `-m`, `--measure-unit` */
+    const char * measure_unit_str;
+
+    /* Scale to use with the maps, set by `-s`, `--scale` */
+    double scale_factor;
+
+    /* Title to be drawn above the map, set by `-t`, `--title` */
+    const char * title_str;
+
+    /* Name of the output file name, set by `-o`, `--output` */
+    const char * output_file_name;
+
+    const char * input_file_name;
+
+    /* Number of the column to display, set by `-c`, `--column` */
+    unsigned short column_number;
+
+    /* Extrema of the color bar, optinally set by `--min` and `--max`.
+     * If the user does not specify them, they will be initialized to
+     * NAN. In this case, the code will use the extrema of the map. */
+    double min_value;
+    double max_value;
+
+    /* Values of `--width`, `--xy-aspect-ratio`, `--tick-font-size`
+     * and `--title-font-size`, used by `finalize_figure_options` to
+     * compute the size of the image and the layout of the page */
+    double requested_width;
+    double xy_aspect_ratio;
+    double tick_font_size;
+    double title_font_size;
+
+    /* Size of the image. Depending on the output format, these number
+     * can be pixels (PNG) or points (1/72 inch, used by PS, PDF, SVG).
+     * Therefore, they are set once the format has been decided. */
+    double image_width;
+    double image_height;
+
+    /* Relative height of the title and of the color bar. Together with
+     * the height of the map, their sum is 1.0. */
+    float title_height_fraction;
+    float colorbar_height_fraction;
+
+    palette_type_code_t palette_type_code;
+    hpix_projection_type_t projection_type_code;
+} figure_options_t;
+
+/* This structure holds information about one option that can be used
+ * both on the command line and in the jobs read in batch mode. */
+typedef struct {
+    /* Long name, used as `--name` */
+    const char * long_name;
+    /* Short name, used as `-c`, or 0 if there is none */
+    char short_name;
+    /* Code passed to `gopt` and `apply_option` */
+    char code;
+    /* Does the option require a value? */
+    int has_value;
+} figure_option_t;
+
+/* List of the options which specify how to draw a figure. Options
+ * like `--help` and `--verbose`, which affect the whole program, are
+ * not included here. */
+figure_option_t list_of_figure_options[] = {
+    { "log10", 0, 'l', 0 },
+    { "draw-color-bar", 'b', 'b', 0 },
+    { "remove-monopole", 0, 'M', 0 },
+    { "no-background", 0, 'B', 0 },
+    { "column", 'c', 'c', 1 },
+    { "measure-unit", 'm', 'm', 1 },
+    { "output", 'o', 'o', 1 },
+    { "width", 'w', 'w', 1 },
+    { "xy-aspect-ratio", 0, 'a', 1 },
+    { "min", 0, '_', 1 },
+    { "max", 0, '^', 1 },
+    { "scale", 's', 's', 1 },
+    { "title", 't', 't', 1 },
+    { "tick-font-size", 0, '1', 1 },
+    { "title-font-size", 0, '2', 1 },
+    { "format", 'f', 'f', 1 },
+    { "palette", 'p', 'p', 1 },
+    { "projection", 'j', 'j', 1 },
+    { NULL, 0, 0, 0 }
+};
+
+/* Maximum number of ticks in the color bar. With the values of
+ * `nice_number`, there are never more than 11. */
+#define MAX_NUM_OF_TICKS 16
+
+typedef struct {
+    /* Position of the tick mark */
+    double x;
+    /* Position of the (centered) label */
+    double label_x;
+    double label_y;
+    char label[40];
+} colorbar_tick_t;
+
+/* Everything needed to draw a color bar, once the size of every text
+ * label has been measured. See `compute_colorbar_layout`. */
+typedef struct {
+    rect_t colorbar_rect;
+    /* This is space 2. in the diagram in `compute_colorbar_layout` */
+    rect_t bar_only_rect;
+    /* This is the height of space 4. in the diagram */
+    double tick_band_height;
+    double font_size;
+    char label_min[20], label_max[20];
+    double label_max_x;
+    double label_baseline;
+    int num_of_ticks;
+    colorbar_tick_t ticks[MAX_NUM_OF_TICKS];
+} colorbar_layout_t;
+
+/* A color bar drawn by a previous figure in batch mode */
+typedef struct {
+    palette_type_code_t palette_type_code;
+    double min_level, max_level;
+    char * measure_unit_str;
+    colorbar_layout_t layout;
+    /* Pre-rendered color bar (PNG files only), NULL otherwise */
+    unsigned char * pixels;
+    double origin_x, origin_y;
+    int width, height, stride;
+    /* If nonzero, the entry is not in the cache */
+    int is_transient;
+} colorbar_cache_entry_t;
+
+#define MAX_NUM_OF_CACHED_COLORBARS 64
+
+/* A projection (or a projection plan) created by a previous figure in
+ * batch mode. When the cache is full, the entry which has not been
+ * used for the longest time is freed, unless some job is using it */
+typedef struct {
+    hpix_bmp_projection_t * projection;
+    /* Number of jobs which have not released the entry yet */
+    int num_of_users;
+    /* Value of `resource_cache_t.clock` at the last request */
+    unsigned long last_used;
+} projection_cache_entry_t;
+
+typedef struct {
+    hpix_projection_plan_t * plan;
+    int num_of_users;
+    unsigned long last_used;
+} plan_cache_entry_t;
+
+/* A plan for a 4000x2000 image takes at least 64 MB */
+#define MAX_NUM_OF_CACHED_PROJECTIONS 16
+#define MAX_NUM_OF_CACHED_PLANS 16
+
+/* Palettes, projections, projection plans, fonts and color bars
+ * shared by the jobs in batch mode. They are created the first time a
+ * job needs them and are never modified afterwards, so that many
+ * threads can use them at the same time. */
+typedef struct {
+    hpix_color_palette_t * palettes[PAL_PLANCK + 1];
+    projection_cache_entry_t projections[MAX_NUM_OF_CACHED_PROJECTIONS];
+    size_t num_of_projections;
+    plan_cache_entry_t plans[MAX_NUM_OF_CACHED_PLANS];
+    size_t num_of_plans;
+    /* Incremented each time a projection or a plan is requested */
+    unsigned long clock;
+    cairo_font_face_t * font_face;
+    colorbar_cache_entry_t * colorbars[MAX_NUM_OF_CACHED_COLORBARS];
+    size_t num_of_colorbars;
+} resource_cache_t;
 
 /******************************************************************************/
 
@@ -257,7 +412,19 @@ print_usage(const char * program_name)
     puts("                            the PNG format, in dots otherwise)");
     puts("  --xy-aspect-ratio=NUM     Width/height ratio of the image size");
     puts("");
+    puts("Batch mode");
+    puts("  --batch                   Read one job per line from stdin");
+    puts("  --socket=PATH             Read jobs from the connections to the");
+    puts("                            local socket PATH");
+    puts("  Each job is a list of the options above, followed by the name");
+    puts("  of the map, e.g. `-o map.png --palette=grayscale map.fits'.");
+    puts("  Options given on the command line are used as defaults. Jobs");
+    puts("  are drawn in parallel, and for each of them a line");
+    puts("  `ok|error JOB_NUMBER MILLISECONDS OUTPUT_FILE' is written to");
+    puts("  stdout (or to the socket).");
+    puts("");
     puts("General");
+    puts("  --verbose                 Print diagnostic messages");
     puts("  -v, --version             Print version number and exit");
     puts("  -h, --help                Print this help");
 }
@@ -290,7 +457,7 @@ print_list_of_palette_types(void)
 	assert(type != NULL);
 	printf("%s\t%s", type->name, type->description);
 
-	if(type->code == palette_type_code)
+	if(type->code == DEFAULT_PALETTE_TYPE)
 	    fputs(" (default)", stdout);
 
 	putchar('\n');
@@ -310,7 +477,7 @@ print_list_of_projection_types(void)
 	assert(proj != NULL);
 	printf("%s\t%s", proj->name, proj->description);
 
-	if(proj->code == projection_type_code)
+	if(proj->code == DEFAULT_PROJECTION_TYPE)
 	    fputs(" (default)", stdout);
 
 	putchar('\n');
@@ -320,8 +487,8 @@ print_list_of_projection_types(void)
 /******************************************************************************/
 
 
-void
-parse_format_specification(const char * format_str)
+int
+parse_format_specification(figure_options_t * options, const char * format_str)
 {
     int idx;
     for(idx = 0; list_of_output_formats[idx].name != NULL; ++idx)
@@ -330,8 +497,8 @@ parse_format_specification(const char * format_str)
 	assert(format != NULL);
 	if(strcmp(format->name, format_str) == 0)
 	{
-	    output_format = format->code;
-	    return;
+	    options->output_format = format->code;
+	    return 1;
 	}
     }
 
@@ -339,13 +506,14 @@ parse_format_specification(const char * format_str)
 	    MSG_HEADER "unknown format `%s', get a list of the available\n"
 	    MSG_HEADER "formats using `--list-formats'\n",
 	    format_str);
+    return 0;
 }
 
 /******************************************************************************/
 
-
-void
-parse_palette_specification(const char * type_str)
+
+int
+parse_palette_specification(figure_options_t * options, const char * type_str)
 {
     int idx;
     for(idx = 0; list_of_palette_types[idx].name != NULL; ++idx)
@@ -354,8 +522,8 @@ parse_palette_specification(const char * type_str)
 	assert(type != NULL);
 	if(strcmp(type->name, type_str) == 0)
 	{
-	    palette_type_code = type->code;
-	    return;
+	    options->palette_type_code = type->code;
+	    return 1;
 	}
     }
 
@@ -363,13 +531,14 @@ parse_palette_specification(const char * type_str)
 	    MSG_HEADER "unknown palette `%s', get a list of the available\n"
 	    MSG_HEADER "palettes using `--list-palettes'\n",
 	    type_str);
+    return 0;
 }
 
 /******************************************************************************/
 
-
-void
-parse_projection_specification(const char * type_str)
+
+int
+parse_projection_specification(figure_options_t * options, const char * type_str)
 {
     int idx;
     for(idx = 0; list_of_projection_types[idx].name != NULL; ++idx)
@@ -378,22 +547,23 @@ parse_projection_specification(const char * type_str)
 	assert(type != NULL);
 	if(strcmp(type->name, type_str) == 0)
 	{
-	    projection_type_code = type->code;
-	    return;
+	    options->projection_type_code = type->code;
+	    return 1;
 	}
     }
 
     fprintf(stderr,
 	    MSG_HEADER "unknown projection `%s', get a list of the available\n"
-	    MSG_HEADER "palettes using `--list-palettes'\n",
+	    MSG_HEADER "projections using `--list-projections'\n",
 	    type_str);
+    return 0;
 }
 
 /******************************************************************************/
 
-
+
 hpix_color_palette_t *
-create_palette(void)
+create_palette(palette_type_code_t palette_type_code)
 {
     switch(palette_type_code)
     {
@@ -408,9 +578,10 @@ create_palette(void)
 
 /******************************************************************************/
 
-
+
 void
-configure_projection(hpix_bmp_projection_t * proj)
+configure_projection(hpix_bmp_projection_t * proj,
+		     hpix_projection_type_t projection_type_code)
 {
     switch(projection_type_code)
     {
@@ -424,49 +595,213 @@ configure_projection(hpix_bmp_projection_t * proj)
 
 /******************************************************************************/
 
-
-double
-parse_double_from_options(void * list_of_options,
-			  char option_code,
-			  double default_value,
-			  const char * command_line_switch)
+
+int
+parse_double(const char * value_str,
+	     const char * command_line_switch,
+	     double * value)
 {
-    const char * value_str;
-    double value = default_value;
+    char * tail_ptr = NULL;
+    double result = strtod(value_str, &tail_ptr);
+
+    if(! tail_ptr ||
+       *tail_ptr != '\x0')
+    {
+	fprintf(stderr,
+		MSG_HEADER "invalid value '%s' specified with %s\n",
+		value_str,
+		command_line_switch);
+	return 0;
+    }
+
+    *value = result;
+    return 1;
+}
+
+/******************************************************************************/
+
+
+void
+init_figure_options(figure_options_t * options)
+{
+    memset(options, 0, sizeof(*options));
+
+    options->output_format = FMT_PNG;
+    options->measure_unit_str = "";
+    options->scale_factor = 1.0;
+    options->title_str = "";
+    options->column_number = 1;
+    options->min_value = NAN;
+    options->max_value = NAN;
+    options->requested_width = -1.0;
+    options->xy_aspect_ratio = 2.0;
+    options->tick_font_size = NAN;
+    options->title_font_size = NAN;
+    options->palette_type_code = DEFAULT_PALETTE_TYPE;
+    options->projection_type_code = DEFAULT_PROJECTION_TYPE;
+}
+
+/******************************************************************************/
 
-    if(gopt_arg(list_of_options, option_code, &value_str))
+
+/* Apply one of the options in `list_of_figure_options`. The value of
+ * `code` is the `code` field of the option, and `value_str` is NULL
+ * for options that have no value. Return 0 if the value is not
+ * valid. */
+int
+apply_option(figure_options_t * options, char code, const char * value_str)
+{
+    char * tail_ptr;
+    unsigned long column;
+
+    switch(code)
     {
-	char * tail_ptr = NULL;
-	value = strtod(value_str, &tail_ptr);
+    case 'l': options->log_flag = 1; return 1;
+    case 'b': options->draw_color_bar_flag = 1; return 1;
+    case 'M': options->remove_monopole = 1; return 1;
+    case 'B': options->no_background_flag = 1; return 1;
+
+    case 'c':
+	tail_ptr = NULL;
+	column = strtoul(value_str, &tail_ptr, 10);
 	if(! tail_ptr ||
-	   *tail_ptr != '\x0')
+	   *tail_ptr != '\x0' ||
+	   column == 0 ||
+	   column > USHRT_MAX)
 	{
-	    fprintf(stderr,
-		    MSG_HEADER "invalid minimum '%s' specified with %s\n",
-		    value_str,
-		    command_line_switch);
-	    exit(EXIT_FAILURE);
+	    fprintf(stderr, MSG_HEADER "invalid column number '%s'\n",
+		    value_str);
+	    return 0;
+	}
+	options->column_number = column;
+	return 1;
+
+    case 'f': return parse_format_specification(options, value_str);
+    case 'p': return parse_palette_specification(options, value_str);
+    case 'j': return parse_projection_specification(options, value_str);
+
+    case '_': return parse_double(value_str, "--min", &options->min_value);
+    case '^': return parse_double(value_str, "--max", &options->max_value);
+    case 's': return parse_double(value_str, "--scale", &options->scale_factor);
+    case 'w': return parse_double(value_str, "--width",
+				  &options->requested_width);
+    case 'a': return parse_double(value_str, "--xy-aspect-ratio",
+				  &options->xy_aspect_ratio);
+    case '1': return parse_double(value_str, "--tick-font-size",
+				  &options->tick_font_size);
+    case '2': return parse_double(value_str, "--title-font-size",
+				  &options->title_font_size);
+
+    case 'm': options->measure_unit_str = value_str; return 1;
+    case 't': options->title_str = value_str; return 1;
+    case 'o': options->output_file_name = value_str; return 1;
+
+    default:
+	abort();
+    }
+}
+
+/******************************************************************************/
+
+
+/* Compute the size of the image and the layout of the page, once
+ * every option has been applied. Return 0 if they are not
+ * consistent. */
+int
+finalize_figure_options(figure_options_t * options)
+{
+    if(options->input_file_name == NULL)
+    {
+	fputs(MSG_HEADER "no input map specified\n", stderr);
+	return 0;
+    }
+
+    if(options->output_file_name == NULL)
+    {
+	fputs(MSG_HEADER "no output file specified (hint: use --output)\n",
+	      stderr);
+	return 0;
+    }
+
+    options->image_width = options->requested_width;
+    if(options->image_width < 0)
+    {
+	switch(options->output_format)
+	{
+	case FMT_PNG:
+	case FMT_TIFF:
+	    /* Pixels */
+	    options->image_width = 750;
+	    break;
+
+	case FMT_PS:
+	case FMT_EPS:
+	case FMT_PDF:
+	case FMT_SVG:
+	    /* Points, that is, 1/72 inches */
+	    options->image_width = 7.5 * 72;
+	    break;
+
+	default:
+	    assert(0);
+	}
+    }
+
+    options->image_height = options->image_width / options->xy_aspect_ratio;
+
+    options->title_height_fraction = 0.1;
+    if(! isnan(options->title_font_size))
+    {
+	if(options->title_font_size <= 0.0)
+	{
+	    fputs(MSG_HEADER "the size of the title font must be positive\n",
+		  stderr);
+	    return 0;
+	}
+	options->title_height_fraction =
+	    options->title_font_size / options->image_height * 1.05;
+    }
+
+    options->colorbar_height_fraction = 0.1;
+    if(! isnan(options->tick_font_size))
+    {
+	if(options->tick_font_size <= 0.0)
+	{
+	    fputs(MSG_HEADER "the size of the font of the colorbar labels\n"
+		  MSG_HEADER "must be positive\n",
+		  stderr);
+	    return 0;
 	}
+	options->colorbar_height_fraction =
+	    options->tick_font_size / options->image_height * 2.10;
+    }
+
+    if(options->title_height_fraction
+       + options->colorbar_height_fraction >= 0.9)
+    {
+	fprintf(stderr,
+		MSG_HEADER "too large title/tick font sizes\n"
+		MSG_HEADER "try to enlarge the image using --width\n");
+	return 0;
     }
 
-    return value;
+    return 1;
 }
 
 /******************************************************************************/
 
-
+
 /* This code uses the `gopt` library to parse the command-line
- * options. It initializes a number of global variables declared at
- * the beginning of this file. */
+ * options. It initializes the global variables declared at the
+ * beginning of this file and `options`, which in batch mode is the
+ * default for every job. */
 void
-parse_command_line(int argc, const char ** argv)
+parse_command_line(int argc, const char ** argv, figure_options_t * options)
 {
     const char * value_str;
-    char * tail_ptr;
-    double tick_font_size = NAN;
-    double title_font_size = NAN;
+    int idx;
 
-    void * options =
+    void * gopt_options =
 	gopt_sort(&argc, argv,
 		  gopt_start(
 		      gopt_option('h', 0, gopt_shorts('h', '?'), gopt_longs("help")),
@@ -479,6 +814,8 @@ parse_command_line(int argc, const char ** argv)
 		      gopt_option('F', 0, gopt_shorts(0), gopt_longs("list-formats")),
 		      gopt_option('P', 0, gopt_shorts(0), gopt_longs("list-palettes")),
 		      gopt_option('J', 0, gopt_shorts(0), gopt_longs("list-projections")),
+		      gopt_option('X', 0, gopt_shorts(0), gopt_longs("batch")),
+		      gopt_option('S', GOPT_ARG, gopt_shorts(0), gopt_longs("socket")),
 		      gopt_option('c', GOPT_ARG, gopt_shorts('c'), gopt_longs("column")),	
 		      gopt_option('m', GOPT_ARG, gopt_shorts('m'), gopt_longs("measure-unit")),
 		      gopt_option('o', GOPT_ARG, gopt_shorts('o'), gopt_longs("output")),
@@ -495,123 +832,72 @@ parse_command_line(int argc, const char ** argv)
 		      gopt_option('j', GOPT_ARG, gopt_shorts('j'), gopt_longs("projection"))));
 
     /* --help */
-    if(gopt(options, 'h'))
+    if(gopt(gopt_options, 'h'))
     {
 	print_usage("map2fig");
 	exit(EXIT_SUCCESS);
     }
 
     /* --version */
-    if(gopt(options, 'v'))
+    if(gopt(gopt_options, 'v'))
     {
 	puts("map2fig version " VERSION " - Copyright(c) 2011-2012 Maurizio Tomasi");
 	exit(EXIT_SUCCESS);
     }
 
-    /* --log10 */
-    if(gopt(options, 'l'))
-	log_flag = 1;
- 
-   /* --no-background */
-    if(gopt(options, 'B'))
-	no_background_flag = 1;
-
     /* --list-formats */
-    if(gopt(options, 'F'))
+    if(gopt(gopt_options, 'F'))
     {
 	print_list_of_available_formats();
 	exit(EXIT_SUCCESS);
     }
 
     /* --list-palettes */
-    if(gopt(options, 'P'))
+    if(gopt(gopt_options, 'P'))
     {
 	print_list_of_palette_types();
 	exit(EXIT_SUCCESS);
     }
 
     /* --list-projections */
-    if(gopt(options, 'J'))
+    if(gopt(gopt_options, 'J'))
     {
 	print_list_of_projection_types();
 	exit(EXIT_SUCCESS);
     }
 
     /* --verbose */
-    if(gopt(options, 'V'))
+    if(gopt(gopt_options, 'V'))
 	verbose_flag = 1;
 
-    /* --remove-monopole */
-    if(gopt(options, 'M'))
-	remove_monopole = 1;
+    /* --batch */
+    if(gopt(gopt_options, 'X'))
+	batch_flag = 1;
 
-    if(gopt(options, 'b'))
-	draw_color_bar_flag = 1;
+    /* --socket PATH */
+    gopt_arg(gopt_options, 'S', &socket_path);
 
-    /* --column NUM */
-    if(gopt_arg(options, 'c', &value_str))
+    /* All the options which specify how to draw the figure */
+    init_figure_options(options);
+    for(idx = 0; list_of_figure_options[idx].long_name != NULL; ++idx)
     {
-	tail_ptr = NULL;
-	column_number = strtoul(value_str, &tail_ptr, 10);
-	if(! tail_ptr ||
-	   *tail_ptr != '\x0' ||
-	   column_number == 0 ||
-	   column_number > USHRT_MAX)
+	const figure_option_t * option = &list_of_figure_options[idx];
+
+	if(option->has_value)
 	{
-	    fprintf(stderr, MSG_HEADER "invalid column number '%s'\n",
-		    value_str);
-	    exit(EXIT_FAILURE);
+	    if(! gopt_arg(gopt_options, option->code, &value_str))
+		continue;
+	} else {
+	    if(! gopt(gopt_options, option->code))
+		continue;
+	    value_str = NULL;
 	}
+
+	if(! apply_option(options, option->code, value_str))
+	    exit(EXIT_FAILURE);
     }
 
-    /* --format STRING */
-    if(gopt_arg(options, 'f', &value_str))
-	parse_format_specification(value_str);
-
-    /* --palette STRING */
-    if(gopt_arg(options, 'p', &value_str))
-	parse_palette_specification(value_str);
-
-    /* --projection STRING */
-    if(gopt_arg(options, 'j', &value_str))
-	parse_projection_specification(value_str);
-
-    /* Here we parse all those options of the form --name VALUE, with
-     * VALUE being a floating-point number. */
-    min_value = parse_double_from_options(options, '_', 
-					  /* default_value = */ NAN,
-					  "--min");
-    max_value = parse_double_from_options(options, '^',
-					  /* default_value = */ NAN,
-					  "--max");
-    scale_factor = 
-	parse_double_from_options(options, 's', 
-				  /* default_value = */ 1.0,
-				  "--scale");
-    image_width = parse_double_from_options(options, 'w',
-					    /* default_value = */ -1.0,
-					    "--width");
-    double xy_aspect_ratio = 
-	parse_double_from_options(options, 'a', 
-				  /* default_value = */ 2.0,
-				  "--xy-aspect-ratio");
-    tick_font_size = 
-	parse_double_from_options(options, '1',
-				  /* default = */ tick_font_size,
-				  "--tick-font-size");
-    title_font_size = 
-	parse_double_from_options(options, '2',
-				  /* default = */ title_font_size,
-				  "--title-font-size");
-
-    /* --measure-unit STRING */
-    gopt_arg(options, 'm', &measure_unit_str);
-    /* --title STRING */
-    gopt_arg(options, 't', &title_str);
-    /* --output FILE */
-    gopt_arg(options, 'o', &output_file_name);
-
-    gopt_free(options);
+    gopt_free(gopt_options);
 
     /* NOTE: in this version, there must be only input parameter! This
      * is the name of the FITS file containing the map to draw. */
@@ -623,6 +909,10 @@ parse_command_line(int argc, const char ** argv)
 	exit(EXIT_FAILURE);
     }
 
+    /* In batch mode, the maps are specified by the jobs */
+    if(batch_flag || socket_path != NULL)
+	return;
+
     if(argc < 2)
     {
 	fprintf(stderr,
@@ -631,87 +921,39 @@ parse_command_line(int argc, const char ** argv)
 	exit(EXIT_FAILURE);
     }
 
-    if(image_width < 0)
-    {
-	switch(output_format)
-	{
-	case FMT_PNG:
-	    /* Pixels */
-	    image_width = 750;
-	    break;
-
-	case FMT_PS:
-	case FMT_EPS:
-	case FMT_PDF:
-	case FMT_SVG:
-	    /* Points, that is, 1/72 inches */
-	    image_width = 7.5 * 72;
-	    break;
-
-	default:
-	    assert(0);
-	}
-    }
-
-    image_height = image_width / xy_aspect_ratio;
-
-    if(! isnan(title_font_size))
-    {
-	if(title_font_size <= 0.0)
-	{
-	    fputs(MSG_HEADER "the size of the title font must be positive\n",
-		  stderr);
-	    exit(EXIT_FAILURE);
-	}
-	title_height_fraction = title_font_size / image_height * 1.05;
-    }
-
-    if(! isnan(tick_font_size))
-    {
-	if(title_font_size <= 0.0)
-	{
-	    fputs(MSG_HEADER "the size of the font of the colorbar labels\n"
-		  MSG_HEADER "must be positive\n",
-		  stderr);
-	    exit(EXIT_FAILURE);
-	}
-	colorbar_height_fraction = tick_font_size / image_height * 2.10;
-    }
-
-    if(title_height_fraction + colorbar_height_fraction >= 0.9)
-    {
-	fprintf(stderr,
-		MSG_HEADER "too large title/tick font sizes\n"
-		MSG_HEADER "try to enlarge the image using --geometry");
+    options->input_file_name = argv[1];
+    if(! finalize_figure_options(options))
 	exit(EXIT_FAILURE);
-    }
-
-    input_file_name = argv[1];
 }
 
 /******************************************************************************/
 
-
+
 hpix_map_t *
-load_map_and_rescale_if_needed(void)
+load_map_and_rescale_if_needed(const figure_options_t * options)
 {
     hpix_map_t * result;
     int status = 0;
+    int is_loaded;
 
-    if(! hpix_load_fits_component_from_file(input_file_name,
-					    column_number,
-					    &result, &status))
+    /* CFITSIO is not guaranteed to be thread-safe */
+#pragma omp critical(load_map)
+    is_loaded = hpix_load_fits_component_from_file(options->input_file_name,
+						   options->column_number,
+						   &result, &status);
+
+    if(! is_loaded)
     {
 	fprintf(stderr, MSG_HEADER "unable to load file '%s'\n",
-		input_file_name);
-	exit(EXIT_FAILURE);
+		options->input_file_name);
+	return NULL;
     }
 
     /* Remove the monopole */
-    if(remove_monopole)
+    if(options->remove_monopole)
 	hpix_remove_monopole_from_map_inplace(result);
 
-    if(log_flag)
+    if(options->log_flag)
     {
 	double * pixels = hpix_map_pixels(result);
 	for(size_t idx = 0; idx < hpix_map_num_of_pixels(result); ++idx)
@@ -723,7 +965,7 @@ load_map_and_rescale_if_needed(void)
 	}
     }
 
-    hpix_scale_pixels_by_constant_inplace(result, scale_factor);
+    hpix_scale_pixels_by_constant_inplace(result, options->scale_factor);
 
     return result;
 }
@@ -826,7 +1068,7 @@ draw_aligned_text(cairo_t * context, const char * label,
 
 
 void
-paint_title(cairo_t * context, const rect_t * region)
+paint_title(cairo_t * context, const rect_t * region, const char * title_str)
 {
     const double title_font_size = region->height * 0.9;
 
@@ -909,31 +1151,74 @@ nice_number(double num, int round_flag)
 /******************************************************************************/
 
 
-/* Draw the Mollweide projection of the map on the rectangle specified
- * by `map_rect' on the Cairo surface specified by `context'. The
- * values of `min' and `max' specify the minimum and maximum values to
- * be used in plotting the map, and are used to set the color scale.
- * This function is a nice wrapper around
- * `plot_bitmap_to_cairo_surface', which is more low-level because (1)
- * it fills the whole Cairo surface, and (2) it fills the whole
- * rectangular surface, instead of just an ellipse. (The latter seems
- * to be due to a bug in Cairo.) */
+/* Create a Cairo image surface with the map traced through `plan`,
+ * like `hpix_bmp_projection_to_cairo_surface` does with a projection.
+ * Since the plan already knows which pixel falls in each cell, no
+ * trigonometric function is computed. */
+cairo_surface_t *
+projection_plan_to_cairo_surface(const hpix_projection_plan_t * plan,
+				 const hpix_color_palette_t * palette,
+				 const hpix_map_t * map,
+				 double min, double max)
+{
+    const unsigned int width = hpix_projection_plan_width(plan);
+    const unsigned int height = hpix_projection_plan_height(plan);
+    double traced_min, traced_max;
+    double * bitmap =
+	hpix_projection_plan_trace(plan, map, &traced_min, &traced_max);
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    cairo_surface_t * surface =
+	cairo_image_surface_create(CAIRO_FORMAT_RGB24, width, height);
+
+    if(isnan(min))
+	min = traced_min;
+    if(isnan(max))
+	max = traced_max;
+
+    cairo_surface_flush(surface);
+    hpix_bitmap_to_argb32(lut, bitmap, width, height, min, max,
+			  cairo_image_surface_get_data(surface),
+			  cairo_image_surface_get_stride(surface),
+			  TRUE);
+    cairo_surface_mark_dirty(surface);
+
+    hpix_free_palette_lut(lut);
+    hpix_free(bitmap);
+    return surface;
+}
+
+/******************************************************************************/
+
+
+/* Draw the projection `projection` of the map on the rectangle
+ * specified by `map_rect' on the Cairo surface specified by
+ * `context'. If `plan` is not NULL, it must have been computed for
+ * `projection` and the resolution of the map, and it is used instead
+ * of `projection` to find the pixels. The values of `min' and `max'
+ * specify the minimum and maximum values to be used in plotting the
+ * map, and are used to set the color scale. This function is a nice
+ * wrapper around `hpix_bmp_projection_to_cairo_surface', which is
+ * more low-level because (1) it fills the whole Cairo surface, and
+ * (2) it fills the whole rectangular surface, instead of just an
+ * ellipse. (The latter seems to be due to a bug in Cairo.) */
 void
 paint_map(cairo_t * context, const rect_t * map_rect,
 	  const hpix_color_palette_t * palette,
-	  const hpix_map_t * map, double min, double max)
+	  const hpix_bmp_projection_t * projection,
+	  const hpix_projection_plan_t * plan,
+	  const hpix_map_t * map, double min, double max,
+	  double image_width)
 {
-    hpix_bmp_projection_t * projection;
     cairo_surface_t * map_surface;
 
     /* First produce a cairo image surface with the map in it */
-    projection = hpix_create_bmp_projection((int) (bitmap_columns + .5),
-					    (int) (bitmap_rows + .5));
-    configure_projection(projection);
-
-    map_surface =
-	hpix_bmp_projection_to_cairo_surface(projection, palette,
-					     map, min, max);
+    if(plan != NULL)
+	map_surface =
+	    projection_plan_to_cairo_surface(plan, palette, map, min, max);
+    else
+	map_surface =
+	    hpix_bmp_projection_to_cairo_surface(projection, palette,
+						 map, min, max);
 
     /* Now copy the cairo surface into the surface we're currently
      * using to draw the figure */
@@ -974,7 +1259,6 @@ paint_map(cairo_t * context, const rect_t * map_rect,
     
     /* Cleanup */
     cairo_surface_destroy(map_surface);
-    hpix_free_bmp_projection(projection);
 }
 
 /******************************************************************************/
@@ -1009,11 +1293,11 @@ format_number(char * buf, size_t size, double number,
 
 
 void
-draw_ticks(cairo_t * context,
-	   double start_x, double start_y,
-	   double width, double height,
-	   double tick_height,
-	   double min_level, double max_level)
+compute_ticks(cairo_t * context,
+	      double start_x, double start_y,
+	      double width, double height,
+	      double min_level, double max_level,
+	      colorbar_layout_t * layout)
 {
     const int num_of_ticks = 5;
     double range = nice_number(max_level - min_level, 0);
@@ -1025,38 +1309,43 @@ draw_ticks(cairo_t * context,
 
     if(num_of_frac_digits < 0)
 	num_of_frac_digits = 0;
-	
-    cairo_set_source_rgb(context, 0.0, 0.0, 0.0);
+
+    layout->num_of_ticks = 0;
     for(x = graph_min; x <= graph_max + 0.5 * delta; x += delta)
     {
-	double pos;
-	char label[40];
+	colorbar_tick_t * tick;
+	cairo_text_extents_t te;
 
 	if(x < min_level || x > max_level)
 	    continue;
 
-	pos = start_x + width * (x - min_level) / (max_level - min_level);
-	cairo_move_to(context, pos, start_y);
-	cairo_line_to(context, pos, start_y + tick_height);
-	cairo_stroke(context);
+	if(layout->num_of_ticks == MAX_NUM_OF_TICKS)
+	    break;
+
+	tick = &layout->ticks[layout->num_of_ticks++];
+	tick->x = start_x + width * (x - min_level) / (max_level - min_level);
 
-	format_number(label, sizeof(label) + 1, x, NULL);
+	format_number(tick->label, sizeof(tick->label), x, NULL);
 
-	draw_aligned_text(context, label,
-			  pos, start_y + height,
-			  HALIGN_CENTER, VALIGN_TOP);
+	/* Center the label horizontally, like `draw_aligned_text` */
+	cairo_text_extents(context, tick->label, &te);
+	tick->label_x = tick->x - te.width * 0.5;
+	tick->label_y = start_y + height;
     }
 }
 
-
 /******************************************************************************/
 
-
+
+/* Measure every element in the color bar. The font face used by
+ * `context` must be the same used to draw the color bar. */
 void
-paint_colorbar(cairo_t * context,
-	       const rect_t * colorbar_rect,
-	       const hpix_color_palette_t * palette,
-	       double min_level, double max_level)
+compute_colorbar_layout(cairo_t * context,
+			const rect_t * colorbar_rect,
+			double min_level, double max_level,
+			const char * measure_unit_str,
+			output_format_code_t output_format,
+			colorbar_layout_t * layout)
 {
     /* Here is the inner layout of the colorbar:
      *
@@ -1079,60 +1368,100 @@ paint_colorbar(cairo_t * context,
      * 5. Values associated with each tick mark
      */
 
-    cairo_pattern_t * linear;
-    char label_min[20], label_max[20];
     cairo_text_extents_t min_te, max_te;
     const double text_margin_factor = 1.1;
-    /* This is space 2. in the diagram above */
-    rect_t bar_only_rect;
-    /* This is the height of space 4. in the diagram above */
-    double tick_band_height;
+    rect_t * bar_only_rect = &layout->bar_only_rect;
 
-    cairo_set_font_size(context, colorbar_rect->height * 0.4);
-    cairo_set_line_width(context, 1.0);
+    layout->colorbar_rect = *colorbar_rect;
+    layout->font_size = colorbar_rect->height * 0.4;
+
+    cairo_save(context);
+    cairo_set_font_size(context, layout->font_size);
 
-    format_number(label_min, sizeof(label_min) + 1, min_level, measure_unit_str);
-    format_number(label_max, sizeof(label_max) + 1, max_level, measure_unit_str);
+    format_number(layout->label_min, sizeof(layout->label_min),
+		  min_level, measure_unit_str);
+    format_number(layout->label_max, sizeof(layout->label_max),
+		  max_level, measure_unit_str);
 
-    cairo_text_extents(context, label_min, &min_te);
-    cairo_text_extents(context, label_max, &max_te);
+    cairo_text_extents(context, layout->label_min, &min_te);
+    cairo_text_extents(context, layout->label_max, &max_te);
 
-    bar_only_rect.x = colorbar_rect->x;
-    bar_only_rect.y = colorbar_rect->y;
-    bar_only_rect.width = colorbar_rect->width;
-    bar_only_rect.height = colorbar_rect->height * 0.4;
+    bar_only_rect->x = colorbar_rect->x;
+    bar_only_rect->y = colorbar_rect->y;
+    bar_only_rect->width = colorbar_rect->width;
+    bar_only_rect->height = colorbar_rect->height * 0.4;
 
-    bar_only_rect.x += min_te.width * text_margin_factor;
-    bar_only_rect.width -= (min_te.width + max_te.width) * text_margin_factor;
+    bar_only_rect->x += min_te.width * text_margin_factor;
+    bar_only_rect->width -= (min_te.width + max_te.width) * text_margin_factor;
 
     if(output_format == FMT_PNG)
-	tick_band_height = 6.0;
+	layout->tick_band_height = 6.0;
     else
-	tick_band_height = 0.1;
+	layout->tick_band_height = 0.1;
+
+    layout->tick_band_height = colorbar_rect->height * 0.1;
+
+    compute_ticks(context,
+		  bar_only_rect->x,
+		  bar_only_rect->y + bar_only_rect->height,
+		  bar_only_rect->width,
+		  colorbar_rect->height - bar_only_rect->height,
+		  min_level, max_level,
+		  layout);
+
+    layout->label_baseline =
+	colorbar_rect->y
+	+ bar_only_rect->height * 0.5
+	- min_te.y_bearing 
+	- min_te.height * 0.5;
+    layout->label_max_x =
+	colorbar_rect->x + colorbar_rect->width - max_te.width;
 
-    tick_band_height = colorbar_rect->height * 0.1;
+    cairo_restore(context);
+}
 
-    draw_ticks(context,
-	       bar_only_rect.x,
-	       bar_only_rect.y + bar_only_rect.height,
-	       bar_only_rect.width,
-	       colorbar_rect->height - bar_only_rect.height,
-	       tick_band_height,
-	       min_level, max_level);
+/******************************************************************************/
 
-    linear =
-	cairo_pattern_create_linear(bar_only_rect.x, 0.0,
-				    bar_only_rect.x + bar_only_rect.width, 0.0);
 
-    hpix_bmp_configure_linear_gradient(linear, palette);
+void
+draw_colorbar(cairo_t * context,
+	      const colorbar_layout_t * layout,
+	      const hpix_color_palette_t * palette)
+{
+    const rect_t * bar_only_rect = &layout->bar_only_rect;
+    cairo_pattern_t * linear;
 
-    cairo_rectangle(context,
-		    bar_only_rect.x, bar_only_rect.y,
-		    bar_only_rect.width, bar_only_rect.height);
+    cairo_set_font_size(context, layout->font_size);
+    cairo_set_line_width(context, 1.0);
 
-    /* Draw the gradient */
-    cairo_set_source(context, linear);
-    cairo_fill_preserve(context);
+    /* Draw the ticks */
+    cairo_set_source_rgb(context, 0.0, 0.0, 0.0);
+    for(int idx = 0; idx < layout->num_of_ticks; ++idx)
+    {
+	const colorbar_tick_t * tick = &layout->ticks[idx];
+	const double start_y = bar_only_rect->y + bar_only_rect->height;
+
+	cairo_move_to(context, tick->x, start_y);
+	cairo_line_to(context, tick->x, start_y + layout->tick_band_height);
+	cairo_stroke(context);
+
+	cairo_move_to(context, tick->label_x, tick->label_y);
+	cairo_show_text(context, tick->label);
+    }
+
+    linear =
+	cairo_pattern_create_linear(bar_only_rect->x, 0.0,
+				    bar_only_rect->x + bar_only_rect->width, 0.0);
+
+    hpix_bmp_configure_linear_gradient(linear, palette);
+
+    cairo_rectangle(context,
+		    bar_only_rect->x, bar_only_rect->y,
+		    bar_only_rect->width, bar_only_rect->height);
+
+    /* Draw the gradient */
+    cairo_set_source(context, linear);
+    cairo_fill_preserve(context);
 
     cairo_pattern_destroy(linear);
 
@@ -1141,63 +1470,214 @@ paint_colorbar(cairo_t * context,
     cairo_stroke(context);
 
     /* Draw the labels */
+    cairo_move_to(context, layout->colorbar_rect.x, layout->label_baseline);
+    cairo_show_text(context, layout->label_min);
+
+    cairo_move_to(context, layout->label_max_x, layout->label_baseline);
+    cairo_show_text(context, layout->label_max);
+}
+
+/******************************************************************************/
+
+
+void
+free_colorbar_cache_entry(colorbar_cache_entry_t * entry)
+{
+    hpix_free(entry->pixels);
+    free(entry->measure_unit_str);
+    hpix_free(entry);
+}
+
+/******************************************************************************/
+
+
+/* Render the color bar into a transparent bitmap, which covers the
+ * pixels from (`origin_x`, `origin_y`) to the bottom-right corner of
+ * the color bar */
+void
+prerender_colorbar(colorbar_cache_entry_t * entry,
+		   const hpix_color_palette_t * palette,
+		   cairo_font_face_t * font_face)
+{
+    const rect_t * rect = &entry->layout.colorbar_rect;
+    cairo_surface_t * surface;
+    cairo_t * context;
+
+    entry->origin_x = floor(rect->x);
+    entry->origin_y = floor(rect->y);
+    entry->width = (int) (ceil(rect->x + rect->width) - entry->origin_x);
+    entry->height = (int) (ceil(rect->y + rect->height) - entry->origin_y);
+    entry->stride =
+	cairo_format_stride_for_width(CAIRO_FORMAT_ARGB32, entry->width);
+
+    surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32,
+					 entry->width, entry->height);
+    context = cairo_create(surface);
+    cairo_set_font_face(context, font_face);
+    cairo_translate(context, -entry->origin_x, -entry->origin_y);
+    draw_colorbar(context, &entry->layout, palette);
+    cairo_destroy(context);
+    cairo_surface_flush(surface);
+
+    /* Keep a copy of the pixels only: every figure wraps them in its
+     * own surface, so that no Cairo object is shared among threads */
+    entry->pixels = hpix_malloc(entry->stride, entry->height);
+    memcpy(entry->pixels, cairo_image_surface_get_data(surface),
+	   (size_t) entry->stride * entry->height);
+    cairo_surface_destroy(surface);
+}
+
+/******************************************************************************/
+
+
+int
+colorbar_cache_entry_matches(const colorbar_cache_entry_t * entry,
+			     palette_type_code_t palette_type_code,
+			     const rect_t * colorbar_rect,
+			     double min_level, double max_level,
+			     const char * measure_unit_str,
+			     int is_bitmap)
+{
+    return entry->palette_type_code == palette_type_code
+	&& entry->min_level == min_level
+	&& entry->max_level == max_level
+	&& memcmp(&entry->layout.colorbar_rect, colorbar_rect,
+		  sizeof(*colorbar_rect)) == 0
+	&& (entry->pixels != NULL) == is_bitmap
+	&& strcmp(entry->measure_unit_str, measure_unit_str) == 0;
+}
+
+/******************************************************************************/
+
+
+/* Draw the color bar. If `cache` is not NULL, the layout of the color
+ * bar is reused from previous figures with the same palette, range
+ * and size, and so is the color bar itself for PNG files. */
+void
+paint_colorbar(cairo_t * context,
+	       const rect_t * colorbar_rect,
+	       const hpix_color_palette_t * palette,
+	       palette_type_code_t palette_type_code,
+	       double min_level, double max_level,
+	       const char * measure_unit_str,
+	       output_format_code_t output_format,
+	       resource_cache_t * cache)
+{
+    colorbar_cache_entry_t * entry = NULL;
+    /* Vector formats must contain vector elements */
+    const int is_bitmap = output_format == FMT_PNG;
+
+    if(cache == NULL)
     {
-	double baseline;
-	baseline =
-	    colorbar_rect->y
-	    + bar_only_rect.height * 0.5
-	    - min_te.y_bearing 
-	    - min_te.height * 0.5;
-	cairo_move_to(context, colorbar_rect->x, baseline);
-	cairo_show_text(context, label_min);
+	colorbar_layout_t layout;
 
-	cairo_move_to(context,
-		      colorbar_rect->x + colorbar_rect->width - max_te.width,
-		      baseline);
-	cairo_show_text(context, label_max);
+	compute_colorbar_layout(context, colorbar_rect, min_level, max_level,
+				measure_unit_str, output_format, &layout);
+	draw_colorbar(context, &layout, palette);
+	return;
+    }
+
+#pragma omp critical(resource_cache)
+    for(size_t idx = 0; idx < cache->num_of_colorbars; ++idx)
+    {
+	if(colorbar_cache_entry_matches(cache->colorbars[idx],
+					palette_type_code, colorbar_rect,
+					min_level, max_level,
+					measure_unit_str, is_bitmap))
+	{
+	    entry = cache->colorbars[idx];
+	    break;
+	}
     }
+
+    if(entry == NULL)
+    {
+	/* Two threads might create the same entry at the same time:
+	 * this is harmless, as both are equal */
+	entry = hpix_calloc(sizeof(colorbar_cache_entry_t), 1);
+	entry->palette_type_code = palette_type_code;
+	entry->min_level = min_level;
+	entry->max_level = max_level;
+	entry->measure_unit_str = strdup(measure_unit_str);
+	compute_colorbar_layout(context, colorbar_rect, min_level, max_level,
+				measure_unit_str, output_format,
+				&entry->layout);
+	if(is_bitmap)
+	    prerender_colorbar(entry, palette, cache->font_face);
+
+#pragma omp critical(resource_cache)
+	{
+	    if(cache->num_of_colorbars < MAX_NUM_OF_CACHED_COLORBARS)
+		cache->colorbars[cache->num_of_colorbars++] = entry;
+	    else
+	    {
+		/* The oldest entry cannot be freed, as other threads
+		 * might be using it: keep it, and forget the new one
+		 * once the color bar has been drawn */
+		entry->is_transient = 1;
+	    }
+	}
+    }
+
+    if(entry->pixels != NULL)
+    {
+	cairo_surface_t * surface =
+	    cairo_image_surface_create_for_data(entry->pixels,
+						CAIRO_FORMAT_ARGB32,
+						entry->width, entry->height,
+						entry->stride);
+	cairo_save(context);
+	cairo_set_source_surface(context, surface,
+				 entry->origin_x, entry->origin_y);
+	cairo_paint(context);
+	cairo_restore(context);
+	cairo_surface_destroy(surface);
+    } else
+	draw_colorbar(context, &entry->layout, palette);
+
+    if(entry->is_transient)
+	free_colorbar_cache_entry(entry);
 }
 
 /******************************************************************************/
 
-
+
 /* Wrapper to one of the cairo_*_surface_create function, depending on
  * the output format chosen by the user (--format). */
 cairo_surface_t *
-create_surface(double width, double height)
+create_surface(const figure_options_t * options, double width, double height)
 {
     cairo_surface_t * surface;
 
-    switch(output_format)
+    switch(options->output_format)
     {
     case FMT_PNG:
-	surface = cairo_image_surface_create(no_background_flag
+	surface = cairo_image_surface_create(options->no_background_flag
 					     ? CAIRO_FORMAT_ARGB32
 					     : CAIRO_FORMAT_RGB24,
 					     width, height);
-	bitmap_columns = width;
 	break;
 
 #if CAIRO_HAS_PS_SURFACE
     case FMT_PS:
     case FMT_EPS:
-	surface = cairo_ps_surface_create(output_file_name,
+	surface = cairo_ps_surface_create(options->output_file_name,
 					     width, height);
-	if(output_format == FMT_EPS)
+	if(options->output_format == FMT_EPS)
 	    cairo_ps_surface_set_eps(surface, TRUE);
 	break;
 #endif
 
 #if CAIRO_HAS_PDF_SURFACE
     case FMT_PDF:
-	surface = cairo_pdf_surface_create(output_file_name,
+	surface = cairo_pdf_surface_create(options->output_file_name,
 					     width, height);
 	break;
 #endif
 
 #if CAIRO_HAS_SVG_SURFACE
     case FMT_SVG:
-	surface = cairo_svg_surface_create(output_file_name,
+	surface = cairo_svg_surface_create(options->output_file_name,
 					     width, height);
 	break;
 #endif
@@ -1210,30 +1690,33 @@ create_surface(double width, double height)
 
 /******************************************************************************/
 
-
+
 /* Determine the position and extents of the three elements of the
  * image, that is, the title, the Mollweide projection, and the color
  * bar. */
 void
-lay_out_page(rect_t * title_rect, rect_t * map_rect, rect_t * colorbar_rect)
+lay_out_page(const figure_options_t * options,
+	     rect_t * title_rect, rect_t * map_rect, rect_t * colorbar_rect)
 {
     /* This is a small dimensionless number that quantifies how much
      * empty vertical space there should be between consecutive
      * elements in the page. */
     const double relative_margin = 0.05;
+    const double image_width = options->image_width;
+    const double image_height = options->image_height;
 
     title_rect->x = title_rect->y = 0.0;
     title_rect->width = image_width;
-    if(title_str != NULL && title_str[0] != 0)
-	title_rect->height = title_height_fraction * image_height;
+    if(options->title_str != NULL && options->title_str[0] != 0)
+	title_rect->height = options->title_height_fraction * image_height;
     else
 	title_rect->height = 0.0;
 
     colorbar_rect->x = 0.0;
     /* Leave colorbar_rect->y to the end */
     colorbar_rect->width = image_width;
-    if(draw_color_bar_flag)
-	colorbar_rect->height = image_height * colorbar_height_fraction;
+    if(options->draw_color_bar_flag)
+	colorbar_rect->height = image_height * options->colorbar_height_fraction;
     else
 	colorbar_rect->height = 0.0;
 
@@ -1261,17 +1744,390 @@ lay_out_page(rect_t * title_rect, rect_t * map_rect, rect_t * colorbar_rect)
 
 /******************************************************************************/
 
-
+
+/* Return the palette of the given type, creating it if this is the
+ * first time it is requested */
+const hpix_color_palette_t *
+cached_palette(resource_cache_t * cache, palette_type_code_t type)
+{
+    const hpix_color_palette_t * result;
+
+    assert(type > PAL_NULL && type <= PAL_PLANCK);
+
+#pragma omp critical(resource_cache)
+    {
+	if(cache->palettes[type] == NULL)
+	    cache->palettes[type] = create_palette(type);
+	result = cache->palettes[type];
+    }
+
+    return result;
+}
+
+/******************************************************************************/
+
+
+/* Return a projection of the given type and size, creating it if this
+ * is the first time it is requested. Call `release_cached_projection`
+ * once the projection is no longer needed. */
+const hpix_bmp_projection_t *
+cached_projection(resource_cache_t * cache,
+		  hpix_projection_type_t type,
+		  unsigned int width, unsigned int height)
+{
+    const hpix_bmp_projection_t * result = NULL;
+
+#pragma omp critical(resource_cache)
+    {
+	for(size_t idx = 0; idx < cache->num_of_projections; ++idx)
+	{
+	    projection_cache_entry_t * entry = &cache->projections[idx];
+	    if(hpix_bmp_projection_type(entry->projection) == type
+	       && hpix_bmp_projection_width(entry->projection) == width
+	       && hpix_bmp_projection_height(entry->projection) == height)
+	    {
+		entry->num_of_users++;
+		entry->last_used = ++cache->clock;
+		result = entry->projection;
+		break;
+	    }
+	}
+
+	if(result == NULL)
+	{
+	    hpix_bmp_projection_t * proj =
+		hpix_create_bmp_projection(width, height);
+	    projection_cache_entry_t * entry = NULL;
+
+	    configure_projection(proj, type);
+
+	    if(cache->num_of_projections < MAX_NUM_OF_CACHED_PROJECTIONS)
+		entry = &cache->projections[cache->num_of_projections++];
+	    else
+	    {
+		for(size_t idx = 0; idx < cache->num_of_projections; ++idx)
+		{
+		    projection_cache_entry_t * cur = &cache->projections[idx];
+		    if(cur->num_of_users == 0
+		       && (entry == NULL || cur->last_used < entry->last_used))
+			entry = cur;
+		}
+
+		if(entry != NULL)
+		    hpix_free_bmp_projection(entry->projection);
+	    }
+
+	    /* If every entry is in use, the projection is not cached
+	     * and `release_cached_projection` will free it */
+	    if(entry != NULL)
+	    {
+		entry->projection = proj;
+		entry->num_of_users = 1;
+		entry->last_used = ++cache->clock;
+	    }
+	    result = proj;
+	}
+    }
+
+    return result;
+}
+
+/******************************************************************************/
+
+
+/* Tell the cache that the job no longer uses `proj`, which was
+ * returned by `cached_projection` */
+void
+release_cached_projection(resource_cache_t * cache,
+			  const hpix_bmp_projection_t * proj)
+{
+    int found = 0;
+
+#pragma omp critical(resource_cache)
+    for(size_t idx = 0; idx < cache->num_of_projections; ++idx)
+    {
+	if(cache->projections[idx].projection == proj)
+	{
+	    assert(cache->projections[idx].num_of_users > 0);
+	    cache->projections[idx].num_of_users--;
+	    found = 1;
+	    break;
+	}
+    }
+
+    if(! found)
+	hpix_free_bmp_projection((hpix_bmp_projection_t *) proj);
+}
+
+/******************************************************************************/
+
+
+plan_cache_entry_t *
+find_cached_plan(resource_cache_t * cache,
+		 hpix_projection_type_t type,
+		 unsigned int width, unsigned int height,
+		 hpix_nside_t nside, hpix_ordering_scheme_t scheme)
+{
+    for(size_t idx = 0; idx < cache->num_of_plans; ++idx)
+    {
+	const hpix_projection_plan_t * plan = cache->plans[idx].plan;
+	if(hpix_projection_plan_type(plan) == type
+	   && hpix_projection_plan_width(plan) == width
+	   && hpix_projection_plan_height(plan) == height
+	   && hpix_projection_plan_nside(plan) == nside
+	   && hpix_projection_plan_ordering_scheme(plan) == scheme)
+	{
+	    return &cache->plans[idx];
+	}
+    }
+
+    return NULL;
+}
+
+/******************************************************************************/
+
+
+/* Return the projection plan for a map with the resolution and the
+ * ordering of `map`, creating it if this is the first time it is
+ * requested. Jobs drawing maps with the same NSIDE therefore find
+ * the pixels of the image with a simple lookup. Call
+ * `release_cached_projection_plan` once the plan is no longer
+ * needed. */
+const hpix_projection_plan_t *
+cached_projection_plan(resource_cache_t * cache,
+		       hpix_projection_type_t type,
+		       unsigned int width, unsigned int height,
+		       const hpix_map_t * map)
+{
+    const hpix_nside_t nside = hpix_map_nside(map);
+    const hpix_ordering_scheme_t scheme = hpix_map_ordering_scheme(map);
+    const hpix_projection_plan_t * result = NULL;
+
+#pragma omp critical(resource_cache)
+    {
+	plan_cache_entry_t * entry =
+	    find_cached_plan(cache, type, width, height, nside, scheme);
+	if(entry != NULL)
+	{
+	    entry->num_of_users++;
+	    entry->last_used = ++cache->clock;
+	    result = entry->plan;
+	}
+    }
+
+    if(result != NULL)
+	return result;
+
+    /* Computing a plan takes as long as drawing a map, so it is done
+     * outside the critical section */
+    const hpix_bmp_projection_t * proj =
+	cached_projection(cache, type, width, height);
+    hpix_projection_plan_t * plan =
+	hpix_create_projection_plan(proj, nside, scheme);
+    release_cached_projection(cache, proj);
+
+#pragma omp critical(resource_cache)
+    {
+	plan_cache_entry_t * entry =
+	    find_cached_plan(cache, type, width, height, nside, scheme);
+
+	if(entry != NULL)
+	{
+	    /* Another job created the same plan in the meantime */
+	    entry->num_of_users++;
+	    entry->last_used = ++cache->clock;
+	    result = entry->plan;
+	} else {
+	    if(cache->num_of_plans < MAX_NUM_OF_CACHED_PLANS)
+		entry = &cache->plans[cache->num_of_plans++];
+	    else
+	    {
+		for(size_t idx = 0; idx < cache->num_of_plans; ++idx)
+		{
+		    plan_cache_entry_t * cur = &cache->plans[idx];
+		    if(cur->num_of_users == 0
+		       && (entry == NULL || cur->last_used < entry->last_used))
+			entry = cur;
+		}
+
+		if(entry != NULL)
+		    hpix_free_projection_plan(entry->plan);
+	    }
+
+	    /* If every entry is in use, the plan is not cached and
+	     * `release_cached_projection_plan` will free it */
+	    if(entry != NULL)
+	    {
+		entry->plan = plan;
+		entry->num_of_users = 1;
+		entry->last_used = ++cache->clock;
+	    }
+	    result = plan;
+	}
+    }
+
+    if(result != plan)
+	hpix_free_projection_plan(plan);
+
+    return result;
+}
+
+/******************************************************************************/
+
+
+/* Tell the cache that the job no longer uses `plan`, which was
+ * returned by `cached_projection_plan` */
+void
+release_cached_projection_plan(resource_cache_t * cache,
+			       const hpix_projection_plan_t * plan)
+{
+    int found = 0;
+
+#pragma omp critical(resource_cache)
+    for(size_t idx = 0; idx < cache->num_of_plans; ++idx)
+    {
+	if(cache->plans[idx].plan == plan)
+	{
+	    assert(cache->plans[idx].num_of_users > 0);
+	    cache->plans[idx].num_of_users--;
+	    found = 1;
+	    break;
+	}
+    }
+
+    if(! found)
+	hpix_free_projection_plan((hpix_projection_plan_t *) plan);
+}
+
+/******************************************************************************/
+
+
 void
-paint_and_save_figure(const hpix_map_t * map)
+init_resource_cache(resource_cache_t * cache)
+{
+    memset(cache, 0, sizeof(*cache));
+
+    /* This is the font Cairo uses by default. Keeping a reference to
+     * it lets every job reuse the glyphs rendered by the previous
+     * ones. */
+    cache->font_face =
+	cairo_toy_font_face_create("", CAIRO_FONT_SLANT_NORMAL,
+				   CAIRO_FONT_WEIGHT_NORMAL);
+}
+
+/******************************************************************************/
+
+
+void
+free_resource_cache(resource_cache_t * cache)
+{
+    for(size_t idx = 0; idx < sizeof(cache->palettes) / sizeof(cache->palettes[0]); ++idx)
+    {
+	if(cache->palettes[idx] != NULL)
+	    hpix_free_color_palette(cache->palettes[idx]);
+    }
+
+    for(size_t idx = 0; idx < cache->num_of_projections; ++idx)
+	hpix_free_bmp_projection(cache->projections[idx].projection);
+
+    for(size_t idx = 0; idx < cache->num_of_plans; ++idx)
+	hpix_free_projection_plan(cache->plans[idx].plan);
+
+    for(size_t idx = 0; idx < cache->num_of_colorbars; ++idx)
+	free_colorbar_cache_entry(cache->colorbars[idx]);
+
+    cairo_font_face_destroy(cache->font_face);
+}
+
+/******************************************************************************/
+
+
+/* Save the projection of the map alone in a TIFF file. Unlike PNG
+ * files, the image is never held in memory as a whole: it is rendered
+ * in strips which are written as soon as they are ready, so that very
+ * large images can be produced. Return 0 in case of error. */
+int
+save_tiff_figure(const figure_options_t * options,
+		 const hpix_map_t * map,
+		 double min, double max,
+		 resource_cache_t * cache)
+{
+    const unsigned int width = (unsigned int) (options->image_width + .5);
+    const unsigned int height = (unsigned int) (options->image_height + .5);
+    const hpix_color_palette_t * palette;
+    hpix_color_palette_t * own_palette = NULL;
+    const hpix_bmp_projection_t * projection;
+    hpix_bmp_projection_t * own_projection = NULL;
+    int result = 1;
+
+    if(verbose_flag
+       && ((options->title_str != NULL && options->title_str[0] != 0)
+	   || options->draw_color_bar_flag))
+	fputs(MSG_HEADER "TIFF files contain the map only, "
+	      "title and color bar are not drawn\n", stderr);
+
+    if(cache != NULL)
+    {
+	palette = cached_palette(cache, options->palette_type_code);
+	projection = cached_projection(cache, options->projection_type_code,
+				       width, height);
+    } else {
+	palette = own_palette = create_palette(options->palette_type_code);
+	projection = own_projection = hpix_create_bmp_projection(width, height);
+	configure_projection(own_projection, options->projection_type_code);
+    }
+
+    hpix_palette_lut_t * lut = hpix_create_palette_lut(palette);
+    FILE * file = fopen(options->output_file_name, "wb");
+
+    if(verbose_flag)
+	fprintf(stderr, MSG_HEADER "writing the file to `%s'\n",
+		options->output_file_name);
+
+    if(file == NULL
+       || ! hpix_save_bmp_projection_to_tiff(file, projection, map, lut,
+					     min, max))
+	result = 0;
+
+    if(file != NULL && fclose(file) != 0)
+	result = 0;
+
+    if(! result)
+	fprintf(stderr, MSG_HEADER "unable to write to file '%s'\n",
+		options->output_file_name);
+    else if(verbose_flag)
+	fputs(MSG_HEADER "file has been written successfully\n", stderr);
+
+    hpix_free_palette_lut(lut);
+    if(cache != NULL)
+	release_cached_projection(cache, projection);
+    if(own_projection != NULL)
+	hpix_free_bmp_projection(own_projection);
+    if(own_palette != NULL)
+	hpix_free_color_palette(own_palette);
+
+    return result;
+}
+
+/******************************************************************************/
+
+
+/* Draw the figure and save it. If `cache` is not NULL, the palette,
+ * the projection and the font are taken from it. Return 0 in case of
+ * error. */
+int
+paint_and_save_figure(const figure_options_t * options,
+		      const hpix_map_t * map,
+		      resource_cache_t * cache)
 {
     double min, max;
+    int result = 1;
 
     find_map_extrema(map, &min, &max);
-    if(! isnan(min_value))
-	min = min_value;
-    if(! isnan(max_value))
-	max = max_value;
+    if(! isnan(options->min_value))
+	min = options->min_value;
+    if(! isnan(options->max_value))
+	max = options->max_value;
 
     if(verbose_flag)
 	fprintf(stderr,
@@ -1279,11 +2135,14 @@ paint_and_save_figure(const hpix_map_t * map)
 		"with a range of %g\n",
 		min, max, max - min);
 
+    if(options->output_format == FMT_TIFF)
+	return save_tiff_figure(options, map, min, max, cache);
+
     /* Steps to create the map:
      * 1. Create a surface of the appropriate type (e.g. PS, PDF...)
      * 2. Fill the background (unless --no-background was used)
      * 3. Draw the title
-     * 4. Use `plot_bitmap_to_cairo_surface` to create another
+     * 4. Use `hpix_bmp_projection_to_cairo_surface` to create another
      *    (bitmapped) surface containing the Mollview projection of
      *    the map
      * 5. Copy the surface with the Mollview projection into the "big"
@@ -1291,20 +2150,33 @@ paint_and_save_figure(const hpix_map_t * map)
      * 6. Draw the color bar 
      * 7. Save the result
      */
-    cairo_surface_t * surface = create_surface(image_width, image_height);
+    cairo_surface_t * surface = create_surface(options,
+					       options->image_width,
+					       options->image_height);
     cairo_t * context = cairo_create(surface);
 
+    if(cache != NULL)
+	cairo_set_font_face(context, cache->font_face);
+
     rect_t title_rect;
     rect_t map_rect;
     rect_t colorbar_rect;
 
-    lay_out_page(&title_rect, &map_rect, &colorbar_rect);
+    lay_out_page(options, &title_rect, &map_rect, &colorbar_rect);
 
-    if(output_format == FMT_PNG)
+    /* Number of pixels in the bitmapped representation of the map.
+     * Unlike `image_width` and `image_height`, these numbers are
+     * always expressed in pixel units. */
+    double bitmap_columns = DEFAULT_BITMAP_COLUMNS;
+    double bitmap_rows = DEFAULT_BITMAP_ROWS;
+    if(options->output_format == FMT_PNG)
+    {
+	bitmap_columns = options->image_width;
 	bitmap_rows = map_rect.height;
+    }
 
     /* Draw the background */
-    if(no_background_flag)
+    if(options->no_background_flag)
     {
 	cairo_save(context);
 	cairo_set_operator(context, CAIRO_OPERATOR_CLEAR);
@@ -1316,56 +2188,471 @@ paint_and_save_figure(const hpix_map_t * map)
     }
 
     if(title_rect.height > 0.0)
-	paint_title(context, &title_rect);
+	paint_title(context, &title_rect, options->title_str);
+
+    const hpix_color_palette_t * palette;
+    hpix_color_palette_t * own_palette = NULL;
+    const hpix_bmp_projection_t * projection;
+    hpix_bmp_projection_t * own_projection = NULL;
+    const hpix_projection_plan_t * plan = NULL;
+    const unsigned int projection_width = (unsigned int) (bitmap_columns + .5);
+    const unsigned int projection_height = (unsigned int) (bitmap_rows + .5);
 
-    hpix_color_palette_t * palette = create_palette();
-    paint_map(context, &map_rect, palette, map, min, max);
+    if(cache != NULL)
+    {
+	palette = cached_palette(cache, options->palette_type_code);
+	projection = cached_projection(cache, options->projection_type_code,
+				       projection_width, projection_height);
+	plan = cached_projection_plan(cache, options->projection_type_code,
+				      projection_width, projection_height,
+				      map);
+    } else {
+	palette = own_palette = create_palette(options->palette_type_code);
+	projection = own_projection =
+	    hpix_create_bmp_projection(projection_width, projection_height);
+	configure_projection(own_projection, options->projection_type_code);
+    }
+
+    paint_map(context, &map_rect, palette, projection, plan, map, min, max,
+	      options->image_width);
 
     if(colorbar_rect.height > 0.0)
-	paint_colorbar(context, &colorbar_rect, palette, min, max);
-    hpix_free_color_palette(palette);
+	paint_colorbar(context, &colorbar_rect, palette,
+		       options->palette_type_code, min, max,
+		       options->measure_unit_str, options->output_format,
+		       cache);
 
-    if(output_format == FMT_PNG)
+    if(cache != NULL)
     {
-	fprintf(stderr, MSG_HEADER "writing the file to `%s'\n",
-		output_file_name);
-	if(cairo_surface_write_to_png(surface, output_file_name)
+	release_cached_projection_plan(cache, plan);
+	release_cached_projection(cache, projection);
+    }
+    if(own_projection != NULL)
+	hpix_free_bmp_projection(own_projection);
+    if(own_palette != NULL)
+	hpix_free_color_palette(own_palette);
+
+    if(options->output_format == FMT_PNG)
+    {
+	if(verbose_flag)
+	    fprintf(stderr, MSG_HEADER "writing the file to `%s'\n",
+		    options->output_file_name);
+	if(cairo_surface_write_to_png(surface, options->output_file_name)
 	   != CAIRO_STATUS_SUCCESS)
 	{
 	    fprintf(stderr, MSG_HEADER "unable to write to file '%s'\n",
-		    output_file_name);
-	    exit(EXIT_FAILURE);
+		    options->output_file_name);
+	    result = 0;
 	}
-	fputs(MSG_HEADER "file has been written successfully\n", stderr);
+	else if(verbose_flag)
+	    fputs(MSG_HEADER "file has been written successfully\n", stderr);
     } else {
 	cairo_show_page(context);
     }
 
     cairo_destroy(context);
     cairo_surface_destroy(surface);
+
+    return result;
 }
 
 /******************************************************************************/
 
-
+
+/* One line read in batch mode */
+typedef struct {
+    unsigned long number;
+    /* Words of the line. The strings in `options` point here. */
+    char * line;
+    figure_options_t options;
+} job_t;
+
+/* Maximum number of words in a job */
+#define MAX_JOB_WORDS 64
+
+/* Split `line` into words, in place. Words are separated by blanks;
+ * single and double quotes can be used to include blanks in a word,
+ * and a backslash outside single quotes escapes the next character.
+ * Return the number of words, or -1 in case of error. */
+int
+split_job_line(char * line, char ** words, int max_num_of_words)
+{
+    const char * src = line;
+    char * dest = line;
+    int num_of_words = 0;
+
+    for(;;)
+    {
+	char quote = 0;
+
+	while(*src == ' ' || *src == '\t' || *src == '\n' || *src == '\r')
+	    ++src;
+	if(*src == '\x0')
+	    break;
+
+	if(num_of_words == max_num_of_words)
+	    return -1;
+	words[num_of_words++] = dest;
+
+	for(; *src != '\x0'; ++src)
+	{
+	    if(quote == 0 && strchr(" \t\n\r", *src) != NULL)
+		break;
+
+	    if(quote == 0 && (*src == '"' || *src == '\''))
+		quote = *src;
+	    else if(quote != 0 && *src == quote)
+		quote = 0;
+	    else if(quote != '\'' && *src == '\\' && src[1] != '\x0')
+		*dest++ = *++src;
+	    else
+		*dest++ = *src;
+	}
+
+	if(quote != 0)
+	    return -1;
+
+	/* `dest` never gets ahead of `src`, so this does not overwrite
+	 * the next word */
+	if(*src != '\x0')
+	    ++src;
+	*dest++ = '\x0';
+    }
+
+    return num_of_words;
+}
+
+/******************************************************************************/
+
+
+const figure_option_t *
+find_figure_option(const char * long_name, size_t long_name_len, char short_name)
+{
+    int idx;
+    for(idx = 0; list_of_figure_options[idx].long_name != NULL; ++idx)
+    {
+	const figure_option_t * option = &list_of_figure_options[idx];
+
+	if(long_name != NULL)
+	{
+	    if(strlen(option->long_name) == long_name_len
+	       && strncmp(option->long_name, long_name, long_name_len) == 0)
+		return option;
+	}
+	else if(short_name != 0 && option->short_name == short_name)
+	    return option;
+    }
+
+    return NULL;
+}
+
+/******************************************************************************/
+
+
+/* Initialize the options of a job, starting from `defaults`. Return 0
+ * if the line contains errors. */
+int
+parse_job(job_t * job, const figure_options_t * defaults)
+{
+    char * words[MAX_JOB_WORDS];
+    int num_of_words = split_job_line(job->line, words, MAX_JOB_WORDS);
+
+    job->options = *defaults;
+
+    if(num_of_words < 0)
+    {
+	fputs(MSG_HEADER "unbalanced quotes or too many words\n", stderr);
+	return 0;
+    }
+
+    for(int idx = 0; idx < num_of_words; ++idx)
+    {
+	const char * word = words[idx];
+	const figure_option_t * option;
+	const char * value_str = NULL;
+
+	if(word[0] != '-' || word[1] == '\x0')
+	{
+	    if(job->options.input_file_name != NULL)
+	    {
+		fputs(MSG_HEADER "more than one input map specified\n", stderr);
+		return 0;
+	    }
+	    job->options.input_file_name = word;
+	    continue;
+	}
+
+	if(word[1] == '-')
+	{
+	    /* --name or --name=VALUE */
+	    const char * equal_sign = strchr(word + 2, '=');
+	    size_t name_len =
+		equal_sign ? (size_t) (equal_sign - word - 2) : strlen(word + 2);
+
+	    option = find_figure_option(word + 2, name_len, 0);
+	    if(option != NULL && equal_sign != NULL)
+		value_str = equal_sign + 1;
+	} else {
+	    /* -c or -cVALUE */
+	    option = find_figure_option(NULL, 0, word[1]);
+	    if(option != NULL && word[2] != '\x0')
+		value_str = word + 2;
+	}
+
+	if(option == NULL)
+	{
+	    fprintf(stderr, MSG_HEADER "unknown option `%s'\n", word);
+	    return 0;
+	}
+
+	if(option->has_value && value_str == NULL)
+	{
+	    if(idx + 1 == num_of_words)
+	    {
+		fprintf(stderr, MSG_HEADER "option `%s' requires a value\n", word);
+		return 0;
+	    }
+	    value_str = words[++idx];
+	} else if(! option->has_value && value_str != NULL)
+	{
+	    fprintf(stderr, MSG_HEADER "option `%s' does not take a value\n", word);
+	    return 0;
+	}
+
+	if(! apply_option(&job->options, option->code, value_str))
+	    return 0;
+    }
+
+    return finalize_figure_options(&job->options);
+}
+
+/******************************************************************************/
+
+
+double
+wall_clock_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/******************************************************************************/
+
+
+/* Draw the figure requested by a job and write a line with the
+ * outcome and the time spent on it to `output`. Return the time in
+ * seconds, negative if the job failed. */
+double
+run_job(job_t * job, const figure_options_t * defaults,
+	resource_cache_t * cache, FILE * output)
+{
+    const double start = wall_clock_time();
+    hpix_map_t * map = NULL;
+    int is_successful = parse_job(job, defaults)
+	&& (map = load_map_and_rescale_if_needed(&job->options)) != NULL
+	&& paint_and_save_figure(&job->options, map, cache);
+    const double latency = wall_clock_time() - start;
+
+    if(map != NULL)
+	hpix_free_map(map);
+
+#pragma omp critical(job_report)
+    {
+	fprintf(output, "%s %lu %.1f %s\n",
+		is_successful ? "ok" : "error",
+		job->number,
+		latency * 1e3,
+		job->options.output_file_name != NULL
+		? job->options.output_file_name : "-");
+	fflush(output);
+    }
+
+    return is_successful ? latency : -1.0;
+}
+
+/******************************************************************************/
+
+
+/* Read jobs from `input` until the end of the stream and draw them
+ * in parallel, reporting the outcome of each of them to `output`. */
+void
+serve_jobs(FILE * input, FILE * output,
+	   const figure_options_t * defaults,
+	   resource_cache_t * cache)
+{
+    unsigned long num_of_jobs = 0;
+    unsigned long num_of_failures = 0;
+    double total_latency = 0.0;
+    const double start = wall_clock_time();
+
+#pragma omp parallel default(shared)
+#pragma omp single
+    {
+	char * line = NULL;
+	size_t line_size = 0;
+
+	while(getline(&line, &line_size, input) != -1)
+	{
+	    const char * first_char = line + strspn(line, " \t\r\n");
+	    /* Skip empty lines and comments */
+	    if(*first_char == '\x0' || *first_char == '#')
+		continue;
+
+	    job_t * job = hpix_malloc(sizeof(job_t), 1);
+	    job->number = ++num_of_jobs;
+	    job->line = strdup(line);
+
+#pragma omp task default(shared) firstprivate(job)
+	    {
+		double latency = run_job(job, defaults, cache, output);
+
+#pragma omp critical(job_statistics)
+		{
+		    if(latency < 0.0)
+			++num_of_failures;
+		    else
+			total_latency += latency;
+		}
+
+		free(job->line);
+		hpix_free(job);
+	    }
+	}
+
+	free(line);
+#pragma omp taskwait
+    }
+
+    if(verbose_flag || num_of_failures > 0)
+    {
+	fprintf(stderr,
+		MSG_HEADER "%lu jobs (%lu failed) in %.2f s, "
+		"average latency %.1f ms\n",
+		num_of_jobs, num_of_failures,
+		wall_clock_time() - start,
+		num_of_jobs > num_of_failures
+		? total_latency * 1e3 / (num_of_jobs - num_of_failures)
+		: 0.0);
+    }
+}
+
+/******************************************************************************/
+
+
+/* Accept connections to a local socket, one at a time, and serve the
+ * jobs sent through each of them. This function only returns in case
+ * of error. */
+void
+serve_socket(const char * path,
+	     const figure_options_t * defaults,
+	     resource_cache_t * cache)
+{
+    struct sockaddr_un address;
+    struct stat path_info;
+    int server_fd;
+
+    if(strlen(path) >= sizeof(address.sun_path))
+    {
+	fprintf(stderr, MSG_HEADER "socket path `%s' is too long\n", path);
+	return;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    /* Remove the socket left by a previous run, but nothing else */
+    if(stat(path, &path_info) == 0 && S_ISSOCK(path_info.st_mode))
+	unlink(path);
+
+    /* A client closing the connection early must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(server_fd < 0
+       || bind(server_fd, (struct sockaddr *) &address, sizeof(address)) != 0
+       || listen(server_fd, 16) != 0)
+    {
+	fprintf(stderr, MSG_HEADER "unable to listen on `%s': %s\n",
+		path, strerror(errno));
+	if(server_fd >= 0)
+	    close(server_fd);
+	return;
+    }
+
+    if(verbose_flag)
+	fprintf(stderr, MSG_HEADER "waiting for jobs on `%s'\n", path);
+
+    for(;;)
+    {
+	int client_fd = accept(server_fd, NULL, NULL);
+	if(client_fd < 0)
+	{
+	    if(errno == EINTR)
+		continue;
+
+	    fprintf(stderr, MSG_HEADER "unable to accept connections: %s\n",
+		    strerror(errno));
+	    break;
+	}
+
+	FILE * input = fdopen(client_fd, "r");
+	FILE * output = fdopen(dup(client_fd), "w");
+	if(input != NULL && output != NULL)
+	    serve_jobs(input, output, defaults, cache);
+
+	if(output != NULL)
+	    fclose(output);
+	if(input != NULL)
+	    fclose(input);
+	else
+	    close(client_fd);
+    }
+
+    close(server_fd);
+    unlink(path);
+}
+
+/******************************************************************************/
+
+
 int
 main(int argc, const char ** argv)
 {
+    figure_options_t options;
     hpix_map_t * map;
+    int is_successful;
+
+    parse_command_line(argc, argv, &options);
 
-    parse_command_line(argc, argv);
+    if(batch_flag || socket_path != NULL)
+    {
+	resource_cache_t cache;
+	init_resource_cache(&cache);
+
+	if(socket_path != NULL)
+	    serve_socket(socket_path, &options, &cache);
+	else
+	    serve_jobs(stdin, stdout, &options, &cache);
+
+	free_resource_cache(&cache);
+	return socket_path != NULL ? EXIT_FAILURE : EXIT_SUCCESS;
+    }
 
     if(verbose_flag)
-	fprintf(stderr, MSG_HEADER "loading map `%s'\n", input_file_name);
-    map = load_map_and_rescale_if_needed();
+	fprintf(stderr, MSG_HEADER "loading map `%s'\n", options.input_file_name);
+    map = load_map_and_rescale_if_needed(&options);
+    if(map == NULL)
+	return EXIT_FAILURE;
     if(verbose_flag)
 	fprintf(stderr, MSG_HEADER "map loaded\n");
 
     if(verbose_flag)
 	fprintf(stderr, MSG_HEADER "painting map\n");
-    paint_and_save_figure(map);
+    is_successful = paint_and_save_figure(&options, map, NULL);
 
     hpix_free_map(map);
 
-    return 0;
+    return is_successful ? EXIT_SUCCESS : EXIT_FAILURE;
 }